@@ -14,8 +14,9 @@ void AllocatedImage::init(VkDevice device, VmaAllocator _allocator, VkExtent3D s
 
     VkImageCreateInfo image_create_info = vk_init::get_image_create_info(this->format, usage_flags, this->extent);
     if(mipmapped) {
-        image_create_info.mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(size.width, size.height)))) + 1;
+        image_create_info.mipLevels = vk_image::get_mip_level_count({ size.width, size.height });
     }
+    this->mip_levels = image_create_info.mipLevels;
 
     VmaAllocationCreateInfo image_alloc_info = {
             .usage = VMA_MEMORY_USAGE_GPU_ONLY,
@@ -38,35 +39,21 @@ void AllocatedImage::init(VkDevice device, VmaAllocator _allocator, VkExtent3D s
 void AllocatedImage::init_with_data(ImmediateSubmitCommandBuffer& immediate_submit_command_buffer, VkDevice device, VmaAllocator _allocator,
                                     void* data, VkExtent3D size, VkFormat _format, VkImageUsageFlags usage_flags, bool mipmapped) {
 
-    size_t data_size = size.depth * size.width * size.height * 4; // four channels
-    Buffer upload_buffer{};
-    upload_buffer.init(_allocator, data_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-
-    memcpy(upload_buffer.info.pMappedData, data, data_size);
-
     this->init(device, _allocator, size, _format, usage_flags | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
                mipmapped);
 
-    immediate_submit_command_buffer.submit([&](VkCommandBuffer cmd) {
-        vk_image::transition_image_layout(cmd, this->image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-
-        VkBufferImageCopy copy_region = {};
-        copy_region.bufferOffset = 0;
-        copy_region.bufferRowLength = 0;
-        copy_region.bufferImageHeight = 0;
-
-        copy_region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        copy_region.imageSubresource.mipLevel = 0;
-        copy_region.imageSubresource.baseArrayLayer = 0;
-        copy_region.imageSubresource.layerCount = 1;
-        copy_region.imageExtent = size;
-
-        vkCmdCopyBufferToImage(cmd, upload_buffer.buffer, this->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy_region);
-
-        vk_image::transition_image_layout(cmd, this->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-    });
-
-    upload_buffer.destroy_buffer();
+    // four channels, staged through the shared ring
+    immediate_submit_command_buffer.upload_to_image(data, this->image, size, 4,
+        [&](VkCommandBuffer cmd) {
+            vk_image::transition_image_layout(cmd, this->image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+        },
+        [&](VkCommandBuffer cmd) {
+            if(mipmapped) {
+                vk_image::generate_mipmaps(cmd, this->image, { size.width, size.height }, this->mip_levels);
+            } else {
+                vk_image::transition_image_layout(cmd, this->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+            }
+        });
 }
 
 void AllocatedImage::destroy(VkDevice device) {
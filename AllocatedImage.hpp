@@ -14,6 +14,7 @@ struct AllocatedImage {
     VmaAllocation allocation;
     VkExtent3D extent;
     VkFormat format;
+    uint32_t mip_levels = 1;
 
     void init(VkDevice device, VmaAllocator allocator, VkExtent3D size, VkFormat format, VkImageUsageFlags usage_flags, bool mipmapped = false);
     void init_with_data(ImmediateSubmitCommandBuffer& immediate_submit_command_buffer, VkDevice device, VmaAllocator allocator, void* data, VkExtent3D size, VkFormat format, VkImageUsageFlags usage_flags, bool mipmapped = false);
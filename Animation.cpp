@@ -0,0 +1,207 @@
+//
+// Created by darby on 2/25/2025.
+//
+
+#include "Animation.hpp"
+#include "SceneGraphMembers.hpp"
+
+#include <algorithm>
+
+uint32_t AnimationSampler::find_keyframe(float time, uint32_t& cursor) const {
+    uint32_t last = static_cast<uint32_t>(times.size()) - 1;
+
+    if(cursor >= last || time < times[cursor]) {
+        // jumped backwards, find the keyframe from scratch
+        auto next = std::upper_bound(times.begin(), times.end(), time);
+        cursor = next == times.begin() ? 0 : static_cast<uint32_t>(next - times.begin()) - 1;
+        cursor = std::min(cursor, last > 0 ? last - 1 : 0);
+        return cursor;
+    }
+
+    while(cursor + 1 < last && time >= times[cursor + 1]) {
+        cursor++;
+    }
+
+    return cursor;
+}
+
+glm::vec4 AnimationSampler::sample(float time, uint32_t& cursor, AnimationPath path) const {
+    bool cubic = interpolation == AnimationInterpolation::CubicSpline;
+    // cubic spline keyframes are (in-tangent, value, out-tangent)
+    uint32_t stride = cubic ? 3 : 1;
+    uint32_t value_offset = cubic ? 1 : 0;
+
+    if(times.size() == 1 || time <= times.front()) {
+        cursor = 0;
+        return values[value_offset];
+    }
+    if(time >= times.back()) {
+        cursor = static_cast<uint32_t>(times.size()) - 2;
+        return values[(times.size() - 1) * stride + value_offset];
+    }
+
+    uint32_t k = find_keyframe(time, cursor);
+    float t0 = times[k];
+    float t1 = times[k + 1];
+    float dt = t1 - t0;
+    float s = dt > 0.f ? (time - t0) / dt : 0.f;
+
+    switch(interpolation) {
+        case AnimationInterpolation::Step:
+            return values[k];
+
+        case AnimationInterpolation::Linear: {
+            const glm::vec4& a = values[k];
+            const glm::vec4& b = values[k + 1];
+            if(path == AnimationPath::Rotation) {
+                glm::quat qa = glm::quat(a.w, a.x, a.y, a.z);
+                glm::quat qb = glm::quat(b.w, b.x, b.y, b.z);
+                glm::quat q = glm::slerp(qa, qb, s);
+                return glm::vec4(q.x, q.y, q.z, q.w);
+            }
+            return glm::mix(a, b, s);
+        }
+
+        case AnimationInterpolation::CubicSpline: {
+            // hermite spline, see the glTF spec's appendix on interpolation
+            float s2 = s * s;
+            float s3 = s2 * s;
+            const glm::vec4& v0 = values[k * 3 + 1];
+            const glm::vec4& out_tangent0 = values[k * 3 + 2];
+            const glm::vec4& in_tangent1 = values[(k + 1) * 3];
+            const glm::vec4& v1 = values[(k + 1) * 3 + 1];
+
+            glm::vec4 result = (2.f * s3 - 3.f * s2 + 1.f) * v0
+                             + (s3 - 2.f * s2 + s) * dt * out_tangent0
+                             + (-2.f * s3 + 3.f * s2) * v1
+                             + (s3 - s2) * dt * in_tangent1;
+
+            if(path == AnimationPath::Rotation) {
+                result = glm::normalize(result);
+            }
+            return result;
+        }
+    }
+
+    return values[k];
+}
+
+void AnimationPose::init(const GLTFFile& file) {
+    world_transforms.resize(file.nodes.size());
+    for(size_t n = 0; n < file.nodes.size(); n++) {
+        world_transforms[n] = file.nodes[n]->world_transform;
+    }
+
+    joint_palettes.resize(file.skins.size());
+    for(size_t s = 0; s < file.skins.size(); s++) {
+        const Skin& skin = file.skins[s];
+        joint_palettes[s].resize(skin.joints.size());
+        for(size_t j = 0; j < skin.joints.size(); j++) {
+            joint_palettes[s][j] = world_transforms[skin.joints[j]] * skin.inverse_bind_matrices[j];
+        }
+    }
+}
+
+void AnimationPlayer::init(std::shared_ptr<GLTFFile> _file, uint32_t clip_index, AnimationPose& _output) {
+    ASSERT(clip_index < _file->animations.size(), "Animation clip index out of range");
+
+    file = _file;
+    output = &_output;
+    clip = file->animations[clip_index];
+    time = 0.f;
+
+    cursors.assign(clip->channels.size(), 0);
+
+    pose.resize(file->nodes.size());
+    local_transforms.resize(file->nodes.size());
+    for(size_t n = 0; n < file->nodes.size(); n++) {
+        pose[n] = file->nodes[n]->rest_pose;
+        local_transforms[n] = file->nodes[n]->local_transform;
+    }
+
+    output->init(*file);
+}
+
+void AnimationPlayer::update(float delta_seconds) {
+    time += delta_seconds * speed;
+    if(looping && clip->duration > 0.f) {
+        time = std::fmod(time, clip->duration);
+        if(time < 0.f) {
+            time += clip->duration;
+        }
+    } else {
+        time = glm::clamp(time, 0.f, clip->duration);
+    }
+
+    for(size_t c = 0; c < clip->channels.size(); c++) {
+        const AnimationChannel& channel = clip->channels[c];
+        glm::vec4 value = clip->samplers[channel.sampler].sample(time, cursors[c], channel.path);
+
+        NodePose& node_pose = pose[channel.target_node];
+        switch(channel.path) {
+            case AnimationPath::Translation:
+                node_pose.translation = glm::vec3(value);
+                break;
+            case AnimationPath::Rotation:
+                node_pose.rotation = glm::quat(value.w, value.x, value.y, value.z);
+                break;
+            case AnimationPath::Scale:
+                node_pose.scale = glm::vec3(value);
+                break;
+        }
+    }
+
+    // untouched nodes keep the local transform they were loaded with
+    for(uint32_t node_index : clip->animated_nodes) {
+        const NodePose& node_pose = pose[node_index];
+        local_transforms[node_index] = glm::translate(glm::mat4(1.f), node_pose.translation)
+                                     * glm::mat4_cast(node_pose.rotation)
+                                     * glm::scale(glm::mat4(1.f), node_pose.scale);
+    }
+
+    for(const std::shared_ptr<Node>& top_node : file->top_nodes) {
+        refresh_world_transforms(*top_node, glm::mat4(1.f));
+    }
+
+    for(size_t s = 0; s < file->skins.size(); s++) {
+        const Skin& skin = file->skins[s];
+        std::vector<glm::mat4>& joint_palette = output->joint_palettes[s];
+        for(size_t j = 0; j < skin.joints.size(); j++) {
+            joint_palette[j] = output->world_transforms[skin.joints[j]] * skin.inverse_bind_matrices[j];
+        }
+    }
+}
+
+// Node::refresh_transform, but reading this player's local transforms and writing the output's world ones
+void AnimationPlayer::refresh_world_transforms(const Node& node, const glm::mat4& parent_matrix) {
+    glm::mat4& world_transform = output->world_transforms[node.index];
+    world_transform = parent_matrix * local_transforms[node.index];
+    for(const std::shared_ptr<Node>& child : node.children) {
+        refresh_world_transforms(*child, world_transform);
+    }
+}
+
+AnimationPlayer& AnimationSystem::add_player(std::shared_ptr<GLTFFile> file, uint32_t clip_index, AnimationPose& output) {
+    for(AnimationPlayer& player : players) {
+        ASSERT(player.output != &output, "An AnimationPose can only be driven by one AnimationPlayer");
+    }
+
+    AnimationPlayer& player = players.emplace_back();
+    player.init(file, clip_index, output);
+    return player;
+}
+
+void AnimationSystem::begin_update(float delta_seconds, JobSystem& job_system) {
+    // one job per posed copy, players only read the file and each writes its own output, so there's nothing to
+    // synchronize between them
+    for(AnimationPlayer& player : players) {
+        AnimationPlayer* p_player = &player;
+        job_system.submit([p_player, delta_seconds]() {
+            p_player->update(delta_seconds);
+        }, update_counter);
+    }
+}
+
+void AnimationSystem::wait(JobSystem& job_system) {
+    job_system.wait(update_counter);
+}
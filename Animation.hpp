@@ -0,0 +1,136 @@
+//
+// Created by darby on 2/25/2025.
+//
+
+#pragma once
+
+#include "Common.hpp"
+#include "JobSystem.hpp"
+
+struct GLTFFile;
+struct Node;
+
+enum class AnimationInterpolation : uint8_t {
+    Step,
+    Linear,
+    CubicSpline
+};
+
+enum class AnimationPath : uint8_t {
+    Translation,
+    Rotation,
+    Scale
+};
+
+/*
+ * Keyframes of one glTF animation sampler, kept as separate time and value arrays so the cursor search only touches
+ * the times. Values are vec4s whatever the path, rotations are quaternions stored (x, y, z, w) like glTF does.
+ * Cubic spline samplers hold three values per keyframe: in-tangent, value, out-tangent.
+ */
+struct AnimationSampler {
+    AnimationInterpolation interpolation;
+    std::vector<float> times;
+    std::vector<glm::vec4> values;
+
+    /*
+     * Returns the keyframe k with times[k] <= time < times[k + 1], starting the search from cursor and leaving it there
+     * for the next call. Playback moves forward a keyframe or so per frame, so this is O(1) amortized; going backwards
+     * (a loop wrapping round) falls back to a binary search.
+     */
+    uint32_t find_keyframe(float time, uint32_t& cursor) const;
+
+    glm::vec4 sample(float time, uint32_t& cursor, AnimationPath path) const;
+};
+
+struct AnimationChannel {
+    uint32_t sampler;
+    uint32_t target_node; // index into GLTFFile::nodes
+    AnimationPath path;
+};
+
+struct AnimationClip {
+    std::string name;
+    std::vector<AnimationSampler> samplers;
+    std::vector<AnimationChannel> channels;
+    std::vector<uint32_t> animated_nodes; // every node some channel targets, each once
+    float duration;
+};
+
+/*
+ * A glTF skin. A pose's palette for it has, for joint i, the joint's world transform times its inverse bind matrix. Per
+ * the glTF spec, the transform of the node the skinned mesh hangs off is ignored, the palette alone places the vertices.
+ */
+struct Skin {
+    std::string name;
+    std::vector<uint32_t> joints; // indices into GLTFFile::nodes
+    std::vector<glm::mat4> inverse_bind_matrices;
+};
+
+// a node's local transform split back into the parts channels animate
+struct NodePose {
+    glm::vec3 translation;
+    glm::quat rotation;
+    glm::vec3 scale;
+};
+
+/*
+ * The animated state of one copy of a GLTFFile. The file's own nodes only ever hold the rest pose, so every copy posed
+ * on its own needs one of these.
+ */
+struct AnimationPose {
+    std::vector<glm::mat4> world_transforms; // one per GLTFFile::nodes, relative to the file's root
+    std::vector<std::vector<glm::mat4>> joint_palettes; // one per GLTFFile::skins
+
+    // sets the file's rest pose
+    void init(const GLTFFile& file);
+};
+
+/*
+ * Plays one clip of a GLTFFile into an AnimationPose. Owns the per-channel keyframe cursors and the local transforms,
+ * so any number of players can share a file and a clip, as long as each has an output of its own.
+ */
+class AnimationPlayer {
+
+public:
+    // output must outlive the player
+    void init(std::shared_ptr<GLTFFile> file, uint32_t clip_index, AnimationPose& output);
+
+    // advances time and writes the pose into output's world transforms and joint palettes
+    void update(float delta_seconds);
+
+    std::shared_ptr<GLTFFile> file;
+    AnimationPose* output = nullptr;
+    float speed = 1.f;
+    bool looping = true;
+
+private:
+    void refresh_world_transforms(const Node& node, const glm::mat4& parent_matrix);
+
+    std::shared_ptr<AnimationClip> clip;
+    float time = 0.f;
+
+    std::vector<uint32_t> cursors; // one per channel
+    std::vector<NodePose> pose; // one per node of the file
+    std::vector<glm::mat4> local_transforms; // one per node of the file
+};
+
+/*
+ * Runs every AnimationPlayer as its own job, so a crowd of copies of one file is animated a copy per job. begin_update()
+ * kicks the jobs off and returns straight away so the main thread can get on with the rest of the frame; wait() must be
+ * called before anything reads the poses.
+ */
+class AnimationSystem {
+
+public:
+    // output must outlive the system, and no other player may write to it
+    AnimationPlayer& add_player(std::shared_ptr<GLTFFile> file, uint32_t clip_index, AnimationPose& output);
+
+    void begin_update(float delta_seconds, JobSystem& job_system);
+    void wait(JobSystem& job_system);
+
+    uint32_t get_player_count() const { return static_cast<uint32_t>(players.size()); }
+
+private:
+    std::deque<AnimationPlayer> players; // deque so handed-out references stay valid
+    JobCounter update_counter;
+};
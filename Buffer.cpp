@@ -18,6 +18,8 @@
 void Buffer::init(VmaAllocator _allocator, size_t alloc_size, VkBufferUsageFlags buffer_usage, VmaMemoryUsage memory_usage) {
 
     this->allocator = _allocator;
+    this->size = alloc_size;
+    this->usage = buffer_usage;
 
     VkBufferCreateInfo buffer_info = {
             .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
@@ -15,6 +15,9 @@ public:
     VkBuffer buffer;
     VmaAllocation allocation;
     VmaAllocationInfo info;
+    // what the buffer was created with, for recreating it elsewhere when it's moved
+    VkDeviceSize size;
+    VkBufferUsageFlags usage;
 
     void init(VmaAllocator allocator, size_t alloc_size, VkBufferUsageFlags flags, VmaMemoryUsage memory_usage);
     void set_name(VkDevice device, const char* name);
@@ -0,0 +1,123 @@
+//
+// Created by darby on 2/23/2025.
+//
+
+#include "CommandEncoder.hpp"
+
+void CommandEncoder::begin(VkCommandBuffer _cmd, VkPipelineBindPoint _bind_point) {
+    cmd = _cmd;
+    bind_point = _bind_point;
+
+    bound_pipeline = VK_NULL_HANDLE;
+    for(uint32_t i = 0; i < MAX_TRACKED_DESCRIPTOR_SETS; i++) {
+        bound_set_layouts[i] = VK_NULL_HANDLE;
+        bound_sets[i] = VK_NULL_HANDLE;
+        bound_dynamic_offsets[i] = 0;
+    }
+    bound_index_buffer = VK_NULL_HANDLE;
+    bound_index_buffer_offset = 0;
+    bound_index_type = VK_INDEX_TYPE_UINT32;
+
+    pipeline_binds = 0;
+    descriptor_set_binds = 0;
+    index_buffer_binds = 0;
+    skipped_binds = 0;
+    draw_calls = 0;
+    triangles = 0;
+}
+
+void CommandEncoder::bind_pipeline(VkPipeline pipeline) {
+    if(pipeline == bound_pipeline) {
+        skipped_binds++;
+        return;
+    }
+
+    vkCmdBindPipeline(cmd, bind_point, pipeline);
+    bound_pipeline = pipeline;
+    pipeline_binds++;
+}
+
+void CommandEncoder::bind_descriptor_set(VkPipelineLayout layout, uint32_t set_index, VkDescriptorSet set) {
+    bind_set(layout, set_index, set, 0, 0);
+}
+
+void CommandEncoder::bind_descriptor_set(VkPipelineLayout layout, uint32_t set_index, VkDescriptorSet set, uint32_t dynamic_offset) {
+    bind_set(layout, set_index, set, 1, dynamic_offset);
+}
+
+void CommandEncoder::bind_set(VkPipelineLayout layout, uint32_t set_index, VkDescriptorSet set,
+                              uint32_t dynamic_offset_count, uint32_t dynamic_offset) {
+    ASSERT(set_index < MAX_TRACKED_DESCRIPTOR_SETS, "Descriptor set index past what the encoder tracks");
+
+    if(bound_sets[set_index] == set && bound_set_layouts[set_index] == layout && bound_dynamic_offsets[set_index] == dynamic_offset) {
+        skipped_binds++;
+        return;
+    }
+
+    vkCmdBindDescriptorSets(cmd, bind_point, layout, set_index, 1, &set, dynamic_offset_count, dynamic_offset_count > 0 ? &dynamic_offset : nullptr);
+    bound_sets[set_index] = set;
+    bound_set_layouts[set_index] = layout;
+    bound_dynamic_offsets[set_index] = dynamic_offset;
+    descriptor_set_binds++;
+
+    // binding through a different layout can disturb the sets above this one, so forget them
+    for(uint32_t i = set_index + 1; i < MAX_TRACKED_DESCRIPTOR_SETS; i++) {
+        if(bound_set_layouts[i] != layout) {
+            bound_sets[i] = VK_NULL_HANDLE;
+            bound_set_layouts[i] = VK_NULL_HANDLE;
+            bound_dynamic_offsets[i] = 0;
+        }
+    }
+}
+
+void CommandEncoder::bind_index_buffer(VkBuffer buffer, VkDeviceSize offset, VkIndexType index_type) {
+    if(buffer == bound_index_buffer && offset == bound_index_buffer_offset && index_type == bound_index_type) {
+        skipped_binds++;
+        return;
+    }
+
+    vkCmdBindIndexBuffer(cmd, buffer, offset, index_type);
+    bound_index_buffer = buffer;
+    bound_index_buffer_offset = offset;
+    bound_index_type = index_type;
+    index_buffer_binds++;
+}
+
+void CommandEncoder::push_constants(VkPipelineLayout layout, VkShaderStageFlags stages, uint32_t offset, uint32_t size, const void* data) {
+    vkCmdPushConstants(cmd, layout, stages, offset, size, data);
+}
+
+void CommandEncoder::draw_indexed(uint32_t index_count, uint32_t instance_count, uint32_t first_index, int32_t vertex_offset, uint32_t first_instance) {
+    vkCmdDrawIndexed(cmd, index_count, instance_count, first_index, vertex_offset, first_instance);
+
+    draw_calls++;
+    triangles += (index_count / 3) * instance_count;
+}
+
+void CommandEncoder::draw_indexed_indirect(VkBuffer buffer, VkDeviceSize offset, uint32_t draw_count, uint32_t stride) {
+    vkCmdDrawIndexedIndirect(cmd, buffer, offset, draw_count, stride);
+
+    draw_calls++;
+}
+
+void CommandEncoder::draw_indexed_indirect_count(VkBuffer buffer, VkDeviceSize offset, VkBuffer count_buffer, VkDeviceSize count_buffer_offset,
+                                                 uint32_t max_draw_count, uint32_t stride) {
+    vkCmdDrawIndexedIndirectCount(cmd, buffer, offset, count_buffer, count_buffer_offset, max_draw_count, stride);
+
+    draw_calls++;
+}
+
+void CommandEncoder::draw_mesh_tasks_indirect(VkBuffer buffer, VkDeviceSize offset, uint32_t draw_count, uint32_t stride) {
+    vkCmdDrawMeshTasksIndirectEXT(cmd, buffer, offset, draw_count, stride);
+
+    draw_calls++;
+}
+
+void CommandEncoder::add_stats(EngineStats& engine_stats) const {
+    engine_stats.pipeline_bind_count += static_cast<int>(pipeline_binds);
+    engine_stats.descriptor_set_bind_count += static_cast<int>(descriptor_set_binds);
+    engine_stats.index_buffer_bind_count += static_cast<int>(index_buffer_binds);
+    engine_stats.skipped_bind_count += static_cast<int>(skipped_binds);
+    engine_stats.draw_call_count += static_cast<int>(draw_calls);
+    engine_stats.triangle_count += static_cast<int>(triangles);
+}
@@ -0,0 +1,64 @@
+//
+// Created by darby on 2/23/2025.
+//
+
+#pragma once
+
+#include "Common.hpp"
+#include "EngineStats.hpp"
+
+/*
+ * Thin wrapper over a command buffer that remembers what's bound and drops binds that wouldn't change anything.
+ * Meant to be fed draws in DrawSorter order, where consecutive draws mostly share pipeline, material and mesh.
+ *
+ * State is only tracked from begin(), anything bound on the command buffer before that is assumed unknown.
+ */
+class CommandEncoder {
+
+public:
+    static constexpr uint32_t MAX_TRACKED_DESCRIPTOR_SETS = 4;
+
+    void begin(VkCommandBuffer cmd, VkPipelineBindPoint bind_point = VK_PIPELINE_BIND_POINT_GRAPHICS);
+
+    void bind_pipeline(VkPipeline pipeline);
+    void bind_descriptor_set(VkPipelineLayout layout, uint32_t set_index, VkDescriptorSet set);
+    // for sets with a single UNIFORM_BUFFER_DYNAMIC binding, rebinding the same set at another offset isn't skipped
+    void bind_descriptor_set(VkPipelineLayout layout, uint32_t set_index, VkDescriptorSet set, uint32_t dynamic_offset);
+    void bind_index_buffer(VkBuffer buffer, VkDeviceSize offset, VkIndexType index_type);
+
+    void push_constants(VkPipelineLayout layout, VkShaderStageFlags stages, uint32_t offset, uint32_t size, const void* data);
+    void draw_indexed(uint32_t index_count, uint32_t instance_count, uint32_t first_index, int32_t vertex_offset, uint32_t first_instance);
+    // counts as one draw call, the caller knows how many triangles the commands hold
+    void draw_indexed_indirect(VkBuffer buffer, VkDeviceSize offset, uint32_t draw_count, uint32_t stride);
+    // same, but the GPU reads how many of the max_draw_count commands to draw from count_buffer
+    void draw_indexed_indirect_count(VkBuffer buffer, VkDeviceSize offset, VkBuffer count_buffer, VkDeviceSize count_buffer_offset,
+                                     uint32_t max_draw_count, uint32_t stride);
+    // VK_EXT_mesh_shader, counts as one draw call like the indexed ones
+    void draw_mesh_tasks_indirect(VkBuffer buffer, VkDeviceSize offset, uint32_t draw_count, uint32_t stride);
+
+    // adds this encoder's bind, draw and triangle counts to the frame's stats
+    void add_stats(EngineStats& engine_stats) const;
+
+    VkCommandBuffer cmd = VK_NULL_HANDLE;
+
+private:
+    void bind_set(VkPipelineLayout layout, uint32_t set_index, VkDescriptorSet set, uint32_t dynamic_offset_count, uint32_t dynamic_offset);
+
+    VkPipelineBindPoint bind_point;
+
+    VkPipeline bound_pipeline;
+    // a set is only reused if it was bound with the same layout, layouts that differ may not be compatible
+    VkPipelineLayout bound_set_layouts[MAX_TRACKED_DESCRIPTOR_SETS];
+    VkDescriptorSet bound_sets[MAX_TRACKED_DESCRIPTOR_SETS];
+    uint32_t bound_dynamic_offsets[MAX_TRACKED_DESCRIPTOR_SETS];
+    VkBuffer bound_index_buffer;
+    VkDeviceSize bound_index_buffer_offset;
+    VkIndexType bound_index_type;
+
+    uint32_t pipeline_binds;
+    uint32_t descriptor_set_binds;
+    uint32_t index_buffer_binds;
+    uint32_t skipped_binds;
+    uint32_t draw_calls;
+    uint32_t triangles;
+};
@@ -10,8 +10,9 @@
 #include "VulkanImageUtility.hpp"
 #include <chrono>
 
-void DeferredRenderer::create_g_buffer(AllocatedImage& g_buffer, VkExtent3D extent, const std::string& name) {
-    g_buffer.extent = draw_image.extent;
+void DeferredRenderer::add_g_buffer(TransientAttachmentPool& transient_attachments, uint32_t lifetime_group,
+                                    AllocatedImage& g_buffer, VkExtent3D extent, const std::string& name) {
+    g_buffer.extent = extent;
     g_buffer.format = VK_FORMAT_R8G8B8A8_UNORM;
 
     VkImageUsageFlags g_buffer_usage_flags = {};
@@ -19,23 +20,32 @@ void DeferredRenderer::create_g_buffer(AllocatedImage& g_buffer, VkExtent3D exte
     g_buffer_usage_flags |= VK_IMAGE_USAGE_SAMPLED_BIT;
     g_buffer_usage_flags |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
 
-    VmaAllocationCreateInfo depth_image_alloc_info = {
-            .usage = VMA_MEMORY_USAGE_GPU_ONLY,
-            .requiredFlags = VkMemoryPropertyFlags (VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)
-    };
+    transient_attachments.add_image(g_buffer, lifetime_group, g_buffer_usage_flags, VK_IMAGE_ASPECT_COLOR_BIT, name);
+}
 
-    VkImageCreateInfo g_buffer_create_info = vk_init::get_image_create_info(g_buffer.format, g_buffer_usage_flags, g_buffer.extent);
-    VK_CHECK(vmaCreateImage(allocator, &g_buffer_create_info, &depth_image_alloc_info, &g_buffer.image, &g_buffer.allocation, nullptr));
-    vk_debug::name_resource<VkImage>(device, VK_OBJECT_TYPE_IMAGE, g_buffer.image, (name + " image").c_str());
+/*
+ * The g-buffers only live while this renderer draws, so they are placed in the engine's transient attachment pool
+ * instead of an allocation each. allocate() has to run on the pool before init.
+ */
+void DeferredRenderer::add_render_targets(TransientAttachmentPool& transient_attachments, uint32_t lifetime_group, VkExtent3D extent) {
+    depth_g_buffer.extent = extent;
+    depth_g_buffer.format = VK_FORMAT_D32_SFLOAT;
 
-    VkImageViewCreateInfo depth_image_view_create_info = vk_init::get_image_view_create_info(g_buffer.format, g_buffer.image, VK_IMAGE_ASPECT_COLOR_BIT);
-    VK_CHECK(vkCreateImageView(device, &depth_image_view_create_info, nullptr, &g_buffer.view));
-    vk_debug::name_resource<VkImageView>(device, VK_OBJECT_TYPE_IMAGE_VIEW, g_buffer.view, (name + "  view").c_str());
+    VkImageUsageFlags depth_image_usage_flags = {};
+    depth_image_usage_flags |= VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+    depth_image_usage_flags |= VK_IMAGE_USAGE_SAMPLED_BIT;
 
+    transient_attachments.add_image(depth_g_buffer, lifetime_group, depth_image_usage_flags, VK_IMAGE_ASPECT_DEPTH_BIT, "Depth G-Buffer");
+
+    add_g_buffer(transient_attachments, lifetime_group, world_normal_g_buffer, extent, "World Normal G-Buffer");
+    add_g_buffer(transient_attachments, lifetime_group, albedo_g_buffer, extent, "Albedo G-Buffer");
 }
 
 void DeferredRenderer::init(VkDevice device, VmaAllocator allocator, AllocatedImage& draw_image,
                             std::shared_ptr<ShadowPipeline>& shadow_pipeline,
+                            std::shared_ptr<WeightedBlendedOIT>& transparency_pass,
+                            std::shared_ptr<GPUDrawCuller>& draw_culler,
+                            std::shared_ptr<MeshletCuller>& meshlet_culler,
                             VkDescriptorSetLayout scene_descriptor_set_layout,
                             VkDescriptorSetLayout shadow_map_descriptor_set_layout,
                             VkDescriptorSetLayout light_source_descriptor_set_layout,
@@ -46,41 +56,19 @@ void DeferredRenderer::init(VkDevice device, VmaAllocator allocator, AllocatedIm
     this->allocator = allocator;
     this->draw_image = draw_image;
     this->shadow_pipeline = shadow_pipeline;
+    this->transparency_pass = transparency_pass;
+    this->draw_culler = draw_culler;
+    this->meshlet_culler = meshlet_culler;
     this->scene_descriptor_set_layout = scene_descriptor_set_layout;
     this->shadow_map_descriptor_set_layout = shadow_map_descriptor_set_layout;
 
-    VkExtent3D g_buffer_extent = {
-            .width = draw_image.extent.width,
-            .height = draw_image.extent.height,
-            .depth = draw_image.extent.depth,
-    };
-
-    // Create Depth G-Buffer {
-    {
-        depth_g_buffer.extent = g_buffer_extent;
-        depth_g_buffer.format = VK_FORMAT_D32_SFLOAT;
-
-        VkImageUsageFlags depth_image_usage_flags = {};
-        depth_image_usage_flags |= VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
-        depth_image_usage_flags |= VK_IMAGE_USAGE_SAMPLED_BIT;
-
-        VmaAllocationCreateInfo depth_g_buffer_alloc_info = {
-                .usage = VMA_MEMORY_USAGE_GPU_ONLY,
-                .requiredFlags = VkMemoryPropertyFlags (VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)
-        };
-
-        VkImageCreateInfo depth_image_create_info = vk_init::get_image_create_info(depth_g_buffer.format, depth_image_usage_flags, depth_g_buffer.extent);
-        VK_CHECK(vmaCreateImage(allocator, &depth_image_create_info, &depth_g_buffer_alloc_info, &depth_g_buffer.image, &depth_g_buffer.allocation, nullptr));
-        vk_debug::name_resource<VkImage>(device, VK_OBJECT_TYPE_IMAGE, depth_g_buffer.image, "Depth G-Buffer Image");
+    depth_pyramid.init(device, allocator, depth_g_buffer, draw_culler->get_depth_pyramid_descriptor_set_layout(),
+                       immediate_submit_command_buffer, renderer_deletion_queue);
 
-        VkImageViewCreateInfo depth_image_view_create_info = vk_init::get_image_view_create_info(depth_g_buffer.format, depth_g_buffer.image, VK_IMAGE_ASPECT_DEPTH_BIT);
-        VK_CHECK(vkCreateImageView(device, &depth_image_view_create_info, nullptr, &depth_g_buffer.view));
-        vk_debug::name_resource<VkImageView>(device, VK_OBJECT_TYPE_IMAGE_VIEW, depth_g_buffer.view, "Depth G-Buffer View");
-    }
-
-    // Create Other G-Buffers
-    create_g_buffer(world_normal_g_buffer, g_buffer_extent, "World Normal G-Buffer");
-    create_g_buffer(albedo_g_buffer, g_buffer_extent, "Albedo G-Buffer");
+    indirect_draws.init(device, allocator);
+    renderer_deletion_queue.push_function([&]() {
+        indirect_draws.destroy();
+    });
 
     // renderer-specific descriptor set pool and layouts
 
@@ -139,12 +127,13 @@ void DeferredRenderer::init(VkDevice device, VmaAllocator allocator, AllocatedIm
 
 }
 
-void DeferredRenderer::draw(VkCommandBuffer cmd, VkCommandBuffer cmd2,
-                            DescriptorAllocatorGrowable& frame_descriptor_allocator,
-                            DeletionQueue& frame_deletion_queue, AllocatedImage& shadow_map,
+void DeferredRenderer::draw(VkCommandBuffer cmd,
+                            ParallelCommandRecorder& command_recorder, JobSystem& job_system,
+                            DescriptorSetCache& descriptor_cache,
+                            TimelineDeletionQueue& gpu_deletion_queue, AllocatedImage& shadow_map,
                             VkSampler shadow_map_sampler, VkSampler g_buffer_sampler, GPUSceneData& current_scene_data,
                             EngineStats& engine_stats, DrawContext& draw_context,
-                            VkDescriptorSet* p_light_data_descriptor_set) {
+                            const FrameUniforms& frame_uniforms) {
 
 //    {
 //        VkRenderingAttachmentInfo normal_g_buffer_attachment = vk_init::get_color_attachment_info(world_normal_g_buffer.view, nullptr);
@@ -204,13 +193,15 @@ void DeferredRenderer::draw(VkCommandBuffer cmd, VkCommandBuffer cmd2,
                 color_2_attachment
         };
 
+        // cleared, the late draws and the pyramid need the early ones' depth and nothing older
         VkRenderingAttachmentInfo depth_attachment = {
                 .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
                 .pNext = nullptr,
                 .imageView = depth_g_buffer.view,
                 .imageLayout = VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL,
-                .loadOp = VK_ATTACHMENT_LOAD_OP_LOAD,
+                .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
                 .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+                .clearValue = { .depthStencil = { .depth = 1.0f } }
         };
 
         VkExtent2D render_extent = {
@@ -218,9 +209,11 @@ void DeferredRenderer::draw(VkCommandBuffer cmd, VkCommandBuffer cmd2,
                 .height = draw_image.extent.height
         };
 
+        // the draws themselves are recorded into secondaries on the job threads
         VkRenderingInfo render_info = {
                 .sType = VK_STRUCTURE_TYPE_RENDERING_INFO,
                 .pNext = nullptr,
+                .flags = VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT,
                 .renderArea = VkRect2D { VkOffset2D{0, 0}, render_extent },
                 .layerCount = 1,
                 .colorAttachmentCount = 2,
@@ -229,74 +222,38 @@ void DeferredRenderer::draw(VkCommandBuffer cmd, VkCommandBuffer cmd2,
                 .pStencilAttachment = nullptr
         };
 
-        vkCmdBeginRendering(cmd, &render_info);
-
-        VkViewport viewport = {
-            .x = 0,
-            .y = 0,
-            .width = static_cast<float>(render_extent.width),
-            .height = static_cast<float>(render_extent.height),
-            .minDepth = 0.f,
-            .maxDepth = 1.f
-        };
-        vkCmdSetViewport(cmd, 0, 1, &viewport);
+        build_geometry_draws(cmd, gpu_deletion_queue, current_scene_data, engine_stats, draw_context);
 
-        VkRect2D scissor = {
-            .offset = {
-                .x = 0,
-                .y = 0
-            },
-            .extent = {
-                .width = render_extent.width,
-                .height = render_extent.height,
-            }
-        };
-        vkCmdSetScissor(cmd, 0, 1, &scissor);
-
-        // SET UP DESCRIPTOR SETS
-        // Create the GPU scene data buffer for this frame
-        // This handles the data-race which may occur if we updated a uniform buffer being read-from by inflight shader executions
-        Buffer gpu_scene_data_buffer;
-        gpu_scene_data_buffer.init(allocator, sizeof(GPUSceneData), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-        frame_deletion_queue.push_function([=, this](){
-            gpu_scene_data_buffer.destroy_buffer();
-        });
-
-        // Get the memory handle mapped to the buffer's allocation
-        GPUSceneData* scene_uniform_data = (GPUSceneData*)gpu_scene_data_buffer.info.pMappedData;
-        *scene_uniform_data = current_scene_data;
-
-        VkDescriptorSet scene_data_descriptor_set = frame_descriptor_allocator.allocate(device, scene_descriptor_set_layout, nullptr);
-
-        // write the buffer's handle into the descriptor set
-        // then update the descriptor set to use the correct buffer handle
-        DescriptorWriter writer;
-        writer.write_buffer(0, gpu_scene_data_buffer.buffer, sizeof(GPUSceneData), 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
-        writer.update_set(device, scene_data_descriptor_set);
-
-        for(const RenderObject& draw : draw_context.opaque_surfaces) {
-            vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, draw.material->deferred_rendering_geometry_pipeline->pipeline);
+        vkCmdBeginRendering(cmd, &render_info);
 
-            // BIND SCENE DATA BUFFER - set 0
-            vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, draw.material->deferred_rendering_geometry_pipeline->layout, 0, 1, &scene_data_descriptor_set, 0, nullptr);
+        std::array<VkFormat, 2> color_attachment_formats = { albedo_g_buffer.format, world_normal_g_buffer.format };
+        record_geometry_draws(cmd, command_recorder, job_system, color_attachment_formats, render_extent,
+                              frame_uniforms, engine_stats);
 
-            // BIND MATERIAL DATA BUFFER - set 1
-            vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, draw.material->deferred_rendering_geometry_pipeline->layout, 1, 1, &draw.material->material_set, 0, nullptr);
+        vkCmdEndRendering(cmd);
 
-            // BIND INDEX BUFFER
-            vkCmdBindIndexBuffer(cmd, draw.index_buffer, 0, VK_INDEX_TYPE_UINT32);
+        // second phase, whatever the first one's depth doesn't hide is drawn on top of it
+        if(draw_context.occlusion_cull_on_gpu) {
+            depth_pyramid.build(cmd);
+            if(draw_context.cull_meshlets_on_gpu) {
+                meshlet_culler->cull_late(cmd, indirect_draws, depth_pyramid, gpu_deletion_queue);
+            }
+            draw_culler->cull_late(cmd, indirect_draws, depth_pyramid, gpu_deletion_queue);
 
-            // PUSH WORLD MATRIX AND VERTEX BUFFER ADDRESS
-            GPUDrawPushConstants push_constants = {
-                .world_matrix = draw.transform,
-                .vertex_buffer_address = draw.vertex_buffer_address
-            };
-            vkCmdPushConstants(cmd, draw.material->deferred_rendering_geometry_pipeline->layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(GPUDrawPushConstants), &push_constants);
+            depth_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
 
-            vkCmdDrawIndexed(cmd, draw.index_count, 1, draw.first_index, 0, 0);
+            vkCmdBeginRendering(cmd, &render_info);
+            record_geometry_draws(cmd, command_recorder, job_system, color_attachment_formats, render_extent,
+                                  frame_uniforms, engine_stats);
+            vkCmdEndRendering(cmd);
         }
 
-        vkCmdEndRendering(cmd);
+        if(draw_context.cull_opaque_on_gpu) {
+            draw_culler->add_stats(engine_stats);
+        }
+        if(draw_context.cull_meshlets_on_gpu) {
+            meshlet_culler->add_stats(engine_stats);
+        }
     }
 
     // 2
@@ -330,7 +287,14 @@ void DeferredRenderer::draw(VkCommandBuffer cmd, VkCommandBuffer cmd2,
         vkCmdEndRendering(cmd);
     }
 
-    vk_image::transition_image_layout(cmd, draw_image.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+    // 3, transparent surfaces, tested against the g-buffer depth
+    VkDescriptorSet shadow_map_descriptor_set = shadow_pipeline->get_shadow_map_descriptor_set(shadow_map, shadow_map_sampler, descriptor_cache,
+                                                                                                shadow_map_descriptor_set_layout);
+
+    transparency_pass->draw(cmd, command_recorder, job_system, gpu_deletion_queue, draw_image, depth_g_buffer, frame_uniforms,
+                            shadow_map_descriptor_set, current_scene_data, engine_stats, draw_context);
+
+    vk_image::transition_image_layout(cmd, draw_image.image, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
 
     // transition from undefined (image either created or in unknown state), to general (for the clear operation)
 //    vk_image::transition_image_layout(cmd, draw_image.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
@@ -343,7 +307,7 @@ void DeferredRenderer::draw(VkCommandBuffer cmd, VkCommandBuffer cmd2,
 //    vk_image::transition_image_layout(cmd, albedo_g_buffer.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
 //    vk_image::transition_image_layout(cmd, depth_g_buffer.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
 //
-////    draw_geometry_into_g_buffers(cmd, frame_descriptor_allocator, frame_deletion_queue, current_scene_data, engine_stats, draw_context);
+////    draw_geometry_into_g_buffers(cmd, descriptor_cache, gpu_deletion_queue, current_scene_data, engine_stats, draw_context);
 //
 //    vk_image::transition_image_layout(cmd, world_normal_g_buffer.image, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 //    vk_image::transition_image_layout(cmd, albedo_g_buffer.image, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
@@ -351,12 +315,17 @@ void DeferredRenderer::draw(VkCommandBuffer cmd, VkCommandBuffer cmd2,
 //    // commented from clear resources above ::transition_image_layout(cmd, draw_image.image, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
 //    vk_image::transition_image_layout(cmd, draw_image.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
 //
-////    draw_lighting_pass(cmd, frame_descriptor_allocator, p_light_data_descriptor_set, g_buffer_sampler,
-////                       frame_deletion_queue, current_scene_data, engine_stats);
+////    draw_lighting_pass(cmd, descriptor_cache, frame_uniforms, g_buffer_sampler,
+////                       gpu_deletion_queue, frame_arena, current_scene_data, engine_stats);
 //
 //    vk_image::transition_image_layout(cmd, draw_image.image, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
 }
 
+void DeferredRenderer::destroy() {
+    // the g-buffers belong to the transient attachment pool
+    renderer_deletion_queue.flush();
+}
+
 void DeferredRenderer::clear_image_resources(VkCommandBuffer cmd) {
     VkClearColorValue clear_value;
     clear_value = { { 0.0f, 0.0f, 0.0f, 1.0f } };
@@ -370,15 +339,18 @@ void DeferredRenderer::clear_image_resources(VkCommandBuffer cmd) {
 }
 
 void DeferredRenderer::draw_geometry_into_g_buffers(VkCommandBuffer cmd,
-                                                    DescriptorAllocatorGrowable& frame_descriptor_allocator,
-                                                    DeletionQueue& frame_deletion_queue,
+                                                    ParallelCommandRecorder& command_recorder,
+                                                    JobSystem& job_system,
+                                                    DescriptorSetCache& descriptor_cache,
+                                                    TimelineDeletionQueue& gpu_deletion_queue,
                                                     GPUSceneData& current_scene_data,
                                                     EngineStats& engine_stats,
-                                                    DrawContext& draw_context) {
+                                                    DrawContext& draw_context,
+                                                    const FrameUniforms& frame_uniforms) {
 
     VkRenderingAttachmentInfo normal_g_buffer_attachment = vk_init::get_color_attachment_info(world_normal_g_buffer.view, nullptr);
     VkRenderingAttachmentInfo albedo_g_buffer_attachment = vk_init::get_color_attachment_info(albedo_g_buffer.view, nullptr);
-    std::vector<VkRenderingAttachmentInfo> color_attachment_infos = {
+    std::array<VkRenderingAttachmentInfo, 2> color_attachment_infos = {
             normal_g_buffer_attachment,
             albedo_g_buffer_attachment
     };
@@ -420,8 +392,6 @@ void DeferredRenderer::draw_geometry_into_g_buffers(VkCommandBuffer cmd,
 //    vkCmdEndRendering(cmd);
 
 
-    engine_stats.draw_call_count = 0;
-    engine_stats.triangle_count = 0;
     auto draw_geometry_start = std::chrono::system_clock::now();
 
     // DYNAMIC RENDERING SETUP
@@ -440,77 +410,15 @@ void DeferredRenderer::draw_geometry_into_g_buffers(VkCommandBuffer cmd,
 
     // ORIGINAL!!! VkRenderingInfo render_info = vk_init::get_rendering_info(render_extent, color_attachment_infos, &depth_attachment_info);
     VkRenderingInfo render_info = vk_init::get_rendering_info(render_extent, color_attachment_infos, &depth_attachment_info);
+    render_info.flags = VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT;
 
-    vkCmdBeginRendering(cmd, &render_info);
+    build_geometry_draws(cmd, gpu_deletion_queue, current_scene_data, engine_stats, draw_context);
 
-    // VIEWPORT/SCISSOR DATA
-    VkViewport viewport = {
-            .x = 0,
-            .y = 0,
-            .width = static_cast<float>(render_extent.width),
-            .height = static_cast<float>(render_extent.height),
-            .minDepth = 0.f,
-            .maxDepth = 1.f
-    };
-    vkCmdSetViewport(cmd, 0, 1, &viewport);
-
-    VkRect2D scissor = {
-            .offset = {
-                    .x = 0,
-                    .y = 0
-            },
-            .extent = {
-                    .width = render_extent.width,
-                    .height = render_extent.height,
-            }
-    };
-    vkCmdSetScissor(cmd, 0, 1, &scissor);
-
-    // SET UP DESCRIPTOR SETS
-    // Create the GPU scene data buffer for this frame
-    // This handles the data-race which may occur if we updated a uniform buffer being read-from by inflight shader executions
-    Buffer gpu_scene_data_buffer;
-    gpu_scene_data_buffer.init(allocator, sizeof(GPUSceneData), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-    frame_deletion_queue.push_function([=, this](){
-        gpu_scene_data_buffer.destroy_buffer();
-    });
-
-    // Get the memory handle mapped to the buffer's allocation
-    GPUSceneData* scene_uniform_data = (GPUSceneData*)gpu_scene_data_buffer.info.pMappedData;
-    *scene_uniform_data = current_scene_data;
-
-    VkDescriptorSet scene_data_descriptor_set = frame_descriptor_allocator.allocate(device, scene_descriptor_set_layout, nullptr);
-
-    // write the buffer's handle into the descriptor set
-    // then update the descriptor set to use the correct buffer handle
-    DescriptorWriter writer;
-    writer.write_buffer(0, gpu_scene_data_buffer.buffer, sizeof(GPUSceneData), 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
-    writer.update_set(device, scene_data_descriptor_set);
-
-    for(const RenderObject& draw : draw_context.opaque_surfaces) {
-        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, draw.material->deferred_rendering_geometry_pipeline->pipeline);
-
-        // BIND SCENE DATA BUFFER - set 0
-        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, draw.material->deferred_rendering_geometry_pipeline->layout, 0, 1, &scene_data_descriptor_set, 0, nullptr);
-
-        // BIND MATERIAL DATA BUFFER - set 1
-        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, draw.material->deferred_rendering_geometry_pipeline->layout, 1, 1, &draw.material->material_set, 0, nullptr);
-
-        // BIND INDEX BUFFER
-        vkCmdBindIndexBuffer(cmd, draw.index_buffer, 0, VK_INDEX_TYPE_UINT32);
-
-        // PUSH WORLD MATRIX AND VERTEX BUFFER ADDRESS
-        GPUDrawPushConstants push_constants = {
-                .world_matrix = draw.transform,
-                .vertex_buffer_address = draw.vertex_buffer_address
-        };
-        vkCmdPushConstants(cmd, draw.material->deferred_rendering_geometry_pipeline->layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(GPUDrawPushConstants), &push_constants);
-
-        vkCmdDrawIndexed(cmd, draw.index_count, 1, draw.first_index, 0, 0);
+    vkCmdBeginRendering(cmd, &render_info);
 
-        engine_stats.draw_call_count++;
-        engine_stats.triangle_count += draw.index_count / 3;
-    }
+    std::array<VkFormat, 2> color_attachment_formats = { world_normal_g_buffer.format, albedo_g_buffer.format };
+    record_geometry_draws(cmd, command_recorder, job_system, color_attachment_formats, render_extent,
+                          frame_uniforms, engine_stats);
 
 //    // Add pipeline barrier so G-Buffers aren't used too soon
 //    VkPipelineStageFlags src_stage_mask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT; // need g-buffers written, and depth buffer written
@@ -554,6 +462,28 @@ void DeferredRenderer::draw_geometry_into_g_buffers(VkCommandBuffer cmd,
 
     vkCmdEndRendering(cmd);
 
+    if(draw_context.occlusion_cull_on_gpu) {
+        depth_pyramid.build(cmd);
+        if(draw_context.cull_meshlets_on_gpu) {
+            meshlet_culler->cull_late(cmd, indirect_draws, depth_pyramid, gpu_deletion_queue);
+        }
+        draw_culler->cull_late(cmd, indirect_draws, depth_pyramid, gpu_deletion_queue);
+
+        depth_attachment_info.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+
+        vkCmdBeginRendering(cmd, &render_info);
+        record_geometry_draws(cmd, command_recorder, job_system, color_attachment_formats, render_extent,
+                              frame_uniforms, engine_stats);
+        vkCmdEndRendering(cmd);
+    }
+
+    if(draw_context.cull_opaque_on_gpu) {
+        draw_culler->add_stats(engine_stats);
+    }
+    if(draw_context.cull_meshlets_on_gpu) {
+        meshlet_culler->add_stats(engine_stats);
+    }
+
     auto draw_geometry_end = std::chrono::system_clock::now();
     auto elapsed = std::chrono::duration_cast<std::chrono::microseconds >(draw_geometry_end - draw_geometry_start);
     engine_stats.mesh_draw_time = elapsed.count() / 1000.f;
@@ -572,10 +502,79 @@ void DeferredRenderer::draw_geometry_into_g_buffers(VkCommandBuffer cmd,
 
 }
 
-void DeferredRenderer::draw_lighting_pass(VkCommandBuffer cmd, DescriptorAllocatorGrowable& frame_descriptor_allocator,
-                                          VkDescriptorSet* light_data_descriptor_set, VkSampler g_buffer_sampler,
-                                          DeletionQueue& frame_deletion_queue, GPUSceneData& current_scene_data,
-                                          EngineStats& engine_stats) {
+/*
+ * Sorts the visible surfaces into indirect batches and, when asked to, culls them and their meshlets on the GPU. With
+ * occlusion culling this only keeps the early draws, the caller culls the late ones once they've been drawn. Has to be
+ * recorded outside of rendering, ahead of record_geometry_draws.
+ */
+void DeferredRenderer::build_geometry_draws(VkCommandBuffer cmd,
+                                            TimelineDeletionQueue& gpu_deletion_queue,
+                                            GPUSceneData& current_scene_data,
+                                            EngineStats& engine_stats,
+                                            DrawContext& draw_context) {
+
+    // group draws by pipeline, material and mesh so they fall into as few indirect batches as possible
+    draw_sorter.sort(draw_context.opaque_surfaces, draw_context.visible_opaque_surfaces, DrawPass::DeferredGeometry, current_scene_data.view);
+
+    // with mesh shading the task shaders cull the meshlets against this, see IndirectDrawBuilder
+    GPUMeshletCullView mesh_shading_view = MeshletCuller::get_cull_view(current_scene_data.view, current_scene_data.view_proj);
+    indirect_draws.build(draw_context.opaque_surfaces, draw_context.visible_opaque_surfaces,
+                         draw_context.opaque_transforms, DrawPass::DeferredGeometry, gpu_deletion_queue,
+                         draw_context.draw_with_mesh_shaders ? &mesh_shading_view : nullptr);
+
+    // meshlets go first, the draw cull compacts what's left
+    if(draw_context.cull_meshlets_on_gpu) {
+        if(draw_context.occlusion_cull_on_gpu) {
+            meshlet_culler->cull_early(cmd, indirect_draws, draw_context.opaque_surfaces, draw_context.visible_opaque_surfaces,
+                                       current_scene_data.view, current_scene_data.view_proj, depth_pyramid, gpu_deletion_queue);
+        } else {
+            meshlet_culler->cull(cmd, indirect_draws, draw_context.opaque_surfaces, draw_context.visible_opaque_surfaces,
+                                 current_scene_data.view, current_scene_data.view_proj, depth_pyramid, gpu_deletion_queue);
+        }
+    }
+
+    if(draw_context.occlusion_cull_on_gpu) {
+        draw_culler->cull_early(cmd, indirect_draws, draw_context.opaque_surfaces, draw_context.visible_opaque_surfaces,
+                                current_scene_data.view_proj, depth_pyramid, gpu_deletion_queue);
+    } else if(draw_context.cull_opaque_on_gpu) {
+        draw_culler->cull(cmd, indirect_draws, draw_context.opaque_surfaces, draw_context.visible_opaque_surfaces,
+                          current_scene_data.view_proj, depth_pyramid, gpu_deletion_queue);
+    }
+}
+
+/*
+ * Records the batches from build_geometry_draws across the job threads. Rendering must already have been begun on cmd
+ * with VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT and the given color attachment formats, in order.
+ */
+void DeferredRenderer::record_geometry_draws(VkCommandBuffer cmd,
+                                             ParallelCommandRecorder& command_recorder,
+                                             JobSystem& job_system,
+                                             std::span<const VkFormat> color_attachment_formats,
+                                             VkExtent2D render_extent,
+                                             const FrameUniforms& frame_uniforms,
+                                             EngineStats& engine_stats) {
+
+    const std::vector<IndirectBatch>& batches = indirect_draws.get_batches();
+
+    command_recorder.record(cmd, color_attachment_formats, depth_g_buffer.format, render_extent,
+                            static_cast<uint32_t>(batches.size()), job_system, engine_stats,
+                            [&](CommandEncoder& encoder, uint32_t start, uint32_t end) {
+        for(uint32_t i = start; i < end; i++) {
+            // BIND SCENE DATA BUFFER - set 0, the batch binds the material at set 1
+            encoder.bind_descriptor_set(batches[i].pipeline->layout, 0, frame_uniforms.scene_set, frame_uniforms.scene_offset);
+
+            indirect_draws.record_batch(encoder, i);
+        }
+    });
+
+    engine_stats.triangle_count += static_cast<int>(indirect_draws.get_triangle_count());
+    engine_stats.indirect_command_count += static_cast<int>(indirect_draws.get_command_count());
+}
+
+void DeferredRenderer::draw_lighting_pass(VkCommandBuffer cmd, DescriptorSetCache& descriptor_cache,
+                                          const FrameUniforms& frame_uniforms, VkSampler g_buffer_sampler,
+                                          TimelineDeletionQueue& gpu_deletion_queue, FrameArena& frame_arena,
+                                          GPUSceneData& current_scene_data, EngineStats& engine_stats) {
 
     engine_stats.draw_call_count = 0;
     engine_stats.triangle_count = 0;
@@ -624,7 +623,7 @@ void DeferredRenderer::draw_lighting_pass(VkCommandBuffer cmd, DescriptorAllocat
 //
 //    // DYNAMIC RENDERING SETUP
     VkRenderingAttachmentInfo draw_image_attachment = vk_init::get_color_attachment_info(draw_image.view, nullptr);
-    std::vector<VkRenderingAttachmentInfo> color_attachment_infos = {
+    std::array<VkRenderingAttachmentInfo, 1> color_attachment_infos = {
         draw_image_attachment
     };
 
@@ -673,44 +672,23 @@ void DeferredRenderer::draw_lighting_pass(VkCommandBuffer cmd, DescriptorAllocat
     };
     vkCmdSetScissor(cmd, 0, 1, &scissor);
 
-    // SET UP DESCRIPTOR SETS
-    // Create the GPU scene data buffer for this frame
-    // This handles the data-race which may occur if we updated a uniform buffer being read-from by inflight shader executions
-    Buffer gpu_scene_data_buffer;
-    gpu_scene_data_buffer.init(allocator, sizeof(GPUSceneData), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-    frame_deletion_queue.push_function([=, this](){
-        gpu_scene_data_buffer.destroy_buffer();
-    });
-
-    // Get the memory handle mapped to the buffer's allocation
-    GPUSceneData* scene_uniform_data = (GPUSceneData*)gpu_scene_data_buffer.info.pMappedData;
-    *scene_uniform_data = current_scene_data;
-
-    VkDescriptorSet global_descriptor_set = frame_descriptor_allocator.allocate(device, scene_descriptor_set_layout, nullptr);
-
-    // write the buffer's handle into the descriptor set
-    // then update the descriptor set to use the correct buffer handle
-    DescriptorWriter writer;
-    writer.write_buffer(0, gpu_scene_data_buffer.buffer, sizeof(GPUSceneData), 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
-    writer.update_set(device, global_descriptor_set);
-
-    // G-BUFFER DESCRIPTOR SETS
-    VkDescriptorSet g_buffer_descriptor_set = frame_descriptor_allocator.allocate(device, lighting_pass_lighting_descriptor_set_layout, nullptr);
+    DescriptorWriter writer(&frame_arena);
 
+    // G-BUFFER DESCRIPTOR SETS - the g-buffers live as long as the renderer, so this is written once and cached
     writer.clear();
     writer.write_image(0, depth_g_buffer.view, g_buffer_sampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
     writer.write_image(1, world_normal_g_buffer.view, g_buffer_sampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
     writer.write_image(2, albedo_g_buffer.view, g_buffer_sampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
-    writer.update_set(device, g_buffer_descriptor_set);
+    VkDescriptorSet g_buffer_descriptor_set = descriptor_cache.get(lighting_pass_lighting_descriptor_set_layout, writer);
 
     // BIND PIPELINE
     vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, deferred_renderer_data.light_pipeline.pipeline);
 
     // BIND SCENE DESCRIPTOR SET - set 0
-    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, deferred_renderer_data.light_pipeline.layout, 0, 1, &global_descriptor_set, 0, nullptr);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, deferred_renderer_data.light_pipeline.layout, 0, 1, &frame_uniforms.scene_set, 1, &frame_uniforms.scene_offset);
 
     // BIND LIGHT DESCRIPTOR SET - set 1
-    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, deferred_renderer_data.light_pipeline.layout, 1, 1, light_data_descriptor_set, 0, nullptr);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, deferred_renderer_data.light_pipeline.layout, 1, 1, &frame_uniforms.light_set, 1, &frame_uniforms.light_offset);
 
     // BIND G-BUFFER DESCRIPTOR SET - set 2
     vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, deferred_renderer_data.light_pipeline.layout, 2, 1, &g_buffer_descriptor_set, 0, nullptr);
@@ -10,13 +10,29 @@
 #include "ComputeEffect.hpp"
 #include "EngineStats.hpp"
 #include "GLTFHDRMaterial.hpp"
+#include "DrawSorter.hpp"
+#include "CommandEncoder.hpp"
+#include "ParallelCommandRecorder.hpp"
+#include "JobSystem.hpp"
+#include "WeightedBlendedOIT.hpp"
+#include "IndirectDrawBuilder.hpp"
+#include "GPUDrawCuller.hpp"
+#include "MeshletCuller.hpp"
+#include "DepthPyramid.hpp"
+#include "TransientAttachmentPool.hpp"
+#include "FrameArena.hpp"
 
 
 class DeferredRenderer {
 
 public:
+    void add_render_targets(TransientAttachmentPool& transient_attachments, uint32_t lifetime_group, VkExtent3D extent);
+
     void init(VkDevice device, VmaAllocator allocator, AllocatedImage& draw_image,
               std::shared_ptr<ShadowPipeline>& shadow_pipeline,
+              std::shared_ptr<WeightedBlendedOIT>& transparency_pass,
+              std::shared_ptr<GPUDrawCuller>& draw_culler,
+              std::shared_ptr<MeshletCuller>& meshlet_culler,
               VkDescriptorSetLayout scene_descriptor_set_layout,
               VkDescriptorSetLayout shadow_map_descriptor_set_layout,
               VkDescriptorSetLayout light_source_descriptor_set_layout,
@@ -24,12 +40,15 @@ public:
               ImmediateSubmitCommandBuffer& immediate_submit_command_buffer);
 
 
-    void draw(VkCommandBuffer cmd, VkCommandBuffer cmd2,
-              DescriptorAllocatorGrowable& frame_descriptor_allocator,
-              DeletionQueue& frame_deletion_queue, AllocatedImage& shadow_map,
+    void draw(VkCommandBuffer cmd,
+              ParallelCommandRecorder& command_recorder, JobSystem& job_system,
+              DescriptorSetCache& descriptor_cache,
+              TimelineDeletionQueue& gpu_deletion_queue, AllocatedImage& shadow_map,
               VkSampler shadow_map_sampler, VkSampler g_buffer_sampler, GPUSceneData& current_scene_data,
               EngineStats& engine_stats, DrawContext& draw_context,
-              VkDescriptorSet* p_light_data_descriptor_set);
+              const FrameUniforms& frame_uniforms);
+
+    void destroy();
 
 private:
 
@@ -38,12 +57,15 @@ private:
     VkDevice device;
     VmaAllocator allocator;
     std::shared_ptr<ShadowPipeline> shadow_pipeline;
+    std::shared_ptr<WeightedBlendedOIT> transparency_pass;
+    std::shared_ptr<GPUDrawCuller> draw_culler;
+    std::shared_ptr<MeshletCuller> meshlet_culler;
     VkDescriptorSetLayout scene_descriptor_set_layout;
     VkDescriptorSetLayout shadow_map_descriptor_set_layout;
 
     // Renderer-owned
 
-    // G-buffers
+    // G-buffers, aliased with the other renderer's targets, see TransientAttachmentPool
     AllocatedImage depth_g_buffer; // can be used to also determine the world position of the fragment
     AllocatedImage world_normal_g_buffer;
     AllocatedImage albedo_g_buffer;
@@ -52,24 +74,50 @@ private:
 
     DescriptorAllocatorGrowable renderer_descriptor_allocator;
 
+    DrawSorter draw_sorter;
+    IndirectDrawBuilder indirect_draws;
+
+    // farthest depth of the early geometry draws, see GPUDrawCuller
+    DepthPyramid depth_pyramid;
+
+    DeletionQueue renderer_deletion_queue;
+
     GLTFHDRMaterial::DeferredRendererData deferred_renderer_data;
 
     // Lighting descriptor sets
     VkDescriptorSetLayout lighting_pass_lighting_descriptor_set_layout;
 
-    void create_g_buffer(AllocatedImage& g_buffer, VkExtent3D extent, const std::string& name);
+    void add_g_buffer(TransientAttachmentPool& transient_attachments, uint32_t lifetime_group,
+                      AllocatedImage& g_buffer, VkExtent3D extent, const std::string& name);
     void clear_image_resources(VkCommandBuffer cmd);
     void draw_geometry_into_g_buffers(VkCommandBuffer cmd,
-                                     DescriptorAllocatorGrowable& frame_descriptor_allocator,
-                                     DeletionQueue& frame_deletion_queue,
+                                     ParallelCommandRecorder& command_recorder,
+                                     JobSystem& job_system,
+                                     DescriptorSetCache& descriptor_cache,
+                                     TimelineDeletionQueue& gpu_deletion_queue,
                                      GPUSceneData& current_scene_data,
                                      EngineStats& engine_stats,
-                                     DrawContext& draw_context);
-
-    void draw_lighting_pass(VkCommandBuffer cmd, DescriptorAllocatorGrowable& frame_descriptor_allocator,
-                            VkDescriptorSet* light_data_descriptor_set, VkSampler g_buffer_sampler,
-                            DeletionQueue& frame_deletion_queue, GPUSceneData& current_scene_data,
-                            EngineStats& engine_stats);
+                                     DrawContext& draw_context,
+                                     const FrameUniforms& frame_uniforms);
+
+    void build_geometry_draws(VkCommandBuffer cmd,
+                              TimelineDeletionQueue& gpu_deletion_queue,
+                              GPUSceneData& current_scene_data,
+                              EngineStats& engine_stats,
+                              DrawContext& draw_context);
+
+    void record_geometry_draws(VkCommandBuffer cmd,
+                               ParallelCommandRecorder& command_recorder,
+                               JobSystem& job_system,
+                               std::span<const VkFormat> color_attachment_formats,
+                               VkExtent2D render_extent,
+                               const FrameUniforms& frame_uniforms,
+                               EngineStats& engine_stats);
+
+    void draw_lighting_pass(VkCommandBuffer cmd, DescriptorSetCache& descriptor_cache,
+                            const FrameUniforms& frame_uniforms, VkSampler g_buffer_sampler,
+                            TimelineDeletionQueue& gpu_deletion_queue, FrameArena& frame_arena,
+                            GPUSceneData& current_scene_data, EngineStats& engine_stats);
 
 
 };
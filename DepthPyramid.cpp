@@ -0,0 +1,164 @@
+//
+// Created by darby on 3/3/2025.
+//
+
+#include "DepthPyramid.hpp"
+#include "DescriptorLayoutBuilder.hpp"
+#include "DescriptorWriter.hpp"
+#include "VulkanInitUtility.hpp"
+#include "VulkanImageUtility.hpp"
+#include "VulkanGeneralUtility.hpp"
+#include "VulkanDebugUtility.hpp"
+
+static uint32_t previous_power_of_two(uint32_t value) {
+    uint32_t result = 1;
+    while(result * 2 <= value) {
+        result *= 2;
+    }
+    return result;
+}
+
+void DepthPyramid::init(VkDevice _device,
+                        VmaAllocator allocator,
+                        AllocatedImage& _depth_image,
+                        VkDescriptorSetLayout cull_descriptor_set_layout,
+                        ImmediateSubmitCommandBuffer& immediate_submit_command_buffer,
+                        DeletionQueue& deletion_queue) {
+    device = _device;
+    depth_image = _depth_image.image;
+
+    VkExtent3D pyramid_extent = {
+            .width = previous_power_of_two(_depth_image.extent.width),
+            .height = previous_power_of_two(_depth_image.extent.height),
+            .depth = 1
+    };
+
+    pyramid_image.init(device, allocator, pyramid_extent, VK_FORMAT_R32_SFLOAT, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, true);
+    vk_debug::name_resource<VkImage>(device, VK_OBJECT_TYPE_IMAGE, pyramid_image.image, "Depth Pyramid Image");
+
+    level_count = static_cast<uint32_t>(std::floor(std::log2(std::max(pyramid_extent.width, pyramid_extent.height)))) + 1;
+    ASSERT(level_count <= MAX_LEVELS, "Depth pyramid has more levels than depth_pyramid.comp can write");
+
+    for(uint32_t level = 0; level < level_count; level++) {
+        VkImageViewCreateInfo level_view_create_info = vk_init::get_image_view_create_info(VK_FORMAT_R32_SFLOAT, pyramid_image.image, VK_IMAGE_ASPECT_COLOR_BIT);
+        level_view_create_info.subresourceRange.baseMipLevel = level;
+        level_view_create_info.subresourceRange.levelCount = 1;
+        VK_CHECK(vkCreateImageView(device, &level_view_create_info, nullptr, &level_views[level]));
+    }
+
+    immediate_submit_command_buffer.submit([&](VkCommandBuffer cmd) {
+        vk_image::transition_image_layout(cmd, pyramid_image.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+    });
+
+    // only ever texelFetch'd, the filter doesn't matter
+    VkSamplerCreateInfo sampler_create_info = {
+            .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+            .magFilter = VK_FILTER_NEAREST,
+            .minFilter = VK_FILTER_NEAREST
+    };
+    VK_CHECK(vkCreateSampler(device, &sampler_create_info, nullptr, &sampler));
+
+    workgroup_counter_buffer.init(allocator, sizeof(uint32_t),
+                                  VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                  VMA_MEMORY_USAGE_GPU_ONLY);
+    workgroup_counter_address = vk_util::get_buffer_device_address(device, workgroup_counter_buffer.buffer);
+
+    // Descriptor sets
+    {
+        DescriptorLayoutBuilder builder;
+        builder.add_binding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER); // depth image
+        builder.add_binding(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, MAX_LEVELS); // pyramid levels
+        build_descriptor_set_layout = builder.build(device, VK_SHADER_STAGE_COMPUTE_BIT);
+    }
+
+    std::vector<DescriptorAllocatorGrowable::PoolSizeRatio> sizes = {
+            {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1},
+            {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, MAX_LEVELS / 2},
+    };
+    descriptor_allocator.init_allocator(device, 2, sizes);
+
+    build_descriptor_set = descriptor_allocator.allocate(device, build_descriptor_set_layout, nullptr);
+    cull_descriptor_set = descriptor_allocator.allocate(device, cull_descriptor_set_layout, nullptr);
+
+    DescriptorWriter writer;
+    writer.write_image(0, _depth_image.view, sampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+    // the shader never touches levels past level_count, but every element has to hold something
+    for(uint32_t level = 0; level < MAX_LEVELS; level++) {
+        writer.write_image(1, level_views[std::min(level, level_count - 1)], VK_NULL_HANDLE, VK_IMAGE_LAYOUT_GENERAL,
+                           VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, level);
+    }
+    writer.update_set(device, build_descriptor_set);
+
+    writer.clear();
+    writer.write_image(0, pyramid_image.view, sampler, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+    writer.update_set(device, cull_descriptor_set);
+
+    // Pipeline
+    std::vector<VkDescriptorSetLayout> build_descriptor_set_layouts = {
+            build_descriptor_set_layout
+    };
+
+    VkPushConstantRange compute_push_constant_range = {
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+            .offset = 0,
+            .size = sizeof(GPUDepthPyramidPushConstants),
+    };
+
+    std::vector<VkPushConstantRange> build_push_constant_ranges = {
+            compute_push_constant_range
+    };
+
+    build_pipeline.init(
+            device,
+            "../shaders/depth_pyramid.comp.spv",
+            build_descriptor_set_layouts,
+            build_push_constant_ranges,
+            deletion_queue
+    );
+
+    deletion_queue.push_function([=, this]() {
+        descriptor_allocator.destroy_descriptor_pools(device);
+        vkDestroyDescriptorSetLayout(device, build_descriptor_set_layout, nullptr);
+        vkDestroySampler(device, sampler, nullptr);
+        workgroup_counter_buffer.destroy_buffer();
+
+        for(uint32_t level = 0; level < level_count; level++) {
+            vkDestroyImageView(device, level_views[level], nullptr);
+        }
+        pyramid_image.destroy(device);
+    });
+}
+
+void DepthPyramid::build(VkCommandBuffer cmd) {
+    vk_image::transition_image_layout_specify_aspect(cmd, depth_image, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL,
+                                                     VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_ASPECT_DEPTH_BIT);
+
+    // the last workgroup is found by counting up from zero. Waiting on compute also keeps us from overwriting the
+    // pyramid while an earlier cull is still reading it
+    vkCmdFillBuffer(cmd, workgroup_counter_buffer.buffer, 0, VK_WHOLE_SIZE, 0);
+    vk_util::memory_barrier(cmd,
+                            VK_PIPELINE_STAGE_2_TRANSFER_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                            VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+
+    uint32_t workgroups_x = (pyramid_image.extent.width + TILE_SIZE - 1) / TILE_SIZE;
+    uint32_t workgroups_y = (pyramid_image.extent.height + TILE_SIZE - 1) / TILE_SIZE;
+
+    GPUDepthPyramidPushConstants push_constants = {
+            .workgroup_counter_address = workgroup_counter_address,
+            .level_count = level_count,
+            .workgroup_count = workgroups_x * workgroups_y
+    };
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, build_pipeline.pipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, build_pipeline.layout, 0, 1, &build_descriptor_set, 0, nullptr);
+    vkCmdPushConstants(cmd, build_pipeline.layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(GPUDepthPyramidPushConstants), &push_constants);
+    vkCmdDispatch(cmd, workgroups_x, workgroups_y, 1);
+
+    // read by the cull dispatch that follows
+    vk_util::memory_barrier(cmd,
+                            VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+                            VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT);
+
+    vk_image::transition_image_layout_specify_aspect(cmd, depth_image, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                                                     VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL, VK_IMAGE_ASPECT_DEPTH_BIT);
+}
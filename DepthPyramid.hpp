@@ -0,0 +1,69 @@
+//
+// Created by darby on 3/3/2025.
+//
+
+#pragma once
+
+#include "Common.hpp"
+#include "AllocatedImage.hpp"
+#include "Buffer.hpp"
+#include "ComputePipeline.hpp"
+#include "DeletionQueue.hpp"
+#include "DescriptorAllocatorGrowable.hpp"
+#include "ImmediateSubmitCommandBuffer.hpp"
+
+/*
+ * Hierarchical-Z mip chain of a depth buffer, each texel holding the farthest depth under it. Used by GPUDrawCuller
+ * to find draws hidden behind what has already been drawn.
+ *
+ * Level 0 is the depth buffer's size rounded down to powers of two, so from there on a texel always covers exactly
+ * 2x2 of the level below. The whole chain is built by one dispatch of depth_pyramid.comp: every workgroup reduces a
+ * 32x32 tile of level 0 down to a single texel of level 5 in shared memory, and the last workgroup to finish (found
+ * with an atomic counter) carries on through the remaining levels.
+ *
+ * The pyramid is kept in VK_IMAGE_LAYOUT_GENERAL for its whole life, it's written as storage and read as sampled.
+ */
+class DepthPyramid {
+
+public:
+    static constexpr uint32_t MAX_LEVELS = 16; // size of the level array in depth_pyramid.comp
+    static constexpr uint32_t TILE_SIZE = 32; // level 0 texels reduced by a single workgroup
+
+    /*
+     * depth_image must be created with VK_IMAGE_USAGE_SAMPLED_BIT. cull_descriptor_set_layout is the layout the
+     * pyramid is read through, see GPUDrawCuller::get_depth_pyramid_descriptor_set_layout.
+     */
+    void init(VkDevice device,
+              VmaAllocator allocator,
+              AllocatedImage& depth_image,
+              VkDescriptorSetLayout cull_descriptor_set_layout,
+              ImmediateSubmitCommandBuffer& immediate_submit_command_buffer,
+              DeletionQueue& deletion_queue);
+
+    /*
+     * Rebuilds the pyramid from depth_image, which must be in VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL and is left
+     * there. Recorded outside of rendering.
+     */
+    void build(VkCommandBuffer cmd);
+
+    VkDescriptorSet get_cull_descriptor_set() const { return cull_descriptor_set; }
+
+private:
+    VkDevice device;
+    VkImage depth_image;
+
+    AllocatedImage pyramid_image;
+    uint32_t level_count;
+    VkImageView level_views[MAX_LEVELS];
+
+    VkSampler sampler;
+    Buffer workgroup_counter_buffer;
+    VkDeviceAddress workgroup_counter_address;
+
+    VkDescriptorSetLayout build_descriptor_set_layout;
+    VkDescriptorSet build_descriptor_set;
+    VkDescriptorSet cull_descriptor_set;
+    DescriptorAllocatorGrowable descriptor_allocator;
+
+    ComputePipeline build_pipeline;
+};
@@ -61,8 +61,9 @@ VkDescriptorSet DescriptorAllocatorGrowable::allocate(VkDevice device, VkDescrip
     if(result == VK_ERROR_OUT_OF_POOL_MEMORY || result == VK_ERROR_FRAGMENTED_POOL) {
         full_pools.push_back(pool_to_use);
 
-        VkDescriptorPool next_pool_to_use = get_pool(device);
-        alloc_info.descriptorPool = next_pool_to_use;
+        // the full pool stays in full_pools, it's the new one that goes back to ready_pools below
+        pool_to_use = get_pool(device);
+        alloc_info.descriptorPool = pool_to_use;
         VkResult result2 = vkAllocateDescriptorSets(device, &alloc_info, &ds);
         fmt::print(stderr, "allocating descriptor sets. result: {}\n", static_cast<long long>(result2));
         VK_CHECK(result2);
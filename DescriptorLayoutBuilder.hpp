@@ -14,11 +14,12 @@ struct DescriptorLayoutBuilder {
     // the bindings in shaders
     std::vector<VkDescriptorSetLayoutBinding> bindings;
 
-    void add_binding(uint32_t binding, VkDescriptorType type) {
+    // descriptor_count > 1 makes the binding an array
+    void add_binding(uint32_t binding, VkDescriptorType type, uint32_t descriptor_count = 1) {
         VkDescriptorSetLayoutBinding new_binding = {
                 .binding = binding,
                 .descriptorType = type,
-                .descriptorCount = 1,
+                .descriptorCount = descriptor_count,
         };
 
         bindings.push_back(new_binding);
@@ -0,0 +1,121 @@
+//
+// Created by darby on 3/6/2025.
+//
+
+#include "DescriptorSetCache.hpp"
+
+void DescriptorSetCache::init(VkDevice _device, uint32_t _capacity, std::span<DescriptorAllocatorGrowable::PoolSizeRatio> pool_ratios) {
+    device = _device;
+    capacity = _capacity;
+    descriptor_allocator.init_allocator(device, capacity, pool_ratios);
+}
+
+void DescriptorSetCache::destroy() {
+    entries.clear();
+    lookup.clear();
+    free_sets.clear();
+    descriptor_allocator.destroy_descriptor_pools(device);
+}
+
+void DescriptorSetCache::begin_frame(const TimelineDeletionQueue& timeline) {
+    pending_value = timeline.get_pending_value();
+    uint64_t completed_value = timeline.get_completed_value();
+
+    frame_hit_count = 0;
+    frame_miss_count = 0;
+    frame_eviction_count = 0;
+
+    // the back of the list is the least recently used, stop at the first one the GPU may still be reading
+    while(!entries.empty()) {
+        Entry& entry = entries.back();
+        bool over_capacity = entries.size() > capacity;
+        bool stale = entry.last_used_value + MAX_UNUSED_SUBMISSIONS < pending_value;
+        if((!over_capacity && !stale) || entry.last_used_value > completed_value) {
+            break;
+        }
+
+        auto [first, last] = lookup.equal_range(entry.hash);
+        for(auto it = first; it != last; it++) {
+            if(&*it->second == &entry) {
+                lookup.erase(it);
+                break;
+            }
+        }
+
+        free_sets[entry.layout].push_back(entry.set);
+        entries.pop_back();
+        frame_eviction_count++;
+    }
+}
+
+VkDescriptorSet DescriptorSetCache::get(VkDescriptorSetLayout layout, DescriptorWriter& writer) {
+    build_key(layout, writer);
+
+    // FNV-1a over the key's words
+    uint64_t hash = 14695981039346656037ull;
+    for(uint64_t word : scratch_key) {
+        hash = (hash ^ word) * 1099511628211ull;
+    }
+
+    auto [first, last] = lookup.equal_range(hash);
+    for(auto it = first; it != last; it++) {
+        std::list<Entry>::iterator entry = it->second;
+        if(entry->key == scratch_key) {
+            entry->last_used_value = pending_value;
+            entries.splice(entries.begin(), entries, entry);
+            frame_hit_count++;
+            return entry->set;
+        }
+    }
+
+    // reuse an evicted set of the same layout before allocating, either way it's written from scratch
+    VkDescriptorSet set;
+    std::vector<VkDescriptorSet>& recycled = free_sets[layout];
+    if(!recycled.empty()) {
+        set = recycled.back();
+        recycled.pop_back();
+    } else {
+        set = descriptor_allocator.allocate(device, layout, nullptr);
+    }
+    writer.update_set(device, set);
+
+    entries.push_front({
+            .key = scratch_key,
+            .hash = hash,
+            .layout = layout,
+            .set = set,
+            .last_used_value = pending_value
+    });
+    lookup.emplace(hash, entries.begin());
+    frame_miss_count++;
+
+    return set;
+}
+
+void DescriptorSetCache::add_stats(EngineStats& stats) const {
+    stats.descriptor_cache_hit_count = static_cast<int>(frame_hit_count);
+    stats.descriptor_cache_miss_count = static_cast<int>(frame_miss_count);
+    stats.descriptor_cache_eviction_count = static_cast<int>(frame_eviction_count);
+    stats.descriptor_cache_set_count = static_cast<int>(entries.size());
+}
+
+void DescriptorSetCache::build_key(VkDescriptorSetLayout layout, const DescriptorWriter& writer) {
+    scratch_key.clear();
+    scratch_key.push_back((uint64_t) layout);
+
+    for(const VkWriteDescriptorSet& write : writer.writes) {
+        scratch_key.push_back((uint64_t) write.dstBinding << 32 | write.dstArrayElement);
+        scratch_key.push_back((uint64_t) write.descriptorType);
+
+        if(write.pBufferInfo != nullptr) {
+            scratch_key.push_back((uint64_t) write.pBufferInfo->buffer);
+            scratch_key.push_back(write.pBufferInfo->offset);
+            scratch_key.push_back(write.pBufferInfo->range);
+        }
+        if(write.pImageInfo != nullptr) {
+            scratch_key.push_back((uint64_t) write.pImageInfo->imageView);
+            scratch_key.push_back((uint64_t) write.pImageInfo->sampler);
+            scratch_key.push_back((uint64_t) write.pImageInfo->imageLayout);
+        }
+    }
+}
@@ -0,0 +1,69 @@
+//
+// Created by darby on 3/6/2025.
+//
+
+#pragma once
+
+#include "Common.hpp"
+#include "DescriptorAllocatorGrowable.hpp"
+#include "DescriptorWriter.hpp"
+#include "TimelineDeletionQueue.hpp"
+#include "EngineStats.hpp"
+
+#include <list>
+#include <unordered_map>
+
+/*
+ * Hands out descriptor sets by what's written into them, so a set whose contents rarely change is allocated and
+ * written once rather than every frame. A hit touches nothing on the device.
+ *
+ * A set's key is its layout plus, per write, the binding, type and array element and the buffer, offset and range or
+ * the image view, sampler and image layout it points at. Writes have to be made in the same order to match.
+ *
+ * Sets are kept in least recently used order, stamped with the timeline value of the last submission that used them.
+ * Past capacity, or once unused for MAX_UNUSED_SUBMISSIONS, the least recently used are evicted, but only after the
+ * GPU has passed that submission. Evicted sets are kept per layout and rewritten for the next miss on that layout.
+ */
+class DescriptorSetCache {
+
+public:
+    static constexpr uint64_t MAX_UNUSED_SUBMISSIONS = 120;
+
+    void init(VkDevice device, uint32_t capacity, std::span<DescriptorAllocatorGrowable::PoolSizeRatio> pool_ratios);
+    void destroy();
+
+    // call once a frame after timeline has collected, before any get()
+    void begin_frame(const TimelineDeletionQueue& timeline);
+
+    // the set for layout holding writer's writes, which must cover every binding of the layout
+    VkDescriptorSet get(VkDescriptorSetLayout layout, DescriptorWriter& writer);
+
+    // this frame's hits and misses, and how many sets are cached
+    void add_stats(EngineStats& stats) const;
+
+private:
+    struct Entry {
+        std::vector<uint64_t> key;
+        uint64_t hash;
+        VkDescriptorSetLayout layout;
+        VkDescriptorSet set;
+        uint64_t last_used_value;
+    };
+
+    void build_key(VkDescriptorSetLayout layout, const DescriptorWriter& writer);
+
+    VkDevice device;
+    uint32_t capacity;
+    DescriptorAllocatorGrowable descriptor_allocator;
+
+    uint64_t pending_value = 0;
+
+    std::list<Entry> entries; // most recently used first
+    std::unordered_multimap<uint64_t, std::list<Entry>::iterator> lookup;
+    std::unordered_map<VkDescriptorSetLayout, std::vector<VkDescriptorSet>> free_sets;
+    std::vector<uint64_t> scratch_key;
+
+    uint32_t frame_hit_count = 0;
+    uint32_t frame_miss_count = 0;
+    uint32_t frame_eviction_count = 0;
+};
@@ -4,8 +4,12 @@
 
 #include "DescriptorWriter.hpp"
 
+DescriptorWriter::DescriptorWriter(std::pmr::memory_resource* memory)
+        : image_infos(memory), buffer_infos(memory), writes(memory) {
+}
+
 void DescriptorWriter::write_image(uint32_t binding, VkImageView view, VkSampler sampler, VkImageLayout layout,
-                                   VkDescriptorType descriptor_type) {
+                                   VkDescriptorType descriptor_type, uint32_t array_element) {
 
     VkDescriptorImageInfo info = {
             .sampler = sampler,
@@ -19,6 +23,7 @@ void DescriptorWriter::write_image(uint32_t binding, VkImageView view, VkSampler
             .pNext = nullptr,
             .dstSet = VK_NULL_HANDLE, // set immediately before update in update_set()
             .dstBinding = binding,
+            .dstArrayElement = array_element,
             .descriptorCount = 1,
             .descriptorType = descriptor_type,
             .pImageInfo = &ref
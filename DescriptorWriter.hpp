@@ -6,14 +6,19 @@
 
 #include "Common.hpp"
 
+#include <memory_resource>
+
 class DescriptorWriter {
 
 public:
-    std::deque<VkDescriptorImageInfo> image_infos;
-    std::deque<VkDescriptorBufferInfo> buffer_infos;
-    std::vector<VkWriteDescriptorSet> writes;
+    // writers built while recording a frame take that frame's FrameArena
+    explicit DescriptorWriter(std::pmr::memory_resource* memory = std::pmr::get_default_resource());
+
+    std::pmr::deque<VkDescriptorImageInfo> image_infos;
+    std::pmr::deque<VkDescriptorBufferInfo> buffer_infos;
+    std::pmr::vector<VkWriteDescriptorSet> writes;
 
-    void write_image(uint32_t binding, VkImageView view, VkSampler sampler, VkImageLayout layout, VkDescriptorType descriptor_type);
+    void write_image(uint32_t binding, VkImageView view, VkSampler sampler, VkImageLayout layout, VkDescriptorType descriptor_type, uint32_t array_element = 0);
     void write_buffer(uint32_t binding, VkBuffer buffer, size_t size, size_t offset, VkDescriptorType descriptor_type);
 
     void clear();
@@ -33,7 +33,7 @@ void Device::reserve_queues(VkSurfaceKHR surface) {
 
 }
 
-void Device::init(VkPhysicalDevice physical_device_, VkSurfaceKHR surface) {
+void Device::init(VkPhysicalDevice physical_device_, VkSurfaceKHR surface, bool enable_mesh_shaders, bool enable_memory_budget) {
 
     this->physical_device = physical_device_;
 
@@ -46,9 +46,17 @@ void Device::init(VkPhysicalDevice physical_device_, VkSurfaceKHR surface) {
         .pQueuePriorities = &queue_priority
     };
 
+    // the mesh shading pipelines' task and mesh stages, only chained in when enabled
+    VkPhysicalDeviceMeshShaderFeaturesEXT mesh_shader_features = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_FEATURES_EXT
+    };
+    mesh_shader_features.taskShader = VK_TRUE;
+    mesh_shader_features.meshShader = VK_TRUE;
+
     // Vulkan 1.3 Features
     VkPhysicalDeviceVulkan13Features vulkan13Features = {
-            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES,
+            .pNext = enable_mesh_shaders ? &mesh_shader_features : nullptr
     };
     vulkan13Features.dynamicRendering = VK_TRUE;
     vulkan13Features.synchronization2 = VK_TRUE;
@@ -59,23 +67,43 @@ void Device::init(VkPhysicalDevice physical_device_, VkSurfaceKHR surface) {
             .pNext = &vulkan13Features
     };
     vulkan12Features.descriptorIndexing = VK_TRUE;
+    // GLTFHDRMaterial's bindless material set
+    vulkan12Features.runtimeDescriptorArray = VK_TRUE;
+    vulkan12Features.descriptorBindingPartiallyBound = VK_TRUE;
+    vulkan12Features.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+    vulkan12Features.descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
+    vulkan12Features.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+    vulkan12Features.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
     vulkan12Features.bufferDeviceAddress = VK_TRUE;
+    vulkan12Features.drawIndirectCount = VK_TRUE; // GPUDrawCuller leaves the draw counts on the GPU
+    vulkan12Features.timelineSemaphore = VK_TRUE; // TimelineDeletionQueue
 
     VkPhysicalDeviceFeatures2 physical_device_features_2 = {
             .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
             .pNext = &vulkan12Features
     };
+    // IndirectDrawBuilder submits many commands per call and indexes draw data with firstInstance
+    physical_device_features_2.features.multiDrawIndirect = VK_TRUE;
+    physical_device_features_2.features.drawIndirectFirstInstance = VK_TRUE;
+    // depth_pyramid.comp walks its array of pyramid levels in a loop
+    physical_device_features_2.features.shaderStorageImageArrayDynamicIndexing = VK_TRUE;
 
-    const std::vector<const char*> required_extensions = {
+    std::vector<const char*> required_extensions = {
             VK_KHR_SWAPCHAIN_EXTENSION_NAME
     };
+    if(enable_mesh_shaders) {
+        required_extensions.push_back(VK_EXT_MESH_SHADER_EXTENSION_NAME);
+    }
+    if(enable_memory_budget) {
+        required_extensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+    }
 
     VkDeviceCreateInfo device_create_info = {
             .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
             .pNext = &physical_device_features_2,
             .queueCreateInfoCount = 1u,
             .pQueueCreateInfos = &queue_create_info,
-            .enabledExtensionCount = 1u,
+            .enabledExtensionCount = static_cast<uint32_t>(required_extensions.size()),
             .ppEnabledExtensionNames = required_extensions.data()
     };
 
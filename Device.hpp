@@ -17,7 +17,8 @@ public:
     VkQueue graphics_queue;
     VkQueue presentation_queue;
 
-    void init(VkPhysicalDevice physical_device, VkSurfaceKHR surface);
+    // enable_mesh_shaders turns on VK_EXT_mesh_shader's task and mesh stages, see PhysicalDevice::supports_mesh_shaders
+    void init(VkPhysicalDevice physical_device, VkSurfaceKHR surface, bool enable_mesh_shaders, bool enable_memory_budget);
     void cleanup();
 
 
@@ -0,0 +1,121 @@
+//
+// Created by darby on 2/23/2025.
+//
+
+#include "DrawSorter.hpp"
+
+#include <bit>
+
+void DrawSorter::sort(const std::vector<RenderObject>& objects, std::vector<uint32_t>& draw_indices, DrawPass pass, const glm::mat4& view) {
+    uint32_t count = static_cast<uint32_t>(draw_indices.size());
+    if(count < 2) {
+        return;
+    }
+
+    keys.resize(count);
+    values.resize(count);
+
+    // view-space z of a world position is the dot of the view matrix's third row with it, negated since we look down -z
+    glm::vec4 depth_row = glm::vec4(view[0][2], view[1][2], view[2][2], view[3][2]);
+
+    for(uint32_t i = 0; i < count; i++) {
+        const RenderObject& object = objects[draw_indices[i]];
+
+        uint32_t pipeline_id = 0;
+        uint32_t material_id = 0;
+        switch(pass) {
+            case DrawPass::Shadow:
+                // one pipeline and no material set, only the mesh and depth matter
+                break;
+            case DrawPass::DeferredGeometry:
+                pipeline_id = get_id(pipeline_ids, reinterpret_cast<uint64_t>(object.material->deferred_rendering_geometry_pipeline));
+                material_id = get_id(material_ids, (uint64_t) object.material->material_set);
+                break;
+            case DrawPass::Forward:
+            case DrawPass::Transparent:
+                pipeline_id = get_id(pipeline_ids, reinterpret_cast<uint64_t>(object.material->forward_rendering_pipeline));
+                material_id = get_id(material_ids, (uint64_t) object.material->material_set);
+                break;
+        }
+
+        uint32_t mesh_id = get_id(mesh_ids, (uint64_t) object.index_buffer);
+
+        glm::vec4 world_center = object.transform * glm::vec4(object.bounds.origin, 1.f);
+        float view_depth = -glm::dot(depth_row, world_center);
+
+        keys[i] = make_sort_key(pass, pipeline_id, material_id, mesh_id, view_depth);
+        values[i] = draw_indices[i];
+    }
+
+    radix_sort(count);
+
+    for(uint32_t i = 0; i < count; i++) {
+        draw_indices[i] = values[i];
+    }
+}
+
+uint64_t DrawSorter::make_sort_key(DrawPass pass, uint32_t pipeline_id, uint32_t material_id, uint32_t mesh_id, float view_depth) {
+    // positive floats order the same as their bit patterns, so the top bits are a cheap monotonic quantization.
+    // the sign bit is always 0 after the clamp, leaving 31 bits to shift down into DEPTH_BITS.
+    uint32_t depth_bits = std::bit_cast<uint32_t>(glm::max(view_depth, 0.f)) >> (31 - DEPTH_BITS);
+
+    uint64_t key = 0;
+    key |= static_cast<uint64_t>(static_cast<uint32_t>(pass) & 0xF) << (PIPELINE_BITS + MATERIAL_BITS + MESH_BITS + DEPTH_BITS);
+    key |= static_cast<uint64_t>(pipeline_id & ((1u << PIPELINE_BITS) - 1)) << (MATERIAL_BITS + MESH_BITS + DEPTH_BITS);
+    key |= static_cast<uint64_t>(material_id & ((1u << MATERIAL_BITS) - 1)) << (MESH_BITS + DEPTH_BITS);
+    key |= static_cast<uint64_t>(mesh_id & ((1u << MESH_BITS) - 1)) << DEPTH_BITS;
+    key |= static_cast<uint64_t>(depth_bits & ((1u << DEPTH_BITS) - 1));
+    return key;
+}
+
+uint32_t DrawSorter::get_id(std::unordered_map<uint64_t, uint32_t>& ids, uint64_t handle) {
+    auto [it, inserted] = ids.try_emplace(handle, static_cast<uint32_t>(ids.size()));
+    return it->second;
+}
+
+/*
+ * LSD radix sort over the 8 bytes of the key, carrying the draw index along.
+ * A byte that is the same for every key (the pass byte, usually, or high id bytes in small scenes) is skipped.
+ */
+void DrawSorter::radix_sort(uint32_t count) {
+    scratch_keys.resize(count);
+    scratch_values.resize(count);
+
+    uint64_t* source_keys = keys.data();
+    uint32_t* source_values = values.data();
+    uint64_t* destination_keys = scratch_keys.data();
+    uint32_t* destination_values = scratch_values.data();
+
+    for(uint32_t shift = 0; shift < 64; shift += 8) {
+        uint32_t histogram[256] = {};
+        for(uint32_t i = 0; i < count; i++) {
+            histogram[(source_keys[i] >> shift) & 0xFF]++;
+        }
+
+        if(histogram[(source_keys[0] >> shift) & 0xFF] == count) {
+            continue;
+        }
+
+        uint32_t offset = 0;
+        for(uint32_t& bucket : histogram) {
+            uint32_t bucket_count = bucket;
+            bucket = offset;
+            offset += bucket_count;
+        }
+
+        for(uint32_t i = 0; i < count; i++) {
+            uint32_t destination = histogram[(source_keys[i] >> shift) & 0xFF]++;
+            destination_keys[destination] = source_keys[i];
+            destination_values[destination] = source_values[i];
+        }
+
+        std::swap(source_keys, destination_keys);
+        std::swap(source_values, destination_values);
+    }
+
+    // after an odd number of passes the sorted data lives in the scratch buffers
+    if(source_keys != keys.data()) {
+        std::copy(source_keys, source_keys + count, keys.data());
+        std::copy(source_values, source_values + count, values.data());
+    }
+}
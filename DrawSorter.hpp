@@ -0,0 +1,55 @@
+//
+// Created by darby on 2/23/2025.
+//
+
+#pragma once
+
+#include "Common.hpp"
+#include "GraphicsTypes.hpp"
+
+enum class DrawPass : uint8_t {
+    Shadow = 0,
+    DeferredGeometry = 1,
+    Forward = 2,
+    Transparent = 3 // weighted blended, order doesn't affect the result so only state is grouped
+};
+
+/*
+ * Orders draws so that draws sharing state end up next to each other.
+ *
+ * Each draw gets a 64-bit key, most significant first:
+ *   [63..60] pass   [59..50] pipeline   [49..34] material set   [33..18] mesh (index buffer)   [17..0] view depth
+ * The keys are radix sorted, which groups draws by pipeline, then material, then mesh. Within a group they go front to
+ * back, which helps early depth rejection.
+ *
+ * Pipelines, material sets and meshes are given small ids the first time they're seen. The ids stay stable from frame
+ * to frame, so the order does too.
+ */
+class DrawSorter {
+
+public:
+    // reorders draw_indices (indices into objects) by sort key, depth is measured along the view matrix's forward axis
+    void sort(const std::vector<RenderObject>& objects, std::vector<uint32_t>& draw_indices, DrawPass pass, const glm::mat4& view);
+
+    static uint64_t make_sort_key(DrawPass pass, uint32_t pipeline_id, uint32_t material_id, uint32_t mesh_id, float view_depth);
+
+private:
+    static constexpr uint32_t PIPELINE_BITS = 10;
+    static constexpr uint32_t MATERIAL_BITS = 16;
+    static constexpr uint32_t MESH_BITS = 16;
+    static constexpr uint32_t DEPTH_BITS = 18;
+
+    // ids past what fits in the key wrap around, which only costs some extra binds
+    static uint32_t get_id(std::unordered_map<uint64_t, uint32_t>& ids, uint64_t handle);
+
+    void radix_sort(uint32_t count);
+
+    std::unordered_map<uint64_t, uint32_t> pipeline_ids;
+    std::unordered_map<uint64_t, uint32_t> material_ids;
+    std::unordered_map<uint64_t, uint32_t> mesh_ids;
+
+    std::vector<uint64_t> keys;
+    std::vector<uint64_t> scratch_keys;
+    std::vector<uint32_t> values;
+    std::vector<uint32_t> scratch_values;
+};
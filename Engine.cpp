@@ -3,6 +3,7 @@
 //
 #include <chrono>
 #include <thread>
+#include <numeric>
 
 #define VK_USE_PLATFORM_WIN32_KHR
 #define VOLK_IMPLEMENTATION
@@ -26,6 +27,7 @@
 #include "DescriptorLayoutBuilder.hpp"
 #include "PipelineBuilder.hpp"
 #include "DescriptorWriter.hpp"
+#include "HeapAllocationCounter.hpp"
 
 void Engine::init() {
     frame_number = 0;
@@ -39,10 +41,13 @@ void Engine::init() {
     input_module.init(&window);
     camera.init(&input_module);
 
+    job_system.init();
+
     vulkan_context.init_vulkan_instance();
     vulkan_context.init_vulkan_surface(window.get_win32_window());
     physical_device.choose_and_init(vulkan_context.instance, vulkan_context.surface);
-    device.init(physical_device.physical_device, vulkan_context.surface);
+    device.init(physical_device.physical_device, vulkan_context.surface, physical_device.supports_mesh_shaders,
+                physical_device.supports_memory_budget);
     swapchain.init(device.device, vulkan_context.surface, physical_device.surface_capabilities, physical_device.surface_formats, physical_device.present_modes, window);
 
     const VmaVulkanFunctions vulkanFunctions = {
@@ -80,7 +85,9 @@ void Engine::init() {
 
     // Create our Vma Allocator
     VmaAllocatorCreateInfo allocator_info = {
-            .flags = VMA_ALLOCATOR_CREATE_BUFFER_DEVICE_ADDRESS_BIT,
+            // with VK_EXT_memory_budget, vmaGetHeapBudgets reports the driver's numbers instead of an estimate
+            .flags = VMA_ALLOCATOR_CREATE_BUFFER_DEVICE_ADDRESS_BIT |
+                     (physical_device.supports_memory_budget ? VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT : 0u),
             .physicalDevice = physical_device.physical_device,
             .device = device.device,
             .pVulkanFunctions = &vulkanFunctions,
@@ -105,6 +112,8 @@ void Engine::init() {
     init_imgui();
 
     init_renderers();
+
+    last_animation_update = std::chrono::system_clock::now();
 }
 
 /*
@@ -173,7 +182,7 @@ void Engine::init_draw_and_depth_images() {
 
     VkImageUsageFlags shadow_map_image_usage_flags = {};
     shadow_map_image_usage_flags |= VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
-    shadow_map_image_usage_flags |= VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    shadow_map_image_usage_flags |= VK_IMAGE_USAGE_SAMPLED_BIT;
 
     VmaAllocationCreateInfo  shadow_map_alloc_info = {
             .usage = VMA_MEMORY_USAGE_GPU_ONLY,
@@ -216,14 +225,18 @@ void Engine::init_command_structures() {
         VkCommandBufferAllocateInfo command_buffer_allocate_info = vk_init::get_command_buffer_allocate_info(frame.command_pool, 1);
         VK_CHECK(vkAllocateCommandBuffers(device.device, &command_buffer_allocate_info, &frame.main_command_buffer));
 
-        VK_CHECK(vkAllocateCommandBuffers(device.device, &command_buffer_allocate_info, &frame.main_command_buffer_2));
+        frame.command_recorder.init(device.device, device.family_index_graphics.value(), job_system.get_thread_count());
 
         engine_deletion_queue.push_function([=, this]() {
             vkDestroyCommandPool(device.device, frame.command_pool, nullptr);
         });
+
+        engine_deletion_queue.push_function([&frame]() {
+            frame.command_recorder.destroy();
+        });
     }
 
-    immediate_submit_command_buffer.init(device.device, device.graphics_queue, device.family_index_graphics.value());
+    immediate_submit_command_buffer.init(device.device, allocator, device.graphics_queue, device.family_index_graphics.value(), STAGING_RING_SIZE);
 
     engine_deletion_queue.push_function([=, this]() {
         immediate_submit_command_buffer.destroy();
@@ -240,6 +253,7 @@ void Engine::init_descriptors() {
             // dedicated 100% of the pool to storage image descriptor types
             {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1},
             {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1},
+            {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1},
     };
 
     engine_descriptor_allocator.init_allocator(device.device, 10, sizes);
@@ -262,39 +276,67 @@ void Engine::init_descriptors() {
 //        vkDestroyDescriptorSetLayout(device.device, draw_image_descriptor_layout, nullptr);
 //    });
 
+    // the mesh shading pipelines transform vertices in their mesh shaders instead
+    VkShaderStageFlags geometry_stages = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+    if(physical_device.supports_mesh_shaders) {
+        geometry_stages |= VK_SHADER_STAGE_MESH_BIT_EXT;
+    }
+
     {
         DescriptorLayoutBuilder builder;
-        builder.add_binding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
-        gpu_scene_descriptor_set_layout = builder.build(device.device, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT);
+        builder.add_binding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC);
+        gpu_scene_descriptor_set_layout = builder.build(device.device, geometry_stages);
     }
 
     // LIGHT SOURCE DESCRIPTOR SET LAYOUT
     DescriptorLayoutBuilder light_source_layout_builder;
-    light_source_layout_builder.add_binding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
-    light_source_descriptor_set_layout = light_source_layout_builder.build(device.device, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT);
+    light_source_layout_builder.add_binding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC);
+    light_source_descriptor_set_layout = light_source_layout_builder.build(device.device, geometry_stages);
+
+    // the scene and light uniforms live in the ring, their sets are made once and picked per frame by dynamic offset
+    uniform_ring.init(device.device, allocator, physical_device.min_uniform_buffer_offset_alignment, UNIFORM_RING_FRAME_SIZE,
+                      FRAME_OVERLAP, engine_deletion_queue);
+    scene_uniform_set = uniform_ring.create_set(device.device, engine_descriptor_allocator, gpu_scene_descriptor_set_layout, sizeof(GPUSceneData));
+    light_uniform_set = uniform_ring.create_set(device.device, engine_descriptor_allocator, light_source_descriptor_set_layout, sizeof(LightSourceData));
 
     // SHADOW MAP DESCRIPTOR SET LAYOUT
     DescriptorLayoutBuilder shadow_map_layout_builder;
     shadow_map_layout_builder.add_binding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
     shadow_map_descriptor_set_layout = shadow_map_layout_builder.build(device.device, VK_SHADER_STAGE_FRAGMENT_BIT);
 
-    for(int i = 0; i < FRAME_OVERLAP; i++) {
-        // create descriptor pool for the frame
-        std::vector<DescriptorAllocatorGrowable::PoolSizeRatio> frame_sizes = {
-                { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 3 },
-                { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3 },
-                { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 3 },
-                { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 4 },
-        };
+    // sets whose contents rarely change (shadow map, g-buffers) are written once and looked up by their contents
+    std::vector<DescriptorAllocatorGrowable::PoolSizeRatio> descriptor_cache_sizes = {
+            { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 4 },
+            { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 },
+            { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1 },
+    };
+    descriptor_cache.init(device.device, DESCRIPTOR_CACHE_CAPACITY, descriptor_cache_sizes);
+    engine_deletion_queue.push_function([&]() {
+        descriptor_cache.destroy();
+    });
 
-        frames[i].frame_descriptors = DescriptorAllocatorGrowable{};
-        frames[i].frame_descriptors.init_allocator(device.device, 1000, frame_sizes);
+    // every frame's per-thread allocators draw from the same pools
+    std::vector<DescriptorAllocatorGrowable::PoolSizeRatio> frame_sizes = {
+            { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 3 },
+            { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3 },
+            { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 3 },
+            { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 4 },
+    };
+    shared_descriptor_pools.init(device.device, SHARED_DESCRIPTOR_POOL_SETS, frame_sizes);
 
-        engine_deletion_queue.push_function([&]() {
-            frames[i].frame_descriptors.destroy_descriptor_pools(device.device);
-        });
+    for(FrameData& frame : frames) {
+        frame.frame_descriptors.init(device.device, shared_descriptor_pools, DescriptorAllocationMode::Frame, job_system.get_thread_count());
+        frame.frame_arena.init(FRAME_ARENA_SIZE);
     }
 
+    engine_deletion_queue.push_function([&]() {
+        for(FrameData& frame : frames) {
+            frame.frame_descriptors.destroy();
+            frame.frame_arena.destroy();
+        }
+        shared_descriptor_pools.destroy();
+    });
+
 }
 
 
@@ -399,7 +441,7 @@ void Engine::init_pipelines() {
 
 
     // SECOND GRAPHICS PIPELINE -> METALLIC ROUGHNESS PIPELINE
-    hdr_material.build_shared_resources(device.device);
+    hdr_material.build_shared_resources(device.device, allocator, physical_device.supports_mesh_shaders);
 
     // FORWARD RENDERER PIPELINES BUILT WHEN INIT-ING RENDERER
 
@@ -435,29 +477,80 @@ void Engine::init_synch_objects() {
             vkDestroySemaphore(device.device, frame.swapchain_semaphore, nullptr);
         });
     }
+
+    gpu_deletion_queue.init(device.device, allocator);
 }
 
 void Engine::init_renderers() {
 
+    // shared by both renderers, which both keep a D32 depth buffer
+    transparency_pass = std::make_shared<WeightedBlendedOIT>();
+    transparency_pass->init(device.device,
+                            allocator,
+                            draw_image,
+                            VK_FORMAT_D32_SFLOAT,
+                            gpu_scene_descriptor_set_layout,
+                            shadow_map_descriptor_set_layout,
+                            light_source_descriptor_set_layout,
+                            hdr_material);
+    engine_deletion_queue.push_function([&](){
+        transparency_pass->destroy_resources(device.device);
+    });
+
+    // frustum culls the opaque draws of whichever renderer is drawing
+    draw_culler = std::make_shared<GPUDrawCuller>();
+    draw_culler->init(device.device, allocator, engine_deletion_queue);
+
+    // and their meshlets, ahead of the draw cull
+    meshlet_culler = std::make_shared<MeshletCuller>();
+    meshlet_culler->init(device.device, allocator, draw_culler->get_depth_pyramid_descriptor_set_layout(), engine_deletion_queue);
+
+    // the shadow map is sampled by whichever renderer draws, and the draw image outlives both, so only the
+    // renderers' own targets alias. the other two are tracked for the footprint
+    transient_attachments.init(device.device, allocator);
+    forward_renderer.add_render_targets(transient_attachments, FORWARD_RENDERER_LIFETIME, draw_image.extent);
+    deferred_renderer.add_render_targets(transient_attachments, DEFERRED_RENDERER_LIFETIME, draw_image.extent);
+    transient_attachments.track_dedicated_image(draw_image);
+    transient_attachments.track_dedicated_image(shadow_map_image);
+    transient_attachments.allocate();
+    engine_deletion_queue.push_function([&]() {
+        transient_attachments.destroy();
+    });
+
+    stats.render_target_dedicated_mb = static_cast<float>(transient_attachments.get_dedicated_size()) / (1024.f * 1024.f);
+    stats.render_target_allocated_mb = static_cast<float>(transient_attachments.get_allocated_size()) / (1024.f * 1024.f);
+    fmt::print("Render targets: {:.1f} MB with an allocation each, {:.1f} MB aliased{}\n",
+               stats.render_target_dedicated_mb, stats.render_target_allocated_mb,
+               transient_attachments.is_lazily_allocated() ? " (lazily allocated)" : "");
+
     forward_renderer.init(device.device,
                           allocator,
                           draw_image,
                           shadow_pipeline,
+                          transparency_pass,
+                          draw_culler,
+                          meshlet_culler,
                           gpu_scene_descriptor_set_layout,
                           shadow_map_descriptor_set_layout,
                           light_source_descriptor_set_layout,
-                          hdr_material);
+                          hdr_material,
+                          immediate_submit_command_buffer);
 
     deferred_renderer.init(device.device,
                            allocator,
                            draw_image,
                            shadow_pipeline,
+                           transparency_pass,
+                           draw_culler,
+                           meshlet_culler,
                            gpu_scene_descriptor_set_layout,
                            shadow_map_descriptor_set_layout,
                            light_source_descriptor_set_layout,
                            hdr_material,
                            immediate_submit_command_buffer);
 
+    skinning_pass.init(device.device, allocator, FRAME_OVERLAP, physical_device.supports_mesh_shaders, engine_deletion_queue);
+    object_transform_buffer.init(allocator, FRAME_OVERLAP, engine_deletion_queue);
 }
 
 void Engine::init_default_data() {
@@ -568,27 +661,26 @@ void Engine::init_default_data() {
     material_resources.ambient_occlusion_sampler = default_linear_sampler;
 
 
-    Buffer material_constants;
-    material_constants.init(allocator, sizeof(GLTFHDRMaterial::MaterialConstants), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+    material_resources.constants.color_factors = glm::vec4(1, 1, 1, 1);
+    material_resources.constants.metal_rough_factors = glm::vec4(1, 0, 0.5, 0);
+    material_resources.constants.includes_certain_textures = glm::bvec4(true, true, true, false);
+    material_resources.constants.normal_scale = 1.0f;
+    material_resources.constants.ambient_occlusion_strength = 1.0f;
 
-    // Write the material constants buffer
-    GLTFHDRMaterial::MaterialConstants* material_uniform_data = (GLTFHDRMaterial::MaterialConstants*)material_constants.allocation->GetMappedData();
-    material_uniform_data->color_factors = glm::vec4(1, 1, 1, 1);
-    material_uniform_data->metal_rough_factors = glm::vec4(1, 0, 0.5, 0);
-    material_uniform_data->includes_certain_textures = glm::bvec4(true, true, true, false);
-    material_uniform_data->normal_scale = 1.0f;
-    material_uniform_data->ambient_occlusion_strength = 1.0f;
+    default_material = hdr_material.write_material(device.device, MaterialPassType::MainColor, material_resources);
 
-    engine_deletion_queue.push_function([=, this](){
-        material_constants.destroy_buffer();
+    texture_residency.init(device.device, allocator, immediate_submit_command_buffer.get_staging_ring(), hdr_material);
+    engine_deletion_queue.push_function([&]() {
+        texture_residency.destroy();
     });
 
-    material_resources.data_buffer = material_constants.buffer;
-    material_resources.data_buffer_offset = 0;
-
-    default_material = hdr_material.write_material(device.device, MaterialPassType::MainColor, material_resources, engine_descriptor_allocator);
+    memory_defragmenter.init(device.device, allocator, immediate_submit_command_buffer, hdr_material);
+    engine_deletion_queue.push_function([&]() {
+        memory_defragmenter.destroy();
+    });
 
     load_gltf_file("../models/ABeautifulGame/ABeautifulGame.gltf");
+    get_scene_instances("ABeautifulGame.gltf").add_instance(glm::mat4(1.f));
 
 }
 
@@ -609,8 +701,31 @@ void Engine::load_gltf_file(const std::string& file_path) {
 
     std::string file_name = vk_file::extract_file_name_from_path(file_path.c_str());
     loaded_scenes[file_name] = gltf_file;
+
+    texture_residency.add_file(gltf_file);
+    memory_defragmenter.add_file(gltf_file);
 }
 
+SceneInstances& Engine::get_scene_instances(const std::string& file_name) {
+    auto instances_iterator = scene_instances.find(file_name);
+    if(instances_iterator != scene_instances.end()) {
+        return instances_iterator->second;
+    }
+
+    ASSERT(loaded_scenes.contains(file_name), "Instancing a GLTF file that hasn't been loaded");
+
+    // every copy of an animated file plays the first clip on its own
+    SceneInstances& instances = scene_instances[file_name];
+    instances.init(device.device, allocator, loaded_scenes[file_name], animation_system);
+    engine_deletion_queue.push_function([&instances]() {
+        instances.destroy();
+    });
+
+    if(!instances.file->skinned_mesh_nodes.empty()) {
+        skinning_pass.add_instances(instances);
+    }
+    return instances;
+}
 
 void Engine::init_imgui() {
     // Create IMGUI's descriptor pool
@@ -676,18 +791,24 @@ void Engine::init_imgui() {
 
 void Engine::cleanup() {
 
+    // don't free nodes out from under a pose still being evaluated
+    animation_system.wait(job_system);
+
     for(auto & frame : frames) {
         vkDestroyCommandPool(device.device, frame.command_pool, nullptr);
 
         vkDestroyFence(device.device, frame.render_fence, nullptr);
         vkDestroySemaphore(device.device, frame.swapchain_semaphore, nullptr);
         vkDestroySemaphore(device.device, frame.render_semaphore, nullptr);
-
-        frame.deletion_queue.flush();
     }
 
+    vkDeviceWaitIdle(device.device);
+    gpu_deletion_queue.destroy();
+
     engine_deletion_queue.flush();
 
+    job_system.shutdown();
+
     window.terminate();
     device.cleanup();
 }
@@ -769,6 +890,49 @@ void Engine::imgui_new_frame() {
             }
         }
 
+        if(ImGui::CollapsingHeader("Culling Controls")) {
+            ImGui::Checkbox("GPU Frustum Culling", &use_gpu_frustum_culling);
+            ImGui::Checkbox("GPU Hi-Z Occlusion Culling", &use_gpu_occlusion_culling);
+            ImGui::Checkbox("GPU Meshlet Culling", &use_gpu_meshlet_culling);
+            ImGui::Checkbox("CPU Occlusion Culling", &use_cpu_occlusion_culling);
+            if(physical_device.supports_mesh_shaders) {
+                ImGui::Checkbox("Mesh Shading (task shader culls meshlets)", &use_mesh_shading);
+            } else {
+                ImGui::Text("Mesh shading not supported on this device");
+            }
+        }
+
+        if(ImGui::CollapsingHeader("Texture Residency Controls")) {
+            ResidencySettings& residency = texture_residency.settings;
+            ImGui::Checkbox("Drop Mips When Over Budget", &residency.enabled);
+            ImGui::SliderFloat("Drop Above (of budget)", &residency.drop_threshold, 0.1f, 1.0f);
+            ImGui::SliderFloat("Drop Down To (of budget)", &residency.target_threshold, 0.1f, residency.drop_threshold);
+            ImGui::SliderInt("Idle Submissions", reinterpret_cast<int*>(&residency.idle_submissions), FRAME_OVERLAP, 1000);
+            ImGui::SliderInt("Mips Dropped", reinterpret_cast<int*>(&residency.dropped_mip_count), 1, 4);
+
+            // 0 uses the budget the driver reports
+            int budget_override_mb = static_cast<int>(residency.budget_override / (1024 * 1024));
+            if(ImGui::SliderInt("Budget Override (MB)", &budget_override_mb, 0, 8192)) {
+                residency.budget_override = VkDeviceSize(budget_override_mb) * 1024 * 1024;
+            }
+        }
+
+        if(ImGui::CollapsingHeader("Memory Defragmentation Controls")) {
+            DefragmentationSettings& defragmentation = memory_defragmenter.settings;
+            ImGui::Checkbox("Defragment When Fragmented", &defragmentation.enabled);
+            ImGui::SliderFloat("Fragmentation Threshold", &defragmentation.fragmentation_threshold, 0.05f, 1.0f);
+
+            int max_mb_per_pass = static_cast<int>(defragmentation.max_bytes_per_pass / (1024 * 1024));
+            if(ImGui::SliderInt("Max MB Moved Per Pass", &max_mb_per_pass, 1, 256)) {
+                defragmentation.max_bytes_per_pass = VkDeviceSize(max_mb_per_pass) * 1024 * 1024;
+            }
+            ImGui::SliderInt("Max Moves Per Pass", reinterpret_cast<int*>(&defragmentation.max_moves_per_pass), 1, 512);
+
+            if(ImGui::Button("Defragment Now")) {
+                memory_defragmenter.request();
+            }
+        }
+
         if(ImGui::CollapsingHeader("HDR/Tone Mapping Controls")) {
 
             ImGui::Text("Current tone mapping strategy: %s", tone_mapping_strategies[tone_mapping_strategy_index]);
@@ -800,7 +964,54 @@ void Engine::imgui_new_frame() {
         ImGui::Text("Draw Time: %f ms", stats.mesh_draw_time);
         ImGui::Text("Update Scene Function Time: %f ms", stats.scene_update_time);
         ImGui::Text("Triangle Count: %i", stats.triangle_count);
-        ImGui::Text("Draw Count %i", stats.draw_call_count);
+        ImGui::Text("Draw Count %i, Indirect Commands: %i", stats.draw_call_count, stats.indirect_command_count);
+        ImGui::Text("Visible Objects: %i, Culled Objects: %i", stats.visible_object_count, stats.culled_object_count);
+        ImGui::Text("Secondary Command Buffers: %i", stats.secondary_command_buffer_count);
+        ImGui::Text("Animated Hierarchies: %i, Main Thread Animation Wait: %f ms", stats.animated_hierarchy_count, stats.animation_wait_time);
+        ImGui::Text("GPU Skinned Instances: %i (%i vertices)", stats.skinned_instance_count, stats.skinned_vertex_count);
+        ImGui::Text("Scene Instances: %i, Visible: %i", stats.scene_instance_count, stats.visible_scene_instance_count);
+        ImGui::Text("Object Transforms: %i, Written: %i in %i ranges",
+                    stats.transform_object_count, stats.transform_written_count, stats.transform_written_range_count);
+        ImGui::Text("Uniform Ring: %i bytes this frame", stats.uniform_ring_bytes_used);
+        int descriptor_cache_lookup_count = stats.descriptor_cache_hit_count + stats.descriptor_cache_miss_count;
+        ImGui::Text("Descriptor Cache: %i sets, %i/%i hits (%.0f%%), %i evicted",
+                    stats.descriptor_cache_set_count, stats.descriptor_cache_hit_count, descriptor_cache_lookup_count,
+                    descriptor_cache_lookup_count > 0 ? 100.0f * stats.descriptor_cache_hit_count / descriptor_cache_lookup_count : 0.0f,
+                    stats.descriptor_cache_eviction_count);
+        ImGui::Text("Device Memory: %.1f / %.1f MB budget", stats.residency_usage_mb, stats.residency_budget_mb);
+        ImGui::Text("Render Targets: %.1f MB aliased, %.1f MB with an allocation each",
+                    stats.render_target_allocated_mb, stats.render_target_dedicated_mb);
+        ImGui::Text("Staging Ring: %.1f MB staged, %i stalls", stats.staging_mb_staged, stats.staging_stall_count);
+        ImGui::Text("Device Memory Fragmentation: %.1f%%, Defragmentation: %i passes, %.1f MB moved (%i this frame)",
+                    stats.defragmentation_fragmentation * 100.f, stats.defragmentation_pass_count, stats.defragmentation_mb_moved,
+                    stats.defragmentation_moved_count);
+        ImGui::Text("Frame Arena: %.1f KB used, %.1f KB overflowed", stats.frame_arena_kb_used, stats.frame_arena_overflow_kb);
+        if(heap_allocation_counter::is_enabled()) {
+            ImGui::Text("Heap Allocations: %i", stats.frame_heap_allocation_count);
+        }
+        ImGui::Text("Textures: %i managed, %i without top mips (%.1f MB on host). %i dropped, %i restored, %i waits this frame",
+                    stats.residency_texture_count, stats.residency_reduced_texture_count, stats.residency_host_mb,
+                    stats.residency_dropped_count, stats.residency_restored_count, stats.residency_restore_wait_count);
+        ImGui::Text("Deferred Deletions: %i queued, %i collected this frame",
+                    stats.deferred_deletion_queued_count, stats.deferred_deletion_collected_count);
+        ImGui::Text("Binds: %i pipeline, %i descriptor set, %i index buffer. %i redundant skipped",
+                    stats.pipeline_bind_count, stats.descriptor_set_bind_count, stats.index_buffer_bind_count, stats.skipped_bind_count);
+        ImGui::Text("Visible Transparent Objects: %i, OIT Draw Time: %f ms", stats.visible_transparent_object_count, stats.transparent_draw_time);
+        ImGui::Text("Frustum Cull Time: %f ms", stats.frustum_cull_time);
+        ImGui::Text("Occluders: %i (%i triangles), Occluded Objects: %i", stats.occluder_count, stats.occluder_triangle_count, stats.occlusion_culled_count);
+        ImGui::Text("Occlusion Cull Time: %f ms", stats.occlusion_cull_time);
+        ImGui::Text("Hi-Z Occluded Objects: %i, Drawn Late: %i", stats.hi_z_occluded_count, stats.hi_z_late_draw_count);
+        {
+            // as a share of the meshlets tested
+            float meshlet_total = static_cast<float>(std::max(stats.meshlet_count, 1));
+            ImGui::Text("Meshlets: %i, Culled by Frustum: %.1f%%, Backface Cone: %.1f%%, Hi-Z: %.1f%%", stats.meshlet_count,
+                        100.f * stats.meshlet_frustum_culled_count / meshlet_total,
+                        100.f * stats.meshlet_cone_culled_count / meshlet_total,
+                        100.f * stats.meshlet_occluded_count / meshlet_total);
+        }
+        ImGui::Text("Shadow Casters: %i", stats.shadow_caster_count);
+        ImGui::Text("BVH Nodes: %i (%s)", stats.bvh_node_count, stats.bvh_rebuilt ? "rebuilt" : "refit");
+        ImGui::Text("Picked Surface: %i", picked_surface_index);
         glm::vec3 cam_pos = camera.get_position();
         ImGui::Text("Camera position: (%f, %f, %f)", cam_pos.x, cam_pos.y, cam_pos.z);
     }
@@ -810,13 +1021,42 @@ void Engine::imgui_new_frame() {
 }
 
 void Engine::draw() {
+    uint64_t heap_allocations_at_start = heap_allocation_counter::get_count();
 
     update_scene();
 
+    stats.draw_call_count = 0;
+    stats.indirect_command_count = 0;
+    stats.triangle_count = 0;
+    stats.pipeline_bind_count = 0;
+    stats.descriptor_set_bind_count = 0;
+    stats.index_buffer_bind_count = 0;
+    stats.skipped_bind_count = 0;
+
     // flush global descriptor set
     VK_CHECK(vkWaitForFences(device.device, 1, &get_current_frame().render_fence, true, 1000000000));
-    get_current_frame().deletion_queue.flush();
-    get_current_frame().frame_descriptors.clear_descriptor_pools(device.device);
+    stats.deferred_deletion_collected_count = static_cast<int>(gpu_deletion_queue.collect());
+    stats.deferred_deletion_queued_count = static_cast<int>(gpu_deletion_queue.get_queued_count());
+    descriptor_cache.begin_frame(gpu_deletion_queue);
+    get_current_frame().frame_descriptors.reset();
+    get_current_frame().frame_arena.reset();
+    get_current_frame().command_recorder.reset();
+
+    // before anything is recorded from main_draw_context, whose surfaces are patched if their meshes move
+    memory_defragmenter.update(main_draw_context, gpu_deletion_queue, stats);
+
+    // this frame's uniforms, its ring region was last read by the frame the fence above waited on
+    uniform_ring.begin_frame(frame_number % FRAME_OVERLAP);
+    FrameUniforms frame_uniforms = {
+            .scene_set = scene_uniform_set,
+            .scene_offset = uniform_ring.push(scene_data),
+            .light_set = light_uniform_set,
+            .light_offset = uniform_ring.push(light_source_data),
+    };
+    stats.uniform_ring_bytes_used = static_cast<int>(uniform_ring.get_frame_bytes_used());
+
+    // every pass below reads the surfaces' transforms from here
+    object_transform_buffer.update(device.device, frame_number % FRAME_OVERLAP, main_draw_context, gpu_deletion_queue, stats);
 
     uint32_t swapchain_image_index = swapchain.get_current_swapchain_image_index(get_current_frame().swapchain_semaphore, swapchain_resize_requested);
 
@@ -839,9 +1079,12 @@ void Engine::draw() {
     VkCommandBufferBeginInfo begin_info = vk_init::get_command_buffer_begin_info(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
     VK_CHECK(vkBeginCommandBuffer(cmd, &begin_info));
 
-    VkCommandBuffer cmd2 = get_current_frame().main_command_buffer_2;
-    VK_CHECK(vkResetCommandBuffer(cmd2, 0));
-    VK_CHECK(vkBeginCommandBuffer(cmd2, &begin_info));
+    // swap textures in or out of full residency before anything samples them this frame
+    const std::vector<uint32_t>& residency_visible_opaque_surfaces = main_draw_context.cull_opaque_on_gpu
+            ? residency_visible_surfaces
+            : main_draw_context.visible_opaque_surfaces;
+    texture_residency.mark_visible(main_draw_context, residency_visible_opaque_surfaces, gpu_deletion_queue);
+    texture_residency.update(cmd, gpu_deletion_queue, stats);
 
 
 
@@ -867,34 +1110,45 @@ void Engine::draw() {
     // set up shadow map image to hold depth information
 //    vk_image::transition_image_layout(cmd, shadow_map_image.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
 //
-//    draw_shadow_map(cmd);
+//    draw_shadow_map(cmd, frame_uniforms);
 //
 //    // set up shadow map image to be read from
 //    vk_image::transition_image_layout_specify_aspect(cmd, shadow_map_image.image, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_ASPECT_DEPTH_BIT);
 //
 //        forward_renderer.draw(cmd,
-//                              get_current_frame().frame_descriptors,
-//                              get_current_frame().deletion_queue,
+//                              get_current_frame().command_recorder,
+//                              job_system,
+//                              descriptor_cache,
+//                              gpu_deletion_queue,
 //                              shadow_map_image,
 //                              default_linear_sampler,
 //                              scene_data,
 //                              stats,
 //                              main_draw_context,
-//                              &get_current_frame().light_data_descriptor_set);
+//                              frame_uniforms);
+
+    // pose skinned meshes first, every pass below draws from the skinned vertex buffers
+    skinning_pass.record(cmd, frame_number % FRAME_OVERLAP, get_current_frame().frame_descriptors, get_current_frame().frame_arena, gpu_deletion_queue, stats);
 
-    deferred_renderer.draw(cmd2, cmd,
-                           get_current_frame().frame_descriptors,
-                           get_current_frame().deletion_queue,
+    deferred_renderer.draw(cmd,
+                           get_current_frame().command_recorder,
+                           job_system,
+                           descriptor_cache,
+                           gpu_deletion_queue,
                            shadow_map_image,
                            default_linear_sampler,
                            default_linear_sampler,
                            scene_data,
                            stats,
                            main_draw_context,
-                           &get_current_frame().light_data_descriptor_set);
+                           frame_uniforms);
+
+    stats.secondary_command_buffer_count = static_cast<int>(get_current_frame().command_recorder.get_secondary_count());
+    descriptor_cache.add_stats(stats);
+    immediate_submit_command_buffer.get_staging_ring().add_stats(stats);
+    get_current_frame().frame_arena.add_stats(stats);
 
     // make swapchain a valid destination, it is the renderer's responsibility to make the draw image a valid source
-    vk_image::transition_image_layout(cmd, draw_image.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
     vk_image::transition_image_layout(cmd, curr_swapchain_image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
 
     // copy draw image into swapchain
@@ -916,10 +1170,17 @@ void Engine::draw() {
     // we wait for this semaphore before submitting the command buffer
     VkSemaphoreSubmitInfo wait_semaphore_submit_info = vk_init::get_semaphore_submit_info(VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR, get_current_frame().swapchain_semaphore);
     // we wait for this semaphore before declaring the command buffer done
-    VkSemaphoreSubmitInfo signal_semaphore_submit_info = vk_init::get_semaphore_submit_info(VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, get_current_frame().render_semaphore);
+    VkSemaphoreSubmitInfo signal_semaphore_submit_infos[2] = {
+            vk_init::get_semaphore_submit_info(VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, get_current_frame().render_semaphore),
+            // everything the deletion queue was handed while recording can go once the GPU gets here
+            vk_init::get_semaphore_submit_info(VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, gpu_deletion_queue.get_semaphore())
+    };
+    signal_semaphore_submit_infos[1].value = gpu_deletion_queue.get_pending_value();
 
-    VkSubmitInfo2 submit_info = vk_init::get_submit_info(&cmd_submit_info, &wait_semaphore_submit_info, &signal_semaphore_submit_info);
+    VkSubmitInfo2 submit_info = vk_init::get_submit_info(&cmd_submit_info, &wait_semaphore_submit_info, signal_semaphore_submit_infos);
+    submit_info.signalSemaphoreInfoCount = 2;
     VK_CHECK(vkQueueSubmit2(device.graphics_queue, 1, &submit_info, get_current_frame().render_fence));
+    gpu_deletion_queue.submitted();
 
     // present the image to the screen
     VkPresentInfoKHR present_info = {
@@ -943,6 +1204,21 @@ void Engine::draw() {
     } else if(present_result != VK_SUCCESS && present_result != VK_SUBOPTIMAL_KHR) {
         fmt::print("failure when presenting queue. {}\n", static_cast<uint32_t>(present_result));
     }
+
+    // animate the next frame's poses while the main thread polls input and builds the UI
+    auto animation_update_time = std::chrono::system_clock::now();
+    float animation_delta_seconds = std::chrono::duration<float>(animation_update_time - last_animation_update).count();
+    last_animation_update = animation_update_time;
+    animation_system.begin_update(animation_delta_seconds, job_system);
+
+    // heap traffic this frame, job threads included, which should stay at zero once everything has been sized
+    uint64_t heap_allocation_count = heap_allocation_counter::get_count() - heap_allocations_at_start;
+    stats.frame_heap_allocation_count = static_cast<int>(heap_allocation_count);
+    if(heap_allocation_counter::is_enabled() && heap_allocation_count > 0 && !heap_allocation_reported
+       && frame_number > HEAP_ALLOCATION_WARM_UP_FRAMES) {
+        fmt::print("frame {} made {} heap allocations after warm up\n", frame_number, heap_allocation_count);
+        heap_allocation_reported = true;
+    }
 }
 
 void Engine::update_scene() {
@@ -951,8 +1227,21 @@ void Engine::update_scene() {
     camera.update();
 
     main_draw_context.opaque_surfaces.clear();
-
-    loaded_scenes["ABeautifulGame.gltf"]->draw(glm::scale(glm::vec3(1.0f)), main_draw_context);
+    main_draw_context.transparent_surfaces.clear();
+
+    auto animation_wait_start = std::chrono::system_clock::now();
+    animation_system.wait(job_system);
+    auto animation_wait_end = std::chrono::system_clock::now();
+    stats.animated_hierarchy_count = static_cast<int>(animation_system.get_player_count());
+    stats.animation_wait_time = std::chrono::duration_cast<std::chrono::microseconds>(animation_wait_end - animation_wait_start).count() / 1000.f;
+
+    stats.scene_instance_count = 0;
+    stats.visible_scene_instance_count = 0;
+    for(auto& [file_name, instances] : scene_instances) {
+        instances.draw(main_draw_context, job_system);
+        stats.scene_instance_count += static_cast<int>(instances.get_instance_count());
+        stats.visible_scene_instance_count += static_cast<int>(instances.get_visible_instance_count());
+    }
 
     glm::mat4 view = camera.get_view_matrix();
     glm::mat4 projection = glm::perspective(glm::radians(70.f), (float)draw_image.extent.width / (float)draw_image.extent.height, 0.0001f, 10000.0f);
@@ -961,6 +1250,76 @@ void Engine::update_scene() {
     scene_data.view = view;
     scene_data.proj = projection;
     scene_data.view_proj = projection * view;
+    scene_data.camera_position = glm::vec4(camera.get_position(), 1.f);
+
+    // rebuilds the BVH when the set of surfaces changes, otherwise refits the ones that moved
+    scene_bvh.update(main_draw_context.opaque_surfaces, job_system);
+    stats.bvh_node_count = static_cast<int>(scene_bvh.get_node_count());
+    stats.bvh_rebuilt = scene_bvh.was_rebuilt_last_update();
+
+    auto frustum_cull_start = std::chrono::system_clock::now();
+    // the task shader culls the meshlets of what it draws, the compute culls only work on indexed commands. Draws are
+    // frustum culled on the CPU instead
+    main_draw_context.draw_with_mesh_shaders = physical_device.supports_mesh_shaders && use_mesh_shading;
+    bool compute_culling = !main_draw_context.draw_with_mesh_shaders;
+    main_draw_context.cull_opaque_on_gpu = compute_culling && use_gpu_frustum_culling;
+    main_draw_context.occlusion_cull_on_gpu = compute_culling && use_gpu_frustum_culling && use_gpu_occlusion_culling;
+    main_draw_context.cull_meshlets_on_gpu = compute_culling && use_gpu_meshlet_culling;
+    if(!main_draw_context.cull_meshlets_on_gpu) {
+        stats.meshlet_count = 0;
+        stats.meshlet_frustum_culled_count = 0;
+        stats.meshlet_cone_culled_count = 0;
+        stats.meshlet_occluded_count = 0;
+    }
+    if(main_draw_context.cull_opaque_on_gpu) {
+        // every surface is a candidate, the renderer's cull dispatch drops the ones outside the frustum and reports
+        // the visible/culled counts once they're read back
+        main_draw_context.visible_opaque_surfaces.resize(main_draw_context.opaque_surfaces.size());
+        std::iota(main_draw_context.visible_opaque_surfaces.begin(), main_draw_context.visible_opaque_surfaces.end(), 0);
+
+        // that result never comes back to the CPU, so the texture residency manager gets a BVH pass of its own,
+        // otherwise every texture would count as drawn every frame
+        cull_surfaces(Frustum::from_view_proj(scene_data.view_proj), residency_visible_surfaces);
+    } else {
+        cull_surfaces(Frustum::from_view_proj(scene_data.view_proj), main_draw_context.visible_opaque_surfaces);
+
+        stats.visible_object_count = static_cast<int>(main_draw_context.visible_opaque_surfaces.size());
+        stats.culled_object_count = static_cast<int>(main_draw_context.opaque_surfaces.size()) - stats.visible_object_count;
+        stats.hi_z_occluded_count = 0;
+        stats.hi_z_late_draw_count = 0;
+    }
+    auto frustum_cull_end = std::chrono::system_clock::now();
+
+    stats.frustum_cull_time = std::chrono::duration_cast<std::chrono::microseconds>(frustum_cull_end - frustum_cull_start).count() / 1000.f;
+
+    // transparent surfaces are few and stay out of the BVH and the occlusion culler, they can't occlude anything
+    transparent_cull_candidates.resize(main_draw_context.transparent_surfaces.size());
+    std::iota(transparent_cull_candidates.begin(), transparent_cull_candidates.end(), 0);
+    main_draw_context.visible_transparent_surfaces.clear();
+    frustum_culler.cull(main_draw_context.transparent_surfaces, transparent_cull_candidates,
+                        Frustum::from_view_proj(scene_data.view_proj), main_draw_context.visible_transparent_surfaces);
+    stats.visible_transparent_object_count = static_cast<int>(main_draw_context.visible_transparent_surfaces.size());
+
+    // drop whatever is hidden behind the big occluders before any draws get recorded
+    stats.occluder_count = 0;
+    stats.occluder_triangle_count = 0;
+    stats.occlusion_culled_count = 0;
+    stats.occlusion_cull_time = 0.f;
+    if(use_cpu_occlusion_culling) {
+        auto occlusion_cull_start = std::chrono::system_clock::now();
+        occlusion_culler.cull(main_draw_context.opaque_surfaces, scene_data.view_proj, main_draw_context.visible_opaque_surfaces, job_system);
+        auto occlusion_cull_end = std::chrono::system_clock::now();
+
+        stats.occluder_count = static_cast<int>(occlusion_culler.get_occluder_count());
+        stats.occluder_triangle_count = static_cast<int>(occlusion_culler.get_occluder_triangle_count());
+        stats.occlusion_culled_count = static_cast<int>(occlusion_culler.get_culled_count());
+        stats.occlusion_cull_time = std::chrono::duration_cast<std::chrono::microseconds>(occlusion_cull_end - occlusion_cull_start).count() / 1000.f;
+    }
+
+    // right click picks a surface, left click is taken by the camera
+    if(input_module.is_mouse_button_just_pressed(MOUSE_BUTTON_RIGHT) && !ImGui::GetIO().WantCaptureMouse) {
+        pick_surface(input_module.mouse_position);
+    }
 
     scene_data.ambient_color = glm::vec4(0.05f);
 
@@ -1005,6 +1364,11 @@ void Engine::update_scene() {
 
     light_source_data.light_view_matrix = light_view_matrix;
     light_source_data.light_projection_matrix = light_projection;
+    light_source_data.light_direction = glm::vec4(glm::normalize(sunlight_position_for_shadow), 0.f);
+
+    // anything outside the light's frustum can't land in the shadow map
+    cull_surfaces(Frustum::from_view_proj(light_projection * light_view_matrix), main_draw_context.shadow_caster_surfaces);
+    stats.shadow_caster_count = static_cast<int>(main_draw_context.shadow_caster_surfaces.size());
 
     // HDR data
     tone_mapping_data.exposure = hdr_exposure;
@@ -1015,7 +1379,35 @@ void Engine::update_scene() {
     stats.scene_update_time = elapsed.count() / 1000.f;
 }
 
-void Engine::draw_shadow_map(VkCommandBuffer cmd) {
+/*
+ * Walks the BVH with the frustum. Objects in subtrees fully inside are taken as is, objects in leaves straddling
+ * the frustum go through the per-object sphere test.
+ */
+void Engine::cull_surfaces(const Frustum& frustum, std::vector<uint32_t>& out_visible) {
+    out_visible.clear();
+    cull_candidates.clear();
+
+    scene_bvh.query_frustum(frustum, out_visible, cull_candidates);
+    frustum_culler.cull(main_draw_context.opaque_surfaces, cull_candidates, frustum, out_visible);
+}
+
+/*
+ * Casts a ray from the camera through the cursor and selects the closest surface whose bounds it hits.
+ */
+void Engine::pick_surface(CursorPosition cursor_position) {
+    float ndc_x = 2.f * static_cast<float>(cursor_position.x) / static_cast<float>(window.width) - 1.f;
+    float ndc_y = 2.f * static_cast<float>(cursor_position.y) / static_cast<float>(window.height) - 1.f;
+
+    // build the direction in view space straight from the projection scale terms, unprojecting through the
+    // inverse view-proj loses too much precision with our tiny near plane. proj[1][1] is already y-flipped.
+    glm::vec3 view_direction = glm::normalize(glm::vec3(ndc_x / scene_data.proj[0][0], ndc_y / scene_data.proj[1][1], -1.f));
+    glm::vec3 world_direction = glm::mat3(glm::inverse(scene_data.view)) * view_direction;
+
+    std::optional<BVHRayHit> hit = scene_bvh.raycast(camera.get_position(), world_direction);
+    picked_surface_index = hit.has_value() ? static_cast<int>(hit->object_index) : -1;
+}
+
+void Engine::draw_shadow_map(VkCommandBuffer cmd, const FrameUniforms& frame_uniforms) {
 
     VkRenderingAttachmentInfo depth_attachment_info = vk_init::get_depth_attachment_info(shadow_map_image.view);
     VkExtent2D render_extent = {
@@ -1023,63 +1415,49 @@ void Engine::draw_shadow_map(VkCommandBuffer cmd) {
             .height = shadow_map_image.extent.height
     };
     VkRenderingInfo render_info = vk_init::get_rendering_info(render_extent, {}, &depth_attachment_info);
+    render_info.flags = VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT;
 
     vkCmdBeginRendering(cmd, &render_info);
 
-    VkViewport viewport = {
-            .x = 0,
-            .y = 0,
-            .width = static_cast<float>(render_extent.width),
-            .height = static_cast<float>(render_extent.height),
-            .minDepth = 0.f,
-            .maxDepth = 1.f
-    };
-    vkCmdSetViewport(cmd, 0, 1, &viewport);
-
-    VkRect2D scissor = {
-            .offset = {
-                    .x = 0,
-                    .y = 0
-            },
-            .extent = {
-                    .width = render_extent.width,
-                    .height = render_extent.height,
-            }
-    };
-    vkCmdSetScissor(cmd, 0, 1, &scissor);
+    // casters sharing a mesh end up next to each other, so most index buffer binds get skipped
+    shadow_draw_sorter.sort(main_draw_context.opaque_surfaces, main_draw_context.shadow_caster_surfaces, DrawPass::Shadow, light_source_data.light_view_matrix);
 
-    DescriptorAllocatorGrowable& frame_descriptor_allocator = get_current_frame().frame_descriptors;
-    DeletionQueue& frame_deletion_queue = get_current_frame().deletion_queue;
+    const std::vector<uint32_t>& shadow_casters = main_draw_context.shadow_caster_surfaces;
 
-    get_current_frame().light_data_descriptor_set = shadow_pipeline->create_frame_light_data_descriptor_set(
-            device.device,
-            light_source_data,
-            allocator,
-            frame_descriptor_allocator,
-            frame_deletion_queue);
+    get_current_frame().command_recorder.record(cmd, {}, shadow_map_image.format, render_extent,
+                                                static_cast<uint32_t>(shadow_casters.size()), job_system, stats,
+                                                [&](CommandEncoder& encoder, uint32_t start, uint32_t end) {
+        encoder.bind_pipeline(shadow_pipeline->pipeline);
+        encoder.bind_descriptor_set(shadow_pipeline->pipeline_layout, 0, frame_uniforms.light_set, frame_uniforms.light_offset);
 
-    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, shadow_pipeline->pipeline);
-    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, shadow_pipeline->pipeline_layout, 0, 1, &get_current_frame().light_data_descriptor_set, 0, nullptr);
+        // the transforms are pushed once, each draw finds its own through its object index as firstInstance
+        VkDeviceAddress transform_buffer_address = main_draw_context.opaque_transforms.transform_buffer_address;
+        encoder.push_constants(shadow_pipeline->pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT,
+                               offsetof(GPUObjectDrawPushConstants, transform_buffer_address), sizeof(VkDeviceAddress), &transform_buffer_address);
 
-    for(const RenderObject& draw : main_draw_context.opaque_surfaces) {
-      // Tell the GPU which material-specific set of variables in memory we want to currently use
-        vkCmdBindIndexBuffer(cmd, draw.index_buffer, 0, VK_INDEX_TYPE_UINT32);
+        VkDeviceAddress pushed_vertex_buffer_address = 0;
+        for(uint32_t i = start; i < end; i++) {
+            const RenderObject& draw = main_draw_context.opaque_surfaces[shadow_casters[i]];
+            encoder.bind_index_buffer(draw.index_buffer, 0, VK_INDEX_TYPE_UINT32);
 
-        GPUDrawPushConstants push_constants = {
-                .world_matrix = draw.transform,
-                .vertex_buffer_address = draw.vertex_buffer_address
-        };
-        vkCmdPushConstants(cmd, shadow_pipeline->pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(GPUDrawPushConstants), &push_constants);
+            // casters are sorted by mesh, so the vertex buffer mostly stays the same
+            if(draw.vertex_buffer_address != pushed_vertex_buffer_address) {
+                encoder.push_constants(shadow_pipeline->pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT,
+                                       offsetof(GPUObjectDrawPushConstants, vertex_buffer_address), sizeof(VkDeviceAddress), &draw.vertex_buffer_address);
+                pushed_vertex_buffer_address = draw.vertex_buffer_address;
+            }
 
-        vkCmdDrawIndexed(cmd, draw.index_count, 1, draw.first_index, 0, 0);
-    }
+            uint32_t object_index = main_draw_context.opaque_transforms.first_object_index + shadow_casters[i];
+            encoder.draw_indexed(draw.index_count, 1, draw.first_index, 0, object_index);
+        }
+    });
 
     vkCmdEndRendering(cmd);
 }
 
 void Engine::draw_imgui(VkCommandBuffer cmd, VkImageView target_image_view) {
 
-    std::vector<VkRenderingAttachmentInfo> color_attachment_infos = {
+    std::array<VkRenderingAttachmentInfo, 1> color_attachment_infos = {
             vk_init::get_color_attachment_info(target_image_view, nullptr)
     };
     VkRenderingInfo rendering_info = vk_init::get_rendering_info(draw_extent, color_attachment_infos, nullptr);
@@ -4,6 +4,9 @@
 #pragma once
 
 #include "Common.hpp"
+
+#include <chrono>
+
 #include "Window.hpp"
 #include "VulkanContext.hpp"
 #include "Device.hpp"
@@ -30,12 +33,35 @@
 #include "imgui.h"
 #include "Input.hpp"
 #include "ShadowPipeline.hpp"
+#include "FrustumCuller.hpp"
+#include "SceneBVH.hpp"
+#include "OcclusionCuller.hpp"
+#include "DrawSorter.hpp"
+#include "CommandEncoder.hpp"
+#include "ParallelCommandRecorder.hpp"
+#include "JobSystem.hpp"
+#include "Animation.hpp"
+#include "SkinningPass.hpp"
+#include "SceneInstances.hpp"
+#include "WeightedBlendedOIT.hpp"
+#include "GPUDrawCuller.hpp"
+#include "MeshletCuller.hpp"
+#include "ObjectTransformBuffer.hpp"
+#include "UniformRingBuffer.hpp"
+#include "TimelineDeletionQueue.hpp"
+#include "DescriptorSetCache.hpp"
+#include "ThreadDescriptorAllocator.hpp"
+#include "TextureResidencyManager.hpp"
+#include "TransientAttachmentPool.hpp"
+#include "FrameArena.hpp"
+#include "MemoryDefragmenter.hpp"
 
 
 struct FrameData {
     VkCommandPool command_pool;
     VkCommandBuffer main_command_buffer;
-    VkCommandBuffer main_command_buffer_2;
+    // per-thread pools for the secondaries the draw passes are recorded into
+    ParallelCommandRecorder command_recorder;
 
     // swapchain semaphore is used tell the command buffer executor we have a swapchain image ready to render into
     // render semaphore is used to tell the presentation engine the image is rendered
@@ -43,10 +69,10 @@ struct FrameData {
     // the render fence is used to inform the CPU the command buffer has finished processing
     VkFence render_fence;
 
-    DeletionQueue deletion_queue;
-    DescriptorAllocatorGrowable frame_descriptors;
-
-    VkDescriptorSet light_data_descriptor_set;
+    // any job thread may allocate from this, its pools go back to shared_descriptor_pools when the fence is waited on
+    ThreadDescriptorAllocator frame_descriptors;
+    // the frame's CPU side scratch, reset with frame_descriptors
+    FrameArena frame_arena;
 };
 
 constexpr uint32_t FRAME_OVERLAP = 2;
@@ -80,10 +106,12 @@ private:
     void init_renderers();
 
     void load_gltf_file(const std::string& file_path);
+    // placed copies of a loaded file, keyed like loaded_scenes. Created empty on first use
+    SceneInstances& get_scene_instances(const std::string& file_name);
 
     void imgui_new_frame();
     void draw_background(VkCommandBuffer cmd);
-    void draw_shadow_map(VkCommandBuffer cmd);
+    void draw_shadow_map(VkCommandBuffer cmd, const FrameUniforms& frame_uniforms);
     void draw_geometry(VkCommandBuffer cmd);
     void draw_imgui(VkCommandBuffer cmd, VkImageView target_image_view);
     void do_tone_mapping(VkCommandBuffer cmd);
@@ -91,6 +119,8 @@ private:
     void resize_swapchain();
 
     void update_scene();
+    void cull_surfaces(const Frustum& frustum, std::vector<uint32_t>& out_visible);
+    void pick_surface(CursorPosition cursor_position);
 
     VulkanContext vulkan_context;
     Window window;
@@ -108,12 +138,23 @@ private:
     ForwardRenderer forward_renderer;
     DeferredRenderer deferred_renderer;
 
+    // only one renderer draws a frame, so their depth and g-buffers share memory
+    static constexpr uint32_t FORWARD_RENDERER_LIFETIME = 0;
+    static constexpr uint32_t DEFERRED_RENDERER_LIFETIME = 1;
+    TransientAttachmentPool transient_attachments;
+
     // Shadows
     std::shared_ptr<ShadowPipeline> shadow_pipeline;
+    std::shared_ptr<WeightedBlendedOIT> transparency_pass;
+    std::shared_ptr<GPUDrawCuller> draw_culler;
+    std::shared_ptr<MeshletCuller> meshlet_culler;
     AllocatedImage shadow_map_image;
     VkDescriptorSetLayout shadow_map_descriptor_set_layout;
 
     DescriptorAllocatorGrowable engine_descriptor_allocator;
+    // backs every FrameData's frame_descriptors
+    static constexpr uint32_t SHARED_DESCRIPTOR_POOL_SETS = 128;
+    SharedDescriptorPools shared_descriptor_pools;
     // VkDescriptorSet draw_image_descriptors;
     // VkDescriptorSetLayout draw_image_descriptor_layout;
 
@@ -136,7 +177,20 @@ private:
     LightSourceData light_source_data;
     VkDescriptorSetLayout light_source_descriptor_set_layout;
 
+    // both of the above are pushed here once a frame
+    static constexpr VkDeviceSize UNIFORM_RING_FRAME_SIZE = 64 * 1024;
+    UniformRingBuffer uniform_ring;
+    VkDescriptorSet scene_uniform_set;
+    VkDescriptorSet light_uniform_set;
+
+    static constexpr uint32_t DESCRIPTOR_CACHE_CAPACITY = 256;
+    DescriptorSetCache descriptor_cache;
+
     GLTFHDRMaterial hdr_material;
+    // drops the top mips of idle loaded textures when over the memory budget
+    TextureResidencyManager texture_residency;
+    // moves loaded meshes and textures around to close the holes between device memory allocations
+    MemoryDefragmenter memory_defragmenter;
 
     // Default Data
     GPUMeshBuffers rectangle;
@@ -152,11 +206,21 @@ private:
     MaterialInstance default_material;
     // End Default Data
 
+    // every upload is staged through its ring, bigger ones in chunks
+    static constexpr VkDeviceSize STAGING_RING_SIZE = 32 * 1024 * 1024;
     ImmediateSubmitCommandBuffer immediate_submit_command_buffer;
 
+    // starting size of each frame's arena, grows if a frame needs more
+    static constexpr size_t FRAME_ARENA_SIZE = 256 * 1024;
+    // frames before one that allocates from the heap is reported, while pools and caches fill
+    static constexpr uint32_t HEAP_ALLOCATION_WARM_UP_FRAMES = 120;
+    bool heap_allocation_reported = false;
+
     GLTFLoader gltf_loader;
 
     DeletionQueue engine_deletion_queue;
+    // GPU objects a frame stops using, destroyed once the GPU has finished that frame
+    TimelineDeletionQueue gpu_deletion_queue;
 
     // Interactive state
     std::vector<ComputeEffect> compute_effects;
@@ -168,6 +232,11 @@ private:
     float shadow_bias_scalar = 0.0001f;
     bool use_perspective_light_projection = false;
     int shadow_softening_kernel_size = 3;
+    bool use_gpu_frustum_culling = true;
+    bool use_gpu_occlusion_culling = true;
+    bool use_gpu_meshlet_culling = true;
+    bool use_cpu_occlusion_culling = true;
+    bool use_mesh_shading = true; // only when PhysicalDevice::supports_mesh_shaders
 
     float hdr_exposure = 1.0f;
     int tone_mapping_strategy_index = 0;
@@ -184,7 +253,24 @@ private:
     EngineStats stats;
 
     DrawContext main_draw_context;
+    FrustumCuller frustum_culler;
+    SceneBVH scene_bvh;
+    OcclusionCuller occlusion_culler;
+    DrawSorter shadow_draw_sorter;
+
+    // poses are evaluated on the workers between the end of one frame and update_scene() of the next
+    AnimationSystem animation_system;
+    std::chrono::system_clock::time_point last_animation_update;
+    SkinningPass skinning_pass;
+    ObjectTransformBuffer object_transform_buffer;
+    std::vector<uint32_t> cull_candidates;
+    std::vector<uint32_t> transparent_cull_candidates;
+    std::vector<uint32_t> residency_visible_surfaces; // in frustum opaque surfaces, only filled when culling on the GPU
+    int picked_surface_index = -1;
+
+    JobSystem job_system;
     std::unordered_map<std::string, std::shared_ptr<GLTFFile>> loaded_scenes;
+    std::unordered_map<std::string, SceneInstances> scene_instances;
 
     bool swapchain_resize_requested = false;
 
@@ -11,7 +11,66 @@ struct EngineStats {
     int longest_frame_number = -1;
     int triangle_count;
     int draw_call_count;
+    int indirect_command_count;
+    int pipeline_bind_count;
+    int descriptor_set_bind_count;
+    int index_buffer_bind_count;
+    int skipped_bind_count;
+    int secondary_command_buffer_count;
+    int animated_hierarchy_count;
+    float animation_wait_time;
+    int skinned_instance_count;
+    int skinned_vertex_count;
+    int transform_object_count;
+    int transform_written_count; // objects whose transform changed since their frame's buffer was last written
+    int transform_written_range_count;
+    int uniform_ring_bytes_used;
+    int descriptor_cache_hit_count;
+    int descriptor_cache_miss_count;
+    int descriptor_cache_eviction_count;
+    int descriptor_cache_set_count;
+    float residency_usage_mb; // device local heaps
+    float residency_budget_mb;
+    float residency_host_mb; // dropped mips kept for restoring
+    int residency_texture_count;
+    int residency_reduced_texture_count;
+    int residency_dropped_count;
+    int residency_restored_count;
+    int residency_restore_wait_count;
+    float render_target_dedicated_mb; // if every render target had its own allocation
+    float render_target_allocated_mb;
+    float staging_mb_staged; // since startup, like the stalls
+    int staging_stall_count;
+    float defragmentation_fragmentation; // device local, as of the last measurement
+    int defragmentation_pass_count; // since startup, like the MB moved
+    float defragmentation_mb_moved;
+    int defragmentation_moved_count;
+    float frame_arena_kb_used;
+    float frame_arena_overflow_kb;
+    int frame_heap_allocation_count; // every thread, only counted with VULKAN_ENGINE_COUNT_HEAP_ALLOCATIONS
+    int deferred_deletion_queued_count; // still waiting on the GPU, after this frame's collect
+    int deferred_deletion_collected_count;
+    int scene_instance_count;
+    int visible_scene_instance_count;
+    int visible_object_count;
+    int culled_object_count;
+    int visible_transparent_object_count;
+    int shadow_caster_count;
+    float frustum_cull_time;
+    int occluder_count;
+    int occluder_triangle_count;
+    int occlusion_culled_count;
+    float occlusion_cull_time;
+    int hi_z_occluded_count;
+    int hi_z_late_draw_count;
+    int meshlet_count;
+    int meshlet_frustum_culled_count;
+    int meshlet_cone_culled_count;
+    int meshlet_occluded_count;
+    int bvh_node_count;
+    bool bvh_rebuilt;
     float scene_update_time;
     float mesh_draw_time;
     float lighting_draw_time;
+    float transparent_draw_time;
 };
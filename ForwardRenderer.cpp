@@ -13,19 +13,41 @@
 // What can I move to an initialization?
 //
 
+/*
+ * The depth image only lives while this renderer draws, so it is placed in the engine's transient attachment pool
+ * instead of its own allocation. allocate() has to run on the pool before init.
+ */
+void ForwardRenderer::add_render_targets(TransientAttachmentPool& transient_attachments, uint32_t lifetime_group, VkExtent3D extent) {
+    depth_image.extent = extent;
+    depth_image.format = VK_FORMAT_D32_SFLOAT;
+
+    VkImageUsageFlags depth_image_usage_flags = {};
+    depth_image_usage_flags |= VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+    depth_image_usage_flags |= VK_IMAGE_USAGE_SAMPLED_BIT; // reduced into the depth pyramid
+
+    transient_attachments.add_image(depth_image, lifetime_group, depth_image_usage_flags, VK_IMAGE_ASPECT_DEPTH_BIT, "Depth");
+}
+
 void ForwardRenderer::init(VkDevice device,
                            VmaAllocator allocator,
                            AllocatedImage& draw_image,
                            std::shared_ptr<ShadowPipeline>& shadow_pipeline,
+                           std::shared_ptr<WeightedBlendedOIT>& transparency_pass,
+                           std::shared_ptr<GPUDrawCuller>& draw_culler,
+                           std::shared_ptr<MeshletCuller>& meshlet_culler,
                            VkDescriptorSetLayout scene_descriptor_set_layout,
                            VkDescriptorSetLayout shadow_map_descriptor_set_layout,
                            VkDescriptorSetLayout light_source_descriptor_set_layout,
-                           GLTFHDRMaterial& pipeline_builder) {
+                           GLTFHDRMaterial& pipeline_builder,
+                           ImmediateSubmitCommandBuffer& immediate_submit_command_buffer) {
 
     this->device = device;
     this->allocator = allocator;
     this->draw_image = draw_image;
     this->shadow_pipeline = shadow_pipeline;
+    this->transparency_pass = transparency_pass;
+    this->draw_culler = draw_culler;
+    this->meshlet_culler = meshlet_culler;
     this->scene_descriptor_set_layout = scene_descriptor_set_layout;
     this->shadow_map_descriptor_set_layout = shadow_map_descriptor_set_layout;
 
@@ -56,25 +78,13 @@ void ForwardRenderer::init(VkDevice device,
         vkDestroyDescriptorSetLayout(device, draw_image_descriptor_layout, nullptr);
     });
 
-    // Create depth image
-    depth_image.extent = draw_image.extent;
-    depth_image.format = VK_FORMAT_D32_SFLOAT;
+    depth_pyramid.init(device, allocator, depth_image, draw_culler->get_depth_pyramid_descriptor_set_layout(),
+                       immediate_submit_command_buffer, renderer_deletion_queue);
 
-    VkImageUsageFlags depth_image_usage_flags = {};
-    depth_image_usage_flags |= VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
-
-    VmaAllocationCreateInfo depth_image_alloc_info = {
-            .usage = VMA_MEMORY_USAGE_GPU_ONLY,
-            .requiredFlags = VkMemoryPropertyFlags (VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)
-    };
-
-    VkImageCreateInfo depth_image_create_info = vk_init::get_image_create_info(depth_image.format, depth_image_usage_flags, depth_image.extent);
-    VK_CHECK(vmaCreateImage(allocator, &depth_image_create_info, &depth_image_alloc_info, &depth_image.image, &depth_image.allocation, nullptr));
-    vk_debug::name_resource<VkImage>(device, VK_OBJECT_TYPE_IMAGE, depth_image.image, "Depth Image");
-
-    VkImageViewCreateInfo depth_image_view_create_info = vk_init::get_image_view_create_info(depth_image.format, depth_image.image, VK_IMAGE_ASPECT_DEPTH_BIT);
-    VK_CHECK(vkCreateImageView(device, &depth_image_view_create_info, nullptr, &depth_image.view));
-    vk_debug::name_resource<VkImageView>(device, VK_OBJECT_TYPE_IMAGE_VIEW, depth_image.view, "Depth Image View");
+    indirect_draws.init(device, allocator);
+    renderer_deletion_queue.push_function([&]() {
+        indirect_draws.destroy();
+    });
 
 
     // Tone Mapping Pipeline
@@ -111,14 +121,16 @@ void ForwardRenderer::init(VkDevice device,
 }
 
 void ForwardRenderer::draw(VkCommandBuffer cmd,
-                           DescriptorAllocatorGrowable& frame_descriptor_allocator,
-                           DeletionQueue& frame_deletion_queue,
+                           ParallelCommandRecorder& command_recorder,
+                           JobSystem& job_system,
+                           DescriptorSetCache& descriptor_cache,
+                           TimelineDeletionQueue& gpu_deletion_queue,
                            AllocatedImage& shadow_map,
                            VkSampler shadow_map_sampler,
                            GPUSceneData& current_scene_data,
                            EngineStats& engine_stats,
                            DrawContext& draw_context,
-                           VkDescriptorSet* light_data_descriptor_set) {
+                           const FrameUniforms& frame_uniforms) {
 
 
     // transition from undefined (image either created or in unknown state), to general (for the clear operation)
@@ -129,8 +141,8 @@ void ForwardRenderer::draw(VkCommandBuffer cmd,
     vk_image::transition_image_layout(cmd, draw_image.image, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
     vk_image::transition_image_layout(cmd, depth_image.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
 
-    draw_geometry_into_draw_image(cmd, frame_descriptor_allocator, frame_deletion_queue, shadow_map, shadow_map_sampler,
-                              current_scene_data, engine_stats, draw_context, light_data_descriptor_set);
+    draw_geometry_into_draw_image(cmd, command_recorder, job_system, descriptor_cache, gpu_deletion_queue, shadow_map, shadow_map_sampler,
+                              current_scene_data, engine_stats, draw_context, frame_uniforms);
 
     // TEST
 //    VkRenderingAttachmentInfo color_attachment = vk_init::get_color_attachment_info(draw_image.view, nullptr);
@@ -184,21 +196,21 @@ void ForwardRenderer::clear_draw_image(VkCommandBuffer cmd) {
 
 
 void ForwardRenderer::draw_geometry_into_draw_image(VkCommandBuffer cmd,
-                                                    DescriptorAllocatorGrowable& frame_descriptor_allocator,
-                                                    DeletionQueue& frame_deletion_queue,
+                                                    ParallelCommandRecorder& command_recorder,
+                                                    JobSystem& job_system,
+                                                    DescriptorSetCache& descriptor_cache,
+                                                    TimelineDeletionQueue& gpu_deletion_queue,
                                                     AllocatedImage& shadow_map,
                                                     VkSampler shadow_map_sampler,
                                                     GPUSceneData& current_scene_data,
                                                     EngineStats& engine_stats,
                                                     DrawContext& draw_context,
-                                                    VkDescriptorSet* light_data_descriptor_set) {
+                                                    const FrameUniforms& frame_uniforms) {
 
-    engine_stats.draw_call_count = 0;
-    engine_stats.triangle_count = 0;
     auto draw_geometry_start = std::chrono::system_clock::now();
 
     VkRenderingAttachmentInfo color_attachment = vk_init::get_color_attachment_info(draw_image.view, nullptr);
-    std::vector<VkRenderingAttachmentInfo> color_attachment_infos = {
+    std::array<VkRenderingAttachmentInfo, 1> color_attachment_infos = {
             color_attachment
     };
     VkRenderingAttachmentInfo depth_attachment_info = vk_init::get_depth_attachment_info(depth_image.view);
@@ -208,89 +220,95 @@ void ForwardRenderer::draw_geometry_into_draw_image(VkCommandBuffer cmd,
             .height = draw_image.extent.height
     };
 
+    // the draws themselves are recorded into secondaries on the job threads
     VkRenderingInfo render_info = vk_init::get_rendering_info(render_extent, color_attachment_infos, &depth_attachment_info);
+    render_info.flags = VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT;
+
+    // group draws by pipeline, material and mesh so they fall into as few indirect batches as possible
+    draw_sorter.sort(draw_context.opaque_surfaces, draw_context.visible_opaque_surfaces, DrawPass::Forward, current_scene_data.view);
+
+    // with mesh shading the task shaders cull the meshlets against this, see IndirectDrawBuilder
+    GPUMeshletCullView mesh_shading_view = MeshletCuller::get_cull_view(current_scene_data.view, current_scene_data.view_proj);
+    indirect_draws.build(draw_context.opaque_surfaces, draw_context.visible_opaque_surfaces,
+                         draw_context.opaque_transforms, DrawPass::Forward, gpu_deletion_queue,
+                         draw_context.draw_with_mesh_shaders ? &mesh_shading_view : nullptr);
+
+    VkDescriptorSet shadow_map_descriptor_set = shadow_pipeline->get_shadow_map_descriptor_set(shadow_map, shadow_map_sampler, descriptor_cache,
+                                                                                                shadow_map_descriptor_set_layout);
+
+    // the cull dispatches have to be recorded outside of rendering. Meshlets go first, the draw cull compacts what's left
+    if(draw_context.cull_meshlets_on_gpu) {
+        if(draw_context.occlusion_cull_on_gpu) {
+            meshlet_culler->cull_early(cmd, indirect_draws, draw_context.opaque_surfaces, draw_context.visible_opaque_surfaces,
+                                       current_scene_data.view, current_scene_data.view_proj, depth_pyramid, gpu_deletion_queue);
+        } else {
+            meshlet_culler->cull(cmd, indirect_draws, draw_context.opaque_surfaces, draw_context.visible_opaque_surfaces,
+                                 current_scene_data.view, current_scene_data.view_proj, depth_pyramid, gpu_deletion_queue);
+        }
+    }
 
-    vkCmdBeginRendering(cmd, &render_info);
-
-    VkViewport viewport = {
-            .x = 0,
-            .y = 0,
-            .width = static_cast<float>(render_extent.width),
-            .height = static_cast<float>(render_extent.height),
-            .minDepth = 0.f,
-            .maxDepth = 1.f
-    };
-    vkCmdSetViewport(cmd, 0, 1, &viewport);
-
-    VkRect2D scissor = {
-            .offset = {
-                    .x = 0,
-                    .y = 0
-            },
-            .extent = {
-                    .width = render_extent.width,
-                    .height = render_extent.height,
-            }
-    };
-    vkCmdSetScissor(cmd, 0, 1, &scissor);
-
-    VkDescriptorSet shadow_map_descriptor_set = shadow_pipeline->create_frame_shadow_map_descriptor_set(device,
-                                                                                                        shadow_map,
-                                                                                                        shadow_map_sampler,
-                                                                                                        frame_descriptor_allocator,
-                                                                                                        shadow_map_descriptor_set_layout);
-
-    // Create the GPU scene data buffer for this frame
-    // This handles the data-race which may occur if we updated a uniform buffer being read-from by inflight shader executions
-    Buffer gpu_scene_data_buffer;
-    gpu_scene_data_buffer.init(allocator, sizeof(GPUSceneData), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-    frame_deletion_queue.push_function([=, this](){
-        gpu_scene_data_buffer.destroy_buffer();
-    });
-
-    // Get the memory handle mapped to the buffer's allocation
-    GPUSceneData* scene_uniform_data = (GPUSceneData*)gpu_scene_data_buffer.info.pMappedData;
-    *scene_uniform_data = current_scene_data;
+    if(draw_context.occlusion_cull_on_gpu) {
+        draw_culler->cull_early(cmd, indirect_draws, draw_context.opaque_surfaces, draw_context.visible_opaque_surfaces,
+                                current_scene_data.view_proj, depth_pyramid, gpu_deletion_queue);
+    } else if(draw_context.cull_opaque_on_gpu) {
+        draw_culler->cull(cmd, indirect_draws, draw_context.opaque_surfaces, draw_context.visible_opaque_surfaces,
+                          current_scene_data.view_proj, depth_pyramid, gpu_deletion_queue);
+    }
 
-    // a descriptor is a handle to an object like an image or buffer
-    // a descriptor set is a bundle of those handles
-    VkDescriptorSet global_descriptor_set = frame_descriptor_allocator.allocate(device, scene_descriptor_set_layout, nullptr);
+    const std::vector<IndirectBatch>& batches = indirect_draws.get_batches();
+    std::array<VkFormat, 1> color_attachment_formats = { draw_image.format };
 
-    // write the buffer's handle into the descriptor set
-    // then update the descriptor set to use the correct buffer handle
-    DescriptorWriter writer;
-    writer.write_buffer(0, gpu_scene_data_buffer.buffer, sizeof(GPUSceneData), 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
-    writer.update_set(device, global_descriptor_set);
+    auto record_batches = [&]() {
+        command_recorder.record(cmd, color_attachment_formats, depth_image.format, render_extent,
+                                static_cast<uint32_t>(batches.size()), job_system, engine_stats,
+                                [&](CommandEncoder& encoder, uint32_t start, uint32_t end) {
+            for(uint32_t i = start; i < end; i++) {
+                VkPipelineLayout layout = batches[i].pipeline->layout;
+                encoder.bind_descriptor_set(layout, 0, frame_uniforms.scene_set, frame_uniforms.scene_offset);
+                encoder.bind_descriptor_set(layout, 1, frame_uniforms.light_set, frame_uniforms.light_offset);
+                encoder.bind_descriptor_set(layout, 2, shadow_map_descriptor_set);
 
-    for(const RenderObject& draw : draw_context.opaque_surfaces) {
-        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, draw.material->forward_rendering_pipeline->pipeline);
-        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, draw.material->forward_rendering_pipeline->layout, 0, 1, &global_descriptor_set, 0, nullptr);
-        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, draw.material->forward_rendering_pipeline->layout, 1, 1, light_data_descriptor_set, 0, nullptr);
-        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, draw.material->forward_rendering_pipeline->layout, 2, 1, &shadow_map_descriptor_set, 0, nullptr);
+                indirect_draws.record_batch(encoder, i);
+            }
+        });
+    };
 
-        // Tell the GPU which material-specific set of variables in memory we want to currently use
-        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, draw.material->forward_rendering_pipeline->layout, 3, 1, &draw.material->material_set, 0, nullptr);
+    vkCmdBeginRendering(cmd, &render_info);
+    record_batches();
+    vkCmdEndRendering(cmd);
 
-        vkCmdBindIndexBuffer(cmd, draw.index_buffer, 0, VK_INDEX_TYPE_UINT32);
+    // second phase, whatever the first one's depth doesn't hide is drawn on top of it
+    if(draw_context.occlusion_cull_on_gpu) {
+        depth_pyramid.build(cmd);
+        if(draw_context.cull_meshlets_on_gpu) {
+            meshlet_culler->cull_late(cmd, indirect_draws, depth_pyramid, gpu_deletion_queue);
+        }
+        draw_culler->cull_late(cmd, indirect_draws, depth_pyramid, gpu_deletion_queue);
 
-        GPUDrawPushConstants push_constants = {
-                .world_matrix = draw.transform,
-                .vertex_buffer_address = draw.vertex_buffer_address
-        };
-        vkCmdPushConstants(cmd, draw.material->forward_rendering_pipeline->layout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(GPUDrawPushConstants), &push_constants);
+        depth_attachment_info.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
 
-        vkCmdDrawIndexed(cmd, draw.index_count, 1, draw.first_index, 0, 0);
+        vkCmdBeginRendering(cmd, &render_info);
+        record_batches();
+        vkCmdEndRendering(cmd);
+    }
 
-        engine_stats.draw_call_count++;
-        engine_stats.triangle_count += draw.index_count / 3;
+    if(draw_context.cull_opaque_on_gpu) {
+        draw_culler->add_stats(engine_stats);
+    }
+    if(draw_context.cull_meshlets_on_gpu) {
+        meshlet_culler->add_stats(engine_stats);
     }
 
-    vkCmdEndRendering(cmd);
+    engine_stats.triangle_count += static_cast<int>(indirect_draws.get_triangle_count());
+    engine_stats.indirect_command_count += static_cast<int>(indirect_draws.get_command_count());
 
     auto draw_geometry_end = std::chrono::system_clock::now();
     auto elapsed = std::chrono::duration_cast<std::chrono::microseconds >(draw_geometry_end - draw_geometry_start);
     engine_stats.mesh_draw_time = elapsed.count() / 1000.f;
 
+    // transparent surfaces go over the lit opaque image, before tone mapping
+    transparency_pass->draw(cmd, command_recorder, job_system, gpu_deletion_queue, draw_image, depth_image, frame_uniforms,
+                            shadow_map_descriptor_set, current_scene_data, engine_stats, draw_context);
 }
 
 void ForwardRenderer::tone_map_draw_image(VkCommandBuffer cmd) {
@@ -301,7 +319,6 @@ void ForwardRenderer::tone_map_draw_image(VkCommandBuffer cmd) {
 }
 
 void ForwardRenderer::destroy() {
-    depth_image.destroy(device);
-
+    // depth_image belongs to the transient attachment pool
     renderer_deletion_queue.flush();
 }
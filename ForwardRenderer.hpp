@@ -10,43 +10,62 @@
 #include "ComputeEffect.hpp"
 #include "EngineStats.hpp"
 #include "GLTFHDRMaterial.hpp"
+#include "DrawSorter.hpp"
+#include "CommandEncoder.hpp"
+#include "ParallelCommandRecorder.hpp"
+#include "JobSystem.hpp"
+#include "WeightedBlendedOIT.hpp"
+#include "IndirectDrawBuilder.hpp"
+#include "GPUDrawCuller.hpp"
+#include "MeshletCuller.hpp"
+#include "TransientAttachmentPool.hpp"
 
 class ForwardRenderer {
 
 public:
+    void add_render_targets(TransientAttachmentPool& transient_attachments, uint32_t lifetime_group, VkExtent3D extent);
+
     void init(VkDevice device,
               VmaAllocator allocator,
               AllocatedImage& draw_image,
               std::shared_ptr<ShadowPipeline>& shadow_pipeline,
+              std::shared_ptr<WeightedBlendedOIT>& transparency_pass,
+              std::shared_ptr<GPUDrawCuller>& draw_culler,
+              std::shared_ptr<MeshletCuller>& meshlet_culler,
               VkDescriptorSetLayout scene_descriptor_set_layout,
               VkDescriptorSetLayout shadow_map_descriptor_set_layout,
               VkDescriptorSetLayout light_source_descriptor_set_layout,
-              GLTFHDRMaterial& pipeline_builder);
+              GLTFHDRMaterial& pipeline_builder,
+              ImmediateSubmitCommandBuffer& immediate_submit_command_buffer);
 
     void destroy();
 
     void draw(VkCommandBuffer cmd,
-              DescriptorAllocatorGrowable& frame_descriptor_allocator,
-              DeletionQueue& frame_deletion_queue,
+              ParallelCommandRecorder& command_recorder,
+              JobSystem& job_system,
+              DescriptorSetCache& descriptor_cache,
+              TimelineDeletionQueue& gpu_deletion_queue,
               AllocatedImage& shadow_map,
               VkSampler shadow_map_sampler,
               GPUSceneData& current_scene_data,
               EngineStats& engine_stats,
               DrawContext& draw_context,
-              VkDescriptorSet* light_data_descriptor_set);
+              const FrameUniforms& frame_uniforms);
 
 private:
 
     void clear_draw_image(VkCommandBuffer cmd);
     void draw_geometry_into_draw_image(VkCommandBuffer cmd,
-                                       DescriptorAllocatorGrowable& frame_descriptor_allocator,
-                                       DeletionQueue& frame_deletion_queue,
+                                       ParallelCommandRecorder& command_recorder,
+                                       JobSystem& job_system,
+                                       DescriptorSetCache& descriptor_cache,
+                                       TimelineDeletionQueue& gpu_deletion_queue,
                                        AllocatedImage& shadow_map,
                                        VkSampler shadow_map_sampler,
                                        GPUSceneData& current_scene_data,
                                        EngineStats& engine_stats,
                                        DrawContext& draw_context,
-                                       VkDescriptorSet* light_data_descriptor_set);
+                                       const FrameUniforms& frame_uniforms);
     void tone_map_draw_image(VkCommandBuffer cmd);
 
     // Pipelines
@@ -58,6 +77,9 @@ private:
     VkDevice device;
     VmaAllocator allocator;
     std::shared_ptr<ShadowPipeline> shadow_pipeline;
+    std::shared_ptr<WeightedBlendedOIT> transparency_pass;
+    std::shared_ptr<GPUDrawCuller> draw_culler;
+    std::shared_ptr<MeshletCuller> meshlet_culler;
     VkDescriptorSetLayout scene_descriptor_set_layout;
     VkDescriptorSetLayout shadow_map_descriptor_set_layout;
 
@@ -65,10 +87,14 @@ private:
     VkDescriptorSetLayout draw_image_descriptor_layout;
     VkDescriptorSet draw_image_descriptor_set;
 
-    AllocatedImage depth_image;
+    AllocatedImage depth_image; // aliased with the other renderer's targets, see TransientAttachmentPool
 
     DescriptorAllocatorGrowable renderer_descriptor_allocator;
 
+    DrawSorter draw_sorter;
+    IndirectDrawBuilder indirect_draws;
+    DepthPyramid depth_pyramid;
+
     ComputePipeline tone_mapping_pipeline;
     ToneMappingComputePushConstants tone_mapping_data {
             .exposure = 1.0f,
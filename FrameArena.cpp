@@ -0,0 +1,58 @@
+//
+// Created by darby on 3/6/2025.
+//
+
+#include "FrameArena.hpp"
+
+void FrameArena::init(size_t _capacity) {
+    capacity = _capacity;
+    block = std::make_unique<std::byte[]>(capacity);
+    offset = 0;
+}
+
+void FrameArena::destroy() {
+    overflow.release();
+    block.reset();
+    capacity = 0;
+    offset = 0;
+}
+
+void FrameArena::reset() {
+    if(overflow_bytes > 0) {
+        // last frame's needs with room to spare, replacing the block is the only heap traffic this does
+        size_t needed = offset + overflow_bytes;
+        init(needed + needed / 2);
+
+        overflow.release();
+        overflow_bytes = 0;
+    }
+
+    offset = 0;
+}
+
+void FrameArena::add_stats(EngineStats& stats) const {
+    stats.frame_arena_kb_used = static_cast<float>(offset + overflow_bytes) / 1024.f;
+    stats.frame_arena_overflow_kb = static_cast<float>(overflow_bytes) / 1024.f;
+}
+
+void* FrameArena::do_allocate(size_t bytes, size_t alignment) {
+    uintptr_t base = reinterpret_cast<uintptr_t>(block.get());
+    uintptr_t aligned = (base + offset + alignment - 1) & ~(uintptr_t(alignment) - 1);
+    size_t aligned_offset = aligned - base;
+
+    if(aligned_offset + bytes <= capacity) {
+        offset = aligned_offset + bytes;
+        return reinterpret_cast<void*>(aligned);
+    }
+
+    overflow_bytes += bytes + alignment;
+    return overflow.allocate(bytes, alignment);
+}
+
+void FrameArena::do_deallocate(void* pointer, size_t bytes, size_t alignment) {
+    // everything is freed together by reset()
+}
+
+bool FrameArena::do_is_equal(const std::pmr::memory_resource& other) const noexcept {
+    return this == &other;
+}
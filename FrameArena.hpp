@@ -0,0 +1,42 @@
+//
+// Created by darby on 3/6/2025.
+//
+
+#pragma once
+
+#include "Common.hpp"
+#include "EngineStats.hpp"
+
+#include <memory_resource>
+
+/*
+ * Bump allocator for the CPU side scratch a frame builds while recording, descriptor writes and the like. Handed to
+ * std::pmr containers as their memory_resource, deallocate is a no-op and everything goes at once in reset().
+ *
+ * One arena per frame in flight, reset once that frame's fence has been waited on. Whatever doesn't fit in the block
+ * comes from the heap for that frame, and the next reset grows the block so steady state frames never touch the heap.
+ * Only used from the main thread.
+ */
+class FrameArena : public std::pmr::memory_resource {
+
+public:
+    void init(size_t capacity);
+    void destroy();
+
+    void reset();
+
+    void add_stats(EngineStats& stats) const;
+
+private:
+    void* do_allocate(size_t bytes, size_t alignment) override;
+    void do_deallocate(void* pointer, size_t bytes, size_t alignment) override;
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+
+    std::unique_ptr<std::byte[]> block;
+    size_t capacity = 0;
+    size_t offset = 0;
+
+    // released wholesale in reset()
+    std::pmr::monotonic_buffer_resource overflow { std::pmr::new_delete_resource() };
+    size_t overflow_bytes = 0;
+};
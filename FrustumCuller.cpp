@@ -0,0 +1,173 @@
+//
+// Created by darby on 2/16/2025.
+//
+
+#include "FrustumCuller.hpp"
+
+#include <bit>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+/*
+ * Gribb/Hartmann plane extraction. glm is column-major, so row i of the matrix is (m[0][i], m[1][i], m[2][i], m[3][i]).
+ * Our projection uses a 0->1 depth range (GLM_FORCE_DEPTH_ZERO_TO_ONE), so the near plane is row 2 on its own.
+ */
+Frustum Frustum::from_view_proj(const glm::mat4& m) {
+    glm::vec4 row_0 = glm::vec4(m[0][0], m[1][0], m[2][0], m[3][0]);
+    glm::vec4 row_1 = glm::vec4(m[0][1], m[1][1], m[2][1], m[3][1]);
+    glm::vec4 row_2 = glm::vec4(m[0][2], m[1][2], m[2][2], m[3][2]);
+    glm::vec4 row_3 = glm::vec4(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+    Frustum frustum;
+    frustum.planes[Left] = row_3 + row_0;
+    frustum.planes[Right] = row_3 - row_0;
+    frustum.planes[Bottom] = row_3 + row_1;
+    frustum.planes[Top] = row_3 - row_1;
+    frustum.planes[Near] = row_2;
+    frustum.planes[Far] = row_3 - row_2;
+
+    // normalize so plane distances are in world units and can be compared against sphere radii
+    for(glm::vec4& plane : frustum.planes) {
+        float length = glm::length(glm::vec3(plane));
+        plane = plane / length;
+    }
+
+    return frustum;
+}
+
+bool Frustum::is_sphere_visible(const glm::vec3& center, float radius) const {
+    for(const glm::vec4& plane : planes) {
+        if(glm::dot(glm::vec3(plane), center) + plane.w < -radius) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+Frustum::Containment Frustum::classify_aabb(const glm::vec3& aabb_min, const glm::vec3& aabb_max) const {
+    glm::vec3 center = (aabb_max + aabb_min) * 0.5f;
+    glm::vec3 extents = (aabb_max - aabb_min) * 0.5f;
+
+    Containment result = Inside;
+    for(const glm::vec4& plane : planes) {
+        glm::vec3 normal = glm::vec3(plane);
+        float distance = glm::dot(normal, center) + plane.w;
+        // projected half-size of the box onto the plane normal
+        float radius = glm::dot(glm::abs(normal), extents);
+
+        if(distance < -radius) {
+            return Outside;
+        }
+        if(distance < radius) {
+            result = Intersecting;
+        }
+    }
+
+    return result;
+}
+
+void FrustumCuller::cull(const std::vector<RenderObject>& objects, std::span<const uint32_t> candidates, const Frustum& frustum, std::vector<uint32_t>& out_visible) {
+    if(candidates.empty()) {
+        return;
+    }
+
+    gather_world_spheres(objects, candidates);
+
+#if defined(__AVX2__)
+    cull_spheres_avx2(frustum, candidates, out_visible);
+#else
+    cull_spheres_scalar(frustum, candidates, out_visible);
+#endif
+}
+
+void FrustumCuller::gather_world_spheres(const std::vector<RenderObject>& objects, std::span<const uint32_t> candidates) {
+    size_t padded_count = (candidates.size() + 7) & ~size_t(7);
+
+    center_x.resize(padded_count);
+    center_y.resize(padded_count);
+    center_z.resize(padded_count);
+    radius.resize(padded_count);
+
+    for(size_t i = 0; i < candidates.size(); i++) {
+        const RenderObject& object = objects[candidates[i]];
+
+        glm::vec4 world_center = object.transform * glm::vec4(object.bounds.origin, 1.f);
+
+        // a non-uniform scale stretches the sphere along its largest axis, so scale the radius by the largest one
+        float max_scale = glm::max(glm::length(glm::vec3(object.transform[0])),
+                                   glm::max(glm::length(glm::vec3(object.transform[1])), glm::length(glm::vec3(object.transform[2]))));
+
+        center_x[i] = world_center.x;
+        center_y[i] = world_center.y;
+        center_z[i] = world_center.z;
+        radius[i] = object.bounds.sphere_radius * max_scale;
+    }
+
+    // padding entries are never reported, but keep them deterministic
+    for(size_t i = candidates.size(); i < padded_count; i++) {
+        center_x[i] = 0.f;
+        center_y[i] = 0.f;
+        center_z[i] = 0.f;
+        radius[i] = 0.f;
+    }
+}
+
+void FrustumCuller::cull_spheres_scalar(const Frustum& frustum, std::span<const uint32_t> candidates, std::vector<uint32_t>& out_visible) {
+    for(size_t i = 0; i < candidates.size(); i++) {
+        glm::vec3 center = glm::vec3(center_x[i], center_y[i], center_z[i]);
+        if(frustum.is_sphere_visible(center, radius[i])) {
+            out_visible.push_back(candidates[i]);
+        }
+    }
+}
+
+#if defined(__AVX2__)
+void FrustumCuller::cull_spheres_avx2(const Frustum& frustum, std::span<const uint32_t> candidates, std::vector<uint32_t>& out_visible) {
+    uint32_t count = static_cast<uint32_t>(candidates.size());
+
+    // broadcast each plane component once, they are shared by every batch
+    __m256 plane_x[Frustum::PLANE_COUNT];
+    __m256 plane_y[Frustum::PLANE_COUNT];
+    __m256 plane_z[Frustum::PLANE_COUNT];
+    __m256 plane_d[Frustum::PLANE_COUNT];
+    for(int p = 0; p < Frustum::PLANE_COUNT; p++) {
+        plane_x[p] = _mm256_set1_ps(frustum.planes[p].x);
+        plane_y[p] = _mm256_set1_ps(frustum.planes[p].y);
+        plane_z[p] = _mm256_set1_ps(frustum.planes[p].z);
+        plane_d[p] = _mm256_set1_ps(frustum.planes[p].w);
+    }
+
+    const __m256 zero = _mm256_setzero_ps();
+
+    for(uint32_t base = 0; base < count; base += 8) {
+        __m256 cx = _mm256_loadu_ps(&center_x[base]);
+        __m256 cy = _mm256_loadu_ps(&center_y[base]);
+        __m256 cz = _mm256_loadu_ps(&center_z[base]);
+        __m256 neg_r = _mm256_sub_ps(zero, _mm256_loadu_ps(&radius[base]));
+
+        // a lane is outside if its signed distance to any plane is less than -radius
+        __m256 outside = zero;
+        for(int p = 0; p < Frustum::PLANE_COUNT; p++) {
+            __m256 dist = _mm256_fmadd_ps(plane_x[p], cx, _mm256_fmadd_ps(plane_y[p], cy, _mm256_fmadd_ps(plane_z[p], cz, plane_d[p])));
+            outside = _mm256_or_ps(outside, _mm256_cmp_ps(dist, neg_r, _CMP_LT_OQ));
+        }
+
+        uint32_t visible_mask = ~static_cast<uint32_t>(_mm256_movemask_ps(outside)) & 0xFF;
+
+        // mask off the padding lanes of the final batch
+        uint32_t lanes_left = count - base;
+        if(lanes_left < 8) {
+            visible_mask &= (1u << lanes_left) - 1;
+        }
+
+        while(visible_mask != 0) {
+            uint32_t lane = static_cast<uint32_t>(std::countr_zero(visible_mask));
+            out_visible.push_back(candidates[base + lane]);
+            visible_mask &= visible_mask - 1;
+        }
+    }
+}
+#endif
@@ -0,0 +1,65 @@
+//
+// Created by darby on 2/16/2025.
+//
+
+#pragma once
+
+#include "Common.hpp"
+#include "GraphicsTypes.hpp"
+
+/*
+ * The six planes of a view frustum, extracted from a view-projection matrix. Each plane is stored as (normal, d) with
+ * the normal pointing into the frustum, so a point p is inside a plane when dot(normal, p) + d >= 0.
+ */
+struct Frustum {
+    enum Plane {
+        Left,
+        Right,
+        Bottom,
+        Top,
+        Near,
+        Far,
+        PLANE_COUNT
+    };
+
+    glm::vec4 planes[PLANE_COUNT];
+
+    enum Containment {
+        Outside,
+        Intersecting,
+        Inside
+    };
+
+    static Frustum from_view_proj(const glm::mat4& view_proj);
+
+    bool is_sphere_visible(const glm::vec3& center, float radius) const;
+    Containment classify_aabb(const glm::vec3& aabb_min, const glm::vec3& aabb_max) const;
+};
+
+/*
+ * Culls RenderObjects against a frustum.
+ *
+ * World-space bounding spheres are gathered into SoA arrays so the plane tests can run on 8 objects at a time with
+ * AVX2. Builds without AVX2 fall back to a scalar loop over the same arrays.
+ * Usually fed the objects from the BVH leaves that straddle the frustum, see SceneBVH::query_frustum.
+ */
+class FrustumCuller {
+
+public:
+    // appends to out_visible the index of every candidate object whose bounding sphere touches the frustum
+    void cull(const std::vector<RenderObject>& objects, std::span<const uint32_t> candidates, const Frustum& frustum, std::vector<uint32_t>& out_visible);
+
+private:
+    void gather_world_spheres(const std::vector<RenderObject>& objects, std::span<const uint32_t> candidates);
+
+    void cull_spheres_scalar(const Frustum& frustum, std::span<const uint32_t> candidates, std::vector<uint32_t>& out_visible);
+#if defined(__AVX2__)
+    void cull_spheres_avx2(const Frustum& frustum, std::span<const uint32_t> candidates, std::vector<uint32_t>& out_visible);
+#endif
+
+    // SoA world-space spheres, padded up to a multiple of 8
+    std::vector<float> center_x;
+    std::vector<float> center_y;
+    std::vector<float> center_z;
+    std::vector<float> radius;
+};
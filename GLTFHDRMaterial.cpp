@@ -8,15 +8,167 @@
 #include "DescriptorLayoutBuilder.hpp"
 #include "VulkanInitUtility.hpp"
 
-void GLTFHDRMaterial::build_shared_resources(VkDevice device) {
+void GLTFHDRMaterial::build_shared_resources(VkDevice device, VmaAllocator allocator, bool _mesh_shading_supported) {
+    mesh_shading_supported = _mesh_shading_supported;
+
     DescriptorLayoutBuilder material_layout_builder;
-    material_layout_builder.add_binding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
-    material_layout_builder.add_binding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
-    material_layout_builder.add_binding(2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
-    material_layout_builder.add_binding(3, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
-    material_layout_builder.add_binding(4, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+    material_layout_builder.add_binding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    material_layout_builder.add_binding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, MAX_BINDLESS_TEXTURES);
+
+    // the array is mostly empty, and filled in as files load while frames using the set are in flight
+    std::array<VkDescriptorBindingFlags, 2> binding_flags = {
+            VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT,
+            VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT,
+    };
+
+    VkDescriptorSetLayoutBindingFlagsCreateInfo binding_flags_info = {
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO,
+            .pNext = nullptr,
+            .bindingCount = (uint32_t) binding_flags.size(),
+            .pBindingFlags = binding_flags.data(),
+    };
+
+    VkShaderStageFlags material_stages = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+    if(mesh_shading_supported) {
+        material_stages |= VK_SHADER_STAGE_MESH_BIT_EXT; // the mesh shaders read the color factors
+    }
+    material_layout = material_layout_builder.build(device, material_stages, &binding_flags_info, VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT);
+
+    std::array<VkDescriptorPoolSize, 2> pool_sizes = {{
+            { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 },
+            { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, MAX_BINDLESS_TEXTURES },
+    }};
+
+    VkDescriptorPoolCreateInfo pool_info = {
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+            .pNext = nullptr,
+            .flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT,
+            .maxSets = 1,
+            .poolSizeCount = (uint32_t) pool_sizes.size(),
+            .pPoolSizes = pool_sizes.data(),
+    };
+    VK_CHECK(vkCreateDescriptorPool(device, &pool_info, nullptr, &bindless_pool));
+
+    VkDescriptorSetAllocateInfo set_info = {
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+            .pNext = nullptr,
+            .descriptorPool = bindless_pool,
+            .descriptorSetCount = 1,
+            .pSetLayouts = &material_layout,
+    };
+    VK_CHECK(vkAllocateDescriptorSets(device, &set_info, &material_set));
+
+    // written straight through the mapping, a material's slot is never written again once draws can read it
+    material_constants_buffer.init(allocator, sizeof(MaterialConstants) * MAX_BINDLESS_MATERIALS, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+    material_constants_buffer.set_name(device, "Material Constants Buffer");
+
+    writer.clear();
+    writer.write_buffer(0, material_constants_buffer.buffer, sizeof(MaterialConstants) * MAX_BINDLESS_MATERIALS, 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    writer.update_set(device, material_set);
+}
+
+uint32_t GLTFHDRMaterial::get_texture_index(VkDevice device, VkImageView view, VkSampler sampler) {
+    auto found = texture_indices.find({ view, sampler });
+    if(found != texture_indices.end()) {
+        return found->second;
+    }
+
+    ASSERT(texture_count < MAX_BINDLESS_TEXTURES, "Out of bindless texture slots");
+
+    uint32_t index = texture_count++;
+    texture_indices[{ view, sampler }] = index;
+
+    writer.clear();
+    writer.write_image(1, view, sampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, index);
+    writer.update_set(device, material_set);
+
+    return index;
+}
+
+void GLTFHDRMaterial::get_texture_slots(VkImageView view, std::vector<uint32_t>& slots) const {
+    for(const auto& [key, index] : texture_indices) {
+        if(key.first == view) {
+            slots.push_back(index);
+        }
+    }
+}
+
+void GLTFHDRMaterial::replace_texture_view(VkDevice device, VkImageView old_view, VkImageView new_view) {
+    writer.clear();
+
+    // keys are ordered by view first, so a view's entries sit next to each other
+    auto it = texture_indices.lower_bound({ old_view, VK_NULL_HANDLE });
+    while(it != texture_indices.end() && it->first.first == old_view) {
+        VkSampler sampler = it->first.second;
+        uint32_t index = it->second;
+        it = texture_indices.erase(it);
+
+        texture_indices[{ new_view, sampler }] = index;
+        writer.write_image(1, new_view, sampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, index);
+    }
+
+    if(!writer.writes.empty()) {
+        writer.update_set(device, material_set);
+    }
+}
+
+MaterialPipeline GLTFHDRMaterial::build_mesh_shading_pipeline(VkDevice device,
+                                                              const char* mesh_shader_path,
+                                                              const char* fragment_shader_path,
+                                                              const std::vector<VkDescriptorSetLayout>& descriptor_set_layouts,
+                                                              const std::vector<VkFormat>& color_attachment_formats,
+                                                              VkFormat depth_format,
+                                                              const std::string& name) {
+
+    VkShaderModule task_shader;
+    if(!vk_file::load_shader_module("../shaders/meshlet_draw.task.spv", device, &task_shader)) {
+        fmt::print("Error loading meshlet draw task shader\n");
+    }
+
+    VkShaderModule mesh_shader;
+    if(!vk_file::load_shader_module(mesh_shader_path, device, &mesh_shader)) {
+        fmt::print("Error loading mesh shader {}\n", mesh_shader_path);
+    }
+
+    VkShaderModule frag_shader;
+    if(!vk_file::load_shader_module(fragment_shader_path, device, &frag_shader)) {
+        fmt::print("Error loading frag shader {}\n", fragment_shader_path);
+    }
+
+    VkPushConstantRange buffer_range = {
+            .stageFlags = VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_MESH_BIT_EXT,
+            .offset = 0,
+            .size = sizeof(GPUMeshTaskPushConstants),
+    };
 
-    material_layout = material_layout_builder.build(device, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT);
+    std::vector<VkPushConstantRange> push_constant_ranges {
+            buffer_range
+    };
+
+    MaterialPipeline material_pipeline;
+    VkPipelineLayoutCreateInfo pipeline_layout_info = vk_init::get_pipeline_layout_create_info(descriptor_set_layouts, push_constant_ranges);
+    VK_CHECK(vkCreatePipelineLayout(device, &pipeline_layout_info, nullptr, &material_pipeline.layout));
+
+    // the same fixed function state as the vertex shaded opaque pipelines
+    PipelineBuilder builder;
+    builder.layout = material_pipeline.layout;
+    builder.set_mesh_shaders(task_shader, mesh_shader, frag_shader);
+    builder.set_rasterizer_polygon_mode(VK_POLYGON_MODE_FILL);
+    builder.set_rasterizer_cull_mode(VK_CULL_MODE_BACK_BIT, VK_FRONT_FACE_COUNTER_CLOCKWISE);
+    builder.set_multisampling_none();
+    builder.enable_depth_test(true, VK_COMPARE_OP_LESS);
+
+    std::vector<PipelineBuilder::BlendOptions> blend_options(color_attachment_formats.size(), PipelineBuilder::BlendOptions::NoBlend);
+    builder.set_multiple_color_attachment_formats_and_blending_styles(color_attachment_formats, blend_options);
+    builder.set_depth_format(depth_format);
+
+    material_pipeline.pipeline = builder.build_pipeline(device, name);
+
+    vkDestroyShaderModule(device, task_shader, nullptr);
+    vkDestroyShaderModule(device, mesh_shader, nullptr);
+    vkDestroyShaderModule(device, frag_shader, nullptr);
+
+    return material_pipeline;
 }
 
 
@@ -44,7 +196,7 @@ void GLTFHDRMaterial::build_forward_renderer_pipelines(VkDevice device,
     VkPushConstantRange buffer_range = {
             .stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
             .offset = 0,
-            .size = sizeof(GPUDrawPushConstants),
+            .size = sizeof(GPUIndirectDrawPushConstants),
     };
 
     std::vector<VkPushConstantRange> mesh_push_constant_ranges {
@@ -63,7 +215,6 @@ void GLTFHDRMaterial::build_forward_renderer_pipelines(VkDevice device,
     VK_CHECK(vkCreatePipelineLayout(device, &pipeline_layout_info, nullptr, &pipeline_layout));
 
     forward_renderer_data.opaque_pipeline.layout = pipeline_layout;
-    forward_renderer_data.transparent_pipeline.layout = pipeline_layout;
 
     PipelineBuilder builder;
     builder.layout = pipeline_layout;
@@ -84,13 +235,87 @@ void GLTFHDRMaterial::build_forward_renderer_pipelines(VkDevice device,
 
     forward_renderer_data.opaque_pipeline.pipeline = builder.build_pipeline(device, "Opaque Pipeline");
 
-    builder.enable_blending_additive_for_single_attachment();
+    vkDestroyShaderModule(device, mesh_vert_shader, nullptr);
+    vkDestroyShaderModule(device, mesh_frag_shader, nullptr);
+
+    if(mesh_shading_supported) {
+        forward_renderer_data.mesh_shading_opaque_pipeline = build_mesh_shading_pipeline(device,
+                                                                                         "../shaders/brdf_mesh.mesh.spv",
+                                                                                         "../shaders/brdf_mesh.frag.spv",
+                                                                                         mesh_descriptor_set_layouts,
+                                                                                         { draw_image.format },
+                                                                                         depth_image.format,
+                                                                                         "Mesh Shading Opaque Pipeline");
+    }
+
+}
+
+void GLTFHDRMaterial::build_transparent_pipeline(VkDevice device,
+                                                 VkDescriptorSetLayout light_data_descriptor_layout,
+                                                 VkDescriptorSetLayout scene_data_descriptor_layout,
+                                                 VkDescriptorSetLayout shadow_map_descriptor_layout,
+                                                 VkFormat accumulation_format,
+                                                 VkFormat revealage_format,
+                                                 VkFormat depth_format) {
+
+    if(material_layout == VK_NULL_HANDLE) {
+        fmt::print("Shared resources not built before attempting to build transparent pipeline");
+        return;
+    }
+
+    VkShaderModule mesh_vert_shader;
+    if(!vk_file::load_shader_module("../shaders/brdf_mesh.vert.spv", device, &mesh_vert_shader)) {
+        fmt::print("Error loading mesh vert shader\n");
+    }
+
+    VkShaderModule accumulate_frag_shader;
+    if(!vk_file::load_shader_module("../shaders/oit_accumulate.frag.spv", device, &accumulate_frag_shader)) {
+        fmt::print("Error loading oit accumulate frag shader\n");
+    }
+
+    VkPushConstantRange buffer_range = {
+            .stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+            .offset = 0,
+            .size = sizeof(GPUIndirectDrawPushConstants),
+    };
+
+    std::vector<VkPushConstantRange> mesh_push_constant_ranges {
+            buffer_range
+    };
+
+    std::vector<VkDescriptorSetLayout> mesh_descriptor_set_layouts {
+            scene_data_descriptor_layout,
+            light_data_descriptor_layout,
+            shadow_map_descriptor_layout,
+            material_layout
+    };
+
+    VkPipelineLayout pipeline_layout;
+    VkPipelineLayoutCreateInfo pipeline_layout_info = vk_init::get_pipeline_layout_create_info(mesh_descriptor_set_layouts, mesh_push_constant_ranges);
+    VK_CHECK(vkCreatePipelineLayout(device, &pipeline_layout_info, nullptr, &pipeline_layout));
+
+    forward_renderer_data.transparent_pipeline.layout = pipeline_layout;
+
+    PipelineBuilder builder;
+    builder.layout = pipeline_layout;
+    builder.set_shaders(mesh_vert_shader, accumulate_frag_shader);
+    builder.set_input_topology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+    builder.set_rasterizer_polygon_mode(VK_POLYGON_MODE_FILL);
+    // both faces of thin transparent geometry should show through
+    builder.set_rasterizer_cull_mode(VK_CULL_MODE_NONE, VK_FRONT_FACE_COUNTER_CLOCKWISE);
+    builder.set_multisampling_none();
+    // tested against the opaque depth but never written, every transparent layer has to reach the blend
+    builder.enable_depth_test(false, VK_COMPARE_OP_LESS);
+
+    builder.set_multiple_color_attachment_formats_and_blending_styles(
+            { accumulation_format, revealage_format },
+            { PipelineBuilder::BlendOptions::AccumulateBlend, PipelineBuilder::BlendOptions::RevealageBlend });
+    builder.set_depth_format(depth_format);
 
     forward_renderer_data.transparent_pipeline.pipeline = builder.build_pipeline(device, "Transparent Pipeline");
 
     vkDestroyShaderModule(device, mesh_vert_shader, nullptr);
-    vkDestroyShaderModule(device, mesh_frag_shader, nullptr);
-
+    vkDestroyShaderModule(device, accumulate_frag_shader, nullptr);
 }
 
 void GLTFHDRMaterial::build_deferred_renderer_pipelines(VkDevice device,
@@ -121,7 +346,7 @@ void GLTFHDRMaterial::build_deferred_renderer_pipelines(VkDevice device,
     VkPushConstantRange geometry_push_constant_range = {
             .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
             .offset = 0,
-            .size = sizeof(GPUDrawPushConstants),
+            .size = sizeof(GPUIndirectDrawPushConstants),
     };
 
     std::vector<VkPushConstantRange> geometry_push_constant_ranges { // also used in lighting stage
@@ -165,6 +390,16 @@ void GLTFHDRMaterial::build_deferred_renderer_pipelines(VkDevice device,
     vkDestroyShaderModule(device, deferred_geometry_vert_shader, nullptr);
     vkDestroyShaderModule(device, deferred_geometry_frag_shader, nullptr);
 
+    if(mesh_shading_supported) {
+        deferred_renderer_data.mesh_shading_geometry_pipeline = build_mesh_shading_pipeline(device,
+                                                                                            "../shaders/geometry_pass.mesh.spv",
+                                                                                            "../shaders/geometry_pass.frag.spv",
+                                                                                            geometry_descriptor_set_layouts,
+                                                                                            color_attachment_formats,
+                                                                                            depth_g_buffer.format,
+                                                                                            "Deferred Mesh Shading Geometry Pipeline");
+    }
+
     // LIGHT PIPELINE
     VkShaderModule light_vert_shader;
     if(!vk_file::load_shader_module("../shaders/lighting_pass.vert.spv", device, &light_vert_shader)) {
@@ -219,8 +454,7 @@ void GLTFHDRMaterial::build_deferred_renderer_pipelines(VkDevice device,
 
 
 MaterialInstance GLTFHDRMaterial::write_material(VkDevice device, MaterialPassType pass_type,
-                                                 const GLTFHDRMaterial::MaterialResources& resources,
-                                                 DescriptorAllocatorGrowable& descriptor_allocator) {
+                                                 const GLTFHDRMaterial::MaterialResources& resources) {
 
     MaterialInstance mat_data;
     mat_data.pass_type = pass_type;
@@ -230,17 +464,27 @@ MaterialInstance GLTFHDRMaterial::write_material(VkDevice device, MaterialPassTy
     } else {
         mat_data.forward_rendering_pipeline = &forward_renderer_data.opaque_pipeline;
         mat_data.deferred_rendering_geometry_pipeline = &deferred_renderer_data.geometry_pipeline;
+        if(mesh_shading_supported) {
+            mat_data.forward_mesh_shading_pipeline = &forward_renderer_data.mesh_shading_opaque_pipeline;
+            mat_data.deferred_mesh_shading_geometry_pipeline = &deferred_renderer_data.mesh_shading_geometry_pipeline;
+        }
     }
 
-    mat_data.material_set = descriptor_allocator.allocate(device, material_layout, nullptr);
+    ASSERT(material_count < MAX_BINDLESS_MATERIALS, "Out of bindless material slots");
 
-    writer.clear();
-    writer.write_buffer(0, resources.data_buffer, sizeof(MaterialConstants), resources.data_buffer_offset, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
-    writer.write_image(1, resources.color_image.view, resources.color_sampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
-    writer.write_image(2, resources.metal_rough_image.view, resources.metal_rough_sampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
-    writer.write_image(3, resources.normal_image.view, resources.normal_sampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
-    writer.write_image(4, resources.ambient_occlusion_image.view, resources.ambient_occlusion_sampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
-    writer.update_set(device, mat_data.material_set);
+    MaterialConstants constants = resources.constants;
+    constants.color_texture_index = get_texture_index(device, resources.color_image.view, resources.color_sampler);
+    constants.metal_rough_texture_index = get_texture_index(device, resources.metal_rough_image.view, resources.metal_rough_sampler);
+    constants.normal_texture_index = get_texture_index(device, resources.normal_image.view, resources.normal_sampler);
+    constants.ambient_occlusion_texture_index = get_texture_index(device, resources.ambient_occlusion_image.view, resources.ambient_occlusion_sampler);
+
+    mat_data.material_set = material_set;
+    mat_data.material_index = material_count++;
+
+    MaterialConstants* mapped_constants = (MaterialConstants*) material_constants_buffer.info.pMappedData;
+    mapped_constants[mat_data.material_index] = constants;
+    material_texture_indices.push_back({ constants.color_texture_index, constants.metal_rough_texture_index,
+                                         constants.normal_texture_index, constants.ambient_occlusion_texture_index });
 
     return mat_data;
 }
@@ -260,8 +504,17 @@ void GLTFHDRMaterial::clear_resources(VkDevice device) {
     vkDestroyPipelineLayout(device, deferred_renderer_data.light_pipeline.layout, nullptr);
     vkDestroyPipeline(device, deferred_renderer_data.light_pipeline.pipeline, nullptr);
 
+    // MESH SHADING, null handles when unsupported
+    vkDestroyPipelineLayout(device, forward_renderer_data.mesh_shading_opaque_pipeline.layout, nullptr);
+    vkDestroyPipeline(device, forward_renderer_data.mesh_shading_opaque_pipeline.pipeline, nullptr);
+
+    vkDestroyPipelineLayout(device, deferred_renderer_data.mesh_shading_geometry_pipeline.layout, nullptr);
+    vkDestroyPipeline(device, deferred_renderer_data.mesh_shading_geometry_pipeline.pipeline, nullptr);
+
     // SHARED
+    vkDestroyDescriptorPool(device, bindless_pool, nullptr);
     vkDestroyDescriptorSetLayout(device, material_layout, nullptr);
+    material_constants_buffer.destroy_buffer();
 }
 
 
@@ -8,20 +8,60 @@
 #include "GraphicsTypes.hpp"
 #include "AllocatedImage.hpp"
 #include "DescriptorWriter.hpp"
-#include "DescriptorAllocatorGrowable.hpp"
+#include "Buffer.hpp"
+
+#include <map>
 
 class GLTFHDRMaterial {
 
 private:
     DescriptorWriter writer;
 
-public:
+    /*
+     * The task/mesh shader variant of an opaque pipeline, drawing into the same attachments with the same descriptor
+     * sets. meshlet_draw.task culls a draw's meshlets and the mesh shader emits the triangles of the ones left.
+     */
+    MaterialPipeline build_mesh_shading_pipeline(VkDevice device,
+                                                 const char* mesh_shader_path,
+                                                 const char* fragment_shader_path,
+                                                 const std::vector<VkDescriptorSetLayout>& descriptor_set_layouts,
+                                                 const std::vector<VkFormat>& color_attachment_formats,
+                                                 VkFormat depth_format,
+                                                 const std::string& name);
+
+    // slot in the bindless texture array per image and sampler pair, so materials sharing a texture share a slot
+    uint32_t get_texture_index(VkDevice device, VkImageView view, VkSampler sampler);
+
+    VkDescriptorPool bindless_pool = VK_NULL_HANDLE;
+    Buffer material_constants_buffer;
+    std::map<std::pair<VkImageView, VkSampler>, uint32_t> texture_indices;
+    std::vector<std::array<uint32_t, 4>> material_texture_indices; // per material slot, color/metal_rough/normal/ao
+    uint32_t texture_count = 0;
+    uint32_t material_count = 0;
 
-    VkDescriptorSetLayout material_layout = VK_NULL_HANDLE; // created when building the pipelines
+public:
+    // sizes of the bindless texture array and material buffer, every loaded file shares them
+    static constexpr uint32_t MAX_BINDLESS_TEXTURES = 4096;
+    static constexpr uint32_t MAX_BINDLESS_MATERIALS = 4096;
+
+    /*
+     * Every material is read through one descriptor set, bound once per pipeline layout rather than per draw:
+     *   - binding 0, a storage buffer holding every material's MaterialConstants
+     *   - binding 1, an array of every material texture, indexed by the constants' texture indices
+     * Draws pick their material by GPUDrawData::material_index. The set is update-after-bind, so materials can be
+     * written while earlier frames that read it are still in flight. Slots are handed out once and never reused, as
+     * materials live until shutdown.
+     */
+    VkDescriptorSetLayout material_layout = VK_NULL_HANDLE; // created by build_shared_resources
+    VkDescriptorSet material_set = VK_NULL_HANDLE;
+
+    // also build task/mesh shader variants of the opaque pipelines, set by build_shared_resources
+    bool mesh_shading_supported = false;
 
     struct ForwardRendererData {
         MaterialPipeline opaque_pipeline;
-        MaterialPipeline transparent_pipeline;
+        MaterialPipeline transparent_pipeline; // weighted blended OIT accumulation, shared by both renderers
+        MaterialPipeline mesh_shading_opaque_pipeline = { VK_NULL_HANDLE, VK_NULL_HANDLE }; // left null without mesh shading
     };
 
     GLTFHDRMaterial::ForwardRendererData forward_renderer_data;
@@ -29,6 +69,7 @@ public:
     struct DeferredRendererData {
         MaterialPipeline geometry_pipeline;
         MaterialPipeline light_pipeline;
+        MaterialPipeline mesh_shading_geometry_pipeline = { VK_NULL_HANDLE, VK_NULL_HANDLE }; // left null without mesh shading
     };
 
     GLTFHDRMaterial::DeferredRendererData deferred_renderer_data;
@@ -46,9 +87,16 @@ public:
         glm::bvec4 includes_certain_textures;
 
         float padding1;
-        glm::vec4 padding[13]; // padding for uniform buffers
+
+        // slots in the bindless texture array, set by write_material
+        uint32_t color_texture_index;
+        uint32_t metal_rough_texture_index;
+        uint32_t normal_texture_index;
+        uint32_t ambient_occlusion_texture_index;
     };
 
+    static_assert(sizeof(MaterialConstants) == 64, "must match MaterialData in bindless_material_structures.glsl");
+
     struct MaterialResources {
         AllocatedImage color_image;
         VkSampler color_sampler;
@@ -62,11 +110,12 @@ public:
         AllocatedImage ambient_occlusion_image;
         VkSampler ambient_occlusion_sampler;
 
-        VkBuffer data_buffer;
-        uint32_t data_buffer_offset;
+        MaterialConstants constants; // texture indices are filled in by write_material
     };
 
-    void build_shared_resources(VkDevice device);
+    // mesh_shading_supported should be PhysicalDevice::supports_mesh_shaders, the scene and light set layouts handed to
+    // the builds below must then also be visible to the mesh stage
+    void build_shared_resources(VkDevice device, VmaAllocator allocator, bool mesh_shading_supported);
 
     void build_forward_renderer_pipelines(VkDevice device,
                                           VkDescriptorSetLayout light_data_descriptor_layout,
@@ -75,6 +124,15 @@ public:
                                           AllocatedImage& draw_image,
                                           AllocatedImage& depth_image);
 
+    // the transparent pipeline writes the accumulation and revealage targets, see WeightedBlendedOIT
+    void build_transparent_pipeline(VkDevice device,
+                                    VkDescriptorSetLayout light_data_descriptor_layout,
+                                    VkDescriptorSetLayout scene_data_descriptor_layout,
+                                    VkDescriptorSetLayout shadow_map_descriptor_layout,
+                                    VkFormat accumulation_format,
+                                    VkFormat revealage_format,
+                                    VkFormat depth_format);
+
     void build_deferred_renderer_pipelines(VkDevice device,
                                            VkDescriptorSetLayout light_data_descriptor_layout,
                                            VkDescriptorSetLayout scene_data_descriptor_layout,
@@ -86,7 +144,20 @@ public:
 
     void clear_resources(VkDevice device);
 
-    MaterialInstance write_material(VkDevice device, MaterialPassType pass_type, const MaterialResources& resources, DescriptorAllocatorGrowable& descriptor_allocator);
+    // takes the next material slot, writing its constants and any textures not already in the array
+    MaterialInstance write_material(VkDevice device, MaterialPassType pass_type, const MaterialResources& resources);
+
+    // the bindless texture slots a material's constants point at
+    const std::array<uint32_t, 4>& get_material_texture_indices(uint32_t material_index) const { return material_texture_indices[material_index]; }
+
+    // every texture slot holding view, with any sampler
+    void get_texture_slots(VkImageView view, std::vector<uint32_t>& slots) const;
+
+    /*
+     * Points every slot holding old_view at new_view instead, keeping their samplers. Used when a texture's image is
+     * replaced, see TextureResidencyManager. No submission still in flight may read those slots.
+     */
+    void replace_texture_view(VkDevice device, VkImageView old_view, VkImageView new_view);
 
 };
 
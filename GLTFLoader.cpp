@@ -8,6 +8,8 @@
 #include "GLTFLoader.hpp"
 #include "Buffer.hpp"
 #include "VulkanGeneralUtility.hpp"
+#include "OcclusionCuller.hpp"
+#include "MeshletCuller.hpp"
 
 
 #define STB_IMAGE_IMPLEMENTATION
@@ -47,6 +49,211 @@ VkSamplerMipmapMode get_mipmap_mode(int filter_id) {
     return VK_SAMPLER_MIPMAP_MODE_LINEAR;
 }
 
+/*
+ * Reads a float accessor into a tightly packed array, num components per element. Handles interleaved buffer views.
+ * Returns an empty array for anything that isn't floats, e.g. quantized animation data, which we don't support.
+ */
+std::vector<float> read_float_accessor(const tinygltf::Model& model, int accessor_index, uint32_t& out_component_count) {
+    const tinygltf::Accessor& accessor = model.accessors[accessor_index];
+    out_component_count = static_cast<uint32_t>(tinygltf::GetNumComponentsInType(accessor.type));
+
+    if(accessor.componentType != TINYGLTF_COMPONENT_TYPE_FLOAT || accessor.bufferView == -1) {
+        fmt::print("Skipping accessor {}, only float accessors are supported here\n", accessor_index);
+        return {};
+    }
+
+    const tinygltf::BufferView& buffer_view = model.bufferViews[accessor.bufferView];
+    const tinygltf::Buffer& buffer = model.buffers[buffer_view.buffer];
+    size_t stride = static_cast<size_t>(accessor.ByteStride(buffer_view));
+    const unsigned char* data = &buffer.data[buffer_view.byteOffset + accessor.byteOffset];
+
+    std::vector<float> out(accessor.count * out_component_count);
+    for(size_t i = 0; i < accessor.count; i++) {
+        memcpy(&out[i * out_component_count], data + i * stride, out_component_count * sizeof(float));
+    }
+
+    return out;
+}
+
+/*
+ * Reads a primitive's JOINTS_0/WEIGHTS_0 into out_skin_vertices from first_vertex on. Joints can be unsigned bytes or
+ * shorts, weights floats or normalized unsigned bytes/shorts. Returns false if the primitive isn't skinned.
+ */
+bool read_skin_attributes(const tinygltf::Model& model, const tinygltf::Primitive& primitive, std::vector<SkinVertex>& out_skin_vertices, size_t first_vertex) {
+    auto joints_accessor_iterator = primitive.attributes.find("JOINTS_0");
+    auto weights_accessor_iterator = primitive.attributes.find("WEIGHTS_0");
+    if(joints_accessor_iterator == primitive.attributes.end() || weights_accessor_iterator == primitive.attributes.end()) {
+        return false;
+    }
+
+    const tinygltf::Accessor& joints_accessor = model.accessors[joints_accessor_iterator->second];
+    const tinygltf::Accessor& weights_accessor = model.accessors[weights_accessor_iterator->second];
+    if(joints_accessor.bufferView == -1 || weights_accessor.bufferView == -1) {
+        return false;
+    }
+
+    const tinygltf::BufferView& joints_buf_view = model.bufferViews[joints_accessor.bufferView];
+    const tinygltf::BufferView& weights_buf_view = model.bufferViews[weights_accessor.bufferView];
+    size_t joints_stride = static_cast<size_t>(joints_accessor.ByteStride(joints_buf_view));
+    size_t weights_stride = static_cast<size_t>(weights_accessor.ByteStride(weights_buf_view));
+    const unsigned char* joints_data = &model.buffers[joints_buf_view.buffer].data[joints_buf_view.byteOffset + joints_accessor.byteOffset];
+    const unsigned char* weights_data = &model.buffers[weights_buf_view.buffer].data[weights_buf_view.byteOffset + weights_accessor.byteOffset];
+
+    for(size_t v = 0; v < joints_accessor.count && first_vertex + v < out_skin_vertices.size(); v++) {
+        SkinVertex& skin_vertex = out_skin_vertices[first_vertex + v];
+        const unsigned char* joint = joints_data + v * joints_stride;
+        const unsigned char* weight = weights_data + v * weights_stride;
+
+        for(int c = 0; c < 4; c++) {
+            switch(joints_accessor.componentType) {
+                case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+                    skin_vertex.joints[c] = joint[c];
+                    break;
+                case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+                    skin_vertex.joints[c] = reinterpret_cast<const uint16_t*>(joint)[c];
+                    break;
+            }
+
+            switch(weights_accessor.componentType) {
+                case TINYGLTF_COMPONENT_TYPE_FLOAT:
+                    skin_vertex.weights[c] = reinterpret_cast<const float*>(weight)[c];
+                    break;
+                case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+                    skin_vertex.weights[c] = weight[c] / 255.f;
+                    break;
+                case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+                    skin_vertex.weights[c] = reinterpret_cast<const uint16_t*>(weight)[c] / 65535.f;
+                    break;
+            }
+        }
+
+        // weights should sum to one, but exporters don't always manage it
+        float weight_sum = skin_vertex.weights.x + skin_vertex.weights.y + skin_vertex.weights.z + skin_vertex.weights.w;
+        if(weight_sum > 0.f) {
+            skin_vertex.weights /= weight_sum;
+        }
+    }
+
+    return true;
+}
+
+void load_skins(const tinygltf::Model& model, GLTFFile& gltf) {
+    for(const tinygltf::Skin& tiny_skin : model.skins) {
+        Skin& skin = gltf.skins.emplace_back();
+        skin.name = tiny_skin.name;
+
+        for(int joint : tiny_skin.joints) {
+            skin.joints.push_back(static_cast<uint32_t>(joint));
+        }
+
+        // no inverse bind matrices means they're all identity
+        skin.inverse_bind_matrices.assign(skin.joints.size(), glm::mat4(1.f));
+        if(tiny_skin.inverseBindMatrices != -1) {
+            uint32_t component_count;
+            std::vector<float> matrices = read_float_accessor(model, tiny_skin.inverseBindMatrices, component_count);
+            if(component_count == 16 && matrices.size() >= skin.joints.size() * 16) {
+                // glTF and glm are both column major
+                memcpy(skin.inverse_bind_matrices.data(), matrices.data(), skin.joints.size() * sizeof(glm::mat4));
+            }
+        }
+    }
+}
+
+/*
+ * Lists the MeshNodes the SkinningPass has to pose, those with a skin and a mesh with skin weights. Their posed
+ * vertices live per instance, see SceneInstances.
+ */
+void find_skinned_mesh_nodes(GLTFFile& gltf) {
+    for(std::shared_ptr<Node>& node : gltf.nodes) {
+        std::shared_ptr<MeshNode> mesh_node = std::dynamic_pointer_cast<MeshNode>(node);
+        if(mesh_node == nullptr || mesh_node->skin < 0 || mesh_node->skin >= gltf.skins.size() || mesh_node->mesh->skin_vertex_buffer_address == 0) {
+            continue;
+        }
+
+        mesh_node->skinned_index = static_cast<int>(gltf.skinned_mesh_nodes.size());
+        gltf.skinned_mesh_nodes.push_back(mesh_node);
+    }
+}
+
+void load_animations(const tinygltf::Model& model, GLTFFile& gltf) {
+    for(const tinygltf::Animation& tiny_animation : model.animations) {
+        std::shared_ptr<AnimationClip> clip = std::make_shared<AnimationClip>();
+        clip->name = tiny_animation.name;
+        clip->duration = 0.f;
+
+        for(const tinygltf::AnimationSampler& tiny_sampler : tiny_animation.samplers) {
+            AnimationSampler& sampler = clip->samplers.emplace_back();
+
+            if(tiny_sampler.interpolation == "STEP") {
+                sampler.interpolation = AnimationInterpolation::Step;
+            } else if(tiny_sampler.interpolation == "CUBICSPLINE") {
+                sampler.interpolation = AnimationInterpolation::CubicSpline;
+            } else {
+                sampler.interpolation = AnimationInterpolation::Linear;
+            }
+
+            uint32_t time_component_count;
+            sampler.times = read_float_accessor(model, tiny_sampler.input, time_component_count);
+
+            uint32_t value_component_count;
+            std::vector<float> values = read_float_accessor(model, tiny_sampler.output, value_component_count);
+            if(value_component_count == 0 || value_component_count > 4) {
+                continue;
+            }
+
+            size_t value_count = values.size() / value_component_count;
+            sampler.values.resize(value_count, glm::vec4(0.f));
+            for(size_t v = 0; v < value_count; v++) {
+                for(uint32_t c = 0; c < value_component_count; c++) {
+                    sampler.values[v][c] = values[v * value_component_count + c];
+                }
+            }
+
+            if(!sampler.times.empty()) {
+                clip->duration = std::max(clip->duration, sampler.times.back());
+            }
+        }
+
+        for(const tinygltf::AnimationChannel& tiny_channel : tiny_animation.channels) {
+            if(tiny_channel.target_node == -1) {
+                continue;
+            }
+
+            AnimationChannel channel = {
+                    .sampler = static_cast<uint32_t>(tiny_channel.sampler),
+                    .target_node = static_cast<uint32_t>(tiny_channel.target_node)
+            };
+
+            if(tiny_channel.target_path == "translation") {
+                channel.path = AnimationPath::Translation;
+            } else if(tiny_channel.target_path == "rotation") {
+                channel.path = AnimationPath::Rotation;
+            } else if(tiny_channel.target_path == "scale") {
+                channel.path = AnimationPath::Scale;
+            } else {
+                fmt::print("Skipping '{}' channel of animation '{}', morph targets aren't supported\n", tiny_channel.target_path, clip->name);
+                continue;
+            }
+
+            // drop channels whose sampler couldn't be read, rather than reading out of bounds later
+            const AnimationSampler& sampler = clip->samplers[channel.sampler];
+            size_t values_per_keyframe = sampler.interpolation == AnimationInterpolation::CubicSpline ? 3 : 1;
+            if(sampler.times.empty() || sampler.values.size() != sampler.times.size() * values_per_keyframe) {
+                fmt::print("Skipping channel of animation '{}' with unreadable keyframes\n", clip->name);
+                continue;
+            }
+
+            clip->channels.push_back(channel);
+
+            if(std::find(clip->animated_nodes.begin(), clip->animated_nodes.end(), channel.target_node) == clip->animated_nodes.end()) {
+                clip->animated_nodes.push_back(channel.target_node);
+            }
+        }
+
+        gltf.animations.push_back(clip);
+    }
+}
+
 std::shared_ptr<GLTFFile> GLTFLoader::load_file(VkDevice device, VmaAllocator allocator,
                                                 GLTFHDRMaterial& material_creator,
                                                 ImmediateSubmitCommandBuffer& immediate_submit_command_buffer,
@@ -89,14 +296,6 @@ std::shared_ptr<GLTFFile> GLTFLoader::load_file(VkDevice device, VmaAllocator al
     }
 
 
-    // Allocate descriptor pool for materials
-    std::vector<DescriptorAllocatorGrowable::PoolSizeRatio> sizes = {
-            {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 3},
-            {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1},
-            {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1},
-    };
-    out_gltf->material_descriptor_pool.init_allocator(device, tinyModel->materials.size(), sizes);
-
     // Load samplers
     for(tinygltf::Sampler sampler : tinyModel->samplers) {
         VkSamplerCreateInfo info = {
@@ -155,17 +354,12 @@ std::shared_ptr<GLTFFile> GLTFLoader::load_file(VkDevice device, VmaAllocator al
                 .depth = 1
         };
 
-        out_gltf->images[index].init_with_data(immediate_submit_command_buffer, device, allocator, image.image.data(), extent, image_format, VK_IMAGE_USAGE_SAMPLED_BIT, false);
+        // full mip chains, the TextureResidencyManager drops the top levels of idle textures when over budget
+        out_gltf->images[index].init_with_data(immediate_submit_command_buffer, device, allocator, image.image.data(), extent, image_format, VK_IMAGE_USAGE_SAMPLED_BIT, true);
         return out_gltf->images[index];
     };
 
-    // Load materials
-    size_t material_buffer_size = sizeof(GLTFHDRMaterial::MaterialConstants) * tinyModel->materials.size();
-    out_gltf->material_data_buffer.init(allocator, material_buffer_size, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-
-    int material_data_index = 0;
-    auto scene_material_constants = (GLTFHDRMaterial::MaterialConstants*) out_gltf->material_data_buffer.info.pMappedData;
-
+    // Load materials, their constants and textures go into material_creator's bindless set
     out_gltf->materials.resize(tinyModel->materials.size());
     for(int i = 0; i < tinyModel->materials.size(); i++) {
         tinygltf::Material& tiny_mat_data = tinyModel->materials[i];
@@ -202,8 +396,6 @@ std::shared_ptr<GLTFFile> GLTFLoader::load_file(VkDevice device, VmaAllocator al
 
         // fmt::print("vec4 size: {}, bvec4 size: {}\n", sizeof(glm::vec4), sizeof(glm::bvec4));
 
-        scene_material_constants[i] = constants;
-
         // Pass Type
 
         MaterialPassType pass_type = MaterialPassType::MainColor;
@@ -251,11 +443,10 @@ std::shared_ptr<GLTFFile> GLTFLoader::load_file(VkDevice device, VmaAllocator al
             resources.ambient_occlusion_sampler = texture_load_error_sampler;
         }
 
-        resources.data_buffer = out_gltf->material_data_buffer.buffer;
-        resources.data_buffer_offset = i * sizeof(GLTFHDRMaterial::MaterialConstants);
+        resources.constants = constants;
 
         std::shared_ptr<Material> our_material = std::make_shared<Material>();
-        our_material->data = material_creator.write_material(device, pass_type, resources, out_gltf->material_descriptor_pool);
+        our_material->data = material_creator.write_material(device, pass_type, resources);
 
         out_gltf->materials[i] = our_material;
     }
@@ -263,6 +454,9 @@ std::shared_ptr<GLTFFile> GLTFLoader::load_file(VkDevice device, VmaAllocator al
     // Load meshes
     std::vector<uint32_t> indices;
     std::vector<Vertex> vertices;
+    std::vector<SkinVertex> skin_vertices;
+    std::vector<GPUMeshlet> meshlets;
+    std::vector<uint32_t> meshlet_data;
 
     out_gltf->meshes.reserve(tinyModel->meshes.size());
     for(int i = 0; i < tinyModel->meshes.size(); i++) {
@@ -271,6 +465,10 @@ std::shared_ptr<GLTFFile> GLTFLoader::load_file(VkDevice device, VmaAllocator al
 
         indices.clear();
         vertices.clear();
+        skin_vertices.clear();
+        meshlets.clear();
+        meshlet_data.clear();
+        bool mesh_skinned = false;
 
         for(int p = 0; p < tiny_mesh.primitives.size(); p++) {
             tinygltf::Primitive& primitive = tiny_mesh.primitives[p];
@@ -316,6 +514,19 @@ std::shared_ptr<GLTFFile> GLTFLoader::load_file(VkDevice device, VmaAllocator al
                 const tinygltf::Buffer& positionBuf = tinyModel->buffers[positionBufView.buffer];
 
                 const glm::vec3* position_data = reinterpret_cast<const glm::vec3*>(&positionBuf.data[position_accessor.byteOffset + positionBufView.byteOffset]);
+
+                // local-space bounds of the surface, used for culling. Zero sized for a primitive without vertices
+                glm::vec3 min_pos = position_accessor.count > 0 ? position_data[0] : glm::vec3(0.f);
+                glm::vec3 max_pos = min_pos;
+                for(int v = 0; v < position_accessor.count; v++) {
+                    min_pos = glm::min(min_pos, position_data[v]);
+                    max_pos = glm::max(max_pos, position_data[v]);
+                }
+
+                new_draw_data.bounds.origin = (max_pos + min_pos) / 2.f;
+                new_draw_data.bounds.extents = (max_pos - min_pos) / 2.f;
+                new_draw_data.bounds.sphere_radius = glm::length(new_draw_data.bounds.extents);
+
                 for(int v = 0; v < position_accessor.count; v++) {
                     Vertex vertex = {
                             .pos = position_data[v],
@@ -392,6 +603,36 @@ std::shared_ptr<GLTFFile> GLTFLoader::load_file(VkDevice device, VmaAllocator al
                 }
             }
 
+            // vert joints/weights, unskinned primitives of a skinned mesh are left with zero weights
+            skin_vertices.resize(vertices.size());
+            mesh_skinned |= read_skin_attributes(*tinyModel, primitive, skin_vertices, initial_vertex);
+
+            // keep a CPU copy of simple surfaces so they can be used as occluders
+            if(new_draw_data.indexCount / 3 <= OcclusionCuller::MAX_OCCLUDER_MESH_TRIANGLES) {
+                std::shared_ptr<OccluderMesh> occluder = std::make_shared<OccluderMesh>();
+                occluder->positions.reserve(vertices.size() - initial_vertex);
+                for(size_t v = initial_vertex; v < vertices.size(); v++) {
+                    occluder->positions.push_back(vertices[v].pos);
+                }
+
+                bool indices_valid = true;
+                occluder->indices.reserve(new_draw_data.indexCount);
+                for(uint32_t index = 0; index < new_draw_data.indexCount; index++) {
+                    uint32_t local_index = indices[new_draw_data.firstIndex + index] - static_cast<uint32_t>(initial_vertex);
+                    indices_valid &= local_index < occluder->positions.size();
+                    occluder->indices.push_back(local_index);
+                }
+
+                if(indices_valid) {
+                    new_draw_data.occluder = occluder;
+                }
+            }
+
+            // split the surface into meshlets, their indices stay where they are in the index buffer
+            new_draw_data.first_meshlet = static_cast<uint32_t>(meshlets.size());
+            MeshletCuller::build_meshlets(vertices, indices, new_draw_data.firstIndex, new_draw_data.indexCount, meshlets, meshlet_data);
+            new_draw_data.meshlet_count = static_cast<uint32_t>(meshlets.size()) - new_draw_data.first_meshlet;
+
             // set draw data's material
             new_draw_data.material = primitive.material == -1 ? out_gltf->materials[0] : out_gltf->materials[primitive.material];
 
@@ -400,6 +641,20 @@ std::shared_ptr<GLTFFile> GLTFLoader::load_file(VkDevice device, VmaAllocator al
 
         // upload mesh data to the GPU
         mesh->mesh_buffers = vk_util::upload_mesh<Vertex>(indices, vertices, allocator, device, immediate_submit_command_buffer, tiny_mesh.name);
+        mesh->vertex_count = static_cast<uint32_t>(vertices.size());
+
+        if(!meshlets.empty()) {
+            mesh->meshlet_buffer = vk_util::upload_buffer<GPUMeshlet>(meshlets, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, allocator, device, immediate_submit_command_buffer, tiny_mesh.name + std::string(" meshlet buffer"));
+            mesh->meshlet_buffer_address = vk_util::get_buffer_device_address(device, mesh->meshlet_buffer.buffer);
+
+            mesh->meshlet_data_buffer = vk_util::upload_buffer<uint32_t>(meshlet_data, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, allocator, device, immediate_submit_command_buffer, tiny_mesh.name + std::string(" meshlet data buffer"));
+            mesh->meshlet_data_buffer_address = vk_util::get_buffer_device_address(device, mesh->meshlet_data_buffer.buffer);
+        }
+
+        if(mesh_skinned) {
+            mesh->skin_vertex_buffer = vk_util::upload_buffer<SkinVertex>(skin_vertices, VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, allocator, device, immediate_submit_command_buffer, tiny_mesh.name + std::string(" skin vertex buffer"));
+            mesh->skin_vertex_buffer_address = vk_util::get_buffer_device_address(device, mesh->skin_vertex_buffer.buffer);
+        }
 
         out_gltf->meshes.push_back(mesh);
     }
@@ -411,10 +666,12 @@ std::shared_ptr<GLTFFile> GLTFLoader::load_file(VkDevice device, VmaAllocator al
         if(tiny_node.mesh != -1) {
             new_node = std::make_shared<MeshNode>();
             static_cast<MeshNode*>(new_node.get())->mesh = out_gltf->meshes[tiny_node.mesh];
+            static_cast<MeshNode*>(new_node.get())->skin = tiny_node.skin;
         } else {
             new_node = std::make_shared<Node>();
         }
 
+        new_node->index = static_cast<uint32_t>(n);
         out_gltf->nodes.push_back(new_node);
 
         glm::mat4 m(1.0);
@@ -443,6 +700,17 @@ std::shared_ptr<GLTFFile> GLTFLoader::load_file(VkDevice device, VmaAllocator al
             }
 
             new_node->local_transform = mTranslate * mRot * mScale;
+
+            // keep the parts too, animation channels replace them one at a time
+            if(!tinyModel->nodes[n].translation.empty()) {
+                new_node->rest_pose.translation = glm::vec3(tinyModel->nodes[n].translation[0], tinyModel->nodes[n].translation[1], tinyModel->nodes[n].translation[2]);
+            }
+            if(!tinyModel->nodes[n].rotation.empty()) {
+                new_node->rest_pose.rotation = glm::quat(tinyModel->nodes[n].rotation[3], tinyModel->nodes[n].rotation[0], tinyModel->nodes[n].rotation[1], tinyModel->nodes[n].rotation[2]);
+            }
+            if(!tinyModel->nodes[n].scale.empty()) {
+                new_node->rest_pose.scale = glm::vec3(tinyModel->nodes[n].scale[0], tinyModel->nodes[n].scale[1], tinyModel->nodes[n].scale[2]);
+            }
         }
     }
 
@@ -453,7 +721,7 @@ std::shared_ptr<GLTFFile> GLTFLoader::load_file(VkDevice device, VmaAllocator al
 
         for(auto& c : tiny_node.children) {
             node->children.push_back(out_gltf->nodes[c]);
-            out_gltf->nodes[c] = node;
+            out_gltf->nodes[c]->parent = node;
         }
     }
 
@@ -467,6 +735,11 @@ std::shared_ptr<GLTFFile> GLTFLoader::load_file(VkDevice device, VmaAllocator al
         }
     }
 
+    // skins and animations refer to nodes by index, so need the hierarchy in place first
+    load_skins(*tinyModel, *out_gltf);
+    find_skinned_mesh_nodes(*out_gltf);
+    load_animations(*tinyModel, *out_gltf);
+
     return out_gltf;
 }
 
@@ -0,0 +1,244 @@
+//
+// Created by darby on 3/2/2025.
+//
+
+#include "GPUDrawCuller.hpp"
+#include "FrustumCuller.hpp"
+#include "DescriptorLayoutBuilder.hpp"
+#include "VulkanGeneralUtility.hpp"
+
+void GPUDrawCuller::init(VkDevice _device, VmaAllocator _allocator, DeletionQueue& deletion_queue) {
+    device = _device;
+    allocator = _allocator;
+
+    {
+        DescriptorLayoutBuilder builder;
+        builder.add_binding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER); // depth pyramid
+        depth_pyramid_descriptor_set_layout = builder.build(device, VK_SHADER_STAGE_COMPUTE_BIT);
+    }
+
+    std::vector<VkDescriptorSetLayout> cull_descriptor_layouts = {
+            depth_pyramid_descriptor_set_layout
+    };
+
+    VkPushConstantRange compute_push_constant_range = {
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+            .offset = 0,
+            .size = sizeof(GPUCullPushConstants),
+    };
+
+    std::vector<VkPushConstantRange> cull_push_constant_ranges = {
+            compute_push_constant_range
+    };
+
+    // everything else is reached through buffer references
+    cull_pipeline.init(
+            device,
+            "../shaders/draw_cull.comp.spv",
+            cull_descriptor_layouts,
+            cull_push_constant_ranges,
+            deletion_queue
+    );
+
+    cull_data_buffers.init(device, allocator, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                           VMA_MEMORY_USAGE_CPU_TO_GPU, "Cull Data Buffer");
+    culled_command_buffers.init(device, allocator, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                                VMA_MEMORY_USAGE_GPU_ONLY, "Culled Command Buffer");
+    draw_count_buffers.init(device, allocator, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                            VMA_MEMORY_USAGE_GPU_ONLY, "Draw Count Buffer");
+
+    deletion_queue.push_function([=, this]() {
+        vkDestroyDescriptorSetLayout(device, depth_pyramid_descriptor_set_layout, nullptr);
+        if(visibility_object_count > 0) {
+            visibility_buffer.destroy_buffer();
+        }
+
+        cull_data_buffers.destroy();
+        culled_command_buffers.destroy();
+        draw_count_buffers.destroy();
+        for(StatsBuffer& stats_buffer : stats_buffers) {
+            stats_buffer.buffer.destroy_buffer();
+        }
+        stats_buffers.clear();
+    });
+}
+
+void GPUDrawCuller::cull(VkCommandBuffer cmd,
+                         IndirectDrawBuilder& draws,
+                         const std::vector<RenderObject>& objects,
+                         const std::vector<uint32_t>& draw_indices,
+                         const glm::mat4& view_proj,
+                         const DepthPyramid& depth_pyramid,
+                         TimelineDeletionQueue& gpu_deletion_queue) {
+    if(draws.get_command_count() == 0) {
+        return;
+    }
+
+    prepare(cmd, draws, objects, draw_indices, view_proj, gpu_deletion_queue);
+    dispatch(cmd, draws, depth_pyramid, CullPhase::Frustum, gpu_deletion_queue);
+}
+
+void GPUDrawCuller::cull_early(VkCommandBuffer cmd,
+                               IndirectDrawBuilder& draws,
+                               const std::vector<RenderObject>& objects,
+                               const std::vector<uint32_t>& draw_indices,
+                               const glm::mat4& view_proj,
+                               const DepthPyramid& depth_pyramid,
+                               TimelineDeletionQueue& gpu_deletion_queue) {
+    if(draws.get_command_count() == 0) {
+        return;
+    }
+
+    // a new set of objects starts out invisible, the late phase draws everything it doesn't find occluded
+    if(visibility_object_count != objects.size()) {
+        if(visibility_object_count > 0) {
+            gpu_deletion_queue.push_buffer(visibility_buffer);
+        }
+
+        visibility_object_count = objects.size();
+        visibility_buffer.init(allocator, visibility_object_count * sizeof(uint32_t),
+                               VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                               VMA_MEMORY_USAGE_GPU_ONLY);
+        visibility_buffer_address = vk_util::get_buffer_device_address(device, visibility_buffer.buffer);
+
+        vkCmdFillBuffer(cmd, visibility_buffer.buffer, 0, VK_WHOLE_SIZE, 0);
+    }
+
+    prepare(cmd, draws, objects, draw_indices, view_proj, gpu_deletion_queue);
+    dispatch(cmd, draws, depth_pyramid, CullPhase::Early, gpu_deletion_queue);
+}
+
+void GPUDrawCuller::cull_late(VkCommandBuffer cmd, IndirectDrawBuilder& draws, const DepthPyramid& depth_pyramid, TimelineDeletionQueue& gpu_deletion_queue) {
+    if(draws.get_command_count() == 0) {
+        return;
+    }
+
+    dispatch(cmd, draws, depth_pyramid, CullPhase::Late, gpu_deletion_queue);
+}
+
+void GPUDrawCuller::prepare(VkCommandBuffer cmd,
+                            IndirectDrawBuilder& draws,
+                            const std::vector<RenderObject>& objects,
+                            const std::vector<uint32_t>& draw_indices,
+                            const glm::mat4& view_proj,
+                            TimelineDeletionQueue& gpu_deletion_queue) {
+    const std::vector<IndirectBatch>& batches = draws.get_batches();
+    uint32_t draw_count = draws.get_command_count();
+
+    // the camera, then a GPUCullData per draw
+    RecyclingBuffer::Slot& cull_data_buffer = cull_data_buffers.acquire(sizeof(GPUCullView) + draw_count * sizeof(GPUCullData), gpu_deletion_queue);
+    Buffer& cull_stats_buffer = acquire_stats_buffer(gpu_deletion_queue);
+
+    cull_data_buffer_address = cull_data_buffer.address;
+    cull_stats_buffer_address = vk_util::get_buffer_device_address(device, cull_stats_buffer.buffer);
+
+    GPUCullView* cull_view = (GPUCullView*)cull_data_buffer.buffer.info.pMappedData;
+    Frustum frustum = Frustum::from_view_proj(view_proj);
+    memcpy(cull_view->frustum_planes, frustum.planes, sizeof(frustum.planes));
+    cull_view->view_proj = view_proj;
+
+    GPUCullData* cull_datas = (GPUCullData*)(cull_view + 1);
+    for(uint32_t b = 0; b < batches.size(); b++) {
+        const IndirectBatch& batch = batches[b];
+        for(uint32_t i = batch.first_command; i < batch.first_command + batch.command_count; i++) {
+            const Bounds& bounds = objects[draw_indices[i]].bounds;
+            cull_datas[i] = {
+                    .bounding_sphere = glm::vec4(bounds.origin, bounds.sphere_radius),
+                    .batch_index = b,
+                    .batch_first_command = batch.first_command,
+                    .object_index = draw_indices[i],
+                    .transform_index = draws.get_transform_index(draw_indices[i])
+            };
+        }
+    }
+
+    // the stats are accumulated into by every phase
+    vkCmdFillBuffer(cmd, cull_stats_buffer.buffer, 0, VK_WHOLE_SIZE, 0);
+}
+
+void GPUDrawCuller::dispatch(VkCommandBuffer cmd, IndirectDrawBuilder& draws, const DepthPyramid& depth_pyramid, CullPhase phase, TimelineDeletionQueue& gpu_deletion_queue) {
+    uint32_t draw_count = draws.get_command_count();
+    size_t batch_count = draws.get_batches().size();
+
+    // each phase compacts into buffers of its own, the early ones are still being drawn from when the late phase runs
+    RecyclingBuffer::Slot& culled_command_buffer = culled_command_buffers.acquire(draw_count * sizeof(VkDrawIndexedIndirectCommand), gpu_deletion_queue);
+    RecyclingBuffer::Slot& draw_count_buffer = draw_count_buffers.acquire(batch_count * sizeof(uint32_t), gpu_deletion_queue);
+
+    // the counts are accumulated into, start them at zero. Also orders us after the last phase's visibility writes
+    vkCmdFillBuffer(cmd, draw_count_buffer.buffer.buffer, 0, batch_count * sizeof(uint32_t), 0);
+    vk_util::memory_barrier(cmd,
+                            VK_PIPELINE_STAGE_2_TRANSFER_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                            VK_ACCESS_2_TRANSFER_WRITE_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+                            VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+
+    GPUCullPushConstants push_constants = {
+            .input_command_buffer_address = draws.get_command_buffer_address(),
+            .output_command_buffer_address = culled_command_buffer.address,
+            .cull_data_buffer_address = cull_data_buffer_address,
+            .transform_buffer_address = draws.get_transform_buffer_address(),
+            .draw_count_buffer_address = draw_count_buffer.address,
+            .cull_stats_buffer_address = cull_stats_buffer_address,
+            .visibility_buffer_address = phase == CullPhase::Frustum ? 0 : visibility_buffer_address,
+            .draw_count = draw_count,
+            .phase = static_cast<uint32_t>(phase)
+    };
+
+    VkDescriptorSet depth_pyramid_descriptor_set = depth_pyramid.get_cull_descriptor_set();
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, cull_pipeline.pipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, cull_pipeline.layout, 0, 1, &depth_pyramid_descriptor_set, 0, nullptr);
+    vkCmdPushConstants(cmd, cull_pipeline.layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(GPUCullPushConstants), &push_constants);
+    vkCmdDispatch(cmd, (draw_count + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, 1, 1);
+
+    // the commands and counts feed the indirect draws, the stats get read by the host after the fence
+    vk_util::memory_barrier(cmd,
+                            VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+                            VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_2_HOST_BIT,
+                            VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_2_HOST_READ_BIT);
+
+    draws.use_draw_counts(culled_command_buffer.buffer.buffer, draw_count_buffer.buffer.buffer);
+}
+
+Buffer& GPUDrawCuller::acquire_stats_buffer(TimelineDeletionQueue& gpu_deletion_queue) {
+    uint64_t completed_value = gpu_deletion_queue.get_completed_value();
+
+    // the newest finished stats are the ones shown
+    StatsBuffer* newest = nullptr;
+    for(StatsBuffer& stats_buffer : stats_buffers) {
+        if(stats_buffer.used_value <= completed_value && (newest == nullptr || stats_buffer.used_value > newest->used_value)) {
+            newest = &stats_buffer;
+        }
+    }
+    if(newest != nullptr && newest->used_value > read_back_value) {
+        vmaInvalidateAllocation(allocator, newest->buffer.allocation, 0, VK_WHOLE_SIZE);
+        memcpy(&read_back_stats, newest->buffer.info.pMappedData, sizeof(GPUCullStats));
+        read_back_value = newest->used_value;
+    }
+
+    StatsBuffer* free_buffer = nullptr;
+    for(StatsBuffer& stats_buffer : stats_buffers) {
+        if(stats_buffer.used_value <= completed_value) {
+            free_buffer = &stats_buffer;
+            break;
+        }
+    }
+
+    // one per frame in flight, unless something culls more than once a frame
+    if(free_buffer == nullptr) {
+        free_buffer = &stats_buffers.emplace_back();
+        free_buffer->buffer.init(allocator, sizeof(GPUCullStats),
+                                 VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                 VMA_MEMORY_USAGE_GPU_TO_CPU);
+        free_buffer->buffer.set_name(device, "Cull Stats Buffer");
+    }
+
+    free_buffer->used_value = gpu_deletion_queue.get_pending_value();
+    return free_buffer->buffer;
+}
+
+void GPUDrawCuller::add_stats(EngineStats& stats) const {
+    stats.visible_object_count = static_cast<int>(read_back_stats.visible_count);
+    stats.culled_object_count = static_cast<int>(read_back_stats.culled_count);
+    stats.hi_z_occluded_count = static_cast<int>(read_back_stats.occluded_count);
+    stats.hi_z_late_draw_count = static_cast<int>(read_back_stats.late_draw_count);
+}
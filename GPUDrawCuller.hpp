@@ -0,0 +1,122 @@
+//
+// Created by darby on 3/2/2025.
+//
+
+#pragma once
+
+#include "Common.hpp"
+#include "ComputePipeline.hpp"
+#include "DeletionQueue.hpp"
+#include "TimelineDeletionQueue.hpp"
+#include "EngineStats.hpp"
+#include "IndirectDrawBuilder.hpp"
+#include "RecyclingBuffer.hpp"
+#include "DepthPyramid.hpp"
+
+/*
+ * Frustum culls a pass's indirect draws on the GPU, so the CPU no longer walks the objects to decide what's visible.
+ *
+ * One dispatch of draw_cull.comp tests every draw's bounding sphere, moved by the draw's transform, against the camera
+ * frustum. Survivors are compacted to the front of their batch's range of a second command buffer, an atomic per
+ * batch counting them, and IndirectDrawBuilder then draws each batch with vkCmdDrawIndexedIndirectCount.
+ *
+ * Occlusion culling splits the pass in two around a DepthPyramid:
+ *   - cull_early() keeps the draws whose object was visible last frame, which the pass draws first
+ *   - the pass builds its pyramid from that depth
+ *   - cull_late() tests every draw against the pyramid, remembers which objects are visible for next frame, and
+ *     keeps only those that weren't already drawn early, which the pass then draws on top
+ * Visibility is kept per index into the pass's object list, so it's only as stable as that list's order.
+ *
+ * The buffers written each frame are recycled once the GPU has passed the frame that used them, and only grow.
+ *
+ * How many draws were kept and culled is written to a host visible buffer, one per frame in flight, that's read back
+ * when it next comes around and the GPU has passed the frame that wrote it. The numbers shown lag by a frame or so.
+ */
+class GPUDrawCuller {
+
+public:
+    static constexpr uint32_t WORKGROUP_SIZE = 64; // local_size_x in draw_cull.comp
+
+    // matches the PHASE_ defines in draw_cull.comp
+    enum class CullPhase : uint32_t {
+        Frustum = 0,
+        Early = 1,
+        Late = 2
+    };
+
+    void init(VkDevice device, VmaAllocator allocator, DeletionQueue& deletion_queue);
+
+    // set 0 of draw_cull.comp, the pyramid a DepthPyramid is read through
+    VkDescriptorSetLayout get_depth_pyramid_descriptor_set_layout() const { return depth_pyramid_descriptor_set_layout; }
+
+    /*
+     * Records the cull of draws' commands into cmd and points draws at the compacted ones. draws must have been built
+     * from objects and draw_indices this frame. Everything here must be recorded outside of rendering, before the
+     * pass that draws the result.
+     */
+    void cull(VkCommandBuffer cmd,
+              IndirectDrawBuilder& draws,
+              const std::vector<RenderObject>& objects,
+              const std::vector<uint32_t>& draw_indices,
+              const glm::mat4& view_proj,
+              const DepthPyramid& depth_pyramid,
+              TimelineDeletionQueue& gpu_deletion_queue);
+
+    // same as cull(), but only keeps what was visible last frame. Must be followed by cull_late() once drawn
+    void cull_early(VkCommandBuffer cmd,
+                    IndirectDrawBuilder& draws,
+                    const std::vector<RenderObject>& objects,
+                    const std::vector<uint32_t>& draw_indices,
+                    const glm::mat4& view_proj,
+                    const DepthPyramid& depth_pyramid,
+                    TimelineDeletionQueue& gpu_deletion_queue);
+
+    // depth_pyramid must have been built from the early draws
+    void cull_late(VkCommandBuffer cmd, IndirectDrawBuilder& draws, const DepthPyramid& depth_pyramid, TimelineDeletionQueue& gpu_deletion_queue);
+
+    // the most recent counts that made it back from the GPU
+    void add_stats(EngineStats& stats) const;
+
+private:
+    // uploads this frame's cull data, shared by both phases
+    void prepare(VkCommandBuffer cmd,
+                 IndirectDrawBuilder& draws,
+                 const std::vector<RenderObject>& objects,
+                 const std::vector<uint32_t>& draw_indices,
+                 const glm::mat4& view_proj,
+                 TimelineDeletionQueue& gpu_deletion_queue);
+
+    void dispatch(VkCommandBuffer cmd, IndirectDrawBuilder& draws, const DepthPyramid& depth_pyramid, CullPhase phase, TimelineDeletionQueue& gpu_deletion_queue);
+
+    // copies the newest stats the GPU is done writing into read_back_stats, then returns a buffer to write this frame's to
+    Buffer& acquire_stats_buffer(TimelineDeletionQueue& gpu_deletion_queue);
+
+    struct StatsBuffer {
+        Buffer buffer;
+        uint64_t used_value; // the timeline value of the submission that writes it
+    };
+
+    VkDevice device;
+    VmaAllocator allocator;
+
+    VkDescriptorSetLayout depth_pyramid_descriptor_set_layout;
+    ComputePipeline cull_pipeline;
+
+    // per object visibility from the last late phase, lives across frames
+    Buffer visibility_buffer;
+    VkDeviceAddress visibility_buffer_address;
+    size_t visibility_object_count = 0;
+
+    RecyclingBuffer cull_data_buffers;
+    RecyclingBuffer culled_command_buffers;
+    RecyclingBuffer draw_count_buffers;
+    std::vector<StatsBuffer> stats_buffers;
+
+    // this frame's, set by prepare()
+    VkDeviceAddress cull_data_buffer_address;
+    VkDeviceAddress cull_stats_buffer_address;
+
+    // copied out of a stats buffer once the GPU is done with the frame that wrote it
+    GPUCullStats read_back_stats = {};
+    uint64_t read_back_value = 0;
+};
@@ -16,6 +16,7 @@ struct GPUSceneData {
     glm::vec4 ambient_color;
     glm::vec4 sunlight_direction;
     glm::vec4 sunlight_color;
+    glm::vec4 camera_position; // world space, precomputed so the shaders don't invert the view per pixel
     float ambient_occlusion_strength;
     float shadow_bias_scalar;
     int shadow_softening_kernel_size;
@@ -24,19 +25,181 @@ struct GPUSceneData {
 struct LightSourceData {
     glm::mat4 light_view_matrix;
     glm::mat4 light_projection_matrix;
+    glm::vec4 light_direction; // world space, towards the light, precomputed like GPUSceneData's camera_position
+};
+
+// this frame's GPUSceneData and LightSourceData in the UniformRingBuffer. The sets are made once, the offsets are
+// their dynamic offsets
+struct FrameUniforms {
+    VkDescriptorSet scene_set;
+    uint32_t scene_offset;
+    VkDescriptorSet light_set;
+    uint32_t light_offset;
 };
 
 struct GPUMeshBuffers {
     Buffer index_buffer;
     Buffer vertex_buffer;
     VkDeviceAddress vertex_buffer_address;
+    VkDeviceAddress index_buffer_address; // read by meshlet_cull.comp
+};
+
+// matches common_pipeline_structures.glsl. The transforms are pushed once, the vertex buffer per draw, and the draw's
+// object index is its firstInstance
+struct GPUObjectDrawPushConstants {
+    VkDeviceAddress transform_buffer_address;
+    VkDeviceAddress vertex_buffer_address;
+};
+
+// where a pass finds its objects' transforms in this frame's ObjectTransformBuffer
+struct ObjectTransforms {
+    VkDeviceAddress transform_buffer_address;
+    VkDeviceAddress normal_matrix_buffer_address; // inverse transpose of each transform, at the same index
+    uint32_t first_object_index; // object index of the pass's object list's first object
 };
 
-struct GPUDrawPushConstants {
-    glm::mat4 world_matrix;
+// one per indirect draw command, found in the shader through the command's firstInstance (see IndirectDrawBuilder)
+struct GPUDrawData {
+    uint32_t transform_index; // the draw's object index, see ObjectTransformBuffer
+    uint32_t material_index; // into GLTFHDRMaterial's material buffer
     VkDeviceAddress vertex_buffer_address;
 };
 
+// matches indirect_draw_structures.glsl, the same for every draw of a pass
+struct GPUIndirectDrawPushConstants {
+    VkDeviceAddress transform_buffer_address;
+    VkDeviceAddress draw_data_buffer_address;
+    VkDeviceAddress normal_matrix_buffer_address;
+};
+
+// the camera draw_cull.comp tests against, at the start of its cull data buffer
+struct GPUCullView {
+    glm::vec4 frustum_planes[6];
+    glm::mat4 view_proj; // projects bounds onto the depth pyramid
+};
+
+// per draw input to draw_cull.comp, in the same order as the pass's indirect commands
+struct GPUCullData {
+    glm::vec4 bounding_sphere; // local-space center and radius
+    uint32_t batch_index; // which IndirectBatch, and so which draw count, the draw is compacted into
+    uint32_t batch_first_command;
+    uint32_t object_index; // where the draw's visibility is kept between frames
+    uint32_t transform_index;
+};
+
+// written by draw_cull.comp, read back on the CPU a few frames later
+struct GPUCullStats {
+    uint32_t visible_count;
+    uint32_t culled_count;
+    uint32_t occluded_count;
+    uint32_t late_draw_count; // visible objects that weren't last frame, drawn in the second phase
+};
+
+// matches draw_cull.comp
+struct GPUCullPushConstants {
+    VkDeviceAddress input_command_buffer_address;
+    VkDeviceAddress output_command_buffer_address;
+    VkDeviceAddress cull_data_buffer_address; // a GPUCullView followed by a GPUCullData per draw
+    VkDeviceAddress transform_buffer_address;
+    VkDeviceAddress draw_count_buffer_address;
+    VkDeviceAddress cull_stats_buffer_address;
+    VkDeviceAddress visibility_buffer_address;
+    uint32_t draw_count;
+    uint32_t phase; // GPUDrawCuller::CullPhase
+};
+
+// matches depth_pyramid.comp
+struct GPUDepthPyramidPushConstants {
+    VkDeviceAddress workgroup_counter_address;
+    uint32_t level_count;
+    uint32_t workgroup_count;
+};
+
+// a cluster of a surface's triangles, see MeshletCuller::build_meshlets. Matches meshlet_cull.comp
+struct GPUMeshlet {
+    glm::vec4 bounding_sphere; // local-space center and radius
+    glm::vec4 cone; // local-space axis and cutoff, 1 when the normals spread too far to ever cull by
+    uint32_t first_index; // into the mesh's index buffer
+    uint32_t triangle_count;
+    // into the mesh's meshlet data, where its vertex_count vertex indices are followed by a uint32 per triangle
+    // holding the triangle's corners as 8 bit indices into those vertices. Read by mesh shaders
+    uint32_t first_data;
+    uint32_t vertex_count;
+};
+
+// the camera meshlet_cull.comp tests against, at the start of its draw data buffer
+struct GPUMeshletCullView {
+    glm::vec4 frustum_planes[6];
+    glm::mat4 view_proj;
+    glm::vec4 camera_position;
+};
+
+// per draw input to meshlet_cull.comp, in the same order as the pass's indirect commands
+struct GPUMeshletDrawData {
+    VkDeviceAddress meshlet_buffer_address;
+    VkDeviceAddress index_buffer_address;
+    uint32_t output_first_index; // where the draw's surviving indices start in the compacted index buffer
+    uint32_t cull_meshlets; // 0 keeps every meshlet, see RenderObject::cull_meshlets
+    uint32_t transform_index;
+    uint32_t padding;
+};
+
+// one per meshlet of every draw, each culled by a workgroup of meshlet_cull.comp
+struct GPUMeshletCullEntry {
+    uint32_t draw_index;
+    uint32_t meshlet_index; // into the draw's meshlet buffer
+};
+
+// per draw input to the mesh shading pipelines' task shader, in the same order as the pass's indirect commands
+struct GPUMeshTaskDrawData {
+    VkDeviceAddress meshlet_buffer_address;
+    VkDeviceAddress meshlet_data_buffer_address;
+    uint32_t first_meshlet;
+    uint32_t meshlet_count;
+    uint32_t cull_meshlets; // 0 keeps every meshlet, see RenderObject::cull_meshlets
+    uint32_t padding;
+};
+
+// matches mesh_shading_structures.glsl. Starts like GPUIndirectDrawPushConstants, the mesh shaders read the same draws
+struct GPUMeshTaskPushConstants {
+    VkDeviceAddress transform_buffer_address;
+    VkDeviceAddress draw_data_buffer_address;
+    VkDeviceAddress normal_matrix_buffer_address;
+    VkDeviceAddress mesh_task_draw_data_buffer_address;
+    VkDeviceAddress view_buffer_address; // a GPUMeshletCullView the task shader culls against
+    uint32_t first_command; // of the batch, gl_DrawID counts from it
+    uint32_t padding;
+};
+
+// written by meshlet_cull.comp, read back on the CPU a few frames later
+struct GPUMeshletCullStats {
+    uint32_t meshlet_count;
+    uint32_t frustum_culled_count;
+    uint32_t cone_culled_count;
+    uint32_t occluded_count;
+};
+
+// matches meshlet_cull.comp
+struct GPUMeshletCullPushConstants {
+    VkDeviceAddress draw_data_buffer_address; // a GPUMeshletCullView followed by a GPUMeshletDrawData per draw
+    VkDeviceAddress entry_buffer_address;
+    VkDeviceAddress transform_buffer_address;
+    VkDeviceAddress output_command_buffer_address;
+    VkDeviceAddress output_index_buffer_address;
+    VkDeviceAddress cull_stats_buffer_address;
+    uint32_t entry_count;
+    uint32_t phase; // MeshletCuller::CullPhase
+};
+
+// addresses are what skinning.comp reads/writes through buffer references
+struct SkinningComputePushConstants {
+    VkDeviceAddress source_vertex_buffer_address;
+    VkDeviceAddress skin_vertex_buffer_address;
+    VkDeviceAddress output_vertex_buffer_address;
+    uint32_t vertex_count;
+    uint32_t first_joint; // offset of the instance's palette in the joint matrix buffer
+};
+
 struct ToneMappingComputePushConstants {
     float exposure;
     uint32_t tone_mapping_strategy; // 0 - No Tone Mapping, 1 - Reinhard Tone Mapping
@@ -62,6 +225,12 @@ struct alignas(16) Vertex {
     }
 };
 
+// JOINTS_0/WEIGHTS_0 of a skinned vertex, kept out of Vertex so unskinned meshes don't pay for it
+struct alignas(16) SkinVertex {
+    glm::uvec4 joints = glm::uvec4();
+    glm::vec4 weights = glm::vec4();
+};
+
 struct alignas(16) DeferredLightingTriangleVertex {
     glm::vec3 pos = glm::vec3();
     uint32_t buf = 0;
@@ -71,6 +240,20 @@ struct alignas(16) DeferredLightingTriangleVertex {
 
 // GLTF Loader data structures VVVVVV
 
+// local-space bounds of a surface. Kept as both an AABB (origin +/- extents) and a bounding sphere so culling can
+// pick whichever test is cheaper
+struct Bounds {
+    glm::vec3 origin;
+    float sphere_radius;
+    glm::vec3 extents;
+};
+
+// CPU-side copy of a low-poly surface's geometry, in local space, rasterized by the OcclusionCuller
+struct OccluderMesh {
+    std::vector<glm::vec3> positions;
+    std::vector<uint32_t> indices;
+};
+
 struct SurfaceDrawData {
     uint32_t indexCount;
     uint32_t instanceCount;
@@ -82,11 +265,30 @@ struct SurfaceDrawData {
 
     int materialId;
     std::optional<std::shared_ptr<Material>> material;
+
+    Bounds bounds;
+    std::shared_ptr<OccluderMesh> occluder; // null for surfaces too detailed to be worth rasterizing on the CPU
+
+    // range of the mesh's meshlet buffer covering the surface's indices
+    uint32_t first_meshlet;
+    uint32_t meshlet_count;
 };
 
 struct GLTFMesh {
     std::vector<SurfaceDrawData> draw_datas;
     GPUMeshBuffers mesh_buffers;
+    uint32_t vertex_count;
+
+    // only set up when some primitive of the mesh has JOINTS_0/WEIGHTS_0, one SkinVertex per vertex
+    Buffer skin_vertex_buffer;
+    VkDeviceAddress skin_vertex_buffer_address = 0;
+
+    // a GPUMeshlet per cluster of every surface, 0 when the mesh has no triangles
+    Buffer meshlet_buffer;
+    VkDeviceAddress meshlet_buffer_address = 0;
+    // the meshlets' vertex and triangle lists, see GPUMeshlet::first_data
+    Buffer meshlet_data_buffer;
+    VkDeviceAddress meshlet_data_buffer_address = 0;
 };
 
 // ^^^^ GLTF Loader data structures
@@ -106,7 +308,11 @@ struct MaterialPipeline {
 struct MaterialInstance {
     MaterialPipeline* forward_rendering_pipeline;
     MaterialPipeline* deferred_rendering_geometry_pipeline;
-    VkDescriptorSet material_set;
+    // task/mesh shader variants of the above, null when the device can't mesh shade or the material can't be drawn so
+    MaterialPipeline* forward_mesh_shading_pipeline = nullptr;
+    MaterialPipeline* deferred_mesh_shading_geometry_pipeline = nullptr;
+    VkDescriptorSet material_set; // the bindless set, shared by every material of its GLTFHDRMaterial
+    uint32_t material_index = 0; // slot of the material's constants, see GLTFHDRMaterial
     MaterialPassType pass_type;
 };
 
@@ -121,10 +327,45 @@ struct RenderObject {
 
     MaterialInstance* material;
 
+    Bounds bounds; // local-space, see transform
+    const OccluderMesh* occluder;
     glm::mat4 transform;
     VkDeviceAddress vertex_buffer_address;
+
+    // see MeshletCuller
+    VkDeviceAddress index_buffer_address;
+    VkDeviceAddress meshlet_buffer_address;
+    VkDeviceAddress meshlet_data_buffer_address;
+    uint32_t first_meshlet;
+    uint32_t meshlet_count;
+    bool cull_meshlets; // off for skinned surfaces, whose meshlets are bounded in the bind pose
 };
 
 struct DrawContext {
     std::vector<RenderObject> opaque_surfaces;
+
+    // indices into opaque_surfaces that survived camera culling this frame
+    std::vector<uint32_t> visible_opaque_surfaces;
+    // when set, visible_opaque_surfaces has only been culled on the CPU by occlusion (if at all) and the renderers
+    // frustum cull it on the GPU, see GPUDrawCuller
+    bool cull_opaque_on_gpu = false;
+    // with cull_opaque_on_gpu, also cull what the depth pyramid says is hidden, drawing in two phases
+    bool occlusion_cull_on_gpu = false;
+    // cull the visible surfaces' meshlets and draw their surviving triangles only, see MeshletCuller
+    bool cull_meshlets_on_gpu = false;
+    // draw the opaque surfaces through their materials' mesh shading pipelines, whose task shaders cull the meshlets.
+    // Only set when the device supports VK_EXT_mesh_shader, and instead of the GPU culls above
+    bool draw_with_mesh_shaders = false;
+    // indices into opaque_surfaces inside the shadow-casting light's frustum
+    std::vector<uint32_t> shadow_caster_surfaces;
+
+    // surfaces with MaterialPassType::Transparent, drawn by the weighted blended OIT pass after the opaque ones.
+    // they don't cast shadows, occlude or get picked
+    std::vector<RenderObject> transparent_surfaces;
+    // indices into transparent_surfaces that survived camera culling this frame
+    std::vector<uint32_t> visible_transparent_surfaces;
+
+    // where each list's transforms were written this frame, set by ObjectTransformBuffer::update
+    ObjectTransforms opaque_transforms;
+    ObjectTransforms transparent_transforms;
 };
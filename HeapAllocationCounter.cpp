@@ -0,0 +1,98 @@
+//
+// Created by darby on 3/6/2025.
+//
+
+#include "HeapAllocationCounter.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#if defined(VULKAN_ENGINE_COUNT_HEAP_ALLOCATIONS)
+
+static std::atomic<uint64_t> allocation_count { 0 };
+static thread_local uint64_t thread_allocation_count = 0;
+
+static void* aligned_malloc(std::size_t size, std::size_t alignment) {
+#if defined(_WIN32)
+    return _aligned_malloc(size, alignment);
+#else
+    // aligned_alloc wants the size to be a multiple of the alignment
+    return std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+#endif
+}
+
+static void aligned_free(void* pointer) {
+#if defined(_WIN32)
+    _aligned_free(pointer);
+#else
+    std::free(pointer);
+#endif
+}
+
+// the array and nothrow forms forward to these two by default
+void* operator new(std::size_t size) {
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    thread_allocation_count++;
+    if(void* pointer = std::malloc(size == 0 ? 1 : size)) {
+        return pointer;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment) {
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    thread_allocation_count++;
+    if(void* pointer = aligned_malloc(size == 0 ? 1 : size, static_cast<std::size_t>(alignment))) {
+        return pointer;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* pointer) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, std::size_t) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, std::align_val_t) noexcept {
+    aligned_free(pointer);
+}
+
+void operator delete(void* pointer, std::size_t, std::align_val_t) noexcept {
+    aligned_free(pointer);
+}
+
+namespace heap_allocation_counter {
+    bool is_enabled() {
+        return true;
+    }
+
+    uint64_t get_count() {
+        return allocation_count.load(std::memory_order_relaxed);
+    }
+
+    uint64_t get_thread_count() {
+        return thread_allocation_count;
+    }
+}
+
+#else
+
+namespace heap_allocation_counter {
+    bool is_enabled() {
+        return false;
+    }
+
+    uint64_t get_count() {
+        return 0;
+    }
+
+    uint64_t get_thread_count() {
+        return 0;
+    }
+}
+
+#endif
@@ -0,0 +1,20 @@
+//
+// Created by darby on 3/6/2025.
+//
+
+#pragma once
+
+#include <cstdint>
+
+/*
+ * Counts global operator new calls, for checking that steady state frames stay off the heap. Only built with
+ * VULKAN_ENGINE_COUNT_HEAP_ALLOCATIONS, which replaces the global operator new and delete. Without it the counts are
+ * always 0.
+ */
+namespace heap_allocation_counter {
+    bool is_enabled();
+    // allocations every thread has made since startup
+    uint64_t get_count();
+    // allocations the calling thread has made since startup
+    uint64_t get_thread_count();
+}
@@ -5,8 +5,11 @@
 #include "ImmediateSubmitCommandBuffer.hpp"
 #include "VulkanInitUtility.hpp"
 
+#include <cstring>
 
-void ImmediateSubmitCommandBuffer::init(VkDevice _device, VkQueue _submit_queue, uint32_t queue_family_index) {
+
+void ImmediateSubmitCommandBuffer::init(VkDevice _device, VmaAllocator allocator, VkQueue _submit_queue, uint32_t queue_family_index,
+                                        VkDeviceSize staging_ring_size) {
     this->device = _device;
     this->submit_queue = _submit_queue;
 
@@ -14,36 +17,173 @@ void ImmediateSubmitCommandBuffer::init(VkDevice _device, VkQueue _submit_queue,
     VkCommandPoolCreateInfo command_pool_create_info = vk_init::get_command_pool_create_info(queue_family_index);
     VK_CHECK(vkCreateCommandPool(device, &command_pool_create_info, nullptr, &command_pool));
 
-    // CREATE COMMAND BUFFER
-    VkCommandBufferAllocateInfo command_buffer_allocate_info = vk_init::get_command_buffer_allocate_info(command_pool, 1);
-    VK_CHECK(vkAllocateCommandBuffers(device, &command_buffer_allocate_info, &command_buffer));
+    // CREATE COMMAND BUFFERS, a few so async submissions can be recorded while earlier ones run
+    VkCommandBufferAllocateInfo command_buffer_allocate_info = vk_init::get_command_buffer_allocate_info(command_pool, COMMAND_BUFFER_COUNT);
+    VK_CHECK(vkAllocateCommandBuffers(device, &command_buffer_allocate_info, command_buffers.data()));
+
+    // CREATE TIMELINE SEMAPHORE
+    VkSemaphoreTypeCreateInfo type_info = {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+            .pNext = nullptr,
+            .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+            .initialValue = 0
+    };
+
+    VkSemaphoreCreateInfo semaphore_create_info = {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+            .pNext = &type_info,
+            .flags = 0
+    };
 
-    // CREATE FENCE
-    VkFenceCreateInfo fence_create_info = vk_init::get_fence_create_info(VK_FENCE_CREATE_SIGNALED_BIT);
-    VK_CHECK(vkCreateFence(device, &fence_create_info, nullptr, &fence));
+    VK_CHECK(vkCreateSemaphore(device, &semaphore_create_info, nullptr, &timeline_semaphore));
+
+    // a quarter of the ring per chunk, so a big upload's next chunk can be written while the last is copied
+    staging_ring.init(device, allocator, staging_ring_size);
+    max_chunk_size = staging_ring_size / 4;
 }
 
 void ImmediateSubmitCommandBuffer::submit(std::function<void(VkCommandBuffer)>&& function) {
-    VK_CHECK(vkResetFences(device, 1, &fence));
-    VK_CHECK(vkResetCommandBuffer(command_buffer, 0));
+    wait(submit_async(std::move(function)));
+}
+
+uint64_t ImmediateSubmitCommandBuffer::submit_async(std::function<void(VkCommandBuffer)>&& function) {
+    uint32_t index = next_command_buffer;
+    next_command_buffer = (next_command_buffer + 1) % COMMAND_BUFFER_COUNT;
+
+    wait(command_buffer_values[index]);
+
+    VkCommandBuffer cmd = command_buffers[index];
+    VK_CHECK(vkResetCommandBuffer(cmd, 0));
 
-    VkCommandBuffer cmd = command_buffer;
     VkCommandBufferBeginInfo cmd_begin_info = vk_init::get_command_buffer_begin_info(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
     VK_CHECK(vkBeginCommandBuffer(cmd, &cmd_begin_info));
 
     function(cmd);
 
+    // nothing later waits on the semaphore, so the barrier is what makes this submission's writes visible to them
+    VkMemoryBarrier2 memory_barrier = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+            .pNext = nullptr,
+            .srcStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+            .srcAccessMask = VK_ACCESS_2_MEMORY_WRITE_BIT,
+            .dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+            .dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT
+    };
+
+    VkDependencyInfo dep_info = {
+            .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+            .pNext = nullptr,
+            .memoryBarrierCount = 1,
+            .pMemoryBarriers = &memory_barrier
+    };
+
+    vkCmdPipelineBarrier2(cmd, &dep_info);
+
     VK_CHECK(vkEndCommandBuffer(cmd));
 
+    submitted_value++;
+
     VkCommandBufferSubmitInfo cmd_info = vk_init::get_command_buffer_submit_info(cmd);
-    VkSubmitInfo2 submit_info_2 = vk_init::get_submit_info(&cmd_info, nullptr, nullptr);
+    VkSemaphoreSubmitInfo signal_info = vk_init::get_semaphore_submit_info(VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, timeline_semaphore);
+    signal_info.value = submitted_value;
+    VkSubmitInfo2 submit_info_2 = vk_init::get_submit_info(&cmd_info, nullptr, &signal_info);
 
-    VK_CHECK(vkQueueSubmit2(submit_queue, 1, &submit_info_2, fence));
+    VK_CHECK(vkQueueSubmit2(submit_queue, 1, &submit_info_2, VK_NULL_HANDLE));
 
-    VK_CHECK(vkWaitForFences(device, 1, &fence, true, 10000000000));
+    command_buffer_values[index] = submitted_value;
+    staging_ring.retire(timeline_semaphore, submitted_value);
+
+    return submitted_value;
+}
+
+void ImmediateSubmitCommandBuffer::wait(uint64_t value) {
+    VkSemaphoreWaitInfo wait_info = {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+            .pNext = nullptr,
+            .flags = 0,
+            .semaphoreCount = 1,
+            .pSemaphores = &timeline_semaphore,
+            .pValues = &value
+    };
+    VK_CHECK(vkWaitSemaphores(device, &wait_info, 10000000000));
 }
 
 void ImmediateSubmitCommandBuffer::destroy() {
-    vkDestroyFence(device, fence, nullptr);
+    wait(submitted_value);
+
+    staging_ring.destroy();
+    vkDestroySemaphore(device, timeline_semaphore, nullptr);
     vkDestroyCommandPool(device, command_pool, nullptr);
-}
\ No newline at end of file
+}
+
+void ImmediateSubmitCommandBuffer::upload_to_buffer(const void* data, VkDeviceSize size, VkBuffer dst, VkDeviceSize dst_offset) {
+    const char* source = static_cast<const char*>(data);
+
+    for(VkDeviceSize copied = 0; copied < size;) {
+        VkDeviceSize chunk_size = std::min(size - copied, max_chunk_size);
+
+        StagingRing::Claim staging = staging_ring.claim(chunk_size);
+        memcpy(staging.data, source + copied, chunk_size);
+
+        submit_async([&](VkCommandBuffer cmd) {
+            VkBufferCopy copy {
+                    .srcOffset = staging.offset,
+                    .dstOffset = dst_offset + copied,
+                    .size = chunk_size
+            };
+
+            vkCmdCopyBuffer(cmd, staging.buffer, dst, 1, &copy);
+        });
+
+        copied += chunk_size;
+    }
+}
+
+void ImmediateSubmitCommandBuffer::upload_to_image(const void* data, VkImage image, VkExtent3D extent, uint32_t texel_size,
+                                                   std::function<void(VkCommandBuffer)>&& before_copy,
+                                                   std::function<void(VkCommandBuffer)>&& after_copy) {
+    const char* source = static_cast<const char*>(data);
+    VkDeviceSize row_size = VkDeviceSize(extent.width) * texel_size;
+    ASSERT(row_size <= staging_ring.get_capacity(), "A single image row doesn't fit in the staging ring");
+
+    // chunks are whole rows, so each one is a plain copy into a band of the image
+    uint32_t rows_per_chunk = static_cast<uint32_t>(std::max(max_chunk_size / row_size, VkDeviceSize(1)));
+    uint32_t row_count = extent.height;
+
+    for(uint32_t row = 0; row < row_count;) {
+        uint32_t chunk_rows = std::min(row_count - row, rows_per_chunk);
+        VkDeviceSize chunk_size = row_size * chunk_rows;
+
+        StagingRing::Claim staging = staging_ring.claim(chunk_size);
+        memcpy(staging.data, source + row * row_size, chunk_size);
+
+        bool first_chunk = row == 0;
+        bool last_chunk = row + chunk_rows == row_count;
+
+        submit_async([&](VkCommandBuffer cmd) {
+            if(first_chunk) {
+                before_copy(cmd);
+            }
+
+            VkBufferImageCopy copy_region = {};
+            copy_region.bufferOffset = staging.offset;
+            copy_region.bufferRowLength = 0;
+            copy_region.bufferImageHeight = 0;
+
+            copy_region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            copy_region.imageSubresource.mipLevel = 0;
+            copy_region.imageSubresource.baseArrayLayer = 0;
+            copy_region.imageSubresource.layerCount = 1;
+            copy_region.imageOffset = { 0, static_cast<int32_t>(row), 0 };
+            copy_region.imageExtent = { extent.width, chunk_rows, 1 };
+
+            vkCmdCopyBufferToImage(cmd, staging.buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy_region);
+
+            if(last_chunk) {
+                after_copy(cmd);
+            }
+        });
+
+        row += chunk_rows;
+    }
+}
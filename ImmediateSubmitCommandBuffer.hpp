@@ -5,20 +5,52 @@
 #pragma once
 
 #include "Common.hpp"
-
+#include "StagingRing.hpp"
+
+/*
+ * Records and submits one off command buffers outside of the frame, mostly uploads.
+ *
+ * Submissions signal a timeline semaphore. submit() waits for its value before returning, submit_async() doesn't,
+ * and leaves a full barrier at the end of the command buffer so that later submissions on the queue see its writes.
+ *
+ * Uploads are staged through a persistent StagingRing and don't wait for the copy. Anything bigger than a chunk of
+ * the ring goes over in several submissions.
+ */
 class ImmediateSubmitCommandBuffer {
 
+    static constexpr uint32_t COMMAND_BUFFER_COUNT = 4;
+
     VkDevice device;
     VkQueue submit_queue;
 
-    VkFence fence;
+    VkSemaphore timeline_semaphore;
+    uint64_t submitted_value = 0;
+
     VkCommandPool command_pool;
-    VkCommandBuffer command_buffer;
+    std::array<VkCommandBuffer, COMMAND_BUFFER_COUNT> command_buffers;
+    std::array<uint64_t, COMMAND_BUFFER_COUNT> command_buffer_values = {};
+    uint32_t next_command_buffer = 0;
+
+    StagingRing staging_ring;
+    VkDeviceSize max_chunk_size;
 
 public:
-    void init(VkDevice device, VkQueue submit_queue, uint32_t queue_family_index);
+    void init(VkDevice device, VmaAllocator allocator, VkQueue submit_queue, uint32_t queue_family_index, VkDeviceSize staging_ring_size);
     void submit(std::function<void(VkCommandBuffer)>&& function);
+    // returns the timeline value the submission signals
+    uint64_t submit_async(std::function<void(VkCommandBuffer)>&& function);
+    void wait(uint64_t value);
     void destroy();
 
+    // size bytes of data into dst at dst_offset
+    void upload_to_buffer(const void* data, VkDeviceSize size, VkBuffer dst, VkDeviceSize dst_offset);
+    // tightly packed rows into mip 0 of a 2D image, which has to be in TRANSFER_DST_OPTIMAL for the copies. before_copy
+    // is recorded ahead of the first chunk and after_copy after the last, for the layout transitions around them
+    void upload_to_image(const void* data, VkImage image, VkExtent3D extent, uint32_t texel_size,
+                         std::function<void(VkCommandBuffer)>&& before_copy,
+                         std::function<void(VkCommandBuffer)>&& after_copy);
+
+    StagingRing& get_staging_ring() { return staging_ring; }
+
 };
 
@@ -0,0 +1,214 @@
+//
+// Created by darby on 3/1/2025.
+//
+
+#include "IndirectDrawBuilder.hpp"
+
+const MaterialPipeline* IndirectDrawBuilder::get_pass_pipeline(const MaterialInstance& material, DrawPass pass) {
+    if(pass == DrawPass::DeferredGeometry) {
+        return material.deferred_rendering_geometry_pipeline;
+    }
+    return material.forward_rendering_pipeline;
+}
+
+const MaterialPipeline* IndirectDrawBuilder::get_pass_mesh_shading_pipeline(const MaterialInstance& material, DrawPass pass) {
+    if(pass == DrawPass::DeferredGeometry) {
+        return material.deferred_mesh_shading_geometry_pipeline;
+    }
+    if(pass == DrawPass::Forward) {
+        return material.forward_mesh_shading_pipeline;
+    }
+    return nullptr;
+}
+
+void IndirectDrawBuilder::init(VkDevice device, VmaAllocator allocator) {
+    // the commands are also read as storage when the GPU culls them
+    command_buffers.init(device, allocator, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                         VMA_MEMORY_USAGE_CPU_TO_GPU, "Indirect Command Buffer");
+    draw_data_buffers.init(device, allocator, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                           VMA_MEMORY_USAGE_CPU_TO_GPU, "Indirect Draw Data Buffer");
+    task_command_buffers.init(device, allocator, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU, "Mesh Task Command Buffer");
+    task_draw_data_buffers.init(device, allocator, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                                VMA_MEMORY_USAGE_CPU_TO_GPU, "Mesh Task Draw Data Buffer");
+    view_buffers.init(device, allocator, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                      VMA_MEMORY_USAGE_CPU_TO_GPU, "Mesh Task View Buffer");
+}
+
+void IndirectDrawBuilder::destroy() {
+    command_buffers.destroy();
+    draw_data_buffers.destroy();
+    task_command_buffers.destroy();
+    task_draw_data_buffers.destroy();
+    view_buffers.destroy();
+}
+
+void IndirectDrawBuilder::build(const std::vector<RenderObject>& objects,
+                                const std::vector<uint32_t>& draw_indices,
+                                const ObjectTransforms& object_transforms,
+                                DrawPass pass,
+                                TimelineDeletionQueue& gpu_deletion_queue,
+                                const GPUMeshletCullView* mesh_shading_view) {
+    // the deferred geometry layout is (scene, material), the forward ones (scene, light, shadow map, material)
+    material_set_index = pass == DrawPass::DeferredGeometry ? 1 : 3;
+    push_constant_stages = pass == DrawPass::DeferredGeometry ? VK_SHADER_STAGE_VERTEX_BIT : VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+
+    batches.clear();
+    culled_command_buffer = VK_NULL_HANDLE;
+    draw_count_buffer = VK_NULL_HANDLE;
+    meshlet_index_buffer = VK_NULL_HANDLE;
+    mesh_task_command_buffer = VK_NULL_HANDLE;
+    first_object_index = object_transforms.first_object_index;
+    command_count = static_cast<uint32_t>(draw_indices.size());
+    triangle_count = 0;
+
+    if(command_count == 0) {
+        return;
+    }
+
+    RecyclingBuffer::Slot& command_buffer = command_buffers.acquire(command_count * sizeof(VkDrawIndexedIndirectCommand), gpu_deletion_queue);
+    RecyclingBuffer::Slot& draw_data_buffer = draw_data_buffers.acquire(command_count * sizeof(GPUDrawData), gpu_deletion_queue);
+
+    draw_command_buffer = command_buffer.buffer.buffer;
+    command_buffer_address = command_buffer.address;
+    push_constants.transform_buffer_address = object_transforms.transform_buffer_address;
+    push_constants.draw_data_buffer_address = draw_data_buffer.address;
+    push_constants.normal_matrix_buffer_address = object_transforms.normal_matrix_buffer_address;
+
+    VkDrawIndexedIndirectCommand* commands = (VkDrawIndexedIndirectCommand*) command_buffer.buffer.info.pMappedData;
+    GPUDrawData* draw_datas = (GPUDrawData*) draw_data_buffer.buffer.info.pMappedData;
+
+    VkDrawMeshTasksIndirectCommandEXT* mesh_task_commands = nullptr;
+    GPUMeshTaskDrawData* mesh_task_draw_datas = nullptr;
+    if(mesh_shading_view != nullptr) {
+        RecyclingBuffer::Slot& task_command_buffer = task_command_buffers.acquire(command_count * sizeof(VkDrawMeshTasksIndirectCommandEXT), gpu_deletion_queue);
+        RecyclingBuffer::Slot& task_draw_data_buffer = task_draw_data_buffers.acquire(command_count * sizeof(GPUMeshTaskDrawData), gpu_deletion_queue);
+        RecyclingBuffer::Slot& view_buffer = view_buffers.acquire(sizeof(GPUMeshletCullView), gpu_deletion_queue);
+
+        mesh_task_command_buffer = task_command_buffer.buffer.buffer;
+        mesh_task_push_constants = {
+                .transform_buffer_address = push_constants.transform_buffer_address,
+                .draw_data_buffer_address = push_constants.draw_data_buffer_address,
+                .normal_matrix_buffer_address = push_constants.normal_matrix_buffer_address,
+                .mesh_task_draw_data_buffer_address = task_draw_data_buffer.address,
+                .view_buffer_address = view_buffer.address,
+                .first_command = 0,
+                .padding = 0
+        };
+
+        *(GPUMeshletCullView*) view_buffer.buffer.info.pMappedData = *mesh_shading_view;
+        mesh_task_commands = (VkDrawMeshTasksIndirectCommandEXT*) task_command_buffer.buffer.info.pMappedData;
+        mesh_task_draw_datas = (GPUMeshTaskDrawData*) task_draw_data_buffer.buffer.info.pMappedData;
+    }
+
+    for(uint32_t i = 0; i < command_count; i++) {
+        const RenderObject& draw = objects[draw_indices[i]];
+        const MaterialPipeline* pipeline = get_pass_pipeline(*draw.material, pass);
+
+        // mesh shaders draw meshlets, a mesh without any has no triangles to draw either way
+        bool mesh_tasks = false;
+        if(mesh_shading_view != nullptr && draw.meshlet_buffer_address != 0) {
+            const MaterialPipeline* mesh_shading_pipeline = get_pass_mesh_shading_pipeline(*draw.material, pass);
+            if(mesh_shading_pipeline != nullptr) {
+                pipeline = mesh_shading_pipeline;
+                mesh_tasks = true;
+            }
+        }
+
+        if(batches.empty()
+           || batches.back().pipeline != pipeline
+           || batches.back().material_set != draw.material->material_set
+           || batches.back().index_buffer != draw.index_buffer) {
+            batches.push_back({
+                    .pipeline = pipeline,
+                    .material_set = draw.material->material_set,
+                    .index_buffer = draw.index_buffer,
+                    .first_command = i,
+                    .command_count = 0,
+                    .mesh_tasks = mesh_tasks
+            });
+        }
+        batches.back().command_count++;
+
+        if(mesh_task_commands != nullptr) {
+            // a draw left to the vertex pipeline still takes its slot, it just launches nothing
+            uint32_t task_count = mesh_tasks ? (draw.meshlet_count + MESH_TASK_WORKGROUP_SIZE - 1) / MESH_TASK_WORKGROUP_SIZE : 0;
+            mesh_task_commands[i] = {
+                    .groupCountX = task_count,
+                    .groupCountY = 1,
+                    .groupCountZ = 1
+            };
+
+            mesh_task_draw_datas[i] = {
+                    .meshlet_buffer_address = draw.meshlet_buffer_address,
+                    .meshlet_data_buffer_address = draw.meshlet_data_buffer_address,
+                    .first_meshlet = draw.first_meshlet,
+                    .meshlet_count = draw.meshlet_count,
+                    .cull_meshlets = draw.cull_meshlets ? 1u : 0u,
+                    .padding = 0
+            };
+        }
+
+        commands[i] = {
+                .indexCount = draw.index_count,
+                .instanceCount = 1,
+                .firstIndex = draw.first_index,
+                .vertexOffset = 0,
+                .firstInstance = i
+        };
+
+        draw_datas[i] = {
+                .transform_index = get_transform_index(draw_indices[i]),
+                .material_index = draw.material->material_index,
+                .vertex_buffer_address = draw.vertex_buffer_address
+        };
+
+        triangle_count += draw.index_count / 3;
+    }
+}
+
+void IndirectDrawBuilder::record_batch(CommandEncoder& encoder, uint32_t batch_index) const {
+    const IndirectBatch& batch = batches[batch_index];
+
+    encoder.bind_pipeline(batch.pipeline->pipeline);
+    encoder.bind_descriptor_set(batch.pipeline->layout, material_set_index, batch.material_set);
+
+    if(batch.mesh_tasks) {
+        // gl_DrawID restarts at every draw call, the task shader adds it to the batch's first slot
+        GPUMeshTaskPushConstants batch_push_constants = mesh_task_push_constants;
+        batch_push_constants.first_command = batch.first_command;
+        encoder.push_constants(batch.pipeline->layout, VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_MESH_BIT_EXT,
+                               0, sizeof(GPUMeshTaskPushConstants), &batch_push_constants);
+
+        encoder.draw_mesh_tasks_indirect(mesh_task_command_buffer, batch.first_command * sizeof(VkDrawMeshTasksIndirectCommandEXT),
+                                         batch.command_count, sizeof(VkDrawMeshTasksIndirectCommandEXT));
+        return;
+    }
+
+    encoder.bind_index_buffer(meshlet_index_buffer != VK_NULL_HANDLE ? meshlet_index_buffer : batch.index_buffer, 0, VK_INDEX_TYPE_UINT32);
+    encoder.push_constants(batch.pipeline->layout, push_constant_stages, 0, sizeof(GPUIndirectDrawPushConstants), &push_constants);
+
+    if(draw_count_buffer != VK_NULL_HANDLE) {
+        // the batch's commands were compacted to the front of its range, the rest of it is stale
+        encoder.draw_indexed_indirect_count(culled_command_buffer, batch.first_command * sizeof(VkDrawIndexedIndirectCommand),
+                                            draw_count_buffer, batch_index * sizeof(uint32_t),
+                                            batch.command_count, sizeof(VkDrawIndexedIndirectCommand));
+        return;
+    }
+
+    encoder.draw_indexed_indirect(draw_command_buffer, batch.first_command * sizeof(VkDrawIndexedIndirectCommand),
+                                  batch.command_count, sizeof(VkDrawIndexedIndirectCommand));
+}
+
+void IndirectDrawBuilder::use_draw_counts(VkBuffer _culled_command_buffer, VkBuffer _draw_count_buffer) {
+    culled_command_buffer = _culled_command_buffer;
+    draw_count_buffer = _draw_count_buffer;
+}
+
+void IndirectDrawBuilder::use_meshlet_commands(VkBuffer _command_buffer, VkDeviceAddress _command_buffer_address, VkBuffer index_buffer) {
+    draw_command_buffer = _command_buffer;
+    command_buffer_address = _command_buffer_address;
+    meshlet_index_buffer = index_buffer;
+
+    culled_command_buffer = VK_NULL_HANDLE;
+    draw_count_buffer = VK_NULL_HANDLE;
+}
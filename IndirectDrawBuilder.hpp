@@ -0,0 +1,117 @@
+//
+// Created by darby on 3/1/2025.
+//
+
+#pragma once
+
+#include "Common.hpp"
+#include "GraphicsTypes.hpp"
+#include "Buffer.hpp"
+#include "DeletionQueue.hpp"
+#include "TimelineDeletionQueue.hpp"
+#include "RecyclingBuffer.hpp"
+#include "DrawSorter.hpp"
+#include "CommandEncoder.hpp"
+
+// draws sharing a pipeline, material set and index buffer, submitted with one vkCmdDrawIndexedIndirect(Count)
+struct IndirectBatch {
+    const MaterialPipeline* pipeline;
+    VkDescriptorSet material_set;
+    VkBuffer index_buffer;
+    uint32_t first_command;
+    uint32_t command_count;
+    bool mesh_tasks; // pipeline is a mesh shading one, drawn with vkCmdDrawMeshTasksIndirectEXT instead
+};
+
+/*
+ * Turns a pass's sorted draw list into GPU draw commands, so the CPU records one indirect draw per state change
+ * rather than a push constant and a draw per surface.
+ *
+ * Every frame build() writes, into persistently mapped buffers recycled once the GPU is done with the frame:
+ *   - a VkDrawIndexedIndirectCommand per draw, firstInstance set to the draw's slot
+ *   - a GPUDrawData per draw (object index, material index and vertex buffer address), read with gl_InstanceIndex
+ * and splits the draws into IndirectBatches wherever the bound state has to change. DrawSorter order keeps the
+ * batches as long as they can be. Transforms aren't copied, the shaders read them from the ObjectTransformBuffer at
+ * GPUDrawData::transform_index.
+ *
+ * A MeshletCuller can replace the commands and every batch's index buffer with the meshlets that survive it, and a
+ * GPUDrawCuller can then compact the commands into a buffer of its own, in which case each batch is drawn with
+ * vkCmdDrawIndexedIndirectCount from its range of that buffer instead.
+ *
+ * Given a mesh shading view, draws whose material has a mesh shading pipeline for the pass are drawn with that instead.
+ * Their commands are VkDrawMeshTasksIndirectCommandEXTs launching a task workgroup per MESH_TASK_WORKGROUP_SIZE
+ * meshlets, each culling its meshlets against the view and launching a mesh workgroup per survivor. Neither culler
+ * applies to those batches, the task shader is their cull.
+ */
+class IndirectDrawBuilder {
+
+public:
+    static constexpr uint32_t MESH_TASK_WORKGROUP_SIZE = 32; // local_size_x in meshlet_draw.task
+
+    void init(VkDevice device, VmaAllocator allocator);
+    // the device must be idle
+    void destroy();
+
+    // object_transforms are where objects' transforms are this frame. mesh_shading_view, when given, draws what can be
+    // through the materials' mesh shading pipelines
+    void build(const std::vector<RenderObject>& objects,
+               const std::vector<uint32_t>& draw_indices,
+               const ObjectTransforms& object_transforms,
+               DrawPass pass,
+               TimelineDeletionQueue& gpu_deletion_queue,
+               const GPUMeshletCullView* mesh_shading_view = nullptr);
+
+    // binds the batch's pipeline, material set and index buffer and draws it. Scene-wide descriptor sets are left to the caller
+    void record_batch(CommandEncoder& encoder, uint32_t batch_index) const;
+
+    // draw from culled_command_buffer, batch i's draw count being the i'th uint32 of draw_count_buffer. Until the next build()
+    void use_draw_counts(VkBuffer culled_command_buffer, VkBuffer draw_count_buffer);
+
+    // draw the commands in command_buffer, one per draw like the built ones, with every batch's indices read from
+    // index_buffer. Forgets any draw counts, they were over the old commands. Until the next build()
+    void use_meshlet_commands(VkBuffer command_buffer, VkDeviceAddress command_buffer_address, VkBuffer index_buffer);
+
+    const std::vector<IndirectBatch>& get_batches() const { return batches; }
+    uint32_t get_command_count() const { return command_count; }
+    uint32_t get_triangle_count() const { return triangle_count; }
+    VkDeviceAddress get_command_buffer_address() const { return command_buffer_address; }
+    VkDeviceAddress get_transform_buffer_address() const { return push_constants.transform_buffer_address; }
+    // where objects[i]'s transform is in the transform buffer
+    uint32_t get_transform_index(uint32_t object_index) const { return first_object_index + object_index; }
+
+    // the pipeline a material draws with in the given pass
+    static const MaterialPipeline* get_pass_pipeline(const MaterialInstance& material, DrawPass pass);
+    // its mesh shading variant, null if it has none
+    static const MaterialPipeline* get_pass_mesh_shading_pipeline(const MaterialInstance& material, DrawPass pass);
+
+private:
+    std::vector<IndirectBatch> batches;
+
+    RecyclingBuffer command_buffers;
+    RecyclingBuffer draw_data_buffers;
+    RecyclingBuffer task_command_buffers;
+    RecyclingBuffer task_draw_data_buffers;
+    RecyclingBuffer view_buffers;
+
+    // the commands drawn, and read by the GPU cull. The built ones unless use_meshlet_commands says otherwise
+    VkBuffer draw_command_buffer;
+    VkDeviceAddress command_buffer_address;
+    VkBuffer meshlet_index_buffer = VK_NULL_HANDLE;
+    GPUIndirectDrawPushConstants push_constants;
+
+    // only built with a mesh shading view, a VkDrawMeshTasksIndirectCommandEXT per draw in the same slots as the commands
+    VkBuffer mesh_task_command_buffer = VK_NULL_HANDLE;
+    GPUMeshTaskPushConstants mesh_task_push_constants;
+
+    // set by use_draw_counts
+    VkBuffer culled_command_buffer = VK_NULL_HANDLE;
+    VkBuffer draw_count_buffer = VK_NULL_HANDLE;
+
+    // where the pass's pipeline layouts expect the material and push constants
+    uint32_t material_set_index;
+    VkShaderStageFlags push_constant_stages;
+
+    uint32_t first_object_index = 0;
+    uint32_t command_count = 0;
+    uint32_t triangle_count = 0;
+};
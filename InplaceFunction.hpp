@@ -0,0 +1,122 @@
+//
+// Created by darby on 3/6/2025.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+/*
+ * Stand-ins for std::function on the per frame paths, neither ever touches the heap.
+ *
+ * FunctionRef only points at a callable the caller owns, for callbacks that are done with before the function taking
+ * them returns, like a parallel_for body. InplaceFunction owns its callable, moved into a buffer of Capacity bytes
+ * inside itself. A callable that doesn't fit is a compile error rather than an allocation, capture less or capture
+ * by reference.
+ */
+template<typename Signature>
+class FunctionRef;
+
+template<typename R, typename... Args>
+class FunctionRef<R(Args...)> {
+
+public:
+    template<typename F>
+    requires (!std::is_same_v<std::remove_cvref_t<F>, FunctionRef>) && std::is_invocable_r_v<R, F&, Args...>
+    FunctionRef(F&& function)
+        : object(const_cast<void*>(static_cast<const void*>(std::addressof(function)))),
+          call([](void* object, Args... args) -> R {
+              return std::invoke(*static_cast<std::remove_reference_t<F>*>(object), std::forward<Args>(args)...);
+          }) {}
+
+    R operator()(Args... args) const {
+        return call(object, std::forward<Args>(args)...);
+    }
+
+private:
+    void* object;
+    R (*call)(void* object, Args... args);
+};
+
+template<typename Signature, size_t Capacity>
+class InplaceFunction;
+
+template<typename R, typename... Args, size_t Capacity>
+class InplaceFunction<R(Args...), Capacity> {
+
+public:
+    InplaceFunction() = default;
+
+    template<typename F>
+    requires (!std::is_same_v<std::decay_t<F>, InplaceFunction>) && std::is_invocable_r_v<R, std::decay_t<F>&, Args...>
+    InplaceFunction(F&& function) {
+        using Callable = std::decay_t<F>;
+        static_assert(sizeof(Callable) <= Capacity, "callable doesn't fit in the InplaceFunction, capture less");
+        static_assert(alignof(Callable) <= alignof(std::max_align_t), "callable is over aligned for an InplaceFunction");
+
+        new (storage) Callable(std::forward<F>(function));
+        call = [](void* storage, Args... args) -> R {
+            return std::invoke(*static_cast<Callable*>(storage), std::forward<Args>(args)...);
+        };
+        relocate = [](void* destination, void* source) {
+            if(destination != nullptr) {
+                new (destination) Callable(std::move(*static_cast<Callable*>(source)));
+            }
+            static_cast<Callable*>(source)->~Callable();
+        };
+    }
+
+    InplaceFunction(InplaceFunction&& other) noexcept {
+        take(other);
+    }
+
+    InplaceFunction& operator=(InplaceFunction&& other) noexcept {
+        if(this != &other) {
+            reset();
+            take(other);
+        }
+        return *this;
+    }
+
+    InplaceFunction(const InplaceFunction&) = delete;
+    InplaceFunction& operator=(const InplaceFunction&) = delete;
+
+    ~InplaceFunction() {
+        reset();
+    }
+
+    explicit operator bool() const { return call != nullptr; }
+
+    R operator()(Args... args) {
+        return call(storage, std::forward<Args>(args)...);
+    }
+
+    void reset() {
+        if(relocate != nullptr) {
+            relocate(nullptr, storage);
+        }
+        call = nullptr;
+        relocate = nullptr;
+    }
+
+private:
+    // moves other's callable into this one, leaving other empty
+    void take(InplaceFunction& other) {
+        if(other.relocate != nullptr) {
+            other.relocate(storage, other.storage);
+        }
+        call = other.call;
+        relocate = other.relocate;
+        other.call = nullptr;
+        other.relocate = nullptr;
+    }
+
+    alignas(std::max_align_t) std::byte storage[Capacity];
+    R (*call)(void* storage, Args... args) = nullptr;
+    // moves the callable in source to destination, if given, then destroys the one in source
+    void (*relocate)(void* destination, void* source) = nullptr;
+};
@@ -0,0 +1,143 @@
+//
+// Created by darby on 2/18/2025.
+//
+
+#include "JobSystem.hpp"
+
+static thread_local uint32_t current_thread_index = 0;
+
+void JobSystem::init(uint32_t worker_count) {
+    if(worker_count == 0) {
+        uint32_t hardware_threads = std::thread::hardware_concurrency();
+        worker_count = hardware_threads > 1 ? hardware_threads - 1 : 1;
+    }
+
+    stopping = false;
+    workers.reserve(worker_count);
+    for(uint32_t i = 0; i < worker_count; i++) {
+        workers.emplace_back(&JobSystem::worker_loop, this, i + 1);
+    }
+}
+
+void JobSystem::shutdown() {
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        stopping = true;
+    }
+    queue_condition.notify_all();
+
+    for(std::thread& worker : workers) {
+        worker.join();
+    }
+
+    workers.clear();
+}
+
+void JobSystem::submit(JobFunction&& job, JobCounter& counter) {
+    counter.pending.fetch_add(1, std::memory_order_relaxed);
+
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        push_job({ std::move(job), &counter });
+    }
+    queue_condition.notify_one();
+}
+
+void JobSystem::wait(JobCounter& counter) {
+    while(counter.pending.load(std::memory_order_acquire) != 0) {
+        if(!try_run_one_job()) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+void JobSystem::parallel_for(uint32_t count, uint32_t batch_size, FunctionRef<void(uint32_t, uint32_t)> fn) {
+    if(count == 0) {
+        return;
+    }
+
+    // not worth waking anyone up for a single batch
+    if(count <= batch_size || workers.empty()) {
+        fn(0, count);
+        return;
+    }
+
+    JobCounter counter;
+    for(uint32_t start = batch_size; start < count; start += batch_size) {
+        uint32_t end = std::min(start + batch_size, count);
+        submit([&fn, start, end]() { fn(start, end); }, counter);
+    }
+
+    // the calling thread takes the first batch itself
+    fn(0, batch_size);
+
+    wait(counter);
+}
+
+uint32_t JobSystem::get_thread_count() const {
+    return static_cast<uint32_t>(workers.size()) + 1;
+}
+
+uint32_t JobSystem::get_thread_index() {
+    return current_thread_index;
+}
+
+void JobSystem::worker_loop(uint32_t thread_index) {
+    current_thread_index = thread_index;
+
+    while(true) {
+        Job job;
+
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            queue_condition.wait(lock, [this]() { return stopping || queue_count != 0; });
+
+            if(stopping && queue_count == 0) {
+                return;
+            }
+
+            job = pop_job();
+        }
+
+        job.function();
+        job.counter->pending.fetch_sub(1, std::memory_order_release);
+    }
+}
+
+bool JobSystem::try_run_one_job() {
+    Job job;
+
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        if(queue_count == 0) {
+            return false;
+        }
+
+        job = pop_job();
+    }
+
+    job.function();
+    job.counter->pending.fetch_sub(1, std::memory_order_release);
+    return true;
+}
+
+void JobSystem::push_job(Job&& job) {
+    if(queue_count == queue.size()) {
+        std::vector<Job> grown(std::max(queue.size() * 2, size_t(64)));
+        for(size_t i = 0; i < queue_count; i++) {
+            grown[i] = std::move(queue[(queue_head + i) % queue.size()]);
+        }
+        queue.swap(grown);
+        queue_head = 0;
+    }
+
+    queue[(queue_head + queue_count) % queue.size()] = std::move(job);
+    queue_count++;
+}
+
+JobSystem::Job JobSystem::pop_job() {
+    Job job = std::move(queue[queue_head]);
+    queue_head = (queue_head + 1) % queue.size();
+    queue_count--;
+    return job;
+}
@@ -0,0 +1,71 @@
+//
+// Created by darby on 2/18/2025.
+//
+
+#pragma once
+
+#include "Common.hpp"
+#include "InplaceFunction.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// Counts the outstanding jobs of a group of submissions. Wait on it with JobSystem::wait.
+struct JobCounter {
+    std::atomic<uint32_t> pending { 0 };
+};
+
+/*
+ * A small fixed-size thread pool.
+ * Jobs are pulled off a single shared queue. A thread waiting on a JobCounter helps run queued jobs until its counter
+ * hits zero, so jobs may submit and wait on jobs of their own without deadlocking the pool.
+ *
+ * Nothing here allocates once the queue has grown to the most jobs ever queued at once. Jobs are stored inline and
+ * the queue is a ring over a vector, parallel_for bodies are only referenced.
+ */
+class JobSystem {
+
+public:
+    // worker_count of 0 uses one worker per hardware thread, minus the main thread
+    void init(uint32_t worker_count = 0);
+    void shutdown();
+
+    // a job's captures have to fit in this many bytes
+    static constexpr size_t MAX_JOB_SIZE = 48;
+    using JobFunction = InplaceFunction<void(), MAX_JOB_SIZE>;
+
+    void submit(JobFunction&& job, JobCounter& counter);
+    void wait(JobCounter& counter);
+
+    // splits [0, count) into batches of batch_size and runs fn(start, end) on each, returning once all have finished
+    void parallel_for(uint32_t count, uint32_t batch_size, FunctionRef<void(uint32_t start, uint32_t end)> fn);
+
+    uint32_t get_thread_count() const;
+
+    // 0 on the main thread, 1..worker count on the workers
+    static uint32_t get_thread_index();
+
+private:
+    struct Job {
+        JobFunction function;
+        JobCounter* counter;
+    };
+
+    void worker_loop(uint32_t thread_index);
+    bool try_run_one_job();
+
+    // queue_mutex must be held
+    void push_job(Job&& job);
+    Job pop_job();
+
+    std::vector<std::thread> workers;
+    // FIFO ring, only grows
+    std::vector<Job> queue;
+    size_t queue_head = 0;
+    size_t queue_count = 0;
+    std::mutex queue_mutex;
+    std::condition_variable queue_condition;
+    bool stopping = false;
+};
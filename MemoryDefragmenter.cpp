@@ -0,0 +1,355 @@
+//
+// Created by darby on 3/6/2025.
+//
+
+#include "MemoryDefragmenter.hpp"
+#include "VulkanInitUtility.hpp"
+#include "VulkanImageUtility.hpp"
+#include "VulkanGeneralUtility.hpp"
+
+#include <algorithm>
+
+void MemoryDefragmenter::init(VkDevice _device, VmaAllocator _allocator, ImmediateSubmitCommandBuffer& _immediate_submit_command_buffer,
+                              GLTFHDRMaterial& _material_creator) {
+    device = _device;
+    allocator = _allocator;
+    immediate_submit_command_buffer = &_immediate_submit_command_buffer;
+    material_creator = &_material_creator;
+}
+
+void MemoryDefragmenter::destroy() {
+    // no pass is ever left open between frames, so this only has to close the defragmentation
+    if(context != VK_NULL_HANDLE) {
+        vmaEndDefragmentation(allocator, context, nullptr);
+        context = VK_NULL_HANDLE;
+    }
+
+    files.clear();
+}
+
+void MemoryDefragmenter::add_file(const std::shared_ptr<GLTFFile>& file) {
+    files.push_back(file);
+}
+
+void MemoryDefragmenter::update(DrawContext& draw_context, TimelineDeletionQueue& timeline, EngineStats& stats) {
+    stats.defragmentation_moved_count = 0;
+
+    if(context == VK_NULL_HANDLE) {
+        frames_since_check++;
+        bool check_due = settings.enabled && frames_since_check >= settings.check_interval;
+
+        if(requested || check_due) {
+            frames_since_check = 0;
+
+            Fragmentation fragmentation = measure();
+            fragmentation_ratio = fragmentation.ratio;
+
+            if(requested || (fragmentation.ratio >= settings.fragmentation_threshold && fragmentation.free_size >= settings.min_free_size)) {
+                requested = false;
+                begin();
+            }
+        }
+    }
+
+    if(context != VK_NULL_HANDLE) {
+        run_pass(draw_context, timeline, stats);
+    }
+
+    stats.defragmentation_fragmentation = fragmentation_ratio;
+    stats.defragmentation_pass_count = static_cast<int>(pass_count);
+    stats.defragmentation_mb_moved = static_cast<float>(bytes_moved) / (1024.f * 1024.f);
+}
+
+MemoryDefragmenter::Fragmentation MemoryDefragmenter::measure() const {
+    VmaTotalStatistics statistics;
+    vmaCalculateStatistics(allocator, &statistics);
+
+    const VkPhysicalDeviceMemoryProperties* memory_properties;
+    vmaGetMemoryProperties(allocator, &memory_properties);
+
+    Fragmentation fragmentation = {};
+    for(uint32_t heap = 0; heap < memory_properties->memoryHeapCount; heap++) {
+        if((memory_properties->memoryHeaps[heap].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) == 0) {
+            continue;
+        }
+
+        const VmaDetailedStatistics& heap_statistics = statistics.memoryHeap[heap];
+        fragmentation.free_size += heap_statistics.statistics.blockBytes - heap_statistics.statistics.allocationBytes;
+        fragmentation.largest_free_range = std::max(fragmentation.largest_free_range, heap_statistics.unusedRangeSizeMax);
+    }
+
+    if(fragmentation.free_size > 0) {
+        fragmentation.ratio = 1.f - static_cast<float>(fragmentation.largest_free_range) / static_cast<float>(fragmentation.free_size);
+    }
+
+    return fragmentation;
+}
+
+void MemoryDefragmenter::begin() {
+    // every default pool, whatever isn't ours is skipped per move
+    VmaDefragmentationInfo defragmentation_info = {
+            .flags = VMA_DEFRAGMENTATION_FLAG_ALGORITHM_BALANCED_BIT,
+            .pool = VK_NULL_HANDLE,
+            .maxBytesPerPass = settings.max_bytes_per_pass,
+            .maxAllocationsPerPass = settings.max_moves_per_pass
+    };
+
+    VK_CHECK(vmaBeginDefragmentation(allocator, &defragmentation_info, &context));
+    session_pass_count = 0;
+
+    fmt::print("defragmenting device memory, {:.1f}% fragmented\n", fragmentation_ratio * 100.f);
+}
+
+void MemoryDefragmenter::end() {
+    VmaDefragmentationStats defragmentation_stats;
+    vmaEndDefragmentation(allocator, context, &defragmentation_stats);
+    context = VK_NULL_HANDLE;
+
+    fragmentation_ratio = measure().ratio;
+    fmt::print("defragmentation done after {} passes: {} allocations moved ({:.1f} MB), {} memory blocks freed ({:.1f} MB), {:.1f}% fragmented\n",
+               session_pass_count, defragmentation_stats.allocationsMoved,
+               static_cast<float>(defragmentation_stats.bytesMoved) / (1024.f * 1024.f),
+               defragmentation_stats.deviceMemoryBlocksFreed,
+               static_cast<float>(defragmentation_stats.bytesFreed) / (1024.f * 1024.f),
+               fragmentation_ratio * 100.f);
+}
+
+void MemoryDefragmenter::run_pass(DrawContext& draw_context, TimelineDeletionQueue& timeline, EngineStats& stats) {
+    // the pass frees the moved allocations' old memory for reuse, nothing in flight may still be reading it
+    uint64_t last_submitted_value = timeline.get_pending_value() - 1;
+    if(last_submitted_value > timeline.get_completed_value()) {
+        VkSemaphore timeline_semaphore = timeline.get_semaphore();
+        VkSemaphoreWaitInfo wait_info = {
+                .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+                .pNext = nullptr,
+                .flags = 0,
+                .semaphoreCount = 1,
+                .pSemaphores = &timeline_semaphore,
+                .pValues = &last_submitted_value
+        };
+        VK_CHECK(vkWaitSemaphores(device, &wait_info, UINT64_MAX));
+    }
+
+    Fragmentation before = measure();
+
+    VmaDefragmentationPassMoveInfo pass;
+    VkResult begin_result = vmaBeginDefragmentationPass(allocator, context, &pass);
+    if(begin_result == VK_SUCCESS) {
+        end(); // nothing left worth moving
+        return;
+    }
+    ASSERT(begin_result == VK_INCOMPLETE, "Failed to begin a defragmentation pass");
+
+    gather_movable_resources();
+    moved_buffers.clear();
+    moved_images.clear();
+    VkDeviceSize pass_bytes_moved = 0;
+
+    // 1, a new resource in each move's destination, or the move is skipped
+    for(uint32_t i = 0; i < pass.moveCount; i++) {
+        VmaDefragmentationMove& move = pass.pMoves[i];
+
+        auto resource_iterator = movable_resources.find(move.srcAllocation);
+        if(resource_iterator == movable_resources.end()) {
+            move.operation = VMA_DEFRAGMENTATION_MOVE_OPERATION_IGNORE;
+            continue;
+        }
+
+        const MovableResource& resource = resource_iterator->second;
+        if(resource.buffer != nullptr) {
+            VkBufferCreateInfo buffer_create_info = {
+                    .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+                    .pNext = nullptr,
+                    .size = resource.buffer->size,
+                    .usage = resource.buffer->usage
+            };
+
+            VkBuffer new_buffer;
+            VK_CHECK(vkCreateBuffer(device, &buffer_create_info, nullptr, &new_buffer));
+            VK_CHECK(vmaBindBufferMemory(allocator, move.dstTmpAllocation, new_buffer));
+
+            moved_buffers.push_back({ resource.buffer, resource.buffer_address, new_buffer });
+        } else {
+            AllocatedImage& image = *resource.image;
+
+            // what every loaded texture is created with, see AllocatedImage::init_with_data
+            VkImageCreateInfo image_create_info = vk_init::get_image_create_info(image.format,
+                                                                                 VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+                                                                                 image.extent);
+            image_create_info.mipLevels = image.mip_levels;
+
+            VkImage new_image;
+            VK_CHECK(vkCreateImage(device, &image_create_info, nullptr, &new_image));
+            VK_CHECK(vmaBindImageMemory(allocator, move.dstTmpAllocation, new_image));
+
+            moved_images.push_back({ resource.image, new_image });
+        }
+
+        VmaAllocationInfo allocation_info;
+        vmaGetAllocationInfo(allocator, move.srcAllocation, &allocation_info);
+        pass_bytes_moved += allocation_info.size;
+    }
+
+    // 2, copy everything over and wait for it
+    if(!moved_buffers.empty() || !moved_images.empty()) {
+        immediate_submit_command_buffer->submit([&](VkCommandBuffer cmd) {
+            record_copies(cmd);
+        });
+    }
+
+    // 3, point everything at the new resources. The old ones have to go before the pass ends
+    moved_buffer_handles.clear();
+    moved_buffer_addresses.clear();
+    for(const MovedBuffer& moved : moved_buffers) {
+        moved_buffer_handles[moved.buffer->buffer] = moved.new_buffer;
+
+        vkDestroyBuffer(device, moved.buffer->buffer, nullptr);
+        moved.buffer->buffer = moved.new_buffer;
+
+        VkDeviceAddress new_address = vk_util::get_buffer_device_address(device, moved.new_buffer);
+        moved_buffer_addresses[*moved.buffer_address] = new_address;
+        *moved.buffer_address = new_address;
+    }
+
+    for(const MovedImage& moved : moved_images) {
+        AllocatedImage& image = *moved.image;
+
+        VkImageViewCreateInfo image_view_create_info = vk_init::get_image_view_create_info(image.format, moved.new_image, VK_IMAGE_ASPECT_COLOR_BIT);
+        image_view_create_info.subresourceRange.levelCount = image.mip_levels;
+        VkImageView new_view;
+        VK_CHECK(vkCreateImageView(device, &image_view_create_info, nullptr, &new_view));
+
+        // nothing in flight samples the old view, so its bindless slots can be rewritten straight away
+        material_creator->replace_texture_view(device, image.view, new_view);
+
+        vkDestroyImageView(device, image.view, nullptr);
+        vkDestroyImage(device, image.image, nullptr);
+        image.image = moved.new_image;
+        image.view = new_view;
+    }
+
+    patch_render_objects(draw_context.opaque_surfaces);
+    patch_render_objects(draw_context.transparent_surfaces);
+
+    // the source allocations now stand for the new memory
+    VkResult end_result = vmaEndDefragmentationPass(allocator, context, &pass);
+    for(const MovedBuffer& moved : moved_buffers) {
+        vmaGetAllocationInfo(allocator, moved.buffer->allocation, &moved.buffer->info);
+    }
+
+    Fragmentation after = measure();
+    fragmentation_ratio = after.ratio;
+
+    uint32_t moved_count = static_cast<uint32_t>(moved_buffers.size() + moved_images.size());
+    pass_count++;
+    session_pass_count++;
+    bytes_moved += pass_bytes_moved;
+    stats.defragmentation_moved_count = static_cast<int>(moved_count);
+
+    fmt::print("defragmentation pass {}: moved {} of {} allocations ({:.1f} MB), {:.1f}% -> {:.1f}% fragmented, largest free range {:.1f} -> {:.1f} MB\n",
+               session_pass_count, moved_count, pass.moveCount, static_cast<float>(pass_bytes_moved) / (1024.f * 1024.f),
+               before.ratio * 100.f, after.ratio * 100.f,
+               static_cast<float>(before.largest_free_range) / (1024.f * 1024.f),
+               static_cast<float>(after.largest_free_range) / (1024.f * 1024.f));
+
+    if(end_result == VK_SUCCESS || session_pass_count >= settings.max_pass_count) {
+        end();
+    }
+}
+
+void MemoryDefragmenter::gather_movable_resources() {
+    movable_resources.clear();
+
+    auto add_buffer = [&](Buffer& buffer, VkDeviceAddress& buffer_address) {
+        movable_resources[buffer.allocation] = { .buffer = &buffer, .buffer_address = &buffer_address, .image = nullptr };
+    };
+
+    for(const std::shared_ptr<GLTFFile>& file : files) {
+        for(const std::shared_ptr<GLTFMesh>& mesh : file->meshes) {
+            add_buffer(mesh->mesh_buffers.vertex_buffer, mesh->mesh_buffers.vertex_buffer_address);
+            add_buffer(mesh->mesh_buffers.index_buffer, mesh->mesh_buffers.index_buffer_address);
+
+            // the optional buffers are only there with an address
+            if(mesh->skin_vertex_buffer_address != 0) {
+                add_buffer(mesh->skin_vertex_buffer, mesh->skin_vertex_buffer_address);
+            }
+            if(mesh->meshlet_buffer_address != 0) {
+                add_buffer(mesh->meshlet_buffer, mesh->meshlet_buffer_address);
+            }
+            if(mesh->meshlet_data_buffer_address != 0) {
+                add_buffer(mesh->meshlet_data_buffer, mesh->meshlet_data_buffer_address);
+            }
+        }
+
+        // images no material referenced were never created
+        for(AllocatedImage& image : file->images) {
+            if(image.image != VK_NULL_HANDLE) {
+                movable_resources[image.allocation] = { .buffer = nullptr, .buffer_address = nullptr, .image = &image };
+            }
+        }
+    }
+}
+
+void MemoryDefragmenter::record_copies(VkCommandBuffer cmd) {
+    for(const MovedBuffer& moved : moved_buffers) {
+        VkBufferCopy buffer_copy = {
+                .srcOffset = 0,
+                .dstOffset = 0,
+                .size = moved.buffer->size
+        };
+        vkCmdCopyBuffer(cmd, moved.buffer->buffer, moved.new_buffer, 1, &buffer_copy);
+    }
+
+    // loaded textures are left in SHADER_READ_ONLY_OPTIMAL, the old image isn't used again
+    for(const MovedImage& moved : moved_images) {
+        const AllocatedImage& image = *moved.image;
+
+        vk_image::transition_image_layout(cmd, image.image, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+        vk_image::transition_image_layout(cmd, moved.new_image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+        image_copies.resize(image.mip_levels);
+        for(uint32_t mip = 0; mip < image.mip_levels; mip++) {
+            image_copies[mip] = {
+                    .srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, mip, 0, 1 },
+                    .srcOffset = { 0, 0, 0 },
+                    .dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, mip, 0, 1 },
+                    .dstOffset = { 0, 0, 0 },
+                    .extent = {
+                            .width = std::max(image.extent.width >> mip, 1u),
+                            .height = std::max(image.extent.height >> mip, 1u),
+                            .depth = 1
+                    }
+            };
+        }
+        vkCmdCopyImage(cmd, image.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, moved.new_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                       static_cast<uint32_t>(image_copies.size()), image_copies.data());
+
+        vk_image::transition_image_layout(cmd, moved.new_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    }
+}
+
+void MemoryDefragmenter::patch_render_objects(std::vector<RenderObject>& objects) const {
+    if(moved_buffers.empty()) {
+        return;
+    }
+
+    auto patch_address = [&](VkDeviceAddress& address) {
+        auto address_iterator = moved_buffer_addresses.find(address);
+        if(address_iterator != moved_buffer_addresses.end()) {
+            address = address_iterator->second;
+        }
+    };
+
+    // gathered from the meshes before this pass moved them
+    for(RenderObject& object : objects) {
+        auto buffer_iterator = moved_buffer_handles.find(object.index_buffer);
+        if(buffer_iterator != moved_buffer_handles.end()) {
+            object.index_buffer = buffer_iterator->second;
+        }
+
+        patch_address(object.vertex_buffer_address);
+        patch_address(object.index_buffer_address);
+        patch_address(object.meshlet_buffer_address);
+        patch_address(object.meshlet_data_buffer_address);
+    }
+}
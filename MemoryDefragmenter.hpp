@@ -0,0 +1,121 @@
+//
+// Created by darby on 3/6/2025.
+//
+
+#pragma once
+
+#include "Common.hpp"
+#include "AllocatedImage.hpp"
+#include "Buffer.hpp"
+#include "GLTFHDRMaterial.hpp"
+#include "SceneGraphMembers.hpp"
+#include "TimelineDeletionQueue.hpp"
+#include "ImmediateSubmitCommandBuffer.hpp"
+#include "EngineStats.hpp"
+
+#include <unordered_map>
+
+struct DefragmentationSettings {
+    bool enabled = true;
+    // device local free space this fragmented, 1 - largest free range / free space, starts a defragmentation...
+    float fragmentation_threshold = 0.5f;
+    // ...as long as there's at least this much free space to gather up
+    VkDeviceSize min_free_size = 64 * 1024 * 1024;
+    // frames between measuring fragmentation, it walks every block
+    uint32_t check_interval = 600;
+    // move work per pass. One pass runs per frame until VMA has nothing left worth moving, or max_pass_count
+    VkDeviceSize max_bytes_per_pass = 16 * 1024 * 1024;
+    uint32_t max_moves_per_pass = 64;
+    uint32_t max_pass_count = 64;
+};
+
+/*
+ * Closes the holes that loading files, and the residency manager swapping textures, leave in VMA's device memory
+ * blocks, using VMA's incremental defragmentation.
+ *
+ * Each frame of a defragmentation runs one pass, bounded by the settings. The pass waits for the last frame submission
+ * first, since the memory it frees can be handed out again straight away. Its copies go through the immediate submit
+ * command buffer and are waited on. Afterwards every handle to a moved resource is patched: the mesh's buffers and
+ * device addresses, the bindless material slots of moved textures, and this frame's already gathered RenderObjects.
+ *
+ * Only the mesh buffers and textures of the added files are moved. VMA is told to leave everything else where it is.
+ * Fragmentation of the device local heaps is measured before and after each pass and printed.
+ */
+class MemoryDefragmenter {
+
+public:
+    DefragmentationSettings settings;
+
+    void init(VkDevice device, VmaAllocator allocator, ImmediateSubmitCommandBuffer& immediate_submit_command_buffer,
+              GLTFHDRMaterial& material_creator);
+    void destroy();
+
+    // file's meshes and textures may be moved from now on. file must outlive the defragmenter
+    void add_file(const std::shared_ptr<GLTFFile>& file);
+
+    // starts a defragmentation on the next update, whatever the fragmentation
+    void request() { requested = true; }
+
+    // runs this frame's pass, if any. Must come after the frame's fence wait and before anything is recorded from
+    // draw_context, whose RenderObjects are patched
+    void update(DrawContext& draw_context, TimelineDeletionQueue& timeline, EngineStats& stats);
+
+private:
+    struct Fragmentation {
+        VkDeviceSize free_size; // inside blocks
+        VkDeviceSize largest_free_range;
+        float ratio; // 1 - largest_free_range / free_size, 0 when nothing is free
+    };
+
+    // what an allocation VMA wants to move belongs to. Exactly one of buffer and image is set
+    struct MovableResource {
+        Buffer* buffer;
+        VkDeviceAddress* buffer_address;
+        AllocatedImage* image;
+    };
+
+    struct MovedBuffer {
+        Buffer* buffer;
+        VkDeviceAddress* buffer_address;
+        VkBuffer new_buffer;
+    };
+
+    struct MovedImage {
+        AllocatedImage* image;
+        VkImage new_image;
+    };
+
+    Fragmentation measure() const;
+
+    void begin();
+    void end();
+    void run_pass(DrawContext& draw_context, TimelineDeletionQueue& timeline, EngineStats& stats);
+
+    void gather_movable_resources();
+    void record_copies(VkCommandBuffer cmd);
+    void patch_render_objects(std::vector<RenderObject>& objects) const;
+
+    VkDevice device;
+    VmaAllocator allocator;
+    ImmediateSubmitCommandBuffer* immediate_submit_command_buffer;
+    GLTFHDRMaterial* material_creator;
+
+    std::vector<std::shared_ptr<GLTFFile>> files;
+
+    VmaDefragmentationContext context = VK_NULL_HANDLE;
+    uint32_t session_pass_count = 0;
+    bool requested = false;
+    uint32_t frames_since_check = 0;
+
+    // rebuilt for every pass, the residency manager swaps texture allocations in between
+    std::unordered_map<VmaAllocation, MovableResource> movable_resources;
+    std::vector<MovedBuffer> moved_buffers;
+    std::vector<MovedImage> moved_images;
+    std::unordered_map<VkBuffer, VkBuffer> moved_buffer_handles; // old -> new
+    std::unordered_map<VkDeviceAddress, VkDeviceAddress> moved_buffer_addresses;
+    std::vector<VkImageCopy> image_copies;
+
+    float fragmentation_ratio = 0.f;
+    uint32_t pass_count = 0;
+    VkDeviceSize bytes_moved = 0;
+};
@@ -0,0 +1,392 @@
+//
+// Created by darby on 3/4/2025.
+//
+
+#include "MeshletCuller.hpp"
+#include "FrustumCuller.hpp"
+#include "VulkanGeneralUtility.hpp"
+
+#include <algorithm>
+
+// bounds and normal cone of the triangles at [first_index, end_index) of indices, whose vertices are meshlet_vertices.
+// Appends the vertex and triangle lists mesh shaders draw the meshlet from to meshlet_data
+static GPUMeshlet finish_meshlet(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices,
+                                 uint32_t first_index, uint32_t end_index,
+                                 const std::vector<uint32_t>& meshlet_vertices, std::vector<uint32_t>& meshlet_data) {
+    glm::vec3 min_pos = vertices[indices[first_index]].pos;
+    glm::vec3 max_pos = min_pos;
+    for(uint32_t i = first_index; i < end_index; i++) {
+        min_pos = glm::min(min_pos, vertices[indices[i]].pos);
+        max_pos = glm::max(max_pos, vertices[indices[i]].pos);
+    }
+
+    glm::vec3 center = (min_pos + max_pos) / 2.f;
+    float radius = 0.f;
+    for(uint32_t i = first_index; i < end_index; i++) {
+        radius = std::max(radius, glm::length(vertices[indices[i]].pos - center));
+    }
+
+    // the cone's axis is the triangles' average facing, its cutoff how far the least aligned one strays from it
+    std::vector<glm::vec3> normals;
+    normals.reserve((end_index - first_index) / 3);
+    glm::vec3 normal_sum = glm::vec3(0.f);
+    for(uint32_t i = first_index; i < end_index; i += 3) {
+        glm::vec3 p0 = vertices[indices[i]].pos;
+        glm::vec3 p1 = vertices[indices[i + 1]].pos;
+        glm::vec3 p2 = vertices[indices[i + 2]].pos;
+
+        // counter clockwise triangles are front facing
+        glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+        float area = glm::length(normal);
+        if(area <= 1e-12f) {
+            continue; // degenerate, never drawn whichever way it faces
+        }
+        normals.push_back(normal / area);
+        normal_sum += normal / area;
+    }
+
+    float cone_cutoff = 1.f;
+    glm::vec3 cone_axis = glm::vec3(0.f, 0.f, 1.f);
+    float normal_sum_length = glm::length(normal_sum);
+    if(normal_sum_length > 1e-6f) {
+        cone_axis = normal_sum / normal_sum_length;
+
+        float min_alignment = 1.f;
+        for(const glm::vec3& normal : normals) {
+            min_alignment = std::min(min_alignment, glm::dot(normal, cone_axis));
+        }
+
+        // past ~85 degrees there's next to no view the whole meshlet faces away from, keep the cutoff at 1 to skip it
+        if(min_alignment > 0.1f) {
+            // sine of the widest normal's angle to the axis
+            cone_cutoff = std::sqrt(1.f - min_alignment * min_alignment);
+        }
+    }
+
+    uint32_t first_data = static_cast<uint32_t>(meshlet_data.size());
+    meshlet_data.insert(meshlet_data.end(), meshlet_vertices.begin(), meshlet_vertices.end());
+
+    // there are at most MAX_MESHLET_VERTICES, so every corner fits in a byte
+    for(uint32_t i = first_index; i < end_index; i += 3) {
+        uint32_t triangle = 0;
+        for(uint32_t v = 0; v < 3; v++) {
+            auto found = std::find(meshlet_vertices.begin(), meshlet_vertices.end(), indices[i + v]);
+            triangle |= static_cast<uint32_t>(found - meshlet_vertices.begin()) << (v * 8);
+        }
+        meshlet_data.push_back(triangle);
+    }
+
+    return {
+            .bounding_sphere = glm::vec4(center, radius),
+            .cone = glm::vec4(cone_axis, cone_cutoff),
+            .first_index = first_index,
+            .triangle_count = (end_index - first_index) / 3,
+            .first_data = first_data,
+            .vertex_count = static_cast<uint32_t>(meshlet_vertices.size())
+    };
+}
+
+void MeshletCuller::build_meshlets(const std::vector<Vertex>& vertices,
+                                   const std::vector<uint32_t>& indices,
+                                   uint32_t first_index,
+                                   uint32_t index_count,
+                                   std::vector<GPUMeshlet>& meshlets,
+                                   std::vector<uint32_t>& meshlet_data) {
+    uint32_t end_index = first_index + (index_count / 3) * 3;
+
+    std::vector<uint32_t> meshlet_vertices;
+    meshlet_vertices.reserve(MAX_MESHLET_VERTICES);
+    uint32_t meshlet_first_index = first_index;
+
+    for(uint32_t i = first_index; i < end_index; i += 3) {
+        uint32_t new_vertex_count = 0;
+        for(uint32_t v = 0; v < 3; v++) {
+            uint32_t vertex = indices[i + v];
+            bool repeated_in_triangle = (v > 0 && indices[i] == vertex) || (v > 1 && indices[i + 1] == vertex);
+            if(!repeated_in_triangle && std::find(meshlet_vertices.begin(), meshlet_vertices.end(), vertex) == meshlet_vertices.end()) {
+                new_vertex_count++;
+            }
+        }
+
+        uint32_t meshlet_triangle_count = (i - meshlet_first_index) / 3;
+        if(meshlet_vertices.size() + new_vertex_count > MAX_MESHLET_VERTICES || meshlet_triangle_count == MAX_MESHLET_TRIANGLES) {
+            meshlets.push_back(finish_meshlet(vertices, indices, meshlet_first_index, i, meshlet_vertices, meshlet_data));
+            meshlet_vertices.clear();
+            meshlet_first_index = i;
+        }
+
+        for(uint32_t v = 0; v < 3; v++) {
+            uint32_t vertex = indices[i + v];
+            if(std::find(meshlet_vertices.begin(), meshlet_vertices.end(), vertex) == meshlet_vertices.end()) {
+                meshlet_vertices.push_back(vertex);
+            }
+        }
+    }
+
+    if(meshlet_first_index < end_index) {
+        meshlets.push_back(finish_meshlet(vertices, indices, meshlet_first_index, end_index, meshlet_vertices, meshlet_data));
+    }
+}
+
+GPUMeshletCullView MeshletCuller::get_cull_view(const glm::mat4& view, const glm::mat4& view_proj) {
+    GPUMeshletCullView cull_view;
+    Frustum frustum = Frustum::from_view_proj(view_proj);
+    memcpy(cull_view.frustum_planes, frustum.planes, sizeof(frustum.planes));
+    cull_view.view_proj = view_proj;
+    cull_view.camera_position = glm::inverse(view)[3];
+    return cull_view;
+}
+
+void MeshletCuller::init(VkDevice _device, VmaAllocator _allocator, VkDescriptorSetLayout depth_pyramid_descriptor_set_layout, DeletionQueue& deletion_queue) {
+    device = _device;
+    allocator = _allocator;
+
+    std::vector<VkDescriptorSetLayout> cull_descriptor_layouts = {
+            depth_pyramid_descriptor_set_layout
+    };
+
+    VkPushConstantRange compute_push_constant_range = {
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+            .offset = 0,
+            .size = sizeof(GPUMeshletCullPushConstants),
+    };
+
+    std::vector<VkPushConstantRange> cull_push_constant_ranges = {
+            compute_push_constant_range
+    };
+
+    // everything else is reached through buffer references
+    cull_pipeline.init(
+            device,
+            "../shaders/meshlet_cull.comp.spv",
+            cull_descriptor_layouts,
+            cull_push_constant_ranges,
+            deletion_queue
+    );
+
+    draw_data_buffers.init(device, allocator, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                           VMA_MEMORY_USAGE_CPU_TO_GPU, "Meshlet Draw Data Buffer");
+    entry_buffers.init(device, allocator, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                       VMA_MEMORY_USAGE_CPU_TO_GPU, "Meshlet Cull Entry Buffer");
+    command_template_buffers.init(device, allocator, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU, "Meshlet Command Template Buffer");
+    output_command_buffers.init(device, allocator, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                VMA_MEMORY_USAGE_GPU_ONLY, "Meshlet Command Buffer");
+    output_index_buffers.init(device, allocator, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                              VMA_MEMORY_USAGE_GPU_ONLY, "Meshlet Index Buffer");
+
+    deletion_queue.push_function([=, this]() {
+        draw_data_buffers.destroy();
+        entry_buffers.destroy();
+        command_template_buffers.destroy();
+        output_command_buffers.destroy();
+        output_index_buffers.destroy();
+        for(StatsBuffer& stats_buffer : stats_buffers) {
+            stats_buffer.buffer.destroy_buffer();
+        }
+        stats_buffers.clear();
+    });
+}
+
+void MeshletCuller::cull(VkCommandBuffer cmd,
+                         IndirectDrawBuilder& draws,
+                         const std::vector<RenderObject>& objects,
+                         const std::vector<uint32_t>& draw_indices,
+                         const glm::mat4& view,
+                         const glm::mat4& view_proj,
+                         const DepthPyramid& depth_pyramid,
+                         TimelineDeletionQueue& gpu_deletion_queue) {
+    if(draws.get_command_count() == 0) {
+        return;
+    }
+
+    prepare(cmd, draws, objects, draw_indices, view, view_proj, gpu_deletion_queue);
+    dispatch(cmd, draws, depth_pyramid, CullPhase::Frustum, gpu_deletion_queue);
+}
+
+void MeshletCuller::cull_early(VkCommandBuffer cmd,
+                               IndirectDrawBuilder& draws,
+                               const std::vector<RenderObject>& objects,
+                               const std::vector<uint32_t>& draw_indices,
+                               const glm::mat4& view,
+                               const glm::mat4& view_proj,
+                               const DepthPyramid& depth_pyramid,
+                               TimelineDeletionQueue& gpu_deletion_queue) {
+    if(draws.get_command_count() == 0) {
+        return;
+    }
+
+    prepare(cmd, draws, objects, draw_indices, view, view_proj, gpu_deletion_queue);
+    dispatch(cmd, draws, depth_pyramid, CullPhase::Early, gpu_deletion_queue);
+}
+
+void MeshletCuller::cull_late(VkCommandBuffer cmd, IndirectDrawBuilder& draws, const DepthPyramid& depth_pyramid, TimelineDeletionQueue& gpu_deletion_queue) {
+    if(draws.get_command_count() == 0) {
+        return;
+    }
+
+    dispatch(cmd, draws, depth_pyramid, CullPhase::Late, gpu_deletion_queue);
+}
+
+void MeshletCuller::prepare(VkCommandBuffer cmd,
+                            IndirectDrawBuilder& draws,
+                            const std::vector<RenderObject>& objects,
+                            const std::vector<uint32_t>& draw_indices,
+                            const glm::mat4& view,
+                            const glm::mat4& view_proj,
+                            TimelineDeletionQueue& gpu_deletion_queue) {
+    uint32_t draw_count = draws.get_command_count();
+
+    entry_count = 0;
+    for(uint32_t i = 0; i < draw_count; i++) {
+        entry_count += objects[draw_indices[i]].meshlet_count;
+    }
+
+    // the camera then a GPUMeshletDrawData per draw, a GPUMeshletCullEntry per meshlet, and a command per draw
+    RecyclingBuffer::Slot& draw_data_buffer = draw_data_buffers.acquire(sizeof(GPUMeshletCullView) + draw_count * sizeof(GPUMeshletDrawData), gpu_deletion_queue);
+    RecyclingBuffer::Slot& entry_buffer = entry_buffers.acquire(std::max(entry_count, 1u) * sizeof(GPUMeshletCullEntry), gpu_deletion_queue);
+    RecyclingBuffer::Slot& template_buffer = command_template_buffers.acquire(draw_count * sizeof(VkDrawIndexedIndirectCommand), gpu_deletion_queue);
+    Buffer& cull_stats_buffer = acquire_stats_buffer(gpu_deletion_queue);
+
+    draw_data_buffer_address = draw_data_buffer.address;
+    entry_buffer_address = entry_buffer.address;
+    cull_stats_buffer_address = vk_util::get_buffer_device_address(device, cull_stats_buffer.buffer);
+    command_template_buffer = template_buffer.buffer.buffer;
+
+    GPUMeshletCullView* cull_view = (GPUMeshletCullView*)draw_data_buffer.buffer.info.pMappedData;
+    *cull_view = get_cull_view(view, view_proj);
+
+    GPUMeshletDrawData* draw_datas = (GPUMeshletDrawData*)(cull_view + 1);
+    GPUMeshletCullEntry* entries = (GPUMeshletCullEntry*)entry_buffer.buffer.info.pMappedData;
+    VkDrawIndexedIndirectCommand* commands = (VkDrawIndexedIndirectCommand*)template_buffer.buffer.info.pMappedData;
+
+    output_index_count = 0;
+    uint32_t entry = 0;
+    for(uint32_t i = 0; i < draw_count; i++) {
+        const RenderObject& object = objects[draw_indices[i]];
+
+        draw_datas[i] = {
+                .meshlet_buffer_address = object.meshlet_buffer_address,
+                .index_buffer_address = object.index_buffer_address,
+                .output_first_index = output_index_count,
+                .cull_meshlets = object.cull_meshlets ? 1u : 0u,
+                .transform_index = draws.get_transform_index(draw_indices[i]),
+                .padding = 0
+        };
+
+        for(uint32_t m = 0; m < object.meshlet_count; m++) {
+            entries[entry++] = {
+                    .draw_index = i,
+                    .meshlet_index = object.first_meshlet + m
+            };
+        }
+
+        // firstInstance finds the draw's data the same way as IndirectDrawBuilder's commands
+        commands[i] = {
+                .indexCount = 0,
+                .instanceCount = 1,
+                .firstIndex = output_index_count,
+                .vertexOffset = 0,
+                .firstInstance = i
+        };
+
+        output_index_count += (object.index_count / 3) * 3;
+    }
+
+    // the stats are accumulated into by the counting phase
+    vkCmdFillBuffer(cmd, cull_stats_buffer.buffer, 0, VK_WHOLE_SIZE, 0);
+}
+
+void MeshletCuller::dispatch(VkCommandBuffer cmd, IndirectDrawBuilder& draws, const DepthPyramid& depth_pyramid, CullPhase phase, TimelineDeletionQueue& gpu_deletion_queue) {
+    uint32_t draw_count = draws.get_command_count();
+
+    // each phase writes buffers of its own, the early ones are still being drawn from when the late phase runs
+    RecyclingBuffer::Slot& output_command_buffer = output_command_buffers.acquire(draw_count * sizeof(VkDrawIndexedIndirectCommand), gpu_deletion_queue);
+    RecyclingBuffer::Slot& output_index_buffer = output_index_buffers.acquire(std::max(output_index_count, 1u) * sizeof(uint32_t), gpu_deletion_queue);
+
+    // the index counts are accumulated into, start every command at zero from the template
+    VkBufferCopy command_copy = {
+            .srcOffset = 0,
+            .dstOffset = 0,
+            .size = draw_count * sizeof(VkDrawIndexedIndirectCommand)
+    };
+    vkCmdCopyBuffer(cmd, command_template_buffer, output_command_buffer.buffer.buffer, 1, &command_copy);
+    vk_util::memory_barrier(cmd,
+                            VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                            VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+
+    GPUMeshletCullPushConstants push_constants = {
+            .draw_data_buffer_address = draw_data_buffer_address,
+            .entry_buffer_address = entry_buffer_address,
+            .transform_buffer_address = draws.get_transform_buffer_address(),
+            .output_command_buffer_address = output_command_buffer.address,
+            .output_index_buffer_address = output_index_buffer.address,
+            .cull_stats_buffer_address = cull_stats_buffer_address,
+            .entry_count = entry_count,
+            .phase = static_cast<uint32_t>(phase)
+    };
+
+    VkDescriptorSet depth_pyramid_descriptor_set = depth_pyramid.get_cull_descriptor_set();
+
+    // a workgroup per meshlet, wrapped into rows when there are more than one row can hold
+    uint32_t workgroups_x = std::min(entry_count, MAX_DISPATCH_WIDTH);
+    uint32_t workgroups_y = workgroups_x == 0 ? 0 : (entry_count + workgroups_x - 1) / workgroups_x;
+
+    if(workgroups_x > 0) {
+        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, cull_pipeline.pipeline);
+        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, cull_pipeline.layout, 0, 1, &depth_pyramid_descriptor_set, 0, nullptr);
+        vkCmdPushConstants(cmd, cull_pipeline.layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(GPUMeshletCullPushConstants), &push_constants);
+        vkCmdDispatch(cmd, workgroups_x, workgroups_y, 1);
+    }
+
+    // the commands are drawn from or compacted by the draw cull, the indices drawn, the stats read by the host
+    vk_util::memory_barrier(cmd,
+                            VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+                            VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_2_INDEX_INPUT_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_2_HOST_BIT,
+                            VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_2_INDEX_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_HOST_READ_BIT);
+
+    draws.use_meshlet_commands(output_command_buffer.buffer.buffer, output_command_buffer.address, output_index_buffer.buffer.buffer);
+}
+
+Buffer& MeshletCuller::acquire_stats_buffer(TimelineDeletionQueue& gpu_deletion_queue) {
+    uint64_t completed_value = gpu_deletion_queue.get_completed_value();
+
+    // the newest finished stats are the ones shown
+    StatsBuffer* newest = nullptr;
+    for(StatsBuffer& stats_buffer : stats_buffers) {
+        if(stats_buffer.used_value <= completed_value && (newest == nullptr || stats_buffer.used_value > newest->used_value)) {
+            newest = &stats_buffer;
+        }
+    }
+    if(newest != nullptr && newest->used_value > read_back_value) {
+        vmaInvalidateAllocation(allocator, newest->buffer.allocation, 0, VK_WHOLE_SIZE);
+        memcpy(&read_back_stats, newest->buffer.info.pMappedData, sizeof(GPUMeshletCullStats));
+        read_back_value = newest->used_value;
+    }
+
+    StatsBuffer* free_buffer = nullptr;
+    for(StatsBuffer& stats_buffer : stats_buffers) {
+        if(stats_buffer.used_value <= completed_value) {
+            free_buffer = &stats_buffer;
+            break;
+        }
+    }
+
+    // one per frame in flight, unless something culls more than once a frame
+    if(free_buffer == nullptr) {
+        free_buffer = &stats_buffers.emplace_back();
+        free_buffer->buffer.init(allocator, sizeof(GPUMeshletCullStats),
+                                 VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                 VMA_MEMORY_USAGE_GPU_TO_CPU);
+        free_buffer->buffer.set_name(device, "Meshlet Cull Stats Buffer");
+    }
+
+    free_buffer->used_value = gpu_deletion_queue.get_pending_value();
+    return free_buffer->buffer;
+}
+
+void MeshletCuller::add_stats(EngineStats& stats) const {
+    stats.meshlet_count = static_cast<int>(read_back_stats.meshlet_count);
+    stats.meshlet_frustum_culled_count = static_cast<int>(read_back_stats.frustum_culled_count);
+    stats.meshlet_cone_culled_count = static_cast<int>(read_back_stats.cone_culled_count);
+    stats.meshlet_occluded_count = static_cast<int>(read_back_stats.occluded_count);
+}
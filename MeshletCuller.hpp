@@ -0,0 +1,143 @@
+//
+// Created by darby on 3/4/2025.
+//
+
+#pragma once
+
+#include "Common.hpp"
+#include "ComputePipeline.hpp"
+#include "DeletionQueue.hpp"
+#include "TimelineDeletionQueue.hpp"
+#include "EngineStats.hpp"
+#include "IndirectDrawBuilder.hpp"
+#include "DepthPyramid.hpp"
+#include "RecyclingBuffer.hpp"
+
+/*
+ * Culls the clusters of triangles a draw is made of, so a big mesh only draws the parts of it that can be seen.
+ *
+ * The loader splits each surface into meshlets (build_meshlets), every one bounded by a sphere and a cone holding its
+ * triangles' normals. Each frame a workgroup of meshlet_cull.comp takes one meshlet of one draw and drops it if it's
+ *   - outside the frustum
+ *   - facing away from the camera, every normal in its cone pointing away
+ *   - behind the depth pyramid, in the late phase of occlusion culling only
+ * and copies the indices of the ones that survive into a compacted index buffer, each draw's command growing to
+ * cover its surviving triangles. IndirectDrawBuilder then draws from those commands and that index buffer.
+ *
+ * This runs ahead of the GPUDrawCuller, which compacts the commands written here. With occlusion culling it mirrors
+ * the draw culler's phases: cull_early() without the pyramid, cull_late() with the one built from the early draws.
+ *
+ * How many meshlets were culled by what is read back once the GPU has passed the frame, like the draw culler's.
+ * Meshlets of skinned draws are kept whole and left out of the counts.
+ */
+class MeshletCuller {
+
+public:
+    static constexpr uint32_t WORKGROUP_SIZE = 64; // local_size_x in meshlet_cull.comp
+    static constexpr uint32_t MAX_DISPATCH_WIDTH = 65535; // the least maxComputeWorkGroupCount[0] a device can have
+
+    // the usual hardware mesh shading limits, so the same meshlets can be drawn by mesh shaders
+    static constexpr uint32_t MAX_MESHLET_VERTICES = 64;
+    static constexpr uint32_t MAX_MESHLET_TRIANGLES = 124;
+
+    // matches the PHASE_ defines in meshlet_cull.comp
+    enum class CullPhase : uint32_t {
+        Frustum = 0,
+        Early = 1,
+        Late = 2
+    };
+
+    /*
+     * Appends the meshlets of the surface at [first_index, first_index + index_count) of indices. Triangles are taken
+     * in index order, a meshlet ending once another would take it past the vertex or triangle limit, so they're only
+     * as tight as the mesh's own triangle order. Each meshlet's vertex and triangle lists go to meshlet_data, see
+     * GPUMeshlet::first_data.
+     */
+    static void build_meshlets(const std::vector<Vertex>& vertices,
+                               const std::vector<uint32_t>& indices,
+                               uint32_t first_index,
+                               uint32_t index_count,
+                               std::vector<GPUMeshlet>& meshlets,
+                               std::vector<uint32_t>& meshlet_data);
+
+    // the frustum and camera meshlets are culled against, also read by the mesh shading task shader
+    static GPUMeshletCullView get_cull_view(const glm::mat4& view, const glm::mat4& view_proj);
+
+    // depth_pyramid_descriptor_set_layout is the draw culler's, so a DepthPyramid's cull set works for both
+    void init(VkDevice device, VmaAllocator allocator, VkDescriptorSetLayout depth_pyramid_descriptor_set_layout, DeletionQueue& deletion_queue);
+
+    /*
+     * Records the cull of draws' meshlets into cmd and points draws at the commands and indices that survive. draws
+     * must have been built from objects and draw_indices this frame, and be culled here before the GPUDrawCuller.
+     * Everything here must be recorded outside of rendering.
+     */
+    void cull(VkCommandBuffer cmd,
+              IndirectDrawBuilder& draws,
+              const std::vector<RenderObject>& objects,
+              const std::vector<uint32_t>& draw_indices,
+              const glm::mat4& view,
+              const glm::mat4& view_proj,
+              const DepthPyramid& depth_pyramid,
+              TimelineDeletionQueue& gpu_deletion_queue);
+
+    // same as cull(), ahead of GPUDrawCuller::cull_early. The counts are left to cull_late()
+    void cull_early(VkCommandBuffer cmd,
+                    IndirectDrawBuilder& draws,
+                    const std::vector<RenderObject>& objects,
+                    const std::vector<uint32_t>& draw_indices,
+                    const glm::mat4& view,
+                    const glm::mat4& view_proj,
+                    const DepthPyramid& depth_pyramid,
+                    TimelineDeletionQueue& gpu_deletion_queue);
+
+    // depth_pyramid must have been built from the early draws. Ahead of GPUDrawCuller::cull_late
+    void cull_late(VkCommandBuffer cmd, IndirectDrawBuilder& draws, const DepthPyramid& depth_pyramid, TimelineDeletionQueue& gpu_deletion_queue);
+
+    // the most recent counts that made it back from the GPU
+    void add_stats(EngineStats& stats) const;
+
+private:
+    // uploads this frame's draws and meshlet entries, shared by both phases
+    void prepare(VkCommandBuffer cmd,
+                 IndirectDrawBuilder& draws,
+                 const std::vector<RenderObject>& objects,
+                 const std::vector<uint32_t>& draw_indices,
+                 const glm::mat4& view,
+                 const glm::mat4& view_proj,
+                 TimelineDeletionQueue& gpu_deletion_queue);
+
+    void dispatch(VkCommandBuffer cmd, IndirectDrawBuilder& draws, const DepthPyramid& depth_pyramid, CullPhase phase, TimelineDeletionQueue& gpu_deletion_queue);
+
+    // copies the newest stats the GPU is done writing into read_back_stats, then returns a buffer to write this frame's to
+    Buffer& acquire_stats_buffer(TimelineDeletionQueue& gpu_deletion_queue);
+
+    struct StatsBuffer {
+        Buffer buffer;
+        uint64_t used_value; // the timeline value of the submission that writes it
+    };
+
+    VkDevice device;
+    VmaAllocator allocator;
+
+    ComputePipeline cull_pipeline;
+
+    RecyclingBuffer draw_data_buffers;
+    RecyclingBuffer entry_buffers;
+    RecyclingBuffer command_template_buffers;
+    // acquired per phase, the early ones are still being drawn from when the late phase runs
+    RecyclingBuffer output_command_buffers;
+    RecyclingBuffer output_index_buffers;
+    std::vector<StatsBuffer> stats_buffers;
+
+    // this frame's, set by prepare()
+    VkDeviceAddress draw_data_buffer_address;
+    VkDeviceAddress entry_buffer_address;
+    VkDeviceAddress cull_stats_buffer_address;
+    VkBuffer command_template_buffer; // every draw's command with no indices yet, copied in before each phase
+    uint32_t entry_count = 0;
+    uint32_t output_index_count = 0;
+
+    // copied out of a stats buffer once the GPU is done with the frame that wrote it
+    GPUMeshletCullStats read_back_stats = {};
+    uint64_t read_back_value = 0;
+};
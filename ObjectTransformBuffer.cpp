@@ -0,0 +1,104 @@
+//
+// Created by darby on 3/5/2025.
+//
+
+#include "ObjectTransformBuffer.hpp"
+#include "VulkanGeneralUtility.hpp"
+
+void ObjectTransformBuffer::init(VmaAllocator _allocator, uint32_t frame_count, DeletionQueue& deletion_queue) {
+    allocator = _allocator;
+    frames.resize(frame_count);
+
+    deletion_queue.push_function([this]() {
+        for(FrameTransforms& frame : frames) {
+            if(frame.capacity > 0) {
+                frame.buffer.destroy_buffer();
+            }
+        }
+    });
+}
+
+void ObjectTransformBuffer::update(VkDevice device, uint32_t frame_index, DrawContext& draw_context, TimelineDeletionQueue& gpu_deletion_queue, EngineStats& stats) {
+    FrameTransforms& frame = frames[frame_index];
+
+    uint32_t opaque_count = static_cast<uint32_t>(draw_context.opaque_surfaces.size());
+    uint32_t object_count = opaque_count + static_cast<uint32_t>(draw_context.transparent_surfaces.size());
+
+    // gathered in object index order, compared against and kept as what was written. Swapped with the frame's last
+    // written transforms below, so both keep their capacity and steady state frames don't allocate here
+    std::vector<glm::mat4>& transforms = gathered_transforms;
+    transforms.resize(object_count);
+    for(uint32_t i = 0; i < opaque_count; i++) {
+        transforms[i] = draw_context.opaque_surfaces[i].transform;
+    }
+    for(uint32_t i = opaque_count; i < object_count; i++) {
+        transforms[i] = draw_context.transparent_surfaces[i - opaque_count].transform;
+    }
+
+    // grown by half again, anything the old buffer held is rewritten
+    if(object_count > frame.capacity) {
+        if(frame.capacity > 0) {
+            gpu_deletion_queue.push_buffer(frame.buffer);
+        }
+
+        frame.capacity = std::max(object_count + object_count / 2, 64u);
+        frame.buffer.init(allocator, frame.capacity * 2 * sizeof(glm::mat4),
+                          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+        frame.buffer.set_name(device, "Object Transform Buffer");
+        frame.address = vk_util::get_buffer_device_address(device, frame.buffer.buffer);
+        frame.written_transforms.clear();
+    }
+
+    // write each run of changed transforms in one go. Objects past what was last written count as changed
+    uint32_t written_count = 0;
+    uint32_t range_count = 0;
+    uint32_t known_count = std::min(object_count, static_cast<uint32_t>(frame.written_transforms.size()));
+    uint32_t i = 0;
+    while(i < object_count) {
+        if(i < known_count && transforms[i] == frame.written_transforms[i]) {
+            i++;
+            continue;
+        }
+
+        uint32_t first = i;
+        while(i < object_count && (i >= known_count || transforms[i] != frame.written_transforms[i])) {
+            i++;
+        }
+
+        write_range(frame, transforms.data(), first, i - first);
+        written_count += i - first;
+        range_count++;
+    }
+
+    frame.written_transforms.swap(transforms);
+
+    VkDeviceAddress normal_matrix_address = frame.address + frame.capacity * sizeof(glm::mat4);
+    draw_context.opaque_transforms = {
+            .transform_buffer_address = frame.address,
+            .normal_matrix_buffer_address = normal_matrix_address,
+            .first_object_index = 0
+    };
+    draw_context.transparent_transforms = {
+            .transform_buffer_address = frame.address,
+            .normal_matrix_buffer_address = normal_matrix_address,
+            .first_object_index = opaque_count
+    };
+
+    stats.transform_object_count = static_cast<int>(object_count);
+    stats.transform_written_count = static_cast<int>(written_count);
+    stats.transform_written_range_count = static_cast<int>(range_count);
+}
+
+void ObjectTransformBuffer::write_range(FrameTransforms& frame, const glm::mat4* transforms, uint32_t first, uint32_t count) {
+    glm::mat4* mapped_transforms = (glm::mat4*) frame.buffer.info.pMappedData;
+    glm::mat4* mapped_normal_matrices = mapped_transforms + frame.capacity;
+
+    memcpy(mapped_transforms + first, transforms + first, count * sizeof(glm::mat4));
+    for(uint32_t i = first; i < first + count; i++) {
+        mapped_normal_matrices[i] = glm::mat4(glm::inverseTranspose(glm::mat3(transforms[i])));
+    }
+
+    // no-ops on coherent memory, which CPU_TO_GPU usually is
+    vmaFlushAllocation(allocator, frame.buffer.allocation, first * sizeof(glm::mat4), count * sizeof(glm::mat4));
+    vmaFlushAllocation(allocator, frame.buffer.allocation, (frame.capacity + first) * sizeof(glm::mat4), count * sizeof(glm::mat4));
+}
@@ -0,0 +1,51 @@
+//
+// Created by darby on 3/5/2025.
+//
+
+#pragma once
+
+#include "Common.hpp"
+#include "GraphicsTypes.hpp"
+#include "Buffer.hpp"
+#include "DeletionQueue.hpp"
+#include "TimelineDeletionQueue.hpp"
+#include "EngineStats.hpp"
+
+/*
+ * Every surface's world matrix and normal matrix, uploaded once a frame and read by every pass through a 32 bit object
+ * index, rather than each pass pushing or copying the transforms of what it draws.
+ *
+ * A surface's object index is its index in the draw context's opaque_surfaces, or opaque_surfaces.size() plus its
+ * index in transparent_surfaces. The buffer holds the matrices at their object index, followed by the normal matrices
+ * at theirs, see ObjectTransforms.
+ *
+ * There's a buffer per frame in flight, persistently mapped. A frame's buffer is only written once its fence has
+ * passed, and then only over the runs of objects whose transform changed since that buffer was last written, so a
+ * still scene writes nothing. The normal matrices of those runs are the only ones recomputed.
+ */
+class ObjectTransformBuffer {
+
+public:
+    void init(VmaAllocator allocator, uint32_t frame_count, DeletionQueue& deletion_queue);
+
+    // writes draw_context's transforms into frame_index's buffer and points its opaque and transparent transforms at
+    // them. The frame's fence must have been waited on
+    void update(VkDevice device, uint32_t frame_index, DrawContext& draw_context, TimelineDeletionQueue& gpu_deletion_queue, EngineStats& stats);
+
+private:
+    struct FrameTransforms {
+        Buffer buffer;
+        VkDeviceAddress address = 0;
+        uint32_t capacity = 0;
+        // what was last written to buffer, to find what changed
+        std::vector<glm::mat4> written_transforms;
+    };
+
+    // copies transforms [first, first + count) and their normal matrices into frame's buffer
+    void write_range(FrameTransforms& frame, const glm::mat4* transforms, uint32_t first, uint32_t count);
+
+    VmaAllocator allocator;
+    std::vector<FrameTransforms> frames;
+    // scratch for update(), holds a previous frame's written transforms in between
+    std::vector<glm::mat4> gathered_transforms;
+};
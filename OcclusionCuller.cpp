@@ -0,0 +1,373 @@
+//
+// Created by darby on 2/21/2025.
+//
+
+#include "OcclusionCuller.hpp"
+
+#include <algorithm>
+#include <cfloat>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// anything with a clip-space w below this is treated as crossing the near plane. Occluders drop those triangles and
+// occludees are kept, both of which stay conservative.
+static constexpr float MIN_CLIP_W = 0.001f;
+
+static glm::vec3 to_screen(const glm::vec4& clip) {
+    float inverse_w = 1.f / clip.w;
+    return glm::vec3(
+            (clip.x * inverse_w * 0.5f + 0.5f) * OcclusionCuller::DEPTH_BUFFER_WIDTH,
+            (clip.y * inverse_w * 0.5f + 0.5f) * OcclusionCuller::DEPTH_BUFFER_HEIGHT,
+            inverse_w);
+}
+
+// clamp before converting, off-screen vertices can land far outside int range
+static int clamp_to_int(float value, int min_value, int max_value) {
+    return static_cast<int>(glm::clamp(value, static_cast<float>(min_value), static_cast<float>(max_value)));
+}
+
+void OcclusionCuller::cull(const std::vector<RenderObject>& objects, const glm::mat4& view_proj, std::vector<uint32_t>& visible, JobSystem& job_system) {
+    culled_count = 0;
+
+    select_occluders(objects, view_proj, visible);
+    if(occluders.empty()) {
+        return;
+    }
+
+    depth_buffer.assign(DEPTH_BUFFER_WIDTH * DEPTH_BUFFER_HEIGHT, 0.f);
+
+    transform_occluders(objects, view_proj, job_system);
+    bin_triangles();
+
+    // one job per tile, tiles never share pixels
+    job_system.parallel_for(TILE_COUNT_X * TILE_COUNT_Y, 1, [this](uint32_t start, uint32_t end) {
+        for(uint32_t tile_index = start; tile_index < end; tile_index++) {
+            rasterize_tile(tile_index);
+        }
+    });
+
+    object_visible.resize(visible.size());
+    job_system.parallel_for(static_cast<uint32_t>(visible.size()), 64, [this, &objects, &view_proj, &visible](uint32_t start, uint32_t end) {
+        for(uint32_t i = start; i < end; i++) {
+            const RenderObject& object = objects[visible[i]];
+
+            if(std::find(occluders.begin(), occluders.end(), visible[i]) != occluders.end()) {
+                object_visible[i] = 1;
+                continue;
+            }
+
+            const glm::mat4& m = object.transform;
+            glm::vec3 center = glm::vec3(m * glm::vec4(object.bounds.origin, 1.f));
+            glm::vec3 extents = glm::abs(glm::vec3(m[0])) * object.bounds.extents.x +
+                                glm::abs(glm::vec3(m[1])) * object.bounds.extents.y +
+                                glm::abs(glm::vec3(m[2])) * object.bounds.extents.z;
+
+            object_visible[i] = is_aabb_visible(center - extents, center + extents, view_proj) ? 1 : 0;
+        }
+    });
+
+    // compact in place, keeping order
+    uint32_t visible_count = 0;
+    for(uint32_t i = 0; i < visible.size(); i++) {
+        if(object_visible[i]) {
+            visible[visible_count++] = visible[i];
+        }
+    }
+
+    culled_count = static_cast<uint32_t>(visible.size()) - visible_count;
+    visible.resize(visible_count);
+}
+
+/*
+ * Picks the surfaces that cover the most of the screen, by bounding sphere radius over view depth.
+ */
+void OcclusionCuller::select_occluders(const std::vector<RenderObject>& objects, const glm::mat4& view_proj, const std::vector<uint32_t>& visible) {
+    occluders.clear();
+
+    std::vector<std::pair<float, uint32_t>>& candidates = occluder_candidates;
+    candidates.clear();
+    for(uint32_t object_index : visible) {
+        const RenderObject& object = objects[object_index];
+        if(object.occluder == nullptr) {
+            continue;
+        }
+
+        float max_scale = glm::max(glm::length(glm::vec3(object.transform[0])),
+                                   glm::max(glm::length(glm::vec3(object.transform[1])), glm::length(glm::vec3(object.transform[2]))));
+        float radius = object.bounds.sphere_radius * max_scale;
+        glm::vec4 clip_center = view_proj * (object.transform * glm::vec4(object.bounds.origin, 1.f));
+
+        // the camera is inside the bounding sphere, as large as it gets
+        float screen_size = clip_center.w > radius ? radius / clip_center.w : FLT_MAX;
+        if(screen_size >= MIN_OCCLUDER_SCREEN_SIZE) {
+            candidates.emplace_back(screen_size, object_index);
+        }
+    }
+
+    uint32_t occluder_count = std::min(static_cast<uint32_t>(candidates.size()), MAX_OCCLUDERS_PER_FRAME);
+    std::partial_sort(candidates.begin(), candidates.begin() + occluder_count, candidates.end(),
+                      [](const auto& a, const auto& b) { return a.first > b.first; });
+
+    occluder_first_triangle.clear();
+    uint32_t triangle_count = 0;
+    for(uint32_t i = 0; i < occluder_count; i++) {
+        occluders.push_back(candidates[i].second);
+        occluder_first_triangle.push_back(triangle_count);
+        triangle_count += static_cast<uint32_t>(objects[candidates[i].second].occluder->indices.size() / 3);
+    }
+
+    triangles.resize(triangle_count);
+    triangle_valid.resize(triangle_count);
+}
+
+void OcclusionCuller::transform_occluders(const std::vector<RenderObject>& objects, const glm::mat4& view_proj, JobSystem& job_system) {
+    job_system.parallel_for(static_cast<uint32_t>(occluders.size()), 4, [this, &objects, &view_proj](uint32_t start, uint32_t end) {
+        for(uint32_t o = start; o < end; o++) {
+            const RenderObject& object = objects[occluders[o]];
+            const OccluderMesh& mesh = *object.occluder;
+            glm::mat4 model_view_proj = view_proj * object.transform;
+
+            uint32_t first_triangle = occluder_first_triangle[o];
+            uint32_t triangle_count = static_cast<uint32_t>(mesh.indices.size() / 3);
+
+            for(uint32_t t = 0; t < triangle_count; t++) {
+                glm::vec4 c0 = model_view_proj * glm::vec4(mesh.positions[mesh.indices[t * 3 + 0]], 1.f);
+                glm::vec4 c1 = model_view_proj * glm::vec4(mesh.positions[mesh.indices[t * 3 + 1]], 1.f);
+                glm::vec4 c2 = model_view_proj * glm::vec4(mesh.positions[mesh.indices[t * 3 + 2]], 1.f);
+
+                // no near plane clipping, a dropped occluder triangle only makes us draw more
+                if(c0.w < MIN_CLIP_W || c1.w < MIN_CLIP_W || c2.w < MIN_CLIP_W) {
+                    triangle_valid[first_triangle + t] = 0;
+                    continue;
+                }
+
+                ScreenTriangle& triangle = triangles[first_triangle + t];
+                triangle.v0 = to_screen(c0);
+                triangle.v1 = to_screen(c1);
+                triangle.v2 = to_screen(c2);
+
+                // both windings are rasterized, so order every triangle counter-clockwise in screen space
+                float area = (triangle.v1.x - triangle.v0.x) * (triangle.v2.y - triangle.v0.y) - (triangle.v1.y - triangle.v0.y) * (triangle.v2.x - triangle.v0.x);
+                if(area < 0.f) {
+                    std::swap(triangle.v1, triangle.v2);
+                }
+
+                triangle_valid[first_triangle + t] = area != 0.f ? 1 : 0;
+            }
+        }
+    });
+}
+
+void OcclusionCuller::bin_triangles() {
+    for(std::vector<uint32_t>& bin : tile_bins) {
+        bin.clear();
+    }
+
+    for(uint32_t t = 0; t < triangles.size(); t++) {
+        if(!triangle_valid[t]) {
+            continue;
+        }
+
+        const ScreenTriangle& triangle = triangles[t];
+        float min_x = glm::min(triangle.v0.x, glm::min(triangle.v1.x, triangle.v2.x));
+        float max_x = glm::max(triangle.v0.x, glm::max(triangle.v1.x, triangle.v2.x));
+        float min_y = glm::min(triangle.v0.y, glm::min(triangle.v1.y, triangle.v2.y));
+        float max_y = glm::max(triangle.v0.y, glm::max(triangle.v1.y, triangle.v2.y));
+
+        if(max_x < 0.f || max_y < 0.f || min_x >= DEPTH_BUFFER_WIDTH || min_y >= DEPTH_BUFFER_HEIGHT) {
+            continue;
+        }
+
+        int tile_x0 = clamp_to_int(min_x, 0, DEPTH_BUFFER_WIDTH - 1) / static_cast<int>(TILE_WIDTH);
+        int tile_x1 = clamp_to_int(max_x, 0, DEPTH_BUFFER_WIDTH - 1) / static_cast<int>(TILE_WIDTH);
+        int tile_y0 = clamp_to_int(min_y, 0, DEPTH_BUFFER_HEIGHT - 1) / static_cast<int>(TILE_HEIGHT);
+        int tile_y1 = clamp_to_int(max_y, 0, DEPTH_BUFFER_HEIGHT - 1) / static_cast<int>(TILE_HEIGHT);
+
+        for(int tile_y = tile_y0; tile_y <= tile_y1; tile_y++) {
+            for(int tile_x = tile_x0; tile_x <= tile_x1; tile_x++) {
+                tile_bins[tile_y * TILE_COUNT_X + tile_x].push_back(t);
+            }
+        }
+    }
+}
+
+/*
+ * Half-space rasterization of every triangle binned to the tile, sampling at pixel centers.
+ * The edge functions and 1/w are all affine in screen space, so each is evaluated as a*x + b*y + c, 8 pixels a step.
+ */
+void OcclusionCuller::rasterize_tile(uint32_t tile_index) {
+    int tile_x0 = static_cast<int>((tile_index % TILE_COUNT_X) * TILE_WIDTH);
+    int tile_y0 = static_cast<int>((tile_index / TILE_COUNT_X) * TILE_HEIGHT);
+    int tile_x1 = tile_x0 + static_cast<int>(TILE_WIDTH);
+    int tile_y1 = tile_y0 + static_cast<int>(TILE_HEIGHT);
+
+    for(uint32_t triangle_index : tile_bins[tile_index]) {
+        const ScreenTriangle& triangle = triangles[triangle_index];
+        const glm::vec3& a = triangle.v0;
+        const glm::vec3& b = triangle.v1;
+        const glm::vec3& c = triangle.v2;
+
+        // edge e_ab(p) = (b.x - a.x) * (p.y - a.y) - (b.y - a.y) * (p.x - a.x), positive inside for ccw triangles
+        float edge_a[3] = { -(c.y - b.y), -(a.y - c.y), -(b.y - a.y) };
+        float edge_b[3] = { c.x - b.x, a.x - c.x, b.x - a.x };
+        float edge_c[3] = { -edge_b[0] * b.y - edge_a[0] * b.x, -edge_b[1] * c.y - edge_a[1] * c.x, -edge_b[2] * a.y - edge_a[2] * a.x };
+
+        float area = edge_a[2] * c.x + edge_b[2] * c.y + edge_c[2];
+        float inverse_area = 1.f / area;
+
+        // e_bc weights a, e_ca weights b, e_ab weights c
+        float z_a = (edge_a[0] * a.z + edge_a[1] * b.z + edge_a[2] * c.z) * inverse_area;
+        float z_b = (edge_b[0] * a.z + edge_b[1] * b.z + edge_b[2] * c.z) * inverse_area;
+        float z_c = (edge_c[0] * a.z + edge_c[1] * b.z + edge_c[2] * c.z) * inverse_area;
+
+        int min_x = clamp_to_int(glm::min(a.x, glm::min(b.x, c.x)), tile_x0, tile_x1 - 1);
+        int max_x = clamp_to_int(glm::max(a.x, glm::max(b.x, c.x)), tile_x0, tile_x1 - 1);
+        int min_y = clamp_to_int(glm::min(a.y, glm::min(b.y, c.y)), tile_y0, tile_y1 - 1);
+        int max_y = clamp_to_int(glm::max(a.y, glm::max(b.y, c.y)), tile_y0, tile_y1 - 1);
+        // tiles are 8-pixel aligned, so stepping from an aligned start never leaves the tile
+        min_x &= ~7;
+
+#if defined(__AVX2__)
+        const __m256 lane_offsets = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f);
+        const __m256 zero = _mm256_setzero_ps();
+        __m256 edge_a_0 = _mm256_set1_ps(edge_a[0]), edge_a_1 = _mm256_set1_ps(edge_a[1]), edge_a_2 = _mm256_set1_ps(edge_a[2]);
+        __m256 z_a_8 = _mm256_set1_ps(z_a);
+
+        for(int y = min_y; y <= max_y; y++) {
+            float pixel_y = y + 0.5f;
+            __m256 row_0 = _mm256_set1_ps(edge_b[0] * pixel_y + edge_c[0]);
+            __m256 row_1 = _mm256_set1_ps(edge_b[1] * pixel_y + edge_c[1]);
+            __m256 row_2 = _mm256_set1_ps(edge_b[2] * pixel_y + edge_c[2]);
+            __m256 row_z = _mm256_set1_ps(z_b * pixel_y + z_c);
+
+            float* row = &depth_buffer[y * DEPTH_BUFFER_WIDTH];
+            for(int x = min_x; x <= max_x; x += 8) {
+                __m256 pixel_x = _mm256_add_ps(_mm256_set1_ps(static_cast<float>(x)), lane_offsets);
+
+                __m256 e0 = _mm256_fmadd_ps(edge_a_0, pixel_x, row_0);
+                __m256 e1 = _mm256_fmadd_ps(edge_a_1, pixel_x, row_1);
+                __m256 e2 = _mm256_fmadd_ps(edge_a_2, pixel_x, row_2);
+                __m256 inside = _mm256_and_ps(_mm256_cmp_ps(e0, zero, _CMP_GE_OQ),
+                                _mm256_and_ps(_mm256_cmp_ps(e1, zero, _CMP_GE_OQ), _mm256_cmp_ps(e2, zero, _CMP_GE_OQ)));
+                if(_mm256_movemask_ps(inside) == 0) {
+                    continue;
+                }
+
+                __m256 z = _mm256_fmadd_ps(z_a_8, pixel_x, row_z);
+                __m256 old_depth = _mm256_loadu_ps(row + x);
+                __m256 new_depth = _mm256_blendv_ps(old_depth, _mm256_max_ps(old_depth, z), inside);
+                _mm256_storeu_ps(row + x, new_depth);
+            }
+        }
+#else
+        for(int y = min_y; y <= max_y; y++) {
+            float pixel_y = y + 0.5f;
+            float* row = &depth_buffer[y * DEPTH_BUFFER_WIDTH];
+            for(int x = min_x; x <= max_x; x++) {
+                float pixel_x = x + 0.5f;
+                float e0 = edge_a[0] * pixel_x + edge_b[0] * pixel_y + edge_c[0];
+                float e1 = edge_a[1] * pixel_x + edge_b[1] * pixel_y + edge_c[1];
+                float e2 = edge_a[2] * pixel_x + edge_b[2] * pixel_y + edge_c[2];
+                if(e0 >= 0.f && e1 >= 0.f && e2 >= 0.f) {
+                    row[x] = glm::max(row[x], z_a * pixel_x + z_b * pixel_y + z_c);
+                }
+            }
+        }
+#endif
+    }
+
+    float nearest = 0.f;
+    float farthest = FLT_MAX;
+    for(int y = tile_y0; y < tile_y1; y++) {
+        for(int x = tile_x0; x < tile_x1; x++) {
+            float depth = depth_buffer[y * DEPTH_BUFFER_WIDTH + x];
+            nearest = glm::max(nearest, depth);
+            farthest = glm::min(farthest, depth);
+        }
+    }
+
+    tile_nearest[tile_index] = nearest;
+    tile_farthest[tile_index] = farthest;
+}
+
+bool OcclusionCuller::is_aabb_visible(const glm::vec3& aabb_min, const glm::vec3& aabb_max, const glm::mat4& view_proj) const {
+    float min_x = FLT_MAX, min_y = FLT_MAX;
+    float max_x = -FLT_MAX, max_y = -FLT_MAX;
+    float nearest = 0.f;
+
+    for(int corner = 0; corner < 8; corner++) {
+        glm::vec3 position = glm::vec3(
+                corner & 1 ? aabb_max.x : aabb_min.x,
+                corner & 2 ? aabb_max.y : aabb_min.y,
+                corner & 4 ? aabb_max.z : aabb_min.z);
+        glm::vec4 clip = view_proj * glm::vec4(position, 1.f);
+
+        if(clip.w < MIN_CLIP_W) {
+            return true;
+        }
+
+        glm::vec3 screen = to_screen(clip);
+        min_x = glm::min(min_x, screen.x);
+        min_y = glm::min(min_y, screen.y);
+        max_x = glm::max(max_x, screen.x);
+        max_y = glm::max(max_y, screen.y);
+        nearest = glm::max(nearest, screen.z);
+    }
+
+    // frustum culling already dropped the ones fully off screen, anything left here that isn't on the buffer is kept
+    if(max_x < 0.f || max_y < 0.f || min_x >= DEPTH_BUFFER_WIDTH || min_y >= DEPTH_BUFFER_HEIGHT) {
+        return true;
+    }
+
+    int rect_x0 = clamp_to_int(min_x, 0, DEPTH_BUFFER_WIDTH - 1);
+    int rect_x1 = clamp_to_int(max_x, 0, DEPTH_BUFFER_WIDTH - 1);
+    int rect_y0 = clamp_to_int(min_y, 0, DEPTH_BUFFER_HEIGHT - 1);
+    int rect_y1 = clamp_to_int(max_y, 0, DEPTH_BUFFER_HEIGHT - 1);
+
+#if defined(__AVX2__)
+    const __m256 nearest_8 = _mm256_set1_ps(nearest);
+#endif
+
+    for(int tile_y = rect_y0 / static_cast<int>(TILE_HEIGHT); tile_y <= rect_y1 / static_cast<int>(TILE_HEIGHT); tile_y++) {
+        for(int tile_x = rect_x0 / static_cast<int>(TILE_WIDTH); tile_x <= rect_x1 / static_cast<int>(TILE_WIDTH); tile_x++) {
+            uint32_t tile_index = tile_y * TILE_COUNT_X + tile_x;
+
+            // behind every pixel of the tile
+            if(nearest < tile_farthest[tile_index]) {
+                continue;
+            }
+            // in front of every pixel of the tile
+            if(nearest >= tile_nearest[tile_index]) {
+                return true;
+            }
+
+            int x0 = std::max(rect_x0, tile_x * static_cast<int>(TILE_WIDTH));
+            int x1 = std::min(rect_x1, (tile_x + 1) * static_cast<int>(TILE_WIDTH) - 1);
+            int y0 = std::max(rect_y0, tile_y * static_cast<int>(TILE_HEIGHT));
+            int y1 = std::min(rect_y1, (tile_y + 1) * static_cast<int>(TILE_HEIGHT) - 1);
+
+            for(int y = y0; y <= y1; y++) {
+                const float* row = &depth_buffer[y * DEPTH_BUFFER_WIDTH];
+#if defined(__AVX2__)
+                // testing a few pixels past the rect on either side can only keep an object, never drop it
+                for(int x = x0 & ~7; x <= x1; x += 8) {
+                    __m256 depth = _mm256_loadu_ps(row + x);
+                    if(_mm256_movemask_ps(_mm256_cmp_ps(nearest_8, depth, _CMP_GE_OQ)) != 0) {
+                        return true;
+                    }
+                }
+#else
+                for(int x = x0; x <= x1; x++) {
+                    if(nearest >= row[x]) {
+                        return true;
+                    }
+                }
+#endif
+            }
+        }
+    }
+
+    return false;
+}
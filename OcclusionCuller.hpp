@@ -0,0 +1,74 @@
+//
+// Created by darby on 2/21/2025.
+//
+
+#pragma once
+
+#include "Common.hpp"
+#include "GraphicsTypes.hpp"
+#include "JobSystem.hpp"
+
+/*
+ * Software occlusion culling against a small CPU depth buffer.
+ *
+ * Each frame the largest on-screen surfaces that carry an OccluderMesh are picked as occluders and rasterized into a
+ * DEPTH_BUFFER_WIDTH x DEPTH_BUFFER_HEIGHT buffer. The buffer is split into tiles that are rasterized as separate jobs,
+ * so no two threads ever write the same pixel. The remaining visible objects then have their screen-space AABB
+ * rectangles tested against it.
+ *
+ * The buffer stores 1/w (reciprocal view depth), which is affine in screen space and keeps its precision with our
+ * very small near plane. Larger values are nearer, 0 is empty.
+ */
+class OcclusionCuller {
+
+public:
+    static constexpr uint32_t DEPTH_BUFFER_WIDTH = 512;
+    static constexpr uint32_t DEPTH_BUFFER_HEIGHT = 256;
+    static constexpr uint32_t TILE_WIDTH = 64;
+    static constexpr uint32_t TILE_HEIGHT = 32;
+    static constexpr uint32_t TILE_COUNT_X = DEPTH_BUFFER_WIDTH / TILE_WIDTH;
+    static constexpr uint32_t TILE_COUNT_Y = DEPTH_BUFFER_HEIGHT / TILE_HEIGHT;
+
+    // surfaces above this are never kept on the CPU, so never become occluders
+    static constexpr uint32_t MAX_OCCLUDER_MESH_TRIANGLES = 1024;
+    static constexpr uint32_t MAX_OCCLUDERS_PER_FRAME = 48;
+    // bounding sphere radius over view depth, roughly the fraction of the screen an occluder has to cover
+    static constexpr float MIN_OCCLUDER_SCREEN_SIZE = 0.05f;
+
+    /*
+     * Removes occluded objects from visible (indices into objects), keeping the order of the survivors.
+     * Objects chosen as occluders are never removed.
+     */
+    void cull(const std::vector<RenderObject>& objects, const glm::mat4& view_proj, std::vector<uint32_t>& visible, JobSystem& job_system);
+
+    uint32_t get_occluder_count() const { return static_cast<uint32_t>(occluders.size()); }
+    uint32_t get_occluder_triangle_count() const { return static_cast<uint32_t>(triangles.size()); }
+    uint32_t get_culled_count() const { return culled_count; }
+
+private:
+    // a screen-space triangle, xy in depth buffer pixels, z is 1/w
+    struct ScreenTriangle {
+        glm::vec3 v0, v1, v2;
+    };
+
+    void select_occluders(const std::vector<RenderObject>& objects, const glm::mat4& view_proj, const std::vector<uint32_t>& visible);
+    void transform_occluders(const std::vector<RenderObject>& objects, const glm::mat4& view_proj, JobSystem& job_system);
+    void bin_triangles();
+    void rasterize_tile(uint32_t tile_index);
+    bool is_aabb_visible(const glm::vec3& aabb_min, const glm::vec3& aabb_max, const glm::mat4& view_proj) const;
+
+    std::vector<float> depth_buffer; // row-major, DEPTH_BUFFER_WIDTH * DEPTH_BUFFER_HEIGHT
+    // nearest and farthest 1/w in each tile after rasterization, for early outs when testing
+    float tile_nearest[TILE_COUNT_X * TILE_COUNT_Y];
+    float tile_farthest[TILE_COUNT_X * TILE_COUNT_Y];
+
+    std::vector<std::pair<float, uint32_t>> occluder_candidates; // screen size, object index
+    std::vector<uint32_t> occluders;
+    std::vector<uint32_t> occluder_first_triangle;
+    std::vector<ScreenTriangle> triangles;
+    std::vector<uint8_t> triangle_valid;
+    std::vector<uint32_t> tile_bins[TILE_COUNT_X * TILE_COUNT_Y];
+    std::vector<uint8_t> object_visible;
+
+    uint32_t culled_count = 0;
+};
@@ -0,0 +1,156 @@
+//
+// Created by darby on 2/24/2025.
+//
+
+#include "ParallelCommandRecorder.hpp"
+
+void ParallelCommandRecorder::init(VkDevice _device, uint32_t queue_family_index, uint32_t thread_count) {
+    device = _device;
+
+    // the pools are only ever reset as a whole, never per buffer
+    VkCommandPoolCreateInfo command_pool_create_info = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+            .pNext = nullptr,
+            .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+            .queueFamilyIndex = queue_family_index,
+    };
+
+    thread_pools.resize(thread_count);
+    for(ThreadCommandPool& thread_pool : thread_pools) {
+        VK_CHECK(vkCreateCommandPool(device, &command_pool_create_info, nullptr, &thread_pool.command_pool));
+        // room for any one thread to end up recording every chunk of a pass, which job stealing allows
+        thread_pool.command_buffers.reserve(thread_count * CHUNKS_PER_THREAD);
+    }
+
+    chunk_command_buffers.reserve(thread_count * CHUNKS_PER_THREAD);
+    chunk_encoders.reserve(thread_count * CHUNKS_PER_THREAD);
+}
+
+void ParallelCommandRecorder::destroy() {
+    for(ThreadCommandPool& thread_pool : thread_pools) {
+        vkDestroyCommandPool(device, thread_pool.command_pool, nullptr);
+    }
+
+    thread_pools.clear();
+}
+
+void ParallelCommandRecorder::reset() {
+    for(ThreadCommandPool& thread_pool : thread_pools) {
+        VK_CHECK(vkResetCommandPool(device, thread_pool.command_pool, 0));
+        thread_pool.used_count = 0;
+    }
+
+    secondary_count = 0;
+}
+
+void ParallelCommandRecorder::record(VkCommandBuffer primary,
+                                     std::span<const VkFormat> color_attachment_formats,
+                                     VkFormat depth_attachment_format,
+                                     VkExtent2D extent,
+                                     uint32_t draw_count,
+                                     JobSystem& job_system,
+                                     EngineStats& engine_stats,
+                                     FunctionRef<void(CommandEncoder& encoder, uint32_t start, uint32_t end)> record_draws) {
+    if(draw_count == 0) {
+        return;
+    }
+
+    uint32_t target_chunk_count = job_system.get_thread_count() * CHUNKS_PER_THREAD;
+    uint32_t draws_per_chunk = std::max(MIN_DRAWS_PER_CHUNK, (draw_count + target_chunk_count - 1) / target_chunk_count);
+    uint32_t chunk_count = (draw_count + draws_per_chunk - 1) / draws_per_chunk;
+
+    chunk_command_buffers.resize(chunk_count);
+    chunk_encoders.resize(chunk_count);
+
+    VkCommandBufferInheritanceRenderingInfo inheritance_rendering_info = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO,
+            .pNext = nullptr,
+            .flags = 0,
+            .viewMask = 0,
+            .colorAttachmentCount = static_cast<uint32_t>(color_attachment_formats.size()),
+            .pColorAttachmentFormats = color_attachment_formats.empty() ? nullptr : color_attachment_formats.data(),
+            .depthAttachmentFormat = depth_attachment_format,
+            .stencilAttachmentFormat = VK_FORMAT_UNDEFINED,
+            .rasterizationSamples = VK_SAMPLE_COUNT_1_BIT
+    };
+
+    VkCommandBufferInheritanceInfo inheritance_info = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+            .pNext = &inheritance_rendering_info,
+            .renderPass = VK_NULL_HANDLE,
+            .subpass = 0,
+            .framebuffer = VK_NULL_HANDLE,
+            .occlusionQueryEnable = VK_FALSE,
+            .queryFlags = 0,
+            .pipelineStatistics = 0
+    };
+
+    VkCommandBufferBeginInfo begin_info = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+            .pNext = nullptr,
+            .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT,
+            .pInheritanceInfo = &inheritance_info
+    };
+
+    VkViewport viewport = {
+            .x = 0,
+            .y = 0,
+            .width = static_cast<float>(extent.width),
+            .height = static_cast<float>(extent.height),
+            .minDepth = 0.f,
+            .maxDepth = 1.f
+    };
+
+    VkRect2D scissor = {
+            .offset = {
+                    .x = 0,
+                    .y = 0
+            },
+            .extent = extent
+    };
+
+    // parallel_for batches line up with chunks, so a batch's start tells us which chunk it is
+    job_system.parallel_for(draw_count, draws_per_chunk, [&](uint32_t start, uint32_t end) {
+        uint32_t chunk_index = start / draws_per_chunk;
+
+        VkCommandBuffer cmd = get_command_buffer(thread_pools[JobSystem::get_thread_index()]);
+        VK_CHECK(vkBeginCommandBuffer(cmd, &begin_info));
+
+        vkCmdSetViewport(cmd, 0, 1, &viewport);
+        vkCmdSetScissor(cmd, 0, 1, &scissor);
+
+        CommandEncoder& encoder = chunk_encoders[chunk_index];
+        encoder.begin(cmd);
+        record_draws(encoder, start, end);
+
+        VK_CHECK(vkEndCommandBuffer(cmd));
+        chunk_command_buffers[chunk_index] = cmd;
+    });
+
+    // chunks run in draw order, whatever order they were recorded in
+    vkCmdExecuteCommands(primary, chunk_count, chunk_command_buffers.data());
+
+    for(const CommandEncoder& encoder : chunk_encoders) {
+        encoder.add_stats(engine_stats);
+    }
+
+    secondary_count += chunk_count;
+}
+
+VkCommandBuffer ParallelCommandRecorder::get_command_buffer(ThreadCommandPool& thread_pool) {
+    if(thread_pool.used_count == thread_pool.command_buffers.size()) {
+        VkCommandBufferAllocateInfo command_buffer_allocate_info = {
+                .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+                .pNext = nullptr,
+                .commandPool = thread_pool.command_pool,
+                .level = VK_COMMAND_BUFFER_LEVEL_SECONDARY,
+                .commandBufferCount = 1,
+        };
+
+        VkCommandBuffer cmd;
+        VK_CHECK(vkAllocateCommandBuffers(device, &command_buffer_allocate_info, &cmd));
+        thread_pool.command_buffers.push_back(cmd);
+    }
+
+    return thread_pool.command_buffers[thread_pool.used_count++];
+}
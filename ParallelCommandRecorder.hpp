@@ -0,0 +1,71 @@
+//
+// Created by darby on 2/24/2025.
+//
+
+#pragma once
+
+#include "Common.hpp"
+#include "CommandEncoder.hpp"
+#include "EngineStats.hpp"
+#include "JobSystem.hpp"
+
+/*
+ * Records a pass's draws on the job system's threads into secondary command buffers, then executes them in order from
+ * the primary command buffer.
+ *
+ * Every thread gets its own command pool, so no locking is needed while recording. There's one recorder per FrameData,
+ * its pools are reset once that frame's fence has been waited on.
+ *
+ * The caller begins rendering on the primary with VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT before calling
+ * record(), and ends it afterwards. No draws may be recorded straight into the primary inside that rendering.
+ */
+class ParallelCommandRecorder {
+
+public:
+    // a chunk has at least this many draws, below it the recording overhead outweighs the parallelism
+    static constexpr uint32_t MIN_DRAWS_PER_CHUNK = 64;
+    // chunks per thread, a few more than one so threads that finish early can pick up the remainder
+    static constexpr uint32_t CHUNKS_PER_THREAD = 2;
+
+    void init(VkDevice device, uint32_t queue_family_index, uint32_t thread_count);
+    void destroy();
+
+    // frees every secondary recorded with this recorder, the GPU must be done with them
+    void reset();
+
+    /*
+     * Splits [0, draw_count) into chunks and calls record_draws(encoder, start, end) for each one on some job thread.
+     * The encoder has already been begun on a secondary with the viewport and scissor set to extent, since dynamic
+     * state is not inherited from the primary. The attachment formats must match the active rendering on primary.
+     * Bind counts from every chunk's encoder are added to engine_stats.
+     */
+    void record(VkCommandBuffer primary,
+                std::span<const VkFormat> color_attachment_formats,
+                VkFormat depth_attachment_format,
+                VkExtent2D extent,
+                uint32_t draw_count,
+                JobSystem& job_system,
+                EngineStats& engine_stats,
+                FunctionRef<void(CommandEncoder& encoder, uint32_t start, uint32_t end)> record_draws);
+
+    uint32_t get_secondary_count() const { return secondary_count; }
+
+private:
+    struct ThreadCommandPool {
+        VkCommandPool command_pool = VK_NULL_HANDLE;
+        std::vector<VkCommandBuffer> command_buffers;
+        uint32_t used_count = 0;
+    };
+
+    // only ever called by the thread owning thread_pool
+    VkCommandBuffer get_command_buffer(ThreadCommandPool& thread_pool);
+
+    VkDevice device;
+
+    std::vector<ThreadCommandPool> thread_pools; // indexed by JobSystem::get_thread_index()
+
+    std::vector<VkCommandBuffer> chunk_command_buffers;
+    std::vector<CommandEncoder> chunk_encoders;
+
+    uint32_t secondary_count = 0; // since the last reset
+};
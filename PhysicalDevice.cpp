@@ -24,8 +24,13 @@ void PhysicalDevice::choose_and_init(VkInstance instance, VkSurfaceKHR surface)
     VkPhysicalDeviceFeatures features;
     vkGetPhysicalDeviceFeatures(physical_device, &features);
 
+    VkPhysicalDeviceMeshShaderFeaturesEXT query_mesh_shader_features = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_FEATURES_EXT
+    };
+
     VkPhysicalDeviceVulkan13Features query13Features = {
-            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES,
+            .pNext = &query_mesh_shader_features
     };
 
     VkPhysicalDeviceVulkan12Features query12Features = {
@@ -56,6 +61,51 @@ void PhysicalDevice::choose_and_init(VkInstance instance, VkSurfaceKHR surface)
         fmt::print("descriptorIndexing not available on this device!");
     }
 
+    // GLTFHDRMaterial's bindless material set
+    if(!query12Features.runtimeDescriptorArray) {
+        fmt::print("runtimeDescriptorArray not available on this device!");
+    }
+
+    if(!query12Features.descriptorBindingPartiallyBound) {
+        fmt::print("descriptorBindingPartiallyBound not available on this device!");
+    }
+
+    if(!query12Features.descriptorBindingSampledImageUpdateAfterBind) {
+        fmt::print("descriptorBindingSampledImageUpdateAfterBind not available on this device!");
+    }
+
+    if(!query12Features.descriptorBindingStorageBufferUpdateAfterBind) {
+        fmt::print("descriptorBindingStorageBufferUpdateAfterBind not available on this device!");
+    }
+
+    if(!query12Features.descriptorBindingUpdateUnusedWhilePending) {
+        fmt::print("descriptorBindingUpdateUnusedWhilePending not available on this device!");
+    }
+
+    if(!query12Features.shaderSampledImageArrayNonUniformIndexing) {
+        fmt::print("shaderSampledImageArrayNonUniformIndexing not available on this device!");
+    }
+
+    if(!query12Features.drawIndirectCount) {
+        fmt::print("drawIndirectCount not available on this device!");
+    }
+
+    if(!query12Features.timelineSemaphore) {
+        fmt::print("timelineSemaphore not available on this device!");
+    }
+
+    if(!features.multiDrawIndirect) {
+        fmt::print("multiDrawIndirect not available on this device!");
+    }
+
+    if(!features.drawIndirectFirstInstance) {
+        fmt::print("drawIndirectFirstInstance not available on this device!");
+    }
+
+    if(!features.shaderStorageImageArrayDynamicIndexing) {
+        fmt::print("shaderStorageImageArrayDynamicIndexing not available on this device!");
+    }
+
     // Check the extensions we want are available
     uint32_t extension_count{0};
     vkEnumerateDeviceExtensionProperties(physical_device, nullptr, &extension_count, nullptr);
@@ -88,6 +138,26 @@ void PhysicalDevice::choose_and_init(VkInstance instance, VkSurfaceKHR surface)
     }
     fmt::print("--End of device extension list--\n", extension_properties.size());
 
+    // optional, only used when both the extension and its task and mesh stages are there
+    bool has_mesh_shader_extension = false;
+    for(auto& property : extension_properties) {
+        if(strcmp(property.extensionName, VK_EXT_MESH_SHADER_EXTENSION_NAME) == 0) {
+            has_mesh_shader_extension = true;
+            break;
+        }
+    }
+
+    supports_mesh_shaders = has_mesh_shader_extension && query_mesh_shader_features.taskShader && query_mesh_shader_features.meshShader;
+    fmt::print("Mesh shaders {}\n", supports_mesh_shaders ? "supported" : "not supported, falling back to vertex shading");
+
+    for(auto& property : extension_properties) {
+        if(strcmp(property.extensionName, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) == 0) {
+            supports_memory_budget = true;
+            break;
+        }
+    }
+    fmt::print("Memory budget extension {}\n", supports_memory_budget ? "supported" : "not supported, budgets are estimated");
+
     // Check formats supported
     VK_CHECK(vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physical_device, surface, &surface_capabilities));
 
@@ -112,6 +182,8 @@ void PhysicalDevice::choose_and_init(VkInstance instance, VkSurfaceKHR surface)
 
     fmt::print("Max color attachments: {}\n", device_properties.properties.limits.maxColorAttachments);
 
+    min_uniform_buffer_offset_alignment = device_properties.properties.limits.minUniformBufferOffsetAlignment;
+
 
 
 }
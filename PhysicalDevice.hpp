@@ -17,5 +17,14 @@ public:
     std::vector<VkSurfaceFormatKHR> surface_formats;
     std::vector<VkPresentModeKHR> present_modes;
 
+    // VK_EXT_mesh_shader with task and mesh shaders, optional. The renderers fall back to vertex shading without it
+    bool supports_mesh_shaders = false;
+
+    // VK_EXT_memory_budget, optional. Without it VMA estimates the heap budgets, see TextureResidencyManager
+    bool supports_memory_budget = false;
+
+    // dynamic uniform buffer offsets have to be a multiple of this, see UniformRingBuffer
+    VkDeviceSize min_uniform_buffer_offset_alignment = 256;
+
 };
 
@@ -36,6 +36,7 @@ void PipelineBuilder::clear() {
     };
 
     shader_stages.clear();
+    uses_mesh_shaders = false;
 
 }
 
@@ -84,8 +85,9 @@ VkPipeline PipelineBuilder::build_pipeline(VkDevice device, const std::string& n
             .pNext = &render_info, // necessary for dynamic rendering
             .stageCount = static_cast<uint32_t>(shader_stages.size()),
             .pStages = shader_stages.data(),
-            .pVertexInputState = &vertex_input_info,
-            .pInputAssemblyState = &input_assembly,
+            // mesh shading pipelines have no vertex input stage, both must be left out
+            .pVertexInputState = uses_mesh_shaders ? nullptr : &vertex_input_info,
+            .pInputAssemblyState = uses_mesh_shaders ? nullptr : &input_assembly,
             .pViewportState = &viewport_info,
             .pRasterizationState = &rasterizer,
             .pMultisampleState = &multisampling,
@@ -110,6 +112,16 @@ void PipelineBuilder::set_shaders(VkShaderModule vertex_shader, VkShaderModule f
 
     shader_stages.push_back(vk_init::get_pipeline_shader_stage_info(VK_SHADER_STAGE_VERTEX_BIT, vertex_shader));
     shader_stages.push_back(vk_init::get_pipeline_shader_stage_info(VK_SHADER_STAGE_FRAGMENT_BIT, fragment_shader));
+    uses_mesh_shaders = false;
+}
+
+void PipelineBuilder::set_mesh_shaders(VkShaderModule task_shader, VkShaderModule mesh_shader, VkShaderModule fragment_shader) {
+    shader_stages.clear();
+
+    shader_stages.push_back(vk_init::get_pipeline_shader_stage_info(VK_SHADER_STAGE_TASK_BIT_EXT, task_shader));
+    shader_stages.push_back(vk_init::get_pipeline_shader_stage_info(VK_SHADER_STAGE_MESH_BIT_EXT, mesh_shader));
+    shader_stages.push_back(vk_init::get_pipeline_shader_stage_info(VK_SHADER_STAGE_FRAGMENT_BIT, fragment_shader));
+    uses_mesh_shaders = true;
 }
 
 void PipelineBuilder::set_input_topology(VkPrimitiveTopology topology) {
@@ -177,6 +189,12 @@ void PipelineBuilder::set_multiple_color_attachment_formats_and_blending_styles(
             case AlphaBlend:
                 set_blending_alphablend(color_blend_attachments[i]);
                 break;
+            case AccumulateBlend:
+                set_blending_accumulate(color_blend_attachments[i]);
+                break;
+            case RevealageBlend:
+                set_blending_revealage(color_blend_attachments[i]);
+                break;
         }
     }
 }
@@ -257,12 +275,25 @@ void PipelineBuilder::set_blending_alphablend(VkPipelineColorBlendAttachmentStat
     color_blend_attachment.alphaBlendOp = VK_BLEND_OP_ADD;
 }
 
+void PipelineBuilder::set_blending_accumulate(VkPipelineColorBlendAttachmentState& color_blend_attachment) {
+    color_blend_attachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+    color_blend_attachment.blendEnable = VK_TRUE;
+    color_blend_attachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+    color_blend_attachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE;
+    color_blend_attachment.colorBlendOp = VK_BLEND_OP_ADD;
+    color_blend_attachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+    color_blend_attachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+    color_blend_attachment.alphaBlendOp = VK_BLEND_OP_ADD;
+}
 
-
-
-
-
-
-
-
-
+// single channel target, each fragment scales what's behind it by (1 - its alpha)
+void PipelineBuilder::set_blending_revealage(VkPipelineColorBlendAttachmentState& color_blend_attachment) {
+    color_blend_attachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT;
+    color_blend_attachment.blendEnable = VK_TRUE;
+    color_blend_attachment.srcColorBlendFactor = VK_BLEND_FACTOR_ZERO;
+    color_blend_attachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_COLOR;
+    color_blend_attachment.colorBlendOp = VK_BLEND_OP_ADD;
+    color_blend_attachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+    color_blend_attachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+    color_blend_attachment.alphaBlendOp = VK_BLEND_OP_ADD;
+}
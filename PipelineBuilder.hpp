@@ -13,7 +13,9 @@ public:
     enum BlendOptions {
         NoBlend,
         AdditiveBlend,
-        AlphaBlend
+        AlphaBlend,
+        AccumulateBlend, // ONE, ONE on every channel, for the weighted blended OIT accumulation target
+        RevealageBlend // dst * (1 - src), for the weighted blended OIT revealage target
     };
 
     // shader module infos
@@ -38,6 +40,8 @@ public:
     PipelineBuilder() { clear(); }
 
     void set_shaders(VkShaderModule vertex_shader, VkShaderModule fragment_shader);
+    // task, mesh and fragment stages instead, VK_EXT_mesh_shader. The input topology is ignored, the mesh shader declares it
+    void set_mesh_shaders(VkShaderModule task_shader, VkShaderModule mesh_shader, VkShaderModule fragment_shader);
     void set_input_topology(VkPrimitiveTopology topology);
     void set_rasterizer_polygon_mode(VkPolygonMode polygon_mode);
     void set_rasterizer_cull_mode(VkCullModeFlags cull_mode, VkFrontFace front_face);
@@ -58,10 +62,16 @@ public:
 
 private:
 
+    bool uses_mesh_shaders = false;
+
     static void set_blending_additive(VkPipelineColorBlendAttachmentState& color_blend_attachment);
 
     static void set_blending_alphablend(VkPipelineColorBlendAttachmentState& color_blend_attachment);
 
+    static void set_blending_accumulate(VkPipelineColorBlendAttachmentState& color_blend_attachment);
+
+    static void set_blending_revealage(VkPipelineColorBlendAttachmentState& color_blend_attachment);
+
     static void set_disable_blending(VkPipelineColorBlendAttachmentState& color_blend_attachment);
 
 };
@@ -0,0 +1,55 @@
+//
+// Created by darby on 3/6/2025.
+//
+
+#include "RecyclingBuffer.hpp"
+#include "VulkanGeneralUtility.hpp"
+
+void RecyclingBuffer::init(VkDevice _device, VmaAllocator _allocator, VkBufferUsageFlags _usage, VmaMemoryUsage _memory_usage, const char* _name) {
+    device = _device;
+    allocator = _allocator;
+    usage = _usage;
+    memory_usage = _memory_usage;
+    name = _name;
+}
+
+void RecyclingBuffer::destroy() {
+    for(Slot& slot : slots) {
+        if(slot.capacity > 0) {
+            slot.buffer.destroy_buffer();
+        }
+    }
+    slots.clear();
+}
+
+RecyclingBuffer::Slot& RecyclingBuffer::acquire(VkDeviceSize size, TimelineDeletionQueue& timeline) {
+    uint64_t completed_value = timeline.get_completed_value();
+
+    // of those the GPU is done with, the biggest is the least likely to need replacing
+    Slot* slot = nullptr;
+    for(Slot& candidate : slots) {
+        if(candidate.used_value <= completed_value && (slot == nullptr || candidate.capacity > slot->capacity)) {
+            slot = &candidate;
+        }
+    }
+
+    if(slot == nullptr) {
+        slot = &slots.emplace_back();
+    }
+
+    if(slot->capacity < size) {
+        if(slot->capacity > 0) {
+            timeline.push_buffer(slot->buffer);
+        }
+
+        slot->capacity = std::max(size + size / 2, VkDeviceSize(256));
+        slot->buffer.init(allocator, slot->capacity, usage, memory_usage);
+        slot->buffer.set_name(device, name);
+        if(usage & VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT) {
+            slot->address = vk_util::get_buffer_device_address(device, slot->buffer.buffer);
+        }
+    }
+
+    slot->used_value = timeline.get_pending_value();
+    return *slot;
+}
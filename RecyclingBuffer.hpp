@@ -0,0 +1,48 @@
+//
+// Created by darby on 3/6/2025.
+//
+
+#pragma once
+
+#include "Common.hpp"
+#include "Buffer.hpp"
+#include "TimelineDeletionQueue.hpp"
+
+#include <deque>
+
+/*
+ * A set of persistent buffers of one usage, handed out for one frame submission at a time, for data that's rewritten
+ * every frame and only read by the GPU that frame, like indirect commands.
+ *
+ * acquire() gives back a buffer the GPU is done with, by the timeline's completed value, that's at least the size
+ * asked for. One too small is replaced by one half as big again as what was asked, so once sizes settle nothing is
+ * allocated. A new buffer is only made when every one is still in flight, so there end up as many as there are
+ * acquires per frame times the frames in flight.
+ */
+class RecyclingBuffer {
+
+public:
+    struct Slot {
+        Buffer buffer;
+        VkDeviceAddress address = 0; // when created with VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
+        VkDeviceSize capacity = 0;
+        uint64_t used_value = 0; // the timeline value of the submission it was last acquired for
+    };
+
+    void init(VkDevice device, VmaAllocator allocator, VkBufferUsageFlags usage, VmaMemoryUsage memory_usage, const char* name);
+    // the device must be idle
+    void destroy();
+
+    // a buffer of at least size bytes that nothing in flight uses, until the submission signalling the timeline's
+    // pending value. Slots never move, the reference stays valid until destroy()
+    Slot& acquire(VkDeviceSize size, TimelineDeletionQueue& timeline);
+
+private:
+    VkDevice device;
+    VmaAllocator allocator;
+    VkBufferUsageFlags usage;
+    VmaMemoryUsage memory_usage;
+    const char* name;
+
+    std::deque<Slot> slots;
+};
@@ -0,0 +1,467 @@
+//
+// Created by darby on 2/18/2025.
+//
+
+#include "SceneBVH.hpp"
+
+static constexpr uint32_t INVALID_NODE = UINT32_MAX;
+static constexpr uint32_t MAX_TRAVERSAL_DEPTH = 64;
+
+// half the surface area of a box, which is all SAH needs since only the ratios between candidates matter
+static float get_half_area(const glm::vec3& aabb_min, const glm::vec3& aabb_max) {
+    glm::vec3 e = aabb_max - aabb_min;
+    return e.x * e.y + e.y * e.z + e.z * e.x;
+}
+
+// slab test, returns the entry distance or FLT_MAX on a miss
+static float intersect_ray_aabb(const glm::vec3& origin, const glm::vec3& inverse_direction, float max_distance,
+                                const glm::vec3& aabb_min, const glm::vec3& aabb_max) {
+    float t_near = 0.f;
+    float t_far = max_distance;
+
+    for(int axis = 0; axis < 3; axis++) {
+        float t_0 = (aabb_min[axis] - origin[axis]) * inverse_direction[axis];
+        float t_1 = (aabb_max[axis] - origin[axis]) * inverse_direction[axis];
+        t_near = glm::max(t_near, glm::min(t_0, t_1));
+        t_far = glm::min(t_far, glm::max(t_0, t_1));
+    }
+
+    return t_near <= t_far ? t_near : FLT_MAX;
+}
+
+void SceneBVH::update(const std::vector<RenderObject>& objects, JobSystem& job_system) {
+    bool same_surfaces = objects.size() == object_transforms.size();
+    for(size_t i = 0; same_surfaces && i < objects.size(); i++) {
+        same_surfaces = objects[i].vertex_buffer_address == object_vertex_addresses[i] && objects[i].first_index == object_first_indices[i];
+    }
+
+    if(!same_surfaces) {
+        build(objects, job_system);
+        return;
+    }
+
+    moved_objects.clear();
+    for(uint32_t i = 0; i < objects.size(); i++) {
+        // skinned surfaces keep their transform and get new local bounds from each pose instead
+        const Bounds& bounds = objects[i].bounds;
+        if(objects[i].transform != object_transforms[i] ||
+           bounds.origin != object_local_bounds[i].origin || bounds.extents != object_local_bounds[i].extents) {
+            moved_objects.push_back(i);
+        }
+    }
+
+    rebuilt_last_update = false;
+
+    if(moved_objects.empty()) {
+        return;
+    }
+
+    if(moved_objects.size() > objects.size() * REBUILD_MOVED_FRACTION) {
+        build(objects, job_system);
+    } else {
+        refit(objects, moved_objects);
+    }
+}
+
+void SceneBVH::build(const std::vector<RenderObject>& objects, JobSystem& job_system) {
+    uint32_t object_count = static_cast<uint32_t>(objects.size());
+
+    rebuilt_last_update = true;
+
+    object_indices.resize(object_count);
+    object_leaves.resize(object_count);
+    object_min.resize(object_count);
+    object_max.resize(object_count);
+    object_centroid.resize(object_count);
+    object_transforms.resize(object_count);
+    object_local_bounds.resize(object_count);
+    object_vertex_addresses.resize(object_count);
+    object_first_indices.resize(object_count);
+
+    if(object_count == 0) {
+        nodes_used = 0;
+        return;
+    }
+
+    job_system.parallel_for(object_count, 512, [this, &objects](uint32_t start, uint32_t end) {
+        for(uint32_t i = start; i < end; i++) {
+            object_indices[i] = i;
+            object_vertex_addresses[i] = objects[i].vertex_buffer_address;
+            object_first_indices[i] = objects[i].first_index;
+            compute_object_bounds(objects, i);
+        }
+    });
+
+    // a binary tree with at least one object per leaf never needs more than 2n - 1 nodes
+    nodes.resize(2 * object_count - 1);
+    node_parents.resize(2 * object_count - 1);
+
+    nodes[0].left_or_first = 0;
+    nodes[0].object_count = object_count;
+    node_parents[0] = INVALID_NODE;
+    nodes_used = 1;
+
+    update_node_bounds(0);
+    subdivide(0, job_system);
+
+    assign_object_leaves();
+}
+
+void SceneBVH::refit(const std::vector<RenderObject>& objects, std::span<const uint32_t> moved) {
+    for(uint32_t object_index : moved) {
+        compute_object_bounds(objects, object_index);
+
+        uint32_t node_index = object_leaves[object_index];
+        update_node_bounds(node_index);
+        node_index = node_parents[node_index];
+
+        // walk towards the root until a node's bounds come out unchanged, everything above it is then still valid
+        while(node_index != INVALID_NODE) {
+            BVHNode& node = nodes[node_index];
+            const BVHNode& left = nodes[node.left_or_first];
+            const BVHNode& right = nodes[node.left_or_first + 1];
+
+            glm::vec3 new_min = glm::min(left.aabb_min, right.aabb_min);
+            glm::vec3 new_max = glm::max(left.aabb_max, right.aabb_max);
+
+            if(new_min.x == node.aabb_min.x && new_min.y == node.aabb_min.y && new_min.z == node.aabb_min.z &&
+               new_max.x == node.aabb_max.x && new_max.y == node.aabb_max.y && new_max.z == node.aabb_max.z) {
+                break;
+            }
+
+            node.aabb_min = new_min;
+            node.aabb_max = new_max;
+            node_index = node_parents[node_index];
+        }
+    }
+}
+
+void SceneBVH::compute_object_bounds(const std::vector<RenderObject>& objects, uint32_t object_index) {
+    const RenderObject& object = objects[object_index];
+    const glm::mat4& m = object.transform;
+
+    // transform the local AABB's center, then take the extents of the rotated box along each world axis
+    glm::vec3 center = glm::vec3(m * glm::vec4(object.bounds.origin, 1.f));
+    glm::vec3 extents = glm::abs(glm::vec3(m[0])) * object.bounds.extents.x +
+                        glm::abs(glm::vec3(m[1])) * object.bounds.extents.y +
+                        glm::abs(glm::vec3(m[2])) * object.bounds.extents.z;
+
+    object_min[object_index] = center - extents;
+    object_max[object_index] = center + extents;
+    object_centroid[object_index] = center;
+    object_transforms[object_index] = m;
+    object_local_bounds[object_index] = object.bounds;
+}
+
+void SceneBVH::update_node_bounds(uint32_t node_index) {
+    BVHNode& node = nodes[node_index];
+    node.aabb_min = glm::vec3(FLT_MAX);
+    node.aabb_max = glm::vec3(-FLT_MAX);
+
+    for(uint32_t i = 0; i < node.object_count; i++) {
+        uint32_t object_index = object_indices[node.left_or_first + i];
+        node.aabb_min = glm::min(node.aabb_min, object_min[object_index]);
+        node.aabb_max = glm::max(node.aabb_max, object_max[object_index]);
+    }
+}
+
+void SceneBVH::subdivide(uint32_t node_index, JobSystem& job_system) {
+    BVHNode& node = nodes[node_index];
+
+    if(node.object_count <= MAX_LEAF_OBJECTS) {
+        return;
+    }
+
+    int axis;
+    float split_position;
+    float split_cost = find_best_split(node, axis, split_position);
+    float leaf_cost = node.object_count * get_half_area(node.aabb_min, node.aabb_max);
+    if(split_cost >= leaf_cost) {
+        return;
+    }
+
+    // partition the node's range of object_indices around the split plane
+    uint32_t first = node.left_or_first;
+    uint32_t i = first;
+    uint32_t j = first + node.object_count - 1;
+    while(i <= j) {
+        if(object_centroid[object_indices[i]][axis] < split_position) {
+            i++;
+        } else {
+            std::swap(object_indices[i], object_indices[j]);
+            if(j == 0) {
+                break;
+            }
+            j--;
+        }
+    }
+
+    uint32_t left_count = i - first;
+    if(left_count == 0 || left_count == node.object_count) {
+        return;
+    }
+
+    uint32_t left_child = nodes_used.fetch_add(2);
+    uint32_t right_child = left_child + 1;
+
+    nodes[left_child].left_or_first = first;
+    nodes[left_child].object_count = left_count;
+    nodes[right_child].left_or_first = i;
+    nodes[right_child].object_count = node.object_count - left_count;
+    node_parents[left_child] = node_index;
+    node_parents[right_child] = node_index;
+
+    uint32_t object_count = node.object_count;
+    node.left_or_first = left_child;
+    node.object_count = 0;
+
+    update_node_bounds(left_child);
+    update_node_bounds(right_child);
+
+    if(object_count > PARALLEL_BUILD_THRESHOLD) {
+        JobCounter counter;
+        job_system.submit([this, left_child, &job_system]() { subdivide(left_child, job_system); }, counter);
+        subdivide(right_child, job_system);
+        job_system.wait(counter);
+    } else {
+        subdivide(left_child, job_system);
+        subdivide(right_child, job_system);
+    }
+}
+
+float SceneBVH::find_best_split(const BVHNode& node, int& out_axis, float& out_split_position) const {
+    struct Bin {
+        glm::vec3 aabb_min = glm::vec3(FLT_MAX);
+        glm::vec3 aabb_max = glm::vec3(-FLT_MAX);
+        uint32_t object_count = 0;
+    };
+
+    // bin by centroid rather than by box, so the bins span only where objects can actually be split
+    glm::vec3 centroid_min = glm::vec3(FLT_MAX);
+    glm::vec3 centroid_max = glm::vec3(-FLT_MAX);
+    for(uint32_t i = 0; i < node.object_count; i++) {
+        const glm::vec3& centroid = object_centroid[object_indices[node.left_or_first + i]];
+        centroid_min = glm::min(centroid_min, centroid);
+        centroid_max = glm::max(centroid_max, centroid);
+    }
+
+    float best_cost = FLT_MAX;
+    out_axis = 0;
+    out_split_position = 0.f;
+
+    for(int axis = 0; axis < 3; axis++) {
+        float axis_min = centroid_min[axis];
+        float axis_max = centroid_max[axis];
+        if(axis_min == axis_max) {
+            continue;
+        }
+
+        Bin bins[SAH_BIN_COUNT];
+        float scale = SAH_BIN_COUNT / (axis_max - axis_min);
+
+        for(uint32_t i = 0; i < node.object_count; i++) {
+            uint32_t object_index = object_indices[node.left_or_first + i];
+            uint32_t bin_index = std::min(SAH_BIN_COUNT - 1, static_cast<uint32_t>((object_centroid[object_index][axis] - axis_min) * scale));
+
+            Bin& bin = bins[bin_index];
+            bin.object_count++;
+            bin.aabb_min = glm::min(bin.aabb_min, object_min[object_index]);
+            bin.aabb_max = glm::max(bin.aabb_max, object_max[object_index]);
+        }
+
+        // sweep from both ends, so every plane between bins gets its left and right cost in two passes
+        float left_area[SAH_BIN_COUNT - 1];
+        float right_area[SAH_BIN_COUNT - 1];
+        uint32_t left_count[SAH_BIN_COUNT - 1];
+        uint32_t right_count[SAH_BIN_COUNT - 1];
+
+        glm::vec3 left_min = glm::vec3(FLT_MAX), left_max = glm::vec3(-FLT_MAX);
+        glm::vec3 right_min = glm::vec3(FLT_MAX), right_max = glm::vec3(-FLT_MAX);
+        uint32_t left_sum = 0, right_sum = 0;
+
+        for(uint32_t i = 0; i < SAH_BIN_COUNT - 1; i++) {
+            const Bin& left_bin = bins[i];
+            left_sum += left_bin.object_count;
+            left_count[i] = left_sum;
+            if(left_bin.object_count > 0) {
+                left_min = glm::min(left_min, left_bin.aabb_min);
+                left_max = glm::max(left_max, left_bin.aabb_max);
+            }
+            left_area[i] = left_sum > 0 ? get_half_area(left_min, left_max) : 0.f;
+
+            const Bin& right_bin = bins[SAH_BIN_COUNT - 1 - i];
+            right_sum += right_bin.object_count;
+            right_count[SAH_BIN_COUNT - 2 - i] = right_sum;
+            if(right_bin.object_count > 0) {
+                right_min = glm::min(right_min, right_bin.aabb_min);
+                right_max = glm::max(right_max, right_bin.aabb_max);
+            }
+            right_area[SAH_BIN_COUNT - 2 - i] = right_sum > 0 ? get_half_area(right_min, right_max) : 0.f;
+        }
+
+        float bin_width = (axis_max - axis_min) / SAH_BIN_COUNT;
+        for(uint32_t i = 0; i < SAH_BIN_COUNT - 1; i++) {
+            if(left_count[i] == 0 || right_count[i] == 0) {
+                continue;
+            }
+
+            float cost = left_count[i] * left_area[i] + right_count[i] * right_area[i];
+            if(cost < best_cost) {
+                best_cost = cost;
+                out_axis = axis;
+                out_split_position = axis_min + bin_width * (i + 1);
+            }
+        }
+    }
+
+    return best_cost;
+}
+
+void SceneBVH::assign_object_leaves() {
+    uint32_t node_count = nodes_used;
+    for(uint32_t node_index = 0; node_index < node_count; node_index++) {
+        const BVHNode& node = nodes[node_index];
+        for(uint32_t i = 0; i < node.object_count; i++) {
+            object_leaves[object_indices[node.left_or_first + i]] = node_index;
+        }
+    }
+}
+
+void SceneBVH::query_frustum(const Frustum& frustum, std::vector<uint32_t>& out_inside, std::vector<uint32_t>& out_intersecting) const {
+    if(nodes_used == 0) {
+        return;
+    }
+
+    struct StackEntry {
+        uint32_t node_index;
+        bool fully_inside;
+    };
+
+    StackEntry stack[MAX_TRAVERSAL_DEPTH * 2];
+    uint32_t stack_size = 0;
+    stack[stack_size++] = { 0, false };
+
+    while(stack_size > 0) {
+        StackEntry entry = stack[--stack_size];
+        const BVHNode& node = nodes[entry.node_index];
+
+        bool fully_inside = entry.fully_inside;
+        if(!fully_inside) {
+            Frustum::Containment containment = frustum.classify_aabb(node.aabb_min, node.aabb_max);
+            if(containment == Frustum::Outside) {
+                continue;
+            }
+            // no need to test anything below a node that's entirely in view
+            fully_inside = containment == Frustum::Inside;
+        }
+
+        if(node.is_leaf()) {
+            std::vector<uint32_t>& out = fully_inside ? out_inside : out_intersecting;
+            for(uint32_t i = 0; i < node.object_count; i++) {
+                out.push_back(object_indices[node.left_or_first + i]);
+            }
+            continue;
+        }
+
+        ASSERT(stack_size + 2 <= MAX_TRAVERSAL_DEPTH * 2, "BVH deeper than the traversal stack");
+        stack[stack_size++] = { node.left_or_first, fully_inside };
+        stack[stack_size++] = { node.left_or_first + 1, fully_inside };
+    }
+}
+
+void SceneBVH::query_sphere(const glm::vec3& center, float radius, std::vector<uint32_t>& out_objects) const {
+    if(nodes_used == 0) {
+        return;
+    }
+
+    float radius_squared = radius * radius;
+    auto overlaps = [&center, radius_squared](const glm::vec3& aabb_min, const glm::vec3& aabb_max) {
+        glm::vec3 closest = glm::max(aabb_min, glm::min(center, aabb_max));
+        glm::vec3 offset = closest - center;
+        return glm::dot(offset, offset) <= radius_squared;
+    };
+
+    uint32_t stack[MAX_TRAVERSAL_DEPTH * 2];
+    uint32_t stack_size = 0;
+    stack[stack_size++] = 0;
+
+    while(stack_size > 0) {
+        const BVHNode& node = nodes[stack[--stack_size]];
+
+        if(!overlaps(node.aabb_min, node.aabb_max)) {
+            continue;
+        }
+
+        if(node.is_leaf()) {
+            for(uint32_t i = 0; i < node.object_count; i++) {
+                uint32_t object_index = object_indices[node.left_or_first + i];
+                if(overlaps(object_min[object_index], object_max[object_index])) {
+                    out_objects.push_back(object_index);
+                }
+            }
+            continue;
+        }
+
+        ASSERT(stack_size + 2 <= MAX_TRAVERSAL_DEPTH * 2, "BVH deeper than the traversal stack");
+        stack[stack_size++] = node.left_or_first;
+        stack[stack_size++] = node.left_or_first + 1;
+    }
+}
+
+std::optional<BVHRayHit> SceneBVH::raycast(const glm::vec3& origin, const glm::vec3& direction, float max_distance) const {
+    if(nodes_used == 0) {
+        return std::nullopt;
+    }
+
+    glm::vec3 inverse_direction = glm::vec3(1.f / direction.x, 1.f / direction.y, 1.f / direction.z);
+
+    BVHRayHit closest_hit = { UINT32_MAX, max_distance };
+
+    uint32_t stack[MAX_TRAVERSAL_DEPTH * 2];
+    uint32_t stack_size = 0;
+
+    if(intersect_ray_aabb(origin, inverse_direction, closest_hit.distance, nodes[0].aabb_min, nodes[0].aabb_max) == FLT_MAX) {
+        return std::nullopt;
+    }
+    stack[stack_size++] = 0;
+
+    while(stack_size > 0) {
+        const BVHNode& node = nodes[stack[--stack_size]];
+
+        if(node.is_leaf()) {
+            for(uint32_t i = 0; i < node.object_count; i++) {
+                uint32_t object_index = object_indices[node.left_or_first + i];
+                float t = intersect_ray_aabb(origin, inverse_direction, closest_hit.distance, object_min[object_index], object_max[object_index]);
+                if(t < closest_hit.distance) {
+                    closest_hit = { object_index, t };
+                }
+            }
+            continue;
+        }
+
+        uint32_t near_child = node.left_or_first;
+        uint32_t far_child = node.left_or_first + 1;
+        float near_t = intersect_ray_aabb(origin, inverse_direction, closest_hit.distance, nodes[near_child].aabb_min, nodes[near_child].aabb_max);
+        float far_t = intersect_ray_aabb(origin, inverse_direction, closest_hit.distance, nodes[far_child].aabb_min, nodes[far_child].aabb_max);
+
+        if(far_t < near_t) {
+            std::swap(near_child, far_child);
+            std::swap(near_t, far_t);
+        }
+
+        // push the far child first so the near one is visited first and can shrink closest_hit for it
+        ASSERT(stack_size + 2 <= MAX_TRAVERSAL_DEPTH * 2, "BVH deeper than the traversal stack");
+        if(far_t < closest_hit.distance) {
+            stack[stack_size++] = far_child;
+        }
+        if(near_t < closest_hit.distance) {
+            stack[stack_size++] = near_child;
+        }
+    }
+
+    if(closest_hit.object_index == UINT32_MAX) {
+        return std::nullopt;
+    }
+
+    return closest_hit;
+}
@@ -0,0 +1,92 @@
+//
+// Created by darby on 2/18/2025.
+//
+
+#pragma once
+
+#include "Common.hpp"
+#include "GraphicsTypes.hpp"
+#include "FrustumCuller.hpp"
+#include "JobSystem.hpp"
+
+#include <atomic>
+#include <cfloat>
+
+struct BVHNode {
+    glm::vec3 aabb_min;
+    uint32_t left_or_first; // index of the left child for interior nodes (right child is left + 1), first object for leaves
+    glm::vec3 aabb_max;
+    uint32_t object_count; // 0 for interior nodes
+
+    bool is_leaf() const { return object_count > 0; }
+};
+
+struct BVHRayHit {
+    uint32_t object_index;
+    float distance;
+};
+
+/*
+ * Bounding volume hierarchy over the world-space AABBs of a DrawContext's surfaces.
+ *
+ * Built top-down with a binned SAH. Subtrees over PARALLEL_BUILD_THRESHOLD objects have their children built as jobs.
+ * When the draw list keeps the same surfaces and only some transforms or local bounds change, the moved leaves are
+ * refit in place and their new bounds are walked up to the root instead of rebuilding.
+ *
+ * Object indices handed back by queries index into the RenderObject list the tree was built from.
+ */
+class SceneBVH {
+
+public:
+    // rebuilds or refits to match objects, depending on what changed since the last call
+    void update(const std::vector<RenderObject>& objects, JobSystem& job_system);
+
+    void build(const std::vector<RenderObject>& objects, JobSystem& job_system);
+    void refit(const std::vector<RenderObject>& objects, std::span<const uint32_t> moved_objects);
+
+    /*
+     * Objects in subtrees entirely inside the frustum are appended to out_inside.
+     * Objects in leaves that straddle a plane are appended to out_intersecting and still need a finer test.
+     */
+    void query_frustum(const Frustum& frustum, std::vector<uint32_t>& out_inside, std::vector<uint32_t>& out_intersecting) const;
+    void query_sphere(const glm::vec3& center, float radius, std::vector<uint32_t>& out_objects) const;
+    // closest object AABB hit along the ray, direction does not need to be normalized
+    std::optional<BVHRayHit> raycast(const glm::vec3& origin, const glm::vec3& direction, float max_distance = FLT_MAX) const;
+
+    uint32_t get_node_count() const { return nodes_used; }
+    uint32_t get_object_count() const { return static_cast<uint32_t>(object_indices.size()); }
+    bool was_rebuilt_last_update() const { return rebuilt_last_update; }
+
+private:
+    static constexpr uint32_t MAX_LEAF_OBJECTS = 4;
+    static constexpr uint32_t SAH_BIN_COUNT = 16;
+    static constexpr uint32_t PARALLEL_BUILD_THRESHOLD = 2048;
+    // past this fraction of moved objects a refit degrades the tree enough that a rebuild is the better deal
+    static constexpr float REBUILD_MOVED_FRACTION = 0.25f;
+
+    void compute_object_bounds(const std::vector<RenderObject>& objects, uint32_t object_index);
+    void update_node_bounds(uint32_t node_index);
+    void subdivide(uint32_t node_index, JobSystem& job_system);
+    // returns the SAH cost of the best binned split, or FLT_MAX if the node's centroids can't be separated
+    float find_best_split(const BVHNode& node, int& out_axis, float& out_split_position) const;
+    void assign_object_leaves();
+
+    std::vector<BVHNode> nodes;
+    std::vector<uint32_t> node_parents;
+    std::atomic<uint32_t> nodes_used { 0 };
+
+    // objects are referenced through object_indices so leaves cover a contiguous range of it
+    std::vector<uint32_t> object_indices;
+    std::vector<uint32_t> object_leaves;
+    std::vector<glm::vec3> object_min;
+    std::vector<glm::vec3> object_max;
+    std::vector<glm::vec3> object_centroid;
+
+    // what the tree was last built or refit against, used to tell a refit from a rebuild
+    std::vector<glm::mat4> object_transforms;
+    std::vector<Bounds> object_local_bounds;
+    std::vector<VkDeviceAddress> object_vertex_addresses;
+    std::vector<uint32_t> object_first_indices;
+    std::vector<uint32_t> moved_objects;
+    bool rebuilt_last_update = false;
+};
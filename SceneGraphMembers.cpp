@@ -17,10 +17,15 @@ void Node::draw(const glm::mat4& top_matrix, DrawContext& ctx) {
     }
 }
 
-
 void MeshNode::draw(const glm::mat4& top_matrix, DrawContext& draw_context) {
+    add_surfaces(top_matrix, draw_context);
+    Node::draw(top_matrix, draw_context);
+}
 
-    glm::mat4 node_matrix = top_matrix * world_transform;
+void MeshNode::add_surfaces(const glm::mat4& top_matrix, DrawContext& draw_context) const {
+    // skinned vertices come out of the skinning pass already posed in model space, the node's own transform is ignored
+    bool skinned = is_skinned();
+    glm::mat4 node_matrix = skinned ? top_matrix : top_matrix * world_transform;
 
     for(auto& s : mesh->draw_datas) {
         RenderObject def = {};
@@ -29,13 +34,25 @@ void MeshNode::draw(const glm::mat4& top_matrix, DrawContext& draw_context) {
         def.index_buffer = mesh->mesh_buffers.index_buffer.buffer;
         def.material = &s.material.value()->data;
 
+        // the occluder mesh is the bind pose's and can't be trusted once animated
+        def.bounds = s.bounds;
+        def.occluder = skinned ? nullptr : s.occluder.get();
         def.transform = node_matrix;
         def.vertex_buffer_address = mesh->mesh_buffers.vertex_buffer_address;
 
-        draw_context.opaque_surfaces.push_back(def);
-    }
+        def.index_buffer_address = mesh->mesh_buffers.index_buffer_address;
+        def.meshlet_buffer_address = mesh->meshlet_buffer_address;
+        def.meshlet_data_buffer_address = mesh->meshlet_data_buffer_address;
+        def.first_meshlet = s.first_meshlet;
+        def.meshlet_count = s.meshlet_count;
+        def.cull_meshlets = !skinned;
 
-    Node::draw(top_matrix, draw_context);
+        if(def.material->pass_type == MaterialPassType::Transparent) {
+            draw_context.transparent_surfaces.push_back(def);
+        } else {
+            draw_context.opaque_surfaces.push_back(def);
+        }
+    }
 }
 
 void GLTFFile::draw(const glm::mat4& top_matrix, DrawContext& draw_context) {
@@ -55,8 +72,12 @@ void GLTFFile::destroy(VkDevice device) {
     for(auto& m : meshes) {
         m->mesh_buffers.vertex_buffer.destroy_buffer();
         m->mesh_buffers.index_buffer.destroy_buffer();
+        if(m->skin_vertex_buffer_address != 0) {
+            m->skin_vertex_buffer.destroy_buffer();
+        }
+        if(m->meshlet_buffer_address != 0) {
+            m->meshlet_buffer.destroy_buffer();
+            m->meshlet_data_buffer.destroy_buffer();
+        }
     }
-
-    material_data_buffer.destroy_buffer(); // handles all material constants
-    material_descriptor_pool.destroy_descriptor_pools(device); // handles all material descriptors
 }
@@ -9,6 +9,7 @@
 #include "AllocatedImage.hpp"
 #include "Buffer.hpp"
 #include "DescriptorAllocatorGrowable.hpp"
+#include "Animation.hpp"
 
 class IRenderable {
     virtual void draw(const glm::mat4& top_matrix, DrawContext& ctx) = 0;
@@ -18,10 +19,14 @@ struct Node : public IRenderable {
 
     std::weak_ptr<Node> parent; // weak ptr to avoid circular dep.
     std::vector<std::shared_ptr<Node>> children;
+    uint32_t index = 0; // into GLTFFile::nodes, where an AnimationPose keeps this node's transform
 
     glm::mat4 local_transform;
     glm::mat4 world_transform;
 
+    // translation/rotation/scale the node was loaded with, what animations start from. identity for nodes given as a matrix
+    NodePose rest_pose = { glm::vec3(0.f), glm::quat(1.f, 0.f, 0.f, 0.f), glm::vec3(1.f) };
+
     void refresh_transform(const glm::mat4& parent_matrix);
     virtual void draw(const glm::mat4& top_matrix, DrawContext& ctx);
 
@@ -30,8 +35,16 @@ struct Node : public IRenderable {
 struct MeshNode : public Node {
     // std::shared_ptr<MeshDrawData> mesh;
     std::shared_ptr<GLTFMesh> mesh;
+    int skin = -1; // index into GLTFFile::skins
+    // index into GLTFFile::skinned_mesh_nodes, -1 for nodes the SkinningPass doesn't pose
+    int skinned_index = -1;
+
+    bool is_skinned() const { return skinned_index >= 0; }
 
     virtual void draw(const glm::mat4& top_matrix, DrawContext& draw_context) override;
+    // draw without the children. Skinned surfaces come out in the bind pose, with the mesh's vertices and bounds.
+    // Whoever holds the pose points them at its posed vertices and rebuilds the bounds from its palette
+    void add_surfaces(const glm::mat4& top_matrix, DrawContext& draw_context) const;
 };
 
 
@@ -47,11 +60,11 @@ struct GLTFFile : public IRenderable {
 
     std::vector<std::shared_ptr<Node>> top_nodes;
 
-    std::vector<VkSampler> samplers;
+    std::vector<std::shared_ptr<AnimationClip>> animations;
+    std::vector<Skin> skins;
+    std::vector<std::shared_ptr<MeshNode>> skinned_mesh_nodes; // the nodes the SkinningPass runs on, per instance
 
-    DescriptorAllocatorGrowable material_descriptor_pool;
-
-    Buffer material_data_buffer;
+    std::vector<VkSampler> samplers;
 
     virtual void draw(const glm::mat4& top_matrix, DrawContext& draw_context) override;
     void destroy(VkDevice device);
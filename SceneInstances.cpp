@@ -0,0 +1,196 @@
+//
+// Created by darby on 2/27/2025.
+//
+
+#include "SceneInstances.hpp"
+#include "VulkanGeneralUtility.hpp"
+
+#include <bit>
+
+// the bind pose box moved by every joint, which holds any blend of the joints' transforms. The box itself is kept for
+// the vertices without weights, which skinning.comp leaves where they are
+static Bounds get_skinned_bounds(const Bounds& bind_bounds, const std::vector<glm::mat4>& joint_palette) {
+    glm::vec3 min_pos = bind_bounds.origin - bind_bounds.extents;
+    glm::vec3 max_pos = bind_bounds.origin + bind_bounds.extents;
+
+    for(const glm::mat4& joint_matrix : joint_palette) {
+        glm::vec3 origin = glm::vec3(joint_matrix * glm::vec4(bind_bounds.origin, 1.f));
+        glm::vec3 extents = glm::abs(glm::vec3(joint_matrix[0])) * bind_bounds.extents.x
+                          + glm::abs(glm::vec3(joint_matrix[1])) * bind_bounds.extents.y
+                          + glm::abs(glm::vec3(joint_matrix[2])) * bind_bounds.extents.z;
+
+        min_pos = glm::min(min_pos, origin - extents);
+        max_pos = glm::max(max_pos, origin + extents);
+    }
+
+    Bounds bounds;
+    bounds.origin = (max_pos + min_pos) / 2.f;
+    bounds.extents = (max_pos - min_pos) / 2.f;
+    bounds.sphere_radius = glm::length(bounds.extents);
+    return bounds;
+}
+
+void SceneInstances::init(VkDevice _device, VmaAllocator _allocator, std::shared_ptr<GLTFFile> _file, AnimationSystem& _animation_system) {
+    device = _device;
+    allocator = _allocator;
+    file = _file;
+    animation_system = &_animation_system;
+    rest_pose.init(*file);
+}
+
+void SceneInstances::destroy() {
+    for(const Buffer& buffer : skinned_vertex_buffers) {
+        buffer.destroy_buffer();
+    }
+    skinned_vertex_buffers.clear();
+    skinned_vertex_buffer_addresses.clear();
+}
+
+uint32_t SceneInstances::add_instance(const glm::mat4& transform, bool visible) {
+    uint32_t instance_index = static_cast<uint32_t>(transforms.size());
+
+    transforms.push_back(transform);
+    if(!file->animations.empty()) {
+        AnimationPose& pose = poses.emplace_back();
+        players.push_back(&animation_system->add_player(file, 0, pose));
+    }
+
+    for(const std::shared_ptr<MeshNode>& node : file->skinned_mesh_nodes) {
+        Buffer& buffer = skinned_vertex_buffers.emplace_back();
+        buffer.init(allocator, sizeof(Vertex) * node->mesh->vertex_count,
+                    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                    VMA_MEMORY_USAGE_GPU_ONLY);
+        buffer.set_name(device, (file->skins[node->skin].name + std::string(" skinned vertex buffer")).c_str());
+        skinned_vertex_buffer_addresses.push_back(vk_util::get_buffer_device_address(device, buffer.buffer));
+    }
+    if(instance_index % 64 == 0) {
+        visibility_bits.push_back(0);
+    }
+
+    set_visible(instance_index, visible);
+    return instance_index;
+}
+
+void SceneInstances::reserve(uint32_t instance_count) {
+    transforms.reserve(instance_count);
+    if(!file->animations.empty()) {
+        players.reserve(instance_count);
+    }
+    skinned_vertex_buffers.reserve(instance_count * file->skinned_mesh_nodes.size());
+    skinned_vertex_buffer_addresses.reserve(instance_count * file->skinned_mesh_nodes.size());
+    visibility_bits.reserve((instance_count + 63) / 64);
+}
+
+void SceneInstances::set_transform(uint32_t instance_index, const glm::mat4& transform) {
+    ASSERT(instance_index < transforms.size(), "Instance index out of range");
+    transforms[instance_index] = transform;
+}
+
+void SceneInstances::set_visible(uint32_t instance_index, bool visible) {
+    ASSERT(instance_index < transforms.size(), "Instance index out of range");
+
+    uint64_t& word = visibility_bits[instance_index / 64];
+    uint64_t bit = 1ull << (instance_index % 64);
+    if(visible != ((word & bit) != 0)) {
+        visible_instance_count += visible ? 1 : -1;
+    }
+    word = visible ? word | bit : word & ~bit;
+}
+
+bool SceneInstances::is_visible(uint32_t instance_index) const {
+    return (visibility_bits[instance_index / 64] >> (instance_index % 64)) & 1;
+}
+
+AnimationPlayer* SceneInstances::get_player(uint32_t instance_index) const {
+    ASSERT(instance_index < transforms.size(), "Instance index out of range");
+    return players.empty() ? nullptr : players[instance_index];
+}
+
+const AnimationPose& SceneInstances::get_pose(uint32_t instance_index) const {
+    ASSERT(instance_index < transforms.size(), "Instance index out of range");
+    return poses.empty() ? rest_pose : poses[instance_index];
+}
+
+void SceneInstances::draw(DrawContext& draw_context, JobSystem& job_system) {
+    if(visible_instance_count == 0) {
+        return;
+    }
+
+    // one walk of the tree no matter how many copies there are. Redone every frame, the memory defragmenter may have
+    // moved the mesh buffers
+    template_context.opaque_surfaces.clear();
+    template_context.transparent_surfaces.clear();
+    template_opaque_nodes.clear();
+    template_transparent_nodes.clear();
+    for(const std::shared_ptr<Node>& top_node : file->top_nodes) {
+        gather_template_surfaces(*top_node);
+    }
+
+    if(template_context.opaque_surfaces.empty() && template_context.transparent_surfaces.empty()) {
+        return;
+    }
+
+    // skip over the hidden ones a word at a time
+    visible_instances.clear();
+    visible_instances.reserve(visible_instance_count);
+    for(uint32_t w = 0; w < visibility_bits.size(); w++) {
+        uint64_t word = visibility_bits[w];
+        while(word != 0) {
+            visible_instances.push_back(w * 64 + static_cast<uint32_t>(std::countr_zero(word)));
+            word &= word - 1;
+        }
+    }
+
+    stamp_instances(template_context.opaque_surfaces, template_opaque_nodes, draw_context.opaque_surfaces, job_system);
+    stamp_instances(template_context.transparent_surfaces, template_transparent_nodes, draw_context.transparent_surfaces, job_system);
+}
+
+void SceneInstances::gather_template_surfaces(const Node& node) {
+    if(const MeshNode* mesh_node = dynamic_cast<const MeshNode*>(&node)) {
+        mesh_node->add_surfaces(glm::mat4(1.f), template_context);
+        template_opaque_nodes.resize(template_context.opaque_surfaces.size(), mesh_node);
+        template_transparent_nodes.resize(template_context.transparent_surfaces.size(), mesh_node);
+    }
+
+    for(const std::shared_ptr<Node>& child : node.children) {
+        gather_template_surfaces(*child);
+    }
+}
+
+void SceneInstances::stamp_instances(const std::vector<RenderObject>& template_surfaces, const std::vector<const MeshNode*>& template_nodes,
+                                     std::vector<RenderObject>& out, JobSystem& job_system) {
+    uint32_t surface_count = static_cast<uint32_t>(template_surfaces.size());
+    if(surface_count == 0) {
+        return;
+    }
+
+    size_t first_surface = out.size();
+    out.resize(first_surface + visible_instances.size() * surface_count);
+
+    // instance i's surfaces land at first_surface + i * surface_count, so batches never touch the same objects
+    RenderObject* out_surfaces = out.data() + first_surface;
+    job_system.parallel_for(static_cast<uint32_t>(visible_instances.size()), INSTANCES_PER_BATCH, [&](uint32_t start, uint32_t end) {
+        for(uint32_t i = start; i < end; i++) {
+            uint32_t instance_index = visible_instances[i];
+            const glm::mat4& instance_transform = transforms[instance_index];
+            const AnimationPose& pose = get_pose(instance_index);
+            RenderObject* instance_surfaces = out_surfaces + static_cast<size_t>(i) * surface_count;
+
+            for(uint32_t s = 0; s < surface_count; s++) {
+                const MeshNode& node = *template_nodes[s];
+                RenderObject& surface = instance_surfaces[s];
+                surface = template_surfaces[s];
+
+                // skinned vertices are posed in the file's space already, into this instance's own buffer. Only their
+                // bounds follow the palette
+                if(node.is_skinned()) {
+                    surface.transform = instance_transform;
+                    surface.bounds = get_skinned_bounds(template_surfaces[s].bounds, pose.joint_palettes[node.skin]);
+                    surface.vertex_buffer_address = get_skinned_vertex_buffer_address(instance_index, node.skinned_index);
+                } else {
+                    surface.transform = instance_transform * pose.world_transforms[node.index];
+                }
+            }
+        }
+    });
+}
@@ -0,0 +1,94 @@
+//
+// Created by darby on 2/27/2025.
+//
+
+#pragma once
+
+#include "Common.hpp"
+#include "GraphicsTypes.hpp"
+#include "JobSystem.hpp"
+#include "SceneGraphMembers.hpp"
+
+/*
+ * Many placed copies of one loaded GLTFFile, each with its own world transform and visibility bit.
+ *
+ * The file's node tree is walked once per frame into a template draw list relative to the file's root, then every
+ * visible instance stamps the template out with its transform on the job system. Walking the tree once per copy
+ * would cost thousands of virtual calls and matrix multiplies per node for what is the same list every time.
+ *
+ * Copies of an animated file each get an AnimationPose and a player of their own on the AnimationSystem, so a crowd
+ * of one loaded character moves independently. Stamping takes every surface's transform, and a skinned surface's
+ * bounds, from its copy's pose. Every copy also has its own output buffer per skinned node, which the SkinningPass
+ * poses with the copy's palette and the copy's skinned surfaces draw from.
+ */
+class SceneInstances {
+
+public:
+    // instances stamped out per job, sets with fewer visible instances than this stay on the calling thread
+    static constexpr uint32_t INSTANCES_PER_BATCH = 256;
+
+    // copies of an animated file play its first clip on animation_system, which must outlive the set
+    void init(VkDevice device, VmaAllocator allocator, std::shared_ptr<GLTFFile> file, AnimationSystem& animation_system);
+    void destroy();
+
+    // returns the instance's index, which stays valid for the lifetime of the set
+    uint32_t add_instance(const glm::mat4& transform, bool visible = true);
+    void reserve(uint32_t instance_count);
+
+    void set_transform(uint32_t instance_index, const glm::mat4& transform);
+    const glm::mat4& get_transform(uint32_t instance_index) const { return transforms[instance_index]; }
+
+    void set_visible(uint32_t instance_index, bool visible);
+    bool is_visible(uint32_t instance_index) const;
+
+    // the instance's own player, nullptr when the file isn't animated
+    AnimationPlayer* get_player(uint32_t instance_index) const;
+    // what the instance was posed with this frame, the rest pose when the file isn't animated. Read after the
+    // AnimationSystem was waited on
+    const AnimationPose& get_pose(uint32_t instance_index) const;
+    // where the SkinningPass writes the instance's posed vertices of file->skinned_mesh_nodes[skinned_index]
+    VkDeviceAddress get_skinned_vertex_buffer_address(uint32_t instance_index, uint32_t skinned_index) const {
+        return skinned_vertex_buffer_addresses[instance_index * file->skinned_mesh_nodes.size() + skinned_index];
+    }
+
+    uint32_t get_instance_count() const { return static_cast<uint32_t>(transforms.size()); }
+    uint32_t get_visible_instance_count() const { return visible_instance_count; }
+    uint32_t get_template_surface_count() const {
+        return static_cast<uint32_t>(template_context.opaque_surfaces.size() + template_context.transparent_surfaces.size());
+    }
+
+    // appends a RenderObject per file surface per visible instance to draw_context's opaque or transparent surfaces
+    void draw(DrawContext& draw_context, JobSystem& job_system);
+
+    std::shared_ptr<GLTFFile> file;
+
+private:
+    // walks the file's tree into template_context, noting the MeshNode each surface came from
+    void gather_template_surfaces(const Node& node);
+    // appends a copy of template_surfaces for every visible instance to out, posed by the instance's pose
+    void stamp_instances(const std::vector<RenderObject>& template_surfaces, const std::vector<const MeshNode*>& template_nodes,
+                         std::vector<RenderObject>& out, JobSystem& job_system);
+
+    VkDevice device;
+    VmaAllocator allocator;
+    AnimationSystem* animation_system;
+
+    std::vector<glm::mat4> transforms;
+    std::vector<uint64_t> visibility_bits; // one bit per instance
+
+    uint32_t visible_instance_count = 0;
+
+    // one of each per instance when the file is animated, empty otherwise. deque since the players point at the poses
+    std::deque<AnimationPose> poses;
+    std::vector<AnimationPlayer*> players;
+    AnimationPose rest_pose; // every instance's pose when the file isn't animated
+
+    // instance i's buffer for skinned node k at i * file->skinned_mesh_nodes.size() + k
+    std::vector<Buffer> skinned_vertex_buffers;
+    std::vector<VkDeviceAddress> skinned_vertex_buffer_addresses;
+
+    DrawContext template_context; // the file's surfaces in its rest pose, transforms relative to the file's root
+    std::vector<const MeshNode*> template_opaque_nodes; // the node of each of template_context's opaque surfaces
+    std::vector<const MeshNode*> template_transparent_nodes; // and of each transparent one
+    std::vector<uint32_t> visible_instances; // rebuilt every draw
+};
@@ -24,7 +24,7 @@ void ShadowPipeline::init(VkDevice device, AllocatedImage& shadow_map_image, VkD
     VkPushConstantRange buffer_range = {
             .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
             .offset = 0,
-            .size = sizeof(GPUDrawPushConstants),
+            .size = sizeof(GPUObjectDrawPushConstants),
     };
 
     std::vector<VkPushConstantRange> shadow_push_constant_ranges {
@@ -58,43 +58,14 @@ void ShadowPipeline::init(VkDevice device, AllocatedImage& shadow_map_image, VkD
 
 }
 
-VkDescriptorSet ShadowPipeline::create_frame_light_data_descriptor_set(VkDevice device, LightSourceData& light_data,
-                                                                       VmaAllocator& allocator,
-                                                                       DescriptorAllocatorGrowable& frame_descriptor_allocator,
-                                                                       DeletionQueue& frame_deletion_queue) {
-
-    Buffer light_data_buffer;
-    light_data_buffer.init(allocator,  sizeof(LightSourceData), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-
-    frame_deletion_queue.push_function([=](){
-       light_data_buffer.destroy_buffer();
-    });
-
-    LightSourceData* lsd = (LightSourceData*)light_data_buffer.info.pMappedData;
-    *lsd = light_data;
-
-    VkDescriptorSet shadow_descriptor_set = frame_descriptor_allocator.allocate(device, light_source_descriptor_set_layout, nullptr);
-
-    writer.clear();
-    writer.write_buffer(0, light_data_buffer.buffer, sizeof(LightSourceData), 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
-    writer.update_set(device, shadow_descriptor_set);
-
-    return shadow_descriptor_set;
-
-}
-
-
-VkDescriptorSet ShadowPipeline::create_frame_shadow_map_descriptor_set(VkDevice device, AllocatedImage& shadow_map,
-                                                                       VkSampler shadow_map_sampler,
-                                                                       DescriptorAllocatorGrowable& frame_descriptor_allocator,
-                                                                       VkDescriptorSetLayout shadow_map_descriptor_set_layout) {
-    VkDescriptorSet shadow_descriptor_set = frame_descriptor_allocator.allocate(device, shadow_map_descriptor_set_layout, nullptr);
-
+VkDescriptorSet ShadowPipeline::get_shadow_map_descriptor_set(AllocatedImage& shadow_map, VkSampler shadow_map_sampler,
+                                                              DescriptorSetCache& descriptor_cache,
+                                                              VkDescriptorSetLayout shadow_map_descriptor_set_layout) {
+    // the shadow map never changes, so after the first frame this is a cache hit
     writer.clear();
     writer.write_image(0, shadow_map.view, shadow_map_sampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
-    writer.update_set(device, shadow_descriptor_set);
 
-    return shadow_descriptor_set;
+    return descriptor_cache.get(shadow_map_descriptor_set_layout, writer);
 }
 
 void ShadowPipeline::destroy_resources(VkDevice device) {
@@ -10,6 +10,7 @@
 #include "DescriptorWriter.hpp"
 #include "Buffer.hpp"
 #include "DescriptorAllocatorGrowable.hpp"
+#include "DescriptorSetCache.hpp"
 #include "GraphicsTypes.hpp"
 
 class ShadowPipeline {
@@ -21,15 +22,10 @@ public:
               AllocatedImage& shadow_map_image,
               VkDescriptorSetLayout light_source_descriptor_set_layout);
 
-    VkDescriptorSet create_frame_light_data_descriptor_set(VkDevice device, LightSourceData& light_data,
-                                                           VmaAllocator& allocator,
-                                                           DescriptorAllocatorGrowable& frame_descriptor_allocator,
-                                                           DeletionQueue& frame_deletion_queue);
-
-    VkDescriptorSet create_frame_shadow_map_descriptor_set(VkDevice device, AllocatedImage& shadow_map,
-                                           VkSampler shadow_map_sampler,
-                                           DescriptorAllocatorGrowable& frame_descriptor_allocator,
-                                           VkDescriptorSetLayout shadow_map_descriptor_set_layout);
+    VkDescriptorSet get_shadow_map_descriptor_set(AllocatedImage& shadow_map,
+                                                  VkSampler shadow_map_sampler,
+                                                  DescriptorSetCache& descriptor_cache,
+                                                  VkDescriptorSetLayout shadow_map_descriptor_set_layout);
 
     void destroy_resources(VkDevice device);
 
@@ -0,0 +1,72 @@
+//
+// Created by darby on 3/6/2025.
+//
+
+#include "SharedDescriptorPools.hpp"
+
+void SharedDescriptorPools::init(VkDevice _device, uint32_t _sets_per_pool,
+                                 std::span<DescriptorAllocatorGrowable::PoolSizeRatio> pool_ratios) {
+    device = _device;
+    sets_per_pool = _sets_per_pool;
+
+    pool_sizes.clear();
+    for(DescriptorAllocatorGrowable::PoolSizeRatio ratio : pool_ratios) {
+        pool_sizes.push_back(VkDescriptorPoolSize{
+                .type = ratio.type,
+                .descriptorCount = uint32_t(ratio.ratio * sets_per_pool)
+        });
+    }
+
+    nodes = std::make_unique<PoolNode[]>(MAX_POOL_COUNT);
+    free_head.store(INVALID_INDEX, std::memory_order_relaxed);
+    pool_count.store(0, std::memory_order_relaxed);
+}
+
+void SharedDescriptorPools::destroy() {
+    uint32_t count = get_pool_count();
+    for(uint32_t i = 0; i < count; i++) {
+        vkDestroyDescriptorPool(device, nodes[i].pool, nullptr);
+    }
+
+    nodes.reset();
+    free_head.store(INVALID_INDEX, std::memory_order_relaxed);
+    pool_count.store(0, std::memory_order_relaxed);
+}
+
+uint32_t SharedDescriptorPools::acquire() {
+    uint64_t head = free_head.load(std::memory_order_acquire);
+    while(static_cast<uint32_t>(head) != INVALID_INDEX) {
+        uint32_t index = static_cast<uint32_t>(head);
+        uint32_t next = nodes[index].next.load(std::memory_order_relaxed);
+        uint64_t new_head = ((head >> 32) + 1) << 32 | next;
+
+        // on failure head is reloaded and we try again with whatever is on top now
+        if(free_head.compare_exchange_weak(head, new_head, std::memory_order_acquire, std::memory_order_acquire)) {
+            return index;
+        }
+    }
+
+    // nothing free, claim a new slot. Only this thread touches it until it's released
+    uint32_t index = pool_count.fetch_add(1, std::memory_order_relaxed);
+    ASSERT(index < MAX_POOL_COUNT, "ran out of shared descriptor pool slots");
+
+    VkDescriptorPoolCreateInfo pool_info = {
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+            .flags = 0,
+            .maxSets = sets_per_pool,
+            .poolSizeCount = (uint32_t) pool_sizes.size(),
+            .pPoolSizes = pool_sizes.data()
+    };
+    VK_CHECK(vkCreateDescriptorPool(device, &pool_info, nullptr, &nodes[index].pool));
+
+    return index;
+}
+
+void SharedDescriptorPools::release(uint32_t pool_index) {
+    uint64_t head = free_head.load(std::memory_order_relaxed);
+    uint64_t new_head;
+    do {
+        nodes[pool_index].next.store(static_cast<uint32_t>(head), std::memory_order_relaxed);
+        new_head = ((head >> 32) + 1) << 32 | pool_index;
+    } while(!free_head.compare_exchange_weak(head, new_head, std::memory_order_release, std::memory_order_relaxed));
+}
@@ -0,0 +1,54 @@
+//
+// Created by darby on 3/6/2025.
+//
+
+#pragma once
+
+#include "Common.hpp"
+#include "DescriptorAllocatorGrowable.hpp"
+
+#include <atomic>
+#include <memory>
+
+/*
+ * Descriptor pools shared by every ThreadDescriptorAllocator. They're all made with the same size and ratios, so any
+ * thread can pick up any pool.
+ *
+ * Reset pools sit on a lock-free free list, a stack threaded through the pools' indices. The head carries a tag bumped
+ * on every change, so a pop can't succeed on a next index that another thread's pop and push have made stale.
+ * When the list is empty a new pool is created. Pools are only destroyed by destroy().
+ */
+class SharedDescriptorPools {
+
+public:
+    static constexpr uint32_t MAX_POOL_COUNT = 1024;
+
+    void init(VkDevice device, uint32_t sets_per_pool, std::span<DescriptorAllocatorGrowable::PoolSizeRatio> pool_ratios);
+    // not thread safe, the GPU must be done with every pool
+    void destroy();
+
+    // safe from any thread. The pool is reset and owned by the caller until released
+    uint32_t acquire();
+    // safe from any thread. The pool must have been reset, or never allocated from
+    void release(uint32_t pool_index);
+
+    VkDescriptorPool get_pool(uint32_t pool_index) const { return nodes[pool_index].pool; }
+    uint32_t get_pool_count() const { return std::min(pool_count.load(std::memory_order_relaxed), MAX_POOL_COUNT); }
+
+private:
+    static constexpr uint32_t INVALID_INDEX = UINT32_MAX;
+
+    struct PoolNode {
+        VkDescriptorPool pool = VK_NULL_HANDLE;
+        std::atomic<uint32_t> next { INVALID_INDEX };
+    };
+
+    VkDevice device;
+    uint32_t sets_per_pool;
+    std::vector<VkDescriptorPoolSize> pool_sizes;
+
+    std::unique_ptr<PoolNode[]> nodes; // fixed size, so nothing moves under a thread walking the list
+
+    std::atomic<uint64_t> free_head { INVALID_INDEX }; // low 32 bits the top pool's index, high 32 bits the tag
+    std::atomic<uint32_t> pool_count { 0 };
+};
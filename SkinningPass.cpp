@@ -0,0 +1,152 @@
+//
+// Created by darby on 2/26/2025.
+//
+
+#include "SkinningPass.hpp"
+#include "DescriptorLayoutBuilder.hpp"
+#include "DescriptorWriter.hpp"
+#include "VulkanGeneralUtility.hpp"
+
+void SkinningPass::init(VkDevice _device, VmaAllocator _allocator, uint32_t frame_count, bool mesh_shading_supported,
+                        DeletionQueue& deletion_queue) {
+    device = _device;
+    allocator = _allocator;
+    frame_joint_matrices.resize(frame_count);
+
+    // with mesh shading on, opaque skinned draws pull their posed vertices in the mesh stage instead
+    vertex_read_stages = VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT;
+    if(mesh_shading_supported) {
+        vertex_read_stages |= VK_PIPELINE_STAGE_2_MESH_SHADER_BIT_EXT;
+    }
+
+    DescriptorLayoutBuilder builder;
+    builder.add_binding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    joint_matrix_descriptor_set_layout = builder.build(device, VK_SHADER_STAGE_COMPUTE_BIT);
+
+    std::vector<VkDescriptorSetLayout> skinning_descriptor_layouts = {
+            joint_matrix_descriptor_set_layout
+    };
+
+    VkPushConstantRange compute_push_constant_range = {
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+            .offset = 0,
+            .size = sizeof(SkinningComputePushConstants),
+    };
+
+    std::vector<VkPushConstantRange> skinning_push_constant_ranges = {
+            compute_push_constant_range
+    };
+
+    skinning_pipeline.init(
+            device,
+            "../shaders/skinning.comp.spv",
+            skinning_descriptor_layouts,
+            skinning_push_constant_ranges,
+            deletion_queue
+    );
+
+    deletion_queue.push_function([=, this]() {
+        vkDestroyDescriptorSetLayout(device, joint_matrix_descriptor_set_layout, nullptr);
+        for(FrameJointMatrices& frame : frame_joint_matrices) {
+            if(frame.capacity > 0) {
+                frame.buffer.destroy_buffer();
+            }
+        }
+    });
+}
+
+void SkinningPass::add_instances(SceneInstances& instances) {
+    instance_sets.push_back(&instances);
+}
+
+void SkinningPass::record(VkCommandBuffer cmd,
+                          uint32_t frame_index,
+                          ThreadDescriptorAllocator& frame_descriptor_allocator,
+                          FrameArena& frame_arena,
+                          TimelineDeletionQueue& gpu_deletion_queue,
+                          EngineStats& stats) {
+    stats.skinned_instance_count = 0;
+    stats.skinned_vertex_count = 0;
+
+    size_t joint_count = 0;
+    for(const SceneInstances* instances : instance_sets) {
+        size_t instance_joint_count = 0;
+        for(const std::shared_ptr<MeshNode>& node : instances->file->skinned_mesh_nodes) {
+            instance_joint_count += instances->file->skins[node->skin].joints.size();
+        }
+        joint_count += instance_joint_count * instances->get_visible_instance_count();
+    }
+
+    if(joint_count == 0) {
+        return;
+    }
+
+    // every instance's palette back to back, each dispatch is told where its own starts
+    FrameJointMatrices& frame = frame_joint_matrices[frame_index];
+    if(joint_count > frame.capacity) {
+        if(frame.capacity > 0) {
+            gpu_deletion_queue.push_buffer(frame.buffer);
+        }
+
+        frame.capacity = std::max(joint_count + joint_count / 2, size_t(64));
+        frame.buffer.init(allocator, frame.capacity * sizeof(glm::mat4), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+        frame.buffer.set_name(device, "Joint Matrix Buffer");
+    }
+
+    const Buffer& joint_matrix_buffer = frame.buffer;
+    size_t joint_matrix_buffer_size = joint_count * sizeof(glm::mat4);
+
+    VkDescriptorSet joint_matrix_descriptor_set = frame_descriptor_allocator.allocate(joint_matrix_descriptor_set_layout);
+    DescriptorWriter writer(&frame_arena);
+    writer.write_buffer(0, joint_matrix_buffer.buffer, joint_matrix_buffer_size, 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    writer.update_set(device, joint_matrix_descriptor_set);
+
+    // the previous frame may still be drawing from the skinned buffers we're about to overwrite. A barrier's first
+    // scope covers earlier submissions on the queue, so this is enough without double buffering them
+    vk_util::memory_barrier(cmd,
+                            vertex_read_stages, VK_ACCESS_2_NONE,
+                            VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, skinning_pipeline.pipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, skinning_pipeline.layout, 0, 1, &joint_matrix_descriptor_set, 0, nullptr);
+
+    glm::mat4* joint_matrices = (glm::mat4*)joint_matrix_buffer.info.pMappedData;
+    uint32_t first_joint = 0;
+
+    for(const SceneInstances* instances : instance_sets) {
+        const GLTFFile& file = *instances->file;
+
+        // hidden instances aren't stamped out, so nothing would draw their vertices
+        for(uint32_t instance_index = 0; instance_index < instances->get_instance_count(); instance_index++) {
+            if(!instances->is_visible(instance_index)) {
+                continue;
+            }
+
+            const AnimationPose& pose = instances->get_pose(instance_index);
+            for(const std::shared_ptr<MeshNode>& node : file.skinned_mesh_nodes) {
+                const std::vector<glm::mat4>& joint_palette = pose.joint_palettes[node->skin];
+                memcpy(joint_matrices + first_joint, joint_palette.data(), joint_palette.size() * sizeof(glm::mat4));
+
+                SkinningComputePushConstants push_constants = {
+                        .source_vertex_buffer_address = node->mesh->mesh_buffers.vertex_buffer_address,
+                        .skin_vertex_buffer_address = node->mesh->skin_vertex_buffer_address,
+                        .output_vertex_buffer_address = instances->get_skinned_vertex_buffer_address(instance_index, node->skinned_index),
+                        .vertex_count = node->mesh->vertex_count,
+                        .first_joint = first_joint
+                };
+
+                vkCmdPushConstants(cmd, skinning_pipeline.layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(SkinningComputePushConstants), &push_constants);
+                vkCmdDispatch(cmd, (node->mesh->vertex_count + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, 1, 1);
+
+                first_joint += static_cast<uint32_t>(joint_palette.size());
+                stats.skinned_instance_count++;
+                stats.skinned_vertex_count += static_cast<int>(node->mesh->vertex_count);
+            }
+        }
+    }
+
+    // posed vertices are pulled through buffer references in the vertex or mesh shaders of every pass
+    vk_util::memory_barrier(cmd,
+                            VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+                            vertex_read_stages, VK_ACCESS_2_SHADER_STORAGE_READ_BIT);
+}
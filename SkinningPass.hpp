@@ -0,0 +1,67 @@
+//
+// Created by darby on 2/26/2025.
+//
+
+#pragma once
+
+#include "Common.hpp"
+#include "ComputePipeline.hpp"
+#include "DeletionQueue.hpp"
+#include "TimelineDeletionQueue.hpp"
+#include "DescriptorAllocatorGrowable.hpp"
+#include "ThreadDescriptorAllocator.hpp"
+#include "EngineStats.hpp"
+#include "FrameArena.hpp"
+#include "SceneGraphMembers.hpp"
+#include "SceneInstances.hpp"
+
+/*
+ * Skins every skinned MeshNode of every visible instance on the GPU before anything is drawn. A compute dispatch per
+ * instance and node blends the node's mesh vertices by the instance's joint palette for the node's skin and writes
+ * them into the instance's own output buffer for the node, which SceneInstances hands out instead of the mesh's. Every pass that draws the node then picks the posed vertices up
+ * through vertex_buffer_address like any other mesh, nothing downstream knows about skinning.
+ */
+class SkinningPass {
+
+public:
+    static constexpr uint32_t WORKGROUP_SIZE = 64; // local_size_x in skinning.comp
+
+    // mesh_shading_supported should be PhysicalDevice::supports_mesh_shaders, the mesh stage reads skinned vertices too
+    void init(VkDevice device, VmaAllocator allocator, uint32_t frame_count, bool mesh_shading_supported,
+              DeletionQueue& deletion_queue);
+
+    // instances are skinned every frame from here on, only those of files with skinned nodes are worth adding.
+    // instances must outlive the pass
+    void add_instances(SceneInstances& instances);
+
+    /*
+     * Records the skinning dispatches into cmd, which must come before any draw of a skinned node in the frame. The
+     * poses must be up to date, i.e. the AnimationSystem waited on. The joint matrices go into frame_index's
+     * buffer, whose fence must have been waited on, and a buffer outgrown goes through gpu_deletion_queue. CPU side
+     * scratch comes from frame_arena.
+     */
+    void record(VkCommandBuffer cmd,
+                uint32_t frame_index,
+                ThreadDescriptorAllocator& frame_descriptor_allocator,
+                FrameArena& frame_arena,
+                TimelineDeletionQueue& gpu_deletion_queue,
+                EngineStats& stats);
+
+private:
+    VkDevice device;
+    VmaAllocator allocator;
+    // every stage that reads the skinned vertex buffers, both barriers wait on or for them
+    VkPipelineStageFlags2 vertex_read_stages;
+
+    // one per frame in flight, grown by half again when the joint count outgrows it
+    struct FrameJointMatrices {
+        Buffer buffer;
+        size_t capacity = 0; // in matrices
+    };
+
+    VkDescriptorSetLayout joint_matrix_descriptor_set_layout;
+    std::vector<FrameJointMatrices> frame_joint_matrices;
+    ComputePipeline skinning_pipeline;
+
+    std::vector<SceneInstances*> instance_sets;
+};
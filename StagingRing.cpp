@@ -0,0 +1,129 @@
+//
+// Created by darby on 3/6/2025.
+//
+
+#include "StagingRing.hpp"
+
+static VkDeviceSize align_up(VkDeviceSize value, VkDeviceSize alignment) {
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+void StagingRing::init(VkDevice _device, VmaAllocator _allocator, VkDeviceSize _capacity) {
+    device = _device;
+    allocator = _allocator;
+    capacity = _capacity;
+
+    buffer.init(allocator, capacity, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
+    buffer.set_name(device, "Staging Ring Buffer");
+}
+
+void StagingRing::destroy() {
+    buffer.destroy_buffer();
+    retired_ranges.clear();
+}
+
+StagingRing::Claim StagingRing::claim(VkDeviceSize size, VkDeviceSize alignment) {
+    uint64_t padding;
+    bool reserved = reserve(size, alignment, true, padding);
+    ASSERT(reserved, "Staging ring claim doesn't fit alongside the claims that haven't been retired yet");
+
+    return take(size, padding);
+}
+
+bool StagingRing::try_claim(VkDeviceSize size, Claim& out_claim, VkDeviceSize alignment) {
+    uint64_t padding;
+    if(!reserve(size, alignment, false, padding)) {
+        return false;
+    }
+
+    out_claim = take(size, padding);
+    return true;
+}
+
+void StagingRing::retire(VkSemaphore timeline, uint64_t value) {
+    if(head == retired_head) {
+        return;
+    }
+
+    // no-op on the coherent heaps CPU_ONLY normally lands in
+    VK_CHECK(vmaFlushAllocation(allocator, buffer.allocation, 0, VK_WHOLE_SIZE));
+
+    retired_ranges.push_back({ head, timeline, value });
+    retired_head = head;
+}
+
+void StagingRing::add_stats(EngineStats& stats) const {
+    stats.staging_mb_staged = static_cast<float>(bytes_staged) / (1024.f * 1024.f);
+    stats.staging_stall_count = static_cast<int>(stall_count);
+}
+
+bool StagingRing::is_complete(const RetiredRange& range) const {
+    uint64_t completed_value;
+    VK_CHECK(vkGetSemaphoreCounterValue(device, range.timeline, &completed_value));
+    return completed_value >= range.value;
+}
+
+void StagingRing::wait(const RetiredRange& range) {
+    VkSemaphoreWaitInfo wait_info = {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+            .pNext = nullptr,
+            .flags = 0,
+            .semaphoreCount = 1,
+            .pSemaphores = &range.timeline,
+            .pValues = &range.value
+    };
+    VK_CHECK(vkWaitSemaphores(device, &wait_info, UINT64_MAX));
+}
+
+bool StagingRing::reserve(VkDeviceSize size, VkDeviceSize alignment, bool can_wait, uint64_t& out_padding) {
+    if(size > capacity) {
+        return false;
+    }
+
+    // claims don't wrap, skip to the start of the buffer if this one would run off the end
+    VkDeviceSize offset = head % capacity;
+    out_padding = align_up(offset, alignment) - offset;
+    if(offset + out_padding + size > capacity) {
+        out_padding = capacity - offset;
+    }
+
+    uint64_t needed_end = head + out_padding + size;
+    bool stalled = false;
+
+    while(needed_end - tail > capacity) {
+        if(retired_ranges.empty()) {
+            return false; // only unretired claims left in the way
+        }
+
+        const RetiredRange& oldest = retired_ranges.front();
+        if(!is_complete(oldest)) {
+            if(!can_wait) {
+                return false;
+            }
+
+            wait(oldest);
+            stalled = true;
+        }
+
+        tail = oldest.end;
+        retired_ranges.pop_front();
+    }
+
+    if(stalled) {
+        stall_count++;
+    }
+
+    return true;
+}
+
+StagingRing::Claim StagingRing::take(VkDeviceSize size, uint64_t padding) {
+    VkDeviceSize offset = (head + padding) % capacity;
+    head += padding + size;
+    bytes_staged += size;
+
+    return {
+            .buffer = buffer.buffer,
+            .offset = offset,
+            .data = static_cast<char*>(buffer.info.pMappedData) + offset
+    };
+}
@@ -0,0 +1,73 @@
+//
+// Created by darby on 3/6/2025.
+//
+
+#pragma once
+
+#include "Common.hpp"
+#include "Buffer.hpp"
+#include "EngineStats.hpp"
+
+#include <deque>
+
+/*
+ * One persistent, mapped upload buffer that staging copies claim space from, instead of creating a staging buffer
+ * for every upload.
+ *
+ * Space is handed out front to back and wraps back to the start. Claims are retired against the timeline value of
+ * the submission that copies out of them. A claim that runs into space the GPU may still be reading waits for that
+ * value first, which is counted as a stall.
+ *
+ * A single claim can't be larger than get_capacity(). Bigger uploads are split into chunks by the caller, see
+ * ImmediateSubmitCommandBuffer::upload_to_buffer. Only used from the main thread.
+ */
+class StagingRing {
+
+public:
+    struct Claim {
+        VkBuffer buffer;
+        VkDeviceSize offset;
+        void* data;
+    };
+
+    void init(VkDevice device, VmaAllocator allocator, VkDeviceSize capacity);
+    void destroy();
+
+    // waits on the GPU if the space is still being copied from
+    Claim claim(VkDeviceSize size, VkDeviceSize alignment = 16);
+    // doesn't wait, fails instead. for claims retired against a submission that hasn't been made yet
+    bool try_claim(VkDeviceSize size, Claim& out_claim, VkDeviceSize alignment = 16);
+    // everything claimed since the last retire is reused once timeline reaches value
+    void retire(VkSemaphore timeline, uint64_t value);
+
+    VkDeviceSize get_capacity() const { return capacity; }
+    void add_stats(EngineStats& stats) const;
+
+private:
+    // positions are virtual and only ever grow, the buffer offset is position % capacity
+    struct RetiredRange {
+        uint64_t end;
+        VkSemaphore timeline;
+        uint64_t value;
+    };
+
+    bool is_complete(const RetiredRange& range) const;
+    void wait(const RetiredRange& range);
+    // finds room for size bytes after head, returns the padding needed in front of it or false if it's still in use
+    bool reserve(VkDeviceSize size, VkDeviceSize alignment, bool can_wait, uint64_t& out_padding);
+    Claim take(VkDeviceSize size, uint64_t padding);
+
+    VkDevice device;
+    VmaAllocator allocator;
+
+    Buffer buffer;
+    VkDeviceSize capacity;
+
+    uint64_t head = 0;
+    uint64_t tail = 0; // the oldest position the GPU may still read
+    uint64_t retired_head = 0;
+    std::deque<RetiredRange> retired_ranges;
+
+    uint64_t bytes_staged = 0;
+    uint32_t stall_count = 0;
+};
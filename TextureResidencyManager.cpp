@@ -0,0 +1,361 @@
+//
+// Created by darby on 3/6/2025.
+//
+
+#include "TextureResidencyManager.hpp"
+#include "Buffer.hpp"
+#include "VulkanImageUtility.hpp"
+#include "VulkanGeneralUtility.hpp"
+
+#include <algorithm>
+
+void TextureResidencyManager::init(VkDevice _device, VmaAllocator _allocator, StagingRing& _staging_ring, GLTFHDRMaterial& _material_creator) {
+    device = _device;
+    allocator = _allocator;
+    staging_ring = &_staging_ring;
+    material_creator = &_material_creator;
+}
+
+void TextureResidencyManager::destroy() {
+    // the images belong to the files, only the host copies of dropped mips are ours
+    textures.clear();
+    slot_textures.clear();
+}
+
+void TextureResidencyManager::add_file(const std::shared_ptr<GLTFFile>& file) {
+    std::vector<uint32_t> slots;
+
+    for(AllocatedImage& image : file->images) {
+        // skips images no material referenced, and ones without mips to drop
+        if(image.image == VK_NULL_HANDLE || image.mip_levels <= 1) {
+            continue;
+        }
+
+        uint32_t texture_index = static_cast<uint32_t>(textures.size());
+        textures.push_back({
+                .image = &image,
+                .full_extent = { image.extent.width, image.extent.height },
+                .full_mip_levels = image.mip_levels
+        });
+
+        slots.clear();
+        material_creator->get_texture_slots(image.view, slots);
+        for(uint32_t slot : slots) {
+            if(slot >= slot_textures.size()) {
+                slot_textures.resize(slot + 1, NOT_MANAGED);
+            }
+            slot_textures[slot] = texture_index;
+        }
+    }
+}
+
+void TextureResidencyManager::mark_visible(const DrawContext& draw_context, std::span<const uint32_t> visible_opaque_surfaces,
+                                           const TimelineDeletionQueue& timeline) {
+    uint64_t pending_value = timeline.get_pending_value();
+
+    auto mark_surface = [&](const RenderObject& surface) {
+        for(uint32_t slot : material_creator->get_material_texture_indices(surface.material->material_index)) {
+            if(slot >= slot_textures.size() || slot_textures[slot] == NOT_MANAGED) {
+                continue;
+            }
+
+            ManagedTexture& texture = textures[slot_textures[slot]];
+            if(texture.last_used_value != pending_value) {
+                texture.previous_used_value = texture.last_used_value;
+                texture.last_used_value = pending_value;
+            }
+        }
+    };
+
+    for(uint32_t surface_index : visible_opaque_surfaces) {
+        mark_surface(draw_context.opaque_surfaces[surface_index]);
+    }
+    for(uint32_t surface_index : draw_context.visible_transparent_surfaces) {
+        mark_surface(draw_context.transparent_surfaces[surface_index]);
+    }
+}
+
+void TextureResidencyManager::update(VkCommandBuffer cmd, TimelineDeletionQueue& timeline, EngineStats& stats) {
+    stats.residency_dropped_count = 0;
+    stats.residency_restored_count = 0;
+    stats.residency_restore_wait_count = 0;
+
+    // what the device local heaps have in use and can take
+    VmaBudget budgets[VK_MAX_MEMORY_HEAPS];
+    vmaGetHeapBudgets(allocator, budgets);
+
+    const VkPhysicalDeviceMemoryProperties* memory_properties;
+    vmaGetMemoryProperties(allocator, &memory_properties);
+
+    VkDeviceSize usage = 0;
+    VkDeviceSize budget = 0;
+    for(uint32_t heap = 0; heap < memory_properties->memoryHeapCount; heap++) {
+        if(memory_properties->memoryHeaps[heap].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) {
+            usage += budgets[heap].usage;
+            budget += budgets[heap].budget;
+        }
+    }
+    if(settings.budget_override != 0) {
+        budget = settings.budget_override;
+    }
+
+    stats.residency_usage_mb = static_cast<float>(usage) / (1024.f * 1024.f);
+    stats.residency_budget_mb = static_cast<float>(budget) / (1024.f * 1024.f);
+
+    uint64_t pending_value = timeline.get_pending_value();
+    uint64_t completed_value = timeline.get_completed_value();
+    VkDeviceSize drop_limit = static_cast<VkDeviceSize>(budget * settings.drop_threshold);
+    VkDeviceSize target = static_cast<VkDeviceSize>(budget * settings.target_threshold);
+    uint32_t change_count = 0;
+
+    if(settings.enabled) {
+        // 1, reduced textures drawn this frame get their mips back, as far as the budget allows
+        restore_candidates.clear();
+        uint64_t wait_value = 0;
+        for(uint32_t i = 0; i < textures.size() && change_count < settings.max_changes_per_frame; i++) {
+            ManagedTexture& texture = textures[i];
+            if(texture.dropped_mip_count == 0 || texture.last_used_value != pending_value) {
+                continue;
+            }
+
+            VkDeviceSize restored_size = get_mips_size(texture, 0, texture.dropped_mip_count);
+            if(usage + restored_size > drop_limit) {
+                continue;
+            }
+
+            usage += restored_size;
+            wait_value = std::max({ wait_value, texture.previous_used_value, texture.read_back_value });
+            restore_candidates.push_back(i);
+            change_count++;
+        }
+
+        // the reduced images' slots are rewritten below, nothing in flight may still be sampling them
+        if(wait_value > completed_value) {
+            VkSemaphore timeline_semaphore = timeline.get_semaphore();
+            VkSemaphoreWaitInfo wait_info = {
+                    .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+                    .pNext = nullptr,
+                    .flags = 0,
+                    .semaphoreCount = 1,
+                    .pSemaphores = &timeline_semaphore,
+                    .pValues = &wait_value
+            };
+            VK_CHECK(vkWaitSemaphores(device, &wait_info, UINT64_MAX));
+            timeline.collect();
+            stats.residency_restore_wait_count++;
+        }
+
+        for(uint32_t texture_index : restore_candidates) {
+            restore_mips(cmd, textures[texture_index], timeline);
+            stats.residency_restored_count++;
+        }
+
+        // 2, over budget, the least recently drawn idle textures lose their top mips. what earlier drops freed has to
+        // have been collected first, or usage still counts it and we'd drop too much
+        if(usage > drop_limit && completed_value >= last_drop_value) {
+            drop_candidates.clear();
+            for(uint32_t i = 0; i < textures.size(); i++) {
+                const ManagedTexture& texture = textures[i];
+                bool idle = texture.last_used_value + settings.idle_submissions <= pending_value && texture.last_used_value <= completed_value;
+                if(texture.dropped_mip_count == 0 && idle) {
+                    drop_candidates.push_back(i);
+                }
+            }
+
+            std::sort(drop_candidates.begin(), drop_candidates.end(), [&](uint32_t a, uint32_t b) {
+                return textures[a].last_used_value < textures[b].last_used_value;
+            });
+
+            for(uint32_t texture_index : drop_candidates) {
+                if(usage <= target || change_count >= settings.max_changes_per_frame) {
+                    break;
+                }
+
+                // keep the largest side at or above min_resident_extent
+                ManagedTexture& texture = textures[texture_index];
+                uint32_t largest_side = std::max(texture.full_extent.width, texture.full_extent.height);
+                uint32_t mip_count = 0;
+                while(mip_count < settings.dropped_mip_count && (largest_side >> (mip_count + 1)) >= settings.min_resident_extent) {
+                    mip_count++;
+                }
+                if(mip_count == 0) {
+                    continue;
+                }
+
+                VkDeviceSize freed_size = drop_mips(cmd, texture, mip_count, timeline);
+                usage = usage > freed_size ? usage - freed_size : 0;
+                last_drop_value = pending_value;
+                stats.residency_dropped_count++;
+                change_count++;
+            }
+        }
+    }
+
+    stats.residency_texture_count = static_cast<int>(textures.size());
+    stats.residency_reduced_texture_count = 0;
+    size_t host_bytes = 0;
+    for(const ManagedTexture& texture : textures) {
+        if(texture.dropped_mip_count != 0) {
+            stats.residency_reduced_texture_count++;
+            host_bytes += texture.dropped_mips.size();
+        }
+    }
+    stats.residency_host_mb = static_cast<float>(host_bytes) / (1024.f * 1024.f);
+}
+
+VkDeviceSize TextureResidencyManager::get_mips_size(const ManagedTexture& texture, uint32_t first_mip, uint32_t mip_count) const {
+    VkDeviceSize size = 0;
+    for(uint32_t mip = first_mip; mip < first_mip + mip_count; mip++) {
+        VkExtent3D extent = get_mip_extent(texture, mip);
+        size += VkDeviceSize(extent.width) * extent.height * TEXEL_SIZE;
+    }
+
+    return size;
+}
+
+VkExtent3D TextureResidencyManager::get_mip_extent(const ManagedTexture& texture, uint32_t mip) const {
+    return {
+            .width = std::max(texture.full_extent.width >> mip, 1u),
+            .height = std::max(texture.full_extent.height >> mip, 1u),
+            .depth = 1
+    };
+}
+
+VkDeviceSize TextureResidencyManager::drop_mips(VkCommandBuffer cmd, ManagedTexture& texture, uint32_t mip_count,
+                                                TimelineDeletionQueue& timeline) {
+    AllocatedImage& full_image = *texture.image;
+
+    // the reduced image's own chain lines up with the full one's from mip_count down
+    AllocatedImage reduced_image;
+    reduced_image.init(device, allocator, get_mip_extent(texture, mip_count), full_image.format,
+                       VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, true);
+    ASSERT(reduced_image.mip_levels == texture.full_mip_levels - mip_count, "reduced mip chain doesn't line up with the full one");
+
+    VkDeviceSize read_back_size = get_mips_size(texture, 0, mip_count);
+    Buffer read_back_buffer;
+    read_back_buffer.init(allocator, read_back_size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_TO_CPU);
+
+    vk_image::transition_image_layout(cmd, full_image.image, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+    vk_image::transition_image_layout(cmd, reduced_image.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+    std::vector<VkImageCopy> image_copies(reduced_image.mip_levels);
+    for(uint32_t mip = 0; mip < reduced_image.mip_levels; mip++) {
+        image_copies[mip] = {
+                .srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, mip + mip_count, 0, 1 },
+                .srcOffset = { 0, 0, 0 },
+                .dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, mip, 0, 1 },
+                .dstOffset = { 0, 0, 0 },
+                .extent = get_mip_extent(texture, mip + mip_count)
+        };
+    }
+    vkCmdCopyImage(cmd, full_image.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, reduced_image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                   static_cast<uint32_t>(image_copies.size()), image_copies.data());
+
+    // the dropped levels go to host memory, back to back largest first
+    std::vector<VkBufferImageCopy> buffer_copies(mip_count);
+    VkDeviceSize offset = 0;
+    for(uint32_t mip = 0; mip < mip_count; mip++) {
+        buffer_copies[mip] = {
+                .bufferOffset = offset,
+                .bufferRowLength = 0,
+                .bufferImageHeight = 0,
+                .imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, mip, 0, 1 },
+                .imageOffset = { 0, 0, 0 },
+                .imageExtent = get_mip_extent(texture, mip)
+        };
+        offset += get_mips_size(texture, mip, 1);
+    }
+    vkCmdCopyImageToBuffer(cmd, full_image.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, read_back_buffer.buffer,
+                           static_cast<uint32_t>(buffer_copies.size()), buffer_copies.data());
+
+    vk_util::memory_barrier(cmd, VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                            VK_PIPELINE_STAGE_2_HOST_BIT, VK_ACCESS_2_HOST_READ_BIT);
+    vk_image::transition_image_layout(cmd, reduced_image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+    texture.dropped_mips.resize(read_back_size);
+    timeline.push_read_back(read_back_buffer, texture.dropped_mips.data(), read_back_size);
+    texture.read_back_value = timeline.get_pending_value();
+    texture.dropped_mip_count = mip_count;
+
+    replace_image(texture, reduced_image, timeline);
+
+    return read_back_size;
+}
+
+void TextureResidencyManager::restore_mips(VkCommandBuffer cmd, ManagedTexture& texture, TimelineDeletionQueue& timeline) {
+    AllocatedImage& reduced_image = *texture.image;
+    uint32_t mip_count = texture.dropped_mip_count;
+
+    AllocatedImage full_image;
+    full_image.init(device, allocator, get_mip_extent(texture, 0), reduced_image.format,
+                    VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, true);
+
+    // this frame hasn't been submitted, so the ring can't be waited on. too big or no room left means a buffer of its own
+    VkDeviceSize upload_size = texture.dropped_mips.size();
+    StagingRing::Claim staging;
+    Buffer upload_buffer = {};
+    bool staged = staging_ring->try_claim(upload_size, staging);
+    if(!staged) {
+        upload_buffer.init(allocator, upload_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+        staging = { upload_buffer.buffer, 0, upload_buffer.info.pMappedData };
+    }
+    memcpy(staging.data, texture.dropped_mips.data(), upload_size);
+    if(!staged) {
+        VK_CHECK(vmaFlushAllocation(allocator, upload_buffer.allocation, 0, VK_WHOLE_SIZE));
+    }
+
+    vk_image::transition_image_layout(cmd, reduced_image.image, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+    vk_image::transition_image_layout(cmd, full_image.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+    std::vector<VkBufferImageCopy> buffer_copies(mip_count);
+    VkDeviceSize offset = staging.offset;
+    for(uint32_t mip = 0; mip < mip_count; mip++) {
+        buffer_copies[mip] = {
+                .bufferOffset = offset,
+                .bufferRowLength = 0,
+                .bufferImageHeight = 0,
+                .imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, mip, 0, 1 },
+                .imageOffset = { 0, 0, 0 },
+                .imageExtent = get_mip_extent(texture, mip)
+        };
+        offset += get_mips_size(texture, mip, 1);
+    }
+    vkCmdCopyBufferToImage(cmd, staging.buffer, full_image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                           static_cast<uint32_t>(buffer_copies.size()), buffer_copies.data());
+
+    std::vector<VkImageCopy> image_copies(reduced_image.mip_levels);
+    for(uint32_t mip = 0; mip < reduced_image.mip_levels; mip++) {
+        image_copies[mip] = {
+                .srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, mip, 0, 1 },
+                .srcOffset = { 0, 0, 0 },
+                .dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, mip + mip_count, 0, 1 },
+                .dstOffset = { 0, 0, 0 },
+                .extent = get_mip_extent(texture, mip + mip_count)
+        };
+    }
+    vkCmdCopyImage(cmd, reduced_image.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, full_image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                   static_cast<uint32_t>(image_copies.size()), image_copies.data());
+
+    vk_image::transition_image_layout(cmd, full_image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+    if(staged) {
+        staging_ring->retire(timeline.get_semaphore(), timeline.get_pending_value());
+    } else {
+        timeline.push_buffer(upload_buffer);
+    }
+    texture.dropped_mip_count = 0;
+    texture.dropped_mips.clear();
+    texture.dropped_mips.shrink_to_fit();
+
+    replace_image(texture, full_image, timeline);
+}
+
+void TextureResidencyManager::replace_image(ManagedTexture& texture, const AllocatedImage& new_image, TimelineDeletionQueue& timeline) {
+    VkImageView old_view = texture.image->view;
+
+    // the copies recorded above still read the old image, it goes once this submission is done
+    timeline.push_image(*texture.image);
+    *texture.image = new_image;
+
+    material_creator->replace_texture_view(device, old_view, new_image.view);
+}
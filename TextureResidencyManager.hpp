@@ -0,0 +1,100 @@
+//
+// Created by darby on 3/6/2025.
+//
+
+#pragma once
+
+#include "Common.hpp"
+#include "AllocatedImage.hpp"
+#include "GLTFHDRMaterial.hpp"
+#include "SceneGraphMembers.hpp"
+#include "TimelineDeletionQueue.hpp"
+#include "StagingRing.hpp"
+#include "EngineStats.hpp"
+
+struct ResidencySettings {
+    bool enabled = true;
+    // above this fraction of the device local budget idle textures lose their top mips...
+    float drop_threshold = 0.9f;
+    // ...until usage is estimated back under this one
+    float target_threshold = 0.8f;
+    // submissions a texture must go unsampled before it can lose its top mips
+    uint32_t idle_submissions = 120;
+    // how many top mips a dropped texture loses, as long as its largest side stays at least min_resident_extent
+    uint32_t dropped_mip_count = 2;
+    uint32_t min_resident_extent = 64;
+    // drops plus restores recorded per frame
+    uint32_t max_changes_per_frame = 4;
+    // when non-zero, used instead of the budget VMA reports. For seeing how a smaller card would cope
+    VkDeviceSize budget_override = 0;
+};
+
+/*
+ * Keeps the loaded textures inside the device local memory budget, as reported by vmaGetHeapBudgets (which reads
+ * VK_EXT_memory_budget when the device has it).
+ *
+ * Over budget, textures that haven't been drawn for a while are swapped for a copy without their top mips. The dropped
+ * levels are read back to host memory first, so once a texture is drawn again they're copied back into a full image,
+ * without going back to the file. Drawn textures are restored before anything else is dropped, so crowded scenes get
+ * blurrier rather than failing allocations.
+ *
+ * Swaps are recorded at the start of the frame's command buffer, repoint the texture's bindless slots and put the old
+ * image on the deletion queue. A slot can't be rewritten while a submission that samples it is in flight, so a restore
+ * waits on the timeline for the last submission that drew the reduced texture, at most a frame.
+ */
+class TextureResidencyManager {
+
+public:
+    ResidencySettings settings;
+
+    void init(VkDevice device, VmaAllocator allocator, StagingRing& staging_ring, GLTFHDRMaterial& material_creator);
+    void destroy();
+
+    // every loaded texture of file is managed from now on. file must outlive the manager
+    void add_file(const std::shared_ptr<GLTFFile>& file);
+
+    // stamps the textures of this frame's visible surfaces as used by the next submission. visible_opaque_surfaces
+    // index draw_context.opaque_surfaces and must really be culled, a list of every surface keeps every texture busy
+    void mark_visible(const DrawContext& draw_context, std::span<const uint32_t> visible_opaque_surfaces,
+                      const TimelineDeletionQueue& timeline);
+
+    // records this frame's drops and restores into cmd, which must not be inside rendering
+    void update(VkCommandBuffer cmd, TimelineDeletionQueue& timeline, EngineStats& stats);
+
+private:
+    static constexpr uint32_t NOT_MANAGED = UINT32_MAX;
+    static constexpr VkDeviceSize TEXEL_SIZE = 4; // every loaded texture is RGBA8
+
+    struct ManagedTexture {
+        AllocatedImage* image; // the file's, swapped in place
+        VkExtent2D full_extent;
+        uint32_t full_mip_levels;
+
+        uint32_t dropped_mip_count = 0; // 0 when fully resident
+        std::vector<uint8_t> dropped_mips; // the dropped levels, largest first, once read back
+        uint64_t read_back_value = 0; // dropped_mips is valid once the timeline has reached this
+
+        uint64_t last_used_value = 0; // submission that last drew the texture, 0 if none has
+        uint64_t previous_used_value = 0; // the one before that
+    };
+
+    VkDeviceSize get_mips_size(const ManagedTexture& texture, uint32_t first_mip, uint32_t mip_count) const;
+    VkExtent3D get_mip_extent(const ManagedTexture& texture, uint32_t mip) const;
+
+    VkDeviceSize drop_mips(VkCommandBuffer cmd, ManagedTexture& texture, uint32_t mip_count, TimelineDeletionQueue& timeline);
+    void restore_mips(VkCommandBuffer cmd, ManagedTexture& texture, TimelineDeletionQueue& timeline);
+    void replace_image(ManagedTexture& texture, const AllocatedImage& new_image, TimelineDeletionQueue& timeline);
+
+    VkDevice device;
+    VmaAllocator allocator;
+    StagingRing* staging_ring;
+    GLTFHDRMaterial* material_creator;
+
+    std::vector<ManagedTexture> textures;
+    std::vector<uint32_t> slot_textures; // bindless slot -> index into textures, NOT_MANAGED for the rest
+
+    std::vector<uint32_t> restore_candidates;
+    std::vector<uint32_t> drop_candidates;
+
+    uint64_t last_drop_value = 0; // drops free memory once collected, don't drop more until then
+};
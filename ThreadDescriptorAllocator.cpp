@@ -0,0 +1,82 @@
+//
+// Created by darby on 3/6/2025.
+//
+
+#include "ThreadDescriptorAllocator.hpp"
+
+void ThreadDescriptorAllocator::init(VkDevice _device, SharedDescriptorPools& _shared_pools, DescriptorAllocationMode _mode,
+                                     uint32_t thread_count) {
+    device = _device;
+    shared_pools = &_shared_pools;
+    mode = _mode;
+
+    thread_pools.clear();
+    thread_pools.resize(thread_count);
+}
+
+void ThreadDescriptorAllocator::destroy() {
+    release_pools();
+    thread_pools.clear();
+}
+
+void ThreadDescriptorAllocator::reset() {
+    ASSERT(mode == DescriptorAllocationMode::Frame, "only frame allocators are reset, persistent sets live until destroy");
+    release_pools();
+}
+
+VkDescriptorSet ThreadDescriptorAllocator::allocate(VkDescriptorSetLayout layout, void* pNext) {
+    ThreadPools& pools = thread_pools[JobSystem::get_thread_index()];
+
+    if(pools.current_pool == INVALID_POOL) {
+        pools.current_pool = shared_pools->acquire();
+    }
+
+    VkDescriptorSetAllocateInfo alloc_info = {
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+            .pNext = pNext,
+            .descriptorPool = shared_pools->get_pool(pools.current_pool),
+            .descriptorSetCount = 1,
+            .pSetLayouts = &layout
+    };
+
+    VkDescriptorSet ds;
+    VkResult result = vkAllocateDescriptorSets(device, &alloc_info, &ds);
+
+    // this thread's pool is full, park it and carry on in a fresh one
+    if(result == VK_ERROR_OUT_OF_POOL_MEMORY || result == VK_ERROR_FRAGMENTED_POOL) {
+        pools.full_pools.push_back(pools.current_pool);
+        pools.current_pool = shared_pools->acquire();
+
+        alloc_info.descriptorPool = shared_pools->get_pool(pools.current_pool);
+        result = vkAllocateDescriptorSets(device, &alloc_info, &ds);
+    }
+    VK_CHECK(result);
+
+    return ds;
+}
+
+uint32_t ThreadDescriptorAllocator::get_pool_count() const {
+    uint32_t count = 0;
+    for(const ThreadPools& pools : thread_pools) {
+        count += static_cast<uint32_t>(pools.full_pools.size()) + (pools.current_pool != INVALID_POOL ? 1 : 0);
+    }
+
+    return count;
+}
+
+void ThreadDescriptorAllocator::release_pools() {
+    for(ThreadPools& pools : thread_pools) {
+        // not parked with the full ones, a thread that has never filled a pool never grows full_pools
+        if(pools.current_pool != INVALID_POOL) {
+            VK_CHECK(vkResetDescriptorPool(device, shared_pools->get_pool(pools.current_pool), 0));
+            shared_pools->release(pools.current_pool);
+            pools.current_pool = INVALID_POOL;
+        }
+
+        for(uint32_t pool_index : pools.full_pools) {
+            VK_CHECK(vkResetDescriptorPool(device, shared_pools->get_pool(pool_index), 0));
+            shared_pools->release(pool_index);
+        }
+        pools.full_pools.clear();
+    }
+}
@@ -0,0 +1,54 @@
+//
+// Created by darby on 3/6/2025.
+//
+
+#pragma once
+
+#include "Common.hpp"
+#include "SharedDescriptorPools.hpp"
+#include "JobSystem.hpp"
+
+enum class DescriptorAllocationMode {
+    Frame,      // sets last until reset(), once the frame that used them has finished on the GPU
+    Persistent, // sets last until destroy(), e.g. material sets written by loader jobs
+};
+
+/*
+ * Lets any job system thread allocate descriptor sets without locking. Every thread allocates from a pool of its own,
+ * when that fills up it takes another off the SharedDescriptorPools free list, which is the only place threads meet.
+ *
+ * In frame mode there's one of these per FrameData, like ParallelCommandRecorder, and reset() hands all of its pools
+ * back once that frame's fence has been waited on. Persistent mode keeps its pools until destroy().
+ */
+class ThreadDescriptorAllocator {
+
+public:
+    void init(VkDevice device, SharedDescriptorPools& shared_pools, DescriptorAllocationMode mode, uint32_t thread_count);
+    // hands every pool back reset, not thread safe. The GPU must be done with the sets
+    void destroy();
+
+    // frame mode only, same as destroy() but the allocator stays usable
+    void reset();
+
+    // safe from any job system thread, each only touches its own pools
+    VkDescriptorSet allocate(VkDescriptorSetLayout layout, void* pNext = nullptr);
+
+    uint32_t get_pool_count() const;
+
+private:
+    static constexpr uint32_t INVALID_POOL = UINT32_MAX;
+
+    // padded to a cache line, neighbouring threads write their own entries constantly
+    struct alignas(64) ThreadPools {
+        uint32_t current_pool = INVALID_POOL;
+        std::vector<uint32_t> full_pools;
+    };
+
+    void release_pools();
+
+    VkDevice device;
+    SharedDescriptorPools* shared_pools;
+    DescriptorAllocationMode mode;
+
+    std::vector<ThreadPools> thread_pools; // indexed by JobSystem::get_thread_index()
+};
@@ -0,0 +1,111 @@
+//
+// Created by darby on 3/5/2025.
+//
+
+#include "TimelineDeletionQueue.hpp"
+
+#include <cstring>
+
+void TimelineDeletionQueue::init(VkDevice _device, VmaAllocator _allocator) {
+    device = _device;
+    allocator = _allocator;
+
+    VkSemaphoreTypeCreateInfo type_info = {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+            .pNext = nullptr,
+            .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+            .initialValue = 0
+    };
+
+    VkSemaphoreCreateInfo create_info = {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+            .pNext = &type_info,
+            .flags = 0
+    };
+
+    VK_CHECK(vkCreateSemaphore(device, &create_info, nullptr, &timeline_semaphore));
+}
+
+void TimelineDeletionQueue::destroy() {
+    collect_up_to(UINT64_MAX);
+    vkDestroySemaphore(device, timeline_semaphore, nullptr);
+}
+
+void TimelineDeletionQueue::push_buffer(const Buffer& buffer) {
+    buffers.push(pending_value, { buffer.buffer, buffer.allocation });
+}
+
+void TimelineDeletionQueue::push_image(const AllocatedImage& image) {
+    image_views.push(pending_value, image.view);
+    images.push(pending_value, { image.image, image.allocation });
+}
+
+void TimelineDeletionQueue::push_image_view(VkImageView view) {
+    image_views.push(pending_value, view);
+}
+
+void TimelineDeletionQueue::push_descriptor_pool(VkDescriptorPool pool) {
+    descriptor_pools.push(pending_value, pool);
+}
+
+void TimelineDeletionQueue::push_pipeline(VkPipeline pipeline) {
+    pipelines.push(pending_value, pipeline);
+}
+
+void TimelineDeletionQueue::push_read_back(const Buffer& buffer, void* destination, size_t size) {
+    read_backs.push(pending_value, { buffer.buffer, buffer.allocation, buffer.info.pMappedData, destination, size });
+}
+
+uint32_t TimelineDeletionQueue::collect() {
+    VK_CHECK(vkGetSemaphoreCounterValue(device, timeline_semaphore, &completed_value));
+    return collect_up_to(completed_value);
+}
+
+uint32_t TimelineDeletionQueue::collect_up_to(uint64_t reached_value) {
+    uint32_t collected = 0;
+
+    ReadBackRecord read_back;
+    while(read_backs.pop(reached_value, read_back)) {
+        vmaInvalidateAllocation(allocator, read_back.allocation, 0, VK_WHOLE_SIZE);
+        memcpy(read_back.destination, read_back.mapped, read_back.size);
+        vmaDestroyBuffer(allocator, read_back.buffer, read_back.allocation);
+        collected++;
+    }
+
+    VkPipeline pipeline;
+    while(pipelines.pop(reached_value, pipeline)) {
+        vkDestroyPipeline(device, pipeline, nullptr);
+        collected++;
+    }
+
+    VkImageView view;
+    while(image_views.pop(reached_value, view)) {
+        vkDestroyImageView(device, view, nullptr);
+        collected++;
+    }
+
+    VkDescriptorPool pool;
+    while(descriptor_pools.pop(reached_value, pool)) {
+        vkDestroyDescriptorPool(device, pool, nullptr);
+        collected++;
+    }
+
+    ImageRecord image;
+    while(images.pop(reached_value, image)) {
+        vmaDestroyImage(allocator, image.image, image.allocation);
+        collected++;
+    }
+
+    BufferRecord buffer;
+    while(buffers.pop(reached_value, buffer)) {
+        vmaDestroyBuffer(allocator, buffer.buffer, buffer.allocation);
+        collected++;
+    }
+
+    return collected;
+}
+
+uint32_t TimelineDeletionQueue::get_queued_count() const {
+    return static_cast<uint32_t>(read_backs.count + pipelines.count + image_views.count + descriptor_pools.count +
+                                 images.count + buffers.count);
+}
@@ -0,0 +1,127 @@
+//
+// Created by darby on 3/5/2025.
+//
+
+#pragma once
+
+#include "Common.hpp"
+#include "Buffer.hpp"
+#include "AllocatedImage.hpp"
+
+/*
+ * Defers destroying GPU objects until the GPU is done with them, without a closure per object. Each kind of handle
+ * has its own queue of plain records in a vector backed ring, so a push is a copy into the ring once it's grown to
+ * the engine's steady state.
+ *
+ * Records are tagged with the timeline value the next frame submission signals (get_pending_value()), and collect()
+ * destroys whatever the GPU has already passed. That's checked with one semaphore query rather than waiting for the
+ * frame's fence to come back around, so a frame's garbage can go as soon as that frame finishes.
+ *
+ * Read backs are a buffer whose mapped contents are copied out to the CPU when it's collected, before the buffer is
+ * destroyed. The destination has to outlive the read back.
+ */
+class TimelineDeletionQueue {
+
+public:
+    void init(VkDevice device, VmaAllocator allocator);
+    // everything still queued is destroyed, the device must be idle
+    void destroy();
+
+    // signalled by every frame submission, with get_pending_value()
+    VkSemaphore get_semaphore() const { return timeline_semaphore; }
+    uint64_t get_pending_value() const { return pending_value; }
+    // to be called once the submission signalling get_pending_value() has been made, later pushes wait for the next one
+    void submitted() { pending_value++; }
+
+    void push_buffer(const Buffer& buffer);
+    void push_image(const AllocatedImage& image); // the view and then the image
+    void push_image_view(VkImageView view);
+    void push_descriptor_pool(VkDescriptorPool pool);
+    void push_pipeline(VkPipeline pipeline);
+    // size bytes of buffer's mapping are copied to destination once the GPU is done writing it, then it's destroyed
+    void push_read_back(const Buffer& buffer, void* destination, size_t size);
+
+    // destroys everything the GPU has finished with, returns how many records went
+    uint32_t collect();
+    // the last value the GPU was seen to have passed, as of the last collect()
+    uint64_t get_completed_value() const { return completed_value; }
+
+    uint32_t get_queued_count() const;
+
+private:
+    struct BufferRecord {
+        VkBuffer buffer;
+        VmaAllocation allocation;
+    };
+
+    struct ImageRecord {
+        VkImage image;
+        VmaAllocation allocation;
+    };
+
+    struct ReadBackRecord {
+        VkBuffer buffer;
+        VmaAllocation allocation;
+        const void* mapped;
+        void* destination;
+        size_t size;
+    };
+
+    // FIFO of records, values only ever go up so the oldest is always the first to complete
+    template<typename T>
+    struct RecordRing {
+        struct Entry {
+            uint64_t value;
+            T record;
+        };
+
+        std::vector<Entry> entries;
+        size_t head = 0;
+        size_t count = 0;
+
+        void push(uint64_t value, const T& record) {
+            if(count == entries.size()) {
+                grow();
+            }
+            entries[(head + count) % entries.size()] = { value, record };
+            count++;
+        }
+
+        // takes the oldest record if its value has been reached
+        bool pop(uint64_t completed_value, T& record) {
+            if(count == 0 || entries[head].value > completed_value) {
+                return false;
+            }
+            record = entries[head].record;
+            head = (head + 1) % entries.size();
+            count--;
+            return true;
+        }
+
+        void grow() {
+            std::vector<Entry> grown(std::max(entries.size() * 2, size_t(64)));
+            for(size_t i = 0; i < count; i++) {
+                grown[i] = entries[(head + i) % entries.size()];
+            }
+            entries.swap(grown);
+            head = 0;
+        }
+    };
+
+    uint32_t collect_up_to(uint64_t reached_value);
+
+    VkDevice device;
+    VmaAllocator allocator;
+
+    VkSemaphore timeline_semaphore;
+    uint64_t pending_value = 1;
+    uint64_t completed_value = 0;
+
+    // collected in this order, so views go before their images
+    RecordRing<ReadBackRecord> read_backs;
+    RecordRing<VkPipeline> pipelines;
+    RecordRing<VkImageView> image_views;
+    RecordRing<VkDescriptorPool> descriptor_pools;
+    RecordRing<ImageRecord> images;
+    RecordRing<BufferRecord> buffers;
+};
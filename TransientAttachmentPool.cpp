@@ -0,0 +1,139 @@
+//
+// Created by darby on 3/6/2025.
+//
+
+#include "TransientAttachmentPool.hpp"
+#include "VulkanInitUtility.hpp"
+#include "VulkanDebugUtility.hpp"
+
+#include <algorithm>
+
+static VkDeviceSize align_up(VkDeviceSize value, VkDeviceSize alignment) {
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+void TransientAttachmentPool::init(VkDevice _device, VmaAllocator _allocator) {
+    device = _device;
+    allocator = _allocator;
+}
+
+void TransientAttachmentPool::add_image(AllocatedImage& image, uint32_t lifetime_group, VkImageUsageFlags usage_flags,
+                                        VkImageAspectFlags aspect_flags, const std::string& name) {
+    ASSERT(allocation == VK_NULL_HANDLE, "Transient attachments have to be added before the pool is allocated");
+
+    image.allocator = allocator;
+    image.allocation = VK_NULL_HANDLE;
+    image.mip_levels = 1;
+
+    VkImageCreateInfo image_create_info = vk_init::get_image_create_info(image.format, usage_flags, image.extent);
+    VK_CHECK(vkCreateImage(device, &image_create_info, nullptr, &image.image));
+    vk_debug::name_resource<VkImage>(device, VK_OBJECT_TYPE_IMAGE, image.image, (name + " Image").c_str());
+
+    PlacedImage placed = {
+            .image = &image,
+            .lifetime_group = lifetime_group,
+            .aspect_flags = aspect_flags,
+            .offset = 0,
+            .name = name
+    };
+    vkGetImageMemoryRequirements(device, image.image, &placed.requirements);
+
+    if((usage_flags & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT) == 0) {
+        all_transient = false;
+    }
+
+    placed_images.push_back(placed);
+}
+
+void TransientAttachmentPool::track_dedicated_image(const AllocatedImage& image) {
+    VmaAllocationInfo allocation_info;
+    vmaGetAllocationInfo(allocator, image.allocation, &allocation_info);
+    separate_image_size += allocation_info.size;
+}
+
+void TransientAttachmentPool::allocate() {
+    ASSERT(allocation == VK_NULL_HANDLE, "Transient attachment pool was already allocated");
+
+    if(placed_images.empty()) {
+        return;
+    }
+
+    // pack each group from the start of the block, so the groups overlap each other
+    std::vector<VkDeviceSize> group_sizes;
+    VkMemoryRequirements block_requirements = {
+            .size = 0,
+            .alignment = 1,
+            .memoryTypeBits = ~0u
+    };
+
+    for(PlacedImage& placed : placed_images) {
+        if(placed.lifetime_group >= group_sizes.size()) {
+            group_sizes.resize(placed.lifetime_group + 1, 0);
+        }
+
+        placed.offset = align_up(group_sizes[placed.lifetime_group], placed.requirements.alignment);
+        group_sizes[placed.lifetime_group] = placed.offset + placed.requirements.size;
+
+        block_requirements.alignment = std::max(block_requirements.alignment, placed.requirements.alignment);
+        block_requirements.memoryTypeBits &= placed.requirements.memoryTypeBits;
+        dedicated_size += placed.requirements.size;
+    }
+
+    block_requirements.size = *std::max_element(group_sizes.begin(), group_sizes.end());
+    ASSERT(block_requirements.memoryTypeBits != 0, "Transient attachments have no memory type in common");
+
+    VmaAllocationCreateInfo allocation_create_info = {
+            .usage = VMA_MEMORY_USAGE_GPU_ONLY,
+            .requiredFlags = VkMemoryPropertyFlags(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)
+    };
+
+    // only attachments that never leave the render pass can live in memory the tiler may never back
+    if(all_transient) {
+        VmaAllocationCreateInfo lazy_allocation_create_info = {
+                .usage = VMA_MEMORY_USAGE_GPU_LAZILY_ALLOCATED
+        };
+
+        uint32_t memory_type_index;
+        if(vmaFindMemoryTypeIndex(allocator, block_requirements.memoryTypeBits, &lazy_allocation_create_info, &memory_type_index) == VK_SUCCESS) {
+            allocation_create_info = lazy_allocation_create_info;
+            lazily_allocated = true;
+        }
+    }
+
+    VK_CHECK(vmaAllocateMemory(allocator, &block_requirements, &allocation_create_info, &allocation, nullptr));
+    allocated_size = block_requirements.size;
+
+    for(PlacedImage& placed : placed_images) {
+        AllocatedImage& image = *placed.image;
+        VK_CHECK(vmaBindImageMemory2(allocator, allocation, placed.offset, image.image, nullptr));
+
+        VkImageViewCreateInfo image_view_create_info = vk_init::get_image_view_create_info(image.format, image.image, placed.aspect_flags);
+        VK_CHECK(vkCreateImageView(device, &image_view_create_info, nullptr, &image.view));
+        vk_debug::name_resource<VkImageView>(device, VK_OBJECT_TYPE_IMAGE_VIEW, image.view, (placed.name + " View").c_str());
+    }
+}
+
+void TransientAttachmentPool::destroy() {
+    for(PlacedImage& placed : placed_images) {
+        vkDestroyImageView(device, placed.image->view, nullptr);
+        vkDestroyImage(device, placed.image->image, nullptr);
+    }
+    placed_images.clear();
+
+    if(allocation != VK_NULL_HANDLE) {
+        vmaFreeMemory(allocator, allocation);
+        allocation = VK_NULL_HANDLE;
+    }
+}
+
+VkDeviceSize TransientAttachmentPool::get_dedicated_size() const {
+    return separate_image_size + dedicated_size;
+}
+
+VkDeviceSize TransientAttachmentPool::get_allocated_size() const {
+    return separate_image_size + allocated_size;
+}
+
+bool TransientAttachmentPool::is_lazily_allocated() const {
+    return lazily_allocated;
+}
@@ -0,0 +1,66 @@
+//
+// Created by darby on 3/6/2025.
+//
+
+#pragma once
+
+#include "Common.hpp"
+#include "AllocatedImage.hpp"
+
+#include <string>
+#include <vector>
+
+/*
+ * Places render targets whose lifetimes never overlap into one shared block of device memory.
+ *
+ * Every target is added to a lifetime group. Targets in the same group can be alive at the same time, so each gets its
+ * own range of the block. Different groups reuse the same ranges, and the block is only as large as the largest group.
+ *
+ * Aliased targets don't keep their contents once another group has used the memory. Each frame has to transition them
+ * from VK_IMAGE_LAYOUT_UNDEFINED and fully write them before reading.
+ *
+ * If every target is a VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT attachment, the block goes into lazily allocated memory
+ * when the device has a lazily allocated memory type.
+ */
+class TransientAttachmentPool {
+
+public:
+    void init(VkDevice device, VmaAllocator allocator);
+
+    // creates the image without memory, allocate() binds it and creates its view. the pool owns it from here on
+    void add_image(AllocatedImage& image, uint32_t lifetime_group, VkImageUsageFlags usage_flags, VkImageAspectFlags aspect_flags, const std::string& name);
+
+    // targets that keep their own allocation, only so the footprint below covers every render target
+    void track_dedicated_image(const AllocatedImage& image);
+
+    void allocate();
+    void destroy();
+
+    // what the render targets would take with an allocation each, and what they take now
+    VkDeviceSize get_dedicated_size() const;
+    VkDeviceSize get_allocated_size() const;
+    bool is_lazily_allocated() const;
+
+private:
+    struct PlacedImage {
+        AllocatedImage* image;
+        uint32_t lifetime_group;
+        VkImageAspectFlags aspect_flags;
+        VkMemoryRequirements requirements;
+        VkDeviceSize offset;
+        std::string name;
+    };
+
+    VkDevice device;
+    VmaAllocator allocator;
+
+    std::vector<PlacedImage> placed_images;
+    VmaAllocation allocation = VK_NULL_HANDLE;
+
+    bool all_transient = true;
+    bool lazily_allocated = false;
+
+    VkDeviceSize separate_image_size = 0;
+    VkDeviceSize dedicated_size = 0;
+    VkDeviceSize allocated_size = 0;
+};
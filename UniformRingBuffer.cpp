@@ -0,0 +1,57 @@
+//
+// Created by darby on 3/5/2025.
+//
+
+#include "UniformRingBuffer.hpp"
+#include "DescriptorWriter.hpp"
+
+#include <cstring>
+
+static VkDeviceSize align_up(VkDeviceSize value, VkDeviceSize alignment) {
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+void UniformRingBuffer::init(VkDevice device, VmaAllocator _allocator, VkDeviceSize min_offset_alignment, VkDeviceSize _frame_size,
+                             uint32_t _frame_count, DeletionQueue& deletion_queue) {
+    allocator = _allocator;
+    alignment = std::max(min_offset_alignment, VkDeviceSize(16));
+    frame_size = align_up(_frame_size, alignment);
+    frame_count = _frame_count;
+
+    buffer.init(allocator, frame_size * frame_count, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+    buffer.set_name(device, "Uniform Ring Buffer");
+
+    deletion_queue.push_function([this]() {
+        buffer.destroy_buffer();
+    });
+}
+
+VkDescriptorSet UniformRingBuffer::create_set(VkDevice device, DescriptorAllocatorGrowable& descriptor_allocator,
+                                              VkDescriptorSetLayout layout, VkDeviceSize range) {
+    ASSERT(range <= frame_size, "Uniform block larger than a frame's ring region");
+
+    VkDescriptorSet set = descriptor_allocator.allocate(device, layout, nullptr);
+
+    DescriptorWriter writer;
+    writer.write_buffer(0, buffer.buffer, range, 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC);
+    writer.update_set(device, set);
+
+    return set;
+}
+
+void UniformRingBuffer::begin_frame(uint32_t frame_index) {
+    frame_start = frame_index * frame_size;
+    frame_offset = 0;
+}
+
+uint32_t UniformRingBuffer::push(const void* data, VkDeviceSize size) {
+    VkDeviceSize offset = frame_offset;
+    ASSERT(offset + size <= frame_size, "Uniform ring frame region overflowed, raise its frame size");
+
+    memcpy((char*)buffer.info.pMappedData + frame_start + offset, data, size);
+    // a no-op on coherent memory, CPU_TO_GPU doesn't promise it
+    vmaFlushAllocation(allocator, buffer.allocation, frame_start + offset, size);
+
+    frame_offset = align_up(offset + size, alignment);
+    return static_cast<uint32_t>(frame_start + offset);
+}
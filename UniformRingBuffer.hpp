@@ -0,0 +1,54 @@
+//
+// Created by darby on 3/5/2025.
+//
+
+#pragma once
+
+#include "Common.hpp"
+#include "Buffer.hpp"
+#include "DeletionQueue.hpp"
+#include "DescriptorAllocatorGrowable.hpp"
+
+/*
+ * Per-frame uniform data without a buffer, allocation and descriptor set per frame. One persistently mapped buffer is
+ * split into a region per frame in flight and each frame bumps through its own region, so handing out a block costs an
+ * aligned memcpy.
+ *
+ * Sets are created once with create_set over a UNIFORM_BUFFER_DYNAMIC binding and stay valid for the whole buffer,
+ * which block they read is picked at bind time by the dynamic offset push() returned.
+ *
+ * A frame's region is only rewritten once its fence has passed, begin_frame() has to come after that wait.
+ */
+class UniformRingBuffer {
+
+public:
+    void init(VkDevice device, VmaAllocator allocator, VkDeviceSize min_offset_alignment, VkDeviceSize frame_size,
+              uint32_t frame_count, DeletionQueue& deletion_queue);
+
+    // a set whose binding 0 is a UNIFORM_BUFFER_DYNAMIC of range bytes over this buffer, layout has to declare it so
+    VkDescriptorSet create_set(VkDevice device, DescriptorAllocatorGrowable& descriptor_allocator, VkDescriptorSetLayout layout,
+                               VkDeviceSize range);
+
+    void begin_frame(uint32_t frame_index);
+
+    // copies size bytes into the current frame's region, returns the dynamic offset to bind them at
+    uint32_t push(const void* data, VkDeviceSize size);
+
+    template<typename T>
+    uint32_t push(const T& data) {
+        return push(&data, sizeof(T));
+    }
+
+    VkDeviceSize get_frame_bytes_used() const { return frame_offset; }
+
+private:
+    Buffer buffer;
+    VmaAllocator allocator;
+
+    VkDeviceSize alignment;
+    VkDeviceSize frame_size;
+    uint32_t frame_count;
+
+    VkDeviceSize frame_start = 0;
+    VkDeviceSize frame_offset = 0;
+};
@@ -19,7 +19,8 @@ namespace vk_util {
         const size_t index_buffer_size = sizeof(uint32_t) * indices.size();
 
         GPUMeshBuffers new_surface;
-        new_surface.vertex_buffer.init(allocator, vertex_buffer_size, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+        // TRANSFER_SRC so the MemoryDefragmenter can copy them somewhere else
+        new_surface.vertex_buffer.init(allocator, vertex_buffer_size, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
                                        VMA_MEMORY_USAGE_GPU_ONLY);
         new_surface.vertex_buffer.set_name(device, (mesh_name + std::string(" vertex buffer")).c_str());
 
@@ -30,42 +31,68 @@ namespace vk_util {
 
         new_surface.vertex_buffer_address = vkGetBufferDeviceAddress(device, &device_address_info);
 
-        new_surface.index_buffer.init(allocator, index_buffer_size, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        // the indices are also read as storage when meshlets are culled
+        new_surface.index_buffer.init(allocator, index_buffer_size, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
                                       VMA_MEMORY_USAGE_GPU_ONLY);
         new_surface.index_buffer.set_name(device, (mesh_name + std::string(" index buffer")).c_str());
 
-        Buffer staging_buffer;
-        staging_buffer.init(allocator, vertex_buffer_size + index_buffer_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
-        staging_buffer.set_name(device, (mesh_name + std::string(" Index/Vertex Staging Buffer")).c_str());
+        device_address_info.buffer = new_surface.index_buffer.buffer;
+        new_surface.index_buffer_address = vkGetBufferDeviceAddress(device, &device_address_info);
 
-    //        void* data = staging_buffer.allocation->GetMappedData();
-        void* data = staging_buffer.info.pMappedData;
+        // staged through the shared ring, the copies aren't waited on
+        immediate_submit_command_buffer.upload_to_buffer(vertices.data(), vertex_buffer_size, new_surface.vertex_buffer.buffer, 0);
+        immediate_submit_command_buffer.upload_to_buffer(indices.data(), index_buffer_size, new_surface.index_buffer.buffer, 0);
 
-        // copy vertex buffer data
-        memcpy(data, vertices.data(), vertex_buffer_size);
-        memcpy((char*)data + vertex_buffer_size, indices.data(), index_buffer_size);
+        return new_surface;
+    }
 
-        immediate_submit_command_buffer.submit([&](VkCommandBuffer cmd) {
-            VkBufferCopy vertex_copy {
-                    .srcOffset = 0,
-                    .dstOffset = 0,
-                    .size = vertex_buffer_size
-            };
+    // global memory barrier, for buffers written and read on the same queue
+    inline void memory_barrier(VkCommandBuffer cmd, VkPipelineStageFlags2 src_stage_mask, VkAccessFlags2 src_access_mask,
+                               VkPipelineStageFlags2 dst_stage_mask, VkAccessFlags2 dst_access_mask) {
+        VkMemoryBarrier2 memory_barrier = {
+                .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+                .pNext = nullptr,
+                .srcStageMask = src_stage_mask,
+                .srcAccessMask = src_access_mask,
+                .dstStageMask = dst_stage_mask,
+                .dstAccessMask = dst_access_mask
+        };
 
-            vkCmdCopyBuffer(cmd, staging_buffer.buffer, new_surface.vertex_buffer.buffer, 1, &vertex_copy);
+        VkDependencyInfo dep_info = {
+                .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+                .pNext = nullptr,
+                .memoryBarrierCount = 1,
+                .pMemoryBarriers = &memory_barrier
+        };
 
-            VkBufferCopy index_copy {
-                    .srcOffset = vertex_buffer_size,
-                    .dstOffset = 0,
-                    .size = index_buffer_size
-            };
+        vkCmdPipelineBarrier2(cmd, &dep_info);
+    }
 
-            vkCmdCopyBuffer(cmd, staging_buffer.buffer, new_surface.index_buffer.buffer, 1, &index_copy);
-        });
+    inline VkDeviceAddress get_buffer_device_address(VkDevice device, VkBuffer buffer) {
+        VkBufferDeviceAddressInfo device_address_info = {
+                .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
+                .buffer = buffer
+        };
 
-        staging_buffer.destroy_buffer();
+        return vkGetBufferDeviceAddress(device, &device_address_info);
+    }
 
-        return new_surface;
+    /*
+     * Uploads data into a new GPU only buffer with the given usage, for per-vertex streams that don't belong in the
+     * main vertex buffer. TRANSFER_DST is added to the usage, and TRANSFER_SRC so it can be moved when defragmenting.
+     */
+    template <typename T>
+    Buffer upload_buffer(std::span<T> data, VkBufferUsageFlags usage, VmaAllocator allocator, VkDevice device, ImmediateSubmitCommandBuffer& immediate_submit_command_buffer, const std::string& buffer_name) {
+
+        const size_t buffer_size = sizeof(T) * data.size();
+
+        Buffer new_buffer;
+        new_buffer.init(allocator, buffer_size, usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+        new_buffer.set_name(device, buffer_name.c_str());
+
+        immediate_submit_command_buffer.upload_to_buffer(data.data(), buffer_size, new_buffer.buffer, 0);
+
+        return new_buffer;
     }
 
 
@@ -89,4 +89,75 @@ void copy_image_to_image(VkCommandBuffer cmd, VkImage source, VkImage destinatio
     vkCmdBlitImage2(cmd, &info);
 }
 
+static void transition_mip_level(VkCommandBuffer cmd, VkImage image, uint32_t mip_level, VkImageLayout current_layout, VkImageLayout new_layout,
+                                 VkPipelineStageFlags2 dst_stage_mask, VkAccessFlags2 dst_access_mask) {
+    VkImageSubresourceRange range = vk_init::get_image_subresource_range(VK_IMAGE_ASPECT_COLOR_BIT);
+    range.baseMipLevel = mip_level;
+    range.levelCount = 1;
+
+    VkImageMemoryBarrier2 image_barrier = {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+            .pNext = nullptr,
+            .srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+            .srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT | VK_ACCESS_2_TRANSFER_READ_BIT,
+            .dstStageMask = dst_stage_mask,
+            .dstAccessMask = dst_access_mask,
+            .oldLayout = current_layout,
+            .newLayout = new_layout,
+            .image = image,
+            .subresourceRange = range,
+    };
+
+    VkDependencyInfo dep_info = {
+            .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+            .pNext = nullptr,
+            .imageMemoryBarrierCount = 1,
+            .pImageMemoryBarriers = &image_barrier
+    };
+
+    vkCmdPipelineBarrier2(cmd, &dep_info);
+}
+
+void generate_mipmaps(VkCommandBuffer cmd, VkImage image, VkExtent2D size, uint32_t mip_levels) {
+    for(uint32_t mip = 0; mip < mip_levels; mip++) {
+        // the level just written becomes the source of the next one down, then is done with
+        transition_mip_level(cmd, image, mip, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                             VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_READ_BIT);
+
+        if(mip + 1 < mip_levels) {
+            VkExtent2D half_size = { std::max(size.width / 2, 1u), std::max(size.height / 2, 1u) };
+
+            VkImageBlit2 blit_region = {
+                    .sType = VK_STRUCTURE_TYPE_IMAGE_BLIT_2,
+                    .pNext = nullptr,
+                    .srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, mip, 0, 1 },
+                    .dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, mip + 1, 0, 1 }
+            };
+            blit_region.srcOffsets[1] = { static_cast<int32_t>(size.width), static_cast<int32_t>(size.height), 1 };
+            blit_region.dstOffsets[1] = { static_cast<int32_t>(half_size.width), static_cast<int32_t>(half_size.height), 1 };
+
+            VkBlitImageInfo2 info = {
+                    .sType = VK_STRUCTURE_TYPE_BLIT_IMAGE_INFO_2,
+                    .srcImage = image,
+                    .srcImageLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                    .dstImage = image,
+                    .dstImageLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                    .regionCount = 1,
+                    .pRegions = &blit_region,
+                    .filter = VK_FILTER_LINEAR,
+            };
+            vkCmdBlitImage2(cmd, &info);
+
+            size = half_size;
+        }
+
+        transition_mip_level(cmd, image, mip, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                             VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_SHADER_READ_BIT);
+    }
+}
+
+uint32_t get_mip_level_count(VkExtent2D size) {
+    return static_cast<uint32_t>(std::floor(std::log2(std::max(size.width, size.height)))) + 1;
+}
+
 }
@@ -12,4 +12,11 @@ namespace vk_image {
     void transition_image_layout_specify_aspect(VkCommandBuffer cmd, VkImage image, VkImageLayout currentLayout, VkImageLayout newLayout, VkImageAspectFlags aspectFlags);
     void copy_image_to_image(VkCommandBuffer cmd, VkImage source, VkImage destination, VkExtent2D source_size, VkExtent2D destination_size);
 
+    // fills levels 1..mip_levels-1 by blitting down from level 0. Expects every level in TRANSFER_DST_OPTIMAL, leaves
+    // every level in SHADER_READ_ONLY_OPTIMAL
+    void generate_mipmaps(VkCommandBuffer cmd, VkImage image, VkExtent2D size, uint32_t mip_levels);
+
+    // number of mips in a full chain down to 1x1
+    uint32_t get_mip_level_count(VkExtent2D size);
+
 }
@@ -0,0 +1,255 @@
+//
+// Created by darby on 2/28/2025.
+//
+
+#include "WeightedBlendedOIT.hpp"
+#include "PipelineBuilder.hpp"
+#include "DescriptorLayoutBuilder.hpp"
+#include "DescriptorWriter.hpp"
+#include "VulkanInitUtility.hpp"
+#include "VulkanImageUtility.hpp"
+#include "VulkanFileLoaderUtility.hpp"
+#include "VulkanDebugUtility.hpp"
+#include <chrono>
+
+void WeightedBlendedOIT::init(VkDevice device,
+                              VmaAllocator allocator,
+                              AllocatedImage& draw_image,
+                              VkFormat depth_format,
+                              VkDescriptorSetLayout scene_descriptor_set_layout,
+                              VkDescriptorSetLayout shadow_map_descriptor_set_layout,
+                              VkDescriptorSetLayout light_source_descriptor_set_layout,
+                              GLTFHDRMaterial& hdr_material) {
+
+    this->device = device;
+    this->allocator = allocator;
+
+    // Targets
+    VkImageUsageFlags target_usage_flags = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+
+    accumulation_image.init(device, allocator, draw_image.extent, ACCUMULATION_FORMAT, target_usage_flags, false);
+    vk_debug::name_resource<VkImage>(device, VK_OBJECT_TYPE_IMAGE, accumulation_image.image, "OIT Accumulation Image");
+
+    revealage_image.init(device, allocator, draw_image.extent, REVEALAGE_FORMAT, target_usage_flags, false);
+    vk_debug::name_resource<VkImage>(device, VK_OBJECT_TYPE_IMAGE, revealage_image.image, "OIT Revealage Image");
+
+    VkSamplerCreateInfo sampler_create_info = {
+            .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+            .magFilter = VK_FILTER_NEAREST,
+            .minFilter = VK_FILTER_NEAREST
+    };
+    VK_CHECK(vkCreateSampler(device, &sampler_create_info, nullptr, &target_sampler));
+
+    indirect_draws.init(device, allocator);
+
+    // Composite descriptor set
+    {
+        DescriptorLayoutBuilder builder;
+        builder.add_binding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER); // accumulation
+        builder.add_binding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER); // revealage
+        composite_descriptor_set_layout = builder.build(device, VK_SHADER_STAGE_FRAGMENT_BIT);
+    }
+
+    std::vector<DescriptorAllocatorGrowable::PoolSizeRatio> sizes = {
+            {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2},
+    };
+    descriptor_allocator.init_allocator(device, 1, sizes);
+
+    composite_descriptor_set = descriptor_allocator.allocate(device, composite_descriptor_set_layout, nullptr);
+
+    DescriptorWriter writer;
+    writer.write_image(0, accumulation_image.view, target_sampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+    writer.write_image(1, revealage_image.view, target_sampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+    writer.update_set(device, composite_descriptor_set);
+
+    // Accumulate pipeline, used through the transparent materials
+    hdr_material.build_transparent_pipeline(device,
+                                            light_source_descriptor_set_layout,
+                                            scene_descriptor_set_layout,
+                                            shadow_map_descriptor_set_layout,
+                                            ACCUMULATION_FORMAT,
+                                            REVEALAGE_FORMAT,
+                                            depth_format);
+
+    // Composite pipeline
+    VkShaderModule fullscreen_vert_shader;
+    if(!vk_file::load_shader_module("../shaders/fullscreen_triangle.vert.spv", device, &fullscreen_vert_shader)) {
+        fmt::print("Error loading fullscreen triangle vert shader\n");
+    }
+
+    VkShaderModule composite_frag_shader;
+    if(!vk_file::load_shader_module("../shaders/oit_composite.frag.spv", device, &composite_frag_shader)) {
+        fmt::print("Error loading oit composite frag shader\n");
+    }
+
+    std::vector<VkDescriptorSetLayout> composite_descriptor_set_layouts = {
+            composite_descriptor_set_layout
+    };
+
+    VkPipelineLayoutCreateInfo pipeline_layout_info = vk_init::get_pipeline_layout_create_info(composite_descriptor_set_layouts, {});
+    VK_CHECK(vkCreatePipelineLayout(device, &pipeline_layout_info, nullptr, &composite_pipeline_layout));
+
+    PipelineBuilder builder;
+    builder.layout = composite_pipeline_layout;
+    builder.set_shaders(fullscreen_vert_shader, composite_frag_shader);
+    builder.set_input_topology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+    builder.set_rasterizer_polygon_mode(VK_POLYGON_MODE_FILL);
+    builder.set_rasterizer_cull_mode(VK_CULL_MODE_NONE, VK_FRONT_FACE_COUNTER_CLOCKWISE);
+    builder.set_multisampling_none();
+    builder.enable_blending_alphablend();
+    builder.disable_depth_test();
+    builder.set_single_color_attachment_format(draw_image.format);
+
+    composite_pipeline = builder.build_pipeline(device, "OIT Composite Pipeline");
+
+    vkDestroyShaderModule(device, fullscreen_vert_shader, nullptr);
+    vkDestroyShaderModule(device, composite_frag_shader, nullptr);
+}
+
+void WeightedBlendedOIT::draw(VkCommandBuffer cmd,
+                              ParallelCommandRecorder& command_recorder,
+                              JobSystem& job_system,
+                              TimelineDeletionQueue& gpu_deletion_queue,
+                              AllocatedImage& target,
+                              AllocatedImage& depth_image,
+                              const FrameUniforms& frame_uniforms,
+                              VkDescriptorSet shadow_map_descriptor_set,
+                              const GPUSceneData& current_scene_data,
+                              EngineStats& engine_stats,
+                              DrawContext& draw_context) {
+
+    engine_stats.transparent_draw_time = 0.f;
+    if(draw_context.visible_transparent_surfaces.empty()) {
+        return;
+    }
+
+    auto transparent_draw_start = std::chrono::system_clock::now();
+
+    // order doesn't matter to the blend, only group by state
+    draw_sorter.sort(draw_context.transparent_surfaces, draw_context.visible_transparent_surfaces, DrawPass::Transparent, current_scene_data.view);
+    indirect_draws.build(draw_context.transparent_surfaces, draw_context.visible_transparent_surfaces,
+                         draw_context.transparent_transforms, DrawPass::Transparent, gpu_deletion_queue);
+
+    vk_image::transition_image_layout(cmd, accumulation_image.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+    vk_image::transition_image_layout(cmd, revealage_image.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+
+    accumulate(cmd, command_recorder, job_system, depth_image, frame_uniforms, shadow_map_descriptor_set, engine_stats, draw_context);
+
+    vk_image::transition_image_layout(cmd, accumulation_image.image, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    vk_image::transition_image_layout(cmd, revealage_image.image, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+    composite(cmd, target);
+
+    auto transparent_draw_end = std::chrono::system_clock::now();
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(transparent_draw_end - transparent_draw_start);
+    engine_stats.transparent_draw_time = elapsed.count() / 1000.f;
+}
+
+void WeightedBlendedOIT::accumulate(VkCommandBuffer cmd,
+                                    ParallelCommandRecorder& command_recorder,
+                                    JobSystem& job_system,
+                                    AllocatedImage& depth_image,
+                                    const FrameUniforms& frame_uniforms,
+                                    VkDescriptorSet shadow_map_descriptor_set,
+                                    EngineStats& engine_stats,
+                                    DrawContext& draw_context) {
+
+    // nothing accumulated and everything revealed
+    VkClearValue accumulation_clear = { .color = { { 0.0f, 0.0f, 0.0f, 0.0f } } };
+    VkClearValue revealage_clear = { .color = { { 1.0f, 0.0f, 0.0f, 0.0f } } };
+
+    std::array<VkRenderingAttachmentInfo, 2> color_attachment_infos = {
+            vk_init::get_color_attachment_info(accumulation_image.view, &accumulation_clear),
+            vk_init::get_color_attachment_info(revealage_image.view, &revealage_clear)
+    };
+
+    // keep the opaque depth, transparent surfaces are only tested against it
+    VkRenderingAttachmentInfo depth_attachment_info = vk_init::get_depth_attachment_info(depth_image.view);
+    depth_attachment_info.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+    depth_attachment_info.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+
+    VkExtent2D render_extent = {
+            .width = accumulation_image.extent.width,
+            .height = accumulation_image.extent.height
+    };
+
+    // the draws themselves are recorded into secondaries on the job threads
+    VkRenderingInfo render_info = vk_init::get_rendering_info(render_extent, color_attachment_infos, &depth_attachment_info);
+    render_info.flags = VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT;
+
+    vkCmdBeginRendering(cmd, &render_info);
+
+    const std::vector<IndirectBatch>& batches = indirect_draws.get_batches();
+    std::array<VkFormat, 2> color_attachment_formats = { ACCUMULATION_FORMAT, REVEALAGE_FORMAT };
+
+    command_recorder.record(cmd, color_attachment_formats, depth_image.format, render_extent,
+                            static_cast<uint32_t>(batches.size()), job_system, engine_stats,
+                            [&](CommandEncoder& encoder, uint32_t start, uint32_t end) {
+        for(uint32_t i = start; i < end; i++) {
+            VkPipelineLayout layout = batches[i].pipeline->layout;
+            encoder.bind_descriptor_set(layout, 0, frame_uniforms.scene_set, frame_uniforms.scene_offset);
+            encoder.bind_descriptor_set(layout, 1, frame_uniforms.light_set, frame_uniforms.light_offset);
+            encoder.bind_descriptor_set(layout, 2, shadow_map_descriptor_set);
+
+            indirect_draws.record_batch(encoder, i);
+        }
+    });
+
+    engine_stats.triangle_count += static_cast<int>(indirect_draws.get_triangle_count());
+    engine_stats.indirect_command_count += static_cast<int>(indirect_draws.get_command_count());
+
+    vkCmdEndRendering(cmd);
+}
+
+void WeightedBlendedOIT::composite(VkCommandBuffer cmd, AllocatedImage& target) {
+    VkRenderingAttachmentInfo color_attachment = vk_init::get_color_attachment_info(target.view, nullptr);
+    std::array<VkRenderingAttachmentInfo, 1> color_attachment_infos = {
+            color_attachment
+    };
+
+    VkExtent2D render_extent = {
+            .width = target.extent.width,
+            .height = target.extent.height
+    };
+
+    VkRenderingInfo render_info = vk_init::get_rendering_info(render_extent, color_attachment_infos, nullptr);
+
+    vkCmdBeginRendering(cmd, &render_info);
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, composite_pipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, composite_pipeline_layout, 0, 1, &composite_descriptor_set, 0, nullptr);
+
+    VkViewport viewport = {
+            .x = 0,
+            .y = 0,
+            .width = static_cast<float>(render_extent.width),
+            .height = static_cast<float>(render_extent.height),
+            .minDepth = 0.f,
+            .maxDepth = 1.f
+    };
+    vkCmdSetViewport(cmd, 0, 1, &viewport);
+
+    VkRect2D scissor = {
+            .offset = { 0, 0 },
+            .extent = render_extent
+    };
+    vkCmdSetScissor(cmd, 0, 1, &scissor);
+
+    vkCmdDraw(cmd, 3, 1, 0, 0);
+
+    vkCmdEndRendering(cmd);
+}
+
+void WeightedBlendedOIT::destroy_resources(VkDevice device) {
+    vkDestroyPipeline(device, composite_pipeline, nullptr);
+    vkDestroyPipelineLayout(device, composite_pipeline_layout, nullptr);
+
+    descriptor_allocator.destroy_descriptor_pools(device);
+    vkDestroyDescriptorSetLayout(device, composite_descriptor_set_layout, nullptr);
+    vkDestroySampler(device, target_sampler, nullptr);
+
+    accumulation_image.destroy(device);
+    revealage_image.destroy(device);
+
+    indirect_draws.destroy();
+}
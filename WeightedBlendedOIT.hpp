@@ -0,0 +1,94 @@
+//
+// Created by darby on 2/28/2025.
+//
+
+#pragma once
+
+#include "Common.hpp"
+#include "AllocatedImage.hpp"
+#include "GraphicsTypes.hpp"
+#include "GLTFHDRMaterial.hpp"
+#include "DescriptorAllocatorGrowable.hpp"
+#include "DeletionQueue.hpp"
+#include "TimelineDeletionQueue.hpp"
+#include "DrawSorter.hpp"
+#include "IndirectDrawBuilder.hpp"
+#include "ParallelCommandRecorder.hpp"
+#include "JobSystem.hpp"
+#include "EngineStats.hpp"
+
+/*
+ * Weighted blended order-independent transparency (McGuire & Bavoil 2013).
+ *
+ * Transparent surfaces are drawn once, in any order, into two targets: an RGBA16F accumulation of weighted
+ * premultiplied color and alpha, and a revealage target holding the product of (1 - alpha) of every layer.
+ * A fullscreen composite then blends average color * (1 - revealage) over the opaque image. Since both blends
+ * are commutative no CPU depth sort is needed, the draws are only grouped by state.
+ *
+ * The accumulate pipeline itself is the transparent MaterialPipeline built by GLTFHDRMaterial, so it's shared by
+ * the forward and deferred renderers, each passing in its own depth buffer.
+ */
+class WeightedBlendedOIT {
+
+public:
+    static constexpr VkFormat ACCUMULATION_FORMAT = VK_FORMAT_R16G16B16A16_SFLOAT;
+    static constexpr VkFormat REVEALAGE_FORMAT = VK_FORMAT_R16_SFLOAT;
+
+    void init(VkDevice device,
+              VmaAllocator allocator,
+              AllocatedImage& draw_image,
+              VkFormat depth_format,
+              VkDescriptorSetLayout scene_descriptor_set_layout,
+              VkDescriptorSetLayout shadow_map_descriptor_set_layout,
+              VkDescriptorSetLayout light_source_descriptor_set_layout,
+              GLTFHDRMaterial& hdr_material);
+
+    void destroy_resources(VkDevice device);
+
+    /*
+     * Accumulates draw_context's visible transparent surfaces, depth tested against depth_image, and composites them
+     * onto target. target must be in COLOR_ATTACHMENT_OPTIMAL and depth_image in DEPTH_ATTACHMENT_OPTIMAL holding the
+     * opaque depth, both are left that way. Does nothing when no transparent surface is visible.
+     */
+    void draw(VkCommandBuffer cmd,
+              ParallelCommandRecorder& command_recorder,
+              JobSystem& job_system,
+              TimelineDeletionQueue& gpu_deletion_queue,
+              AllocatedImage& target,
+              AllocatedImage& depth_image,
+              const FrameUniforms& frame_uniforms,
+              VkDescriptorSet shadow_map_descriptor_set,
+              const GPUSceneData& current_scene_data,
+              EngineStats& engine_stats,
+              DrawContext& draw_context);
+
+private:
+    void accumulate(VkCommandBuffer cmd,
+                    ParallelCommandRecorder& command_recorder,
+                    JobSystem& job_system,
+                    AllocatedImage& depth_image,
+                    const FrameUniforms& frame_uniforms,
+                    VkDescriptorSet shadow_map_descriptor_set,
+                    EngineStats& engine_stats,
+                    DrawContext& draw_context);
+
+    void composite(VkCommandBuffer cmd, AllocatedImage& target);
+
+    VkDevice device;
+    VmaAllocator allocator;
+
+    AllocatedImage accumulation_image;
+    AllocatedImage revealage_image;
+
+    // the composite reads the targets with texelFetch, the sampler is only there to fill the descriptor
+    VkSampler target_sampler;
+    VkDescriptorSetLayout composite_descriptor_set_layout;
+    VkDescriptorSet composite_descriptor_set; // written once, the targets never change
+    DescriptorAllocatorGrowable descriptor_allocator;
+
+    VkPipelineLayout composite_pipeline_layout;
+    VkPipeline composite_pipeline;
+
+    DrawSorter draw_sorter;
+    IndirectDrawBuilder indirect_draws;
+};
@@ -0,0 +1,27 @@
+// GLTFHDRMaterial's bindless material set. Define MATERIAL_SET as the set the pipeline layout puts it at before
+// including, and enable GL_EXT_nonuniform_qualifier
+
+// must match GLTFHDRMaterial::MaterialConstants
+struct MaterialData {
+    vec4 color_factors;
+    vec4 metal_rough_factors; // [0] - metallness factor, [1] - roughness factor
+    float normal_tex_scalar;
+    float ambient_occlusion_strength;
+    uint includes_certain_textures; // glm::bvec4, a byte per texture: color, metal_rough, normal, ambient occlusion
+    float padding;
+    uint color_texture_index;
+    uint metal_rough_texture_index;
+    uint normal_texture_index;
+    uint ambient_occlusion_texture_index;
+};
+
+layout(set = MATERIAL_SET, binding = 0, std430) readonly buffer MaterialBuffer {
+    MaterialData materials[];
+} material_buffer;
+
+layout(set = MATERIAL_SET, binding = 1) uniform sampler2D bindless_textures[];
+
+// neighbouring fragments can belong to different draws, so the index can't be assumed uniform
+vec4 sample_material_texture(uint texture_index, vec2 uv) {
+    return texture(bindless_textures[nonuniformEXT(texture_index)], uv);
+}
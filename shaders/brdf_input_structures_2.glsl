@@ -7,6 +7,7 @@ layout(set = 0, binding = 0) uniform SceneData {
     vec4 ambient_color;
     vec4 sunlight_direction; // user-provided
     vec4 sunlight_color;
+    vec4 camera_position; // world space
     float ambient_occlusion_scalar; // user-provided
     float shadow_bias_scalar; // user-provided
     int shadow_softening_kernel_size; // user-provided
@@ -15,26 +16,16 @@ layout(set = 0, binding = 0) uniform SceneData {
 layout(set = 1, binding = 0) uniform LightSourceData {
     mat4 light_view_matrix;
     mat4 light_projection_matrix;
+    vec4 light_direction; // world space, towards the light
 } light_source_data;
 
 layout(set = 2, binding = 0) uniform sampler2D shadow_map_tex;
 
-layout(set = 3, binding = 0) uniform GLTFMaterialData {
-    vec4 color_factors;
-    vec4 metal_rough_factors; // [0] - metallness factor, [1] - roughness factor
-    float normal_tex_scalar;
-    float ambient_occlusion_strength;
-    // [0] - includes color texture
-    // [1] - includes metal_rough texture
-    // [2] - includes normal texture
-    // [3] - includes ambient occlusion texture
-    bvec4 includes_certain_textures;
-} material_data;
-
-layout(set = 3, binding = 1) uniform sampler2D color_tex;
-layout(set = 3, binding = 2) uniform sampler2D metal_rough_tex;
-layout(set = 3, binding = 3) uniform sampler2D normal_tex;
-layout(set = 3, binding = 4) uniform sampler2D ambient_occlusion_tex;
+#define MATERIAL_SET 3
+#include "bindless_material_structures.glsl"
+
+// the draw's material, set at the top of main from its material index
+MaterialData material_data;
 
 
 
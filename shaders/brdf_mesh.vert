@@ -2,8 +2,9 @@
 
 #extension GL_GOOGLE_include_directive : require
 #extension GL_EXT_buffer_reference : require
+#extension GL_EXT_nonuniform_qualifier : require
 
-#include "common_pipeline_structures.glsl"
+#include "indirect_draw_structures.glsl"
 // My changes to the original file were not being respected until I changed the name VV
 #include "brdf_input_structures_2.glsl"
 
@@ -13,18 +14,24 @@ layout(location = 2) out vec2 out_UV;
 layout(location = 3) out vec3 out_world_pos;
 layout(location = 4) out vec4 out_tangent;
 layout(location = 5) out vec4 out_light_space_pos;
+layout(location = 6) flat out uint out_material_index;
 
 void main() {
-    Vertex v = PushConstants.vertex_buffer.vertices[gl_VertexIndex];
+    DrawData draw = PushConstants.draw_data_buffer.draws[gl_InstanceIndex];
+    mat4 model_matrix = PushConstants.transform_buffer.transforms[draw.transform_index];
+    mat3 normal_matrix = mat3(PushConstants.normal_matrix_buffer.normal_matrices[draw.transform_index]);
+    Vertex v = draw.vertex_buffer.vertices[gl_VertexIndex];
+    material_data = material_buffer.materials[draw.material_index];
+    out_material_index = draw.material_index;
 
     vec4 position = vec4(v.position, 1.0f);
-    vec4 world_space_pos = PushConstants.model_matrix * position;
+    vec4 world_space_pos = model_matrix * position;
     out_world_pos = world_space_pos.xyz;
     vec4 view_space_pos = scene_data.view * world_space_pos;
 
     gl_Position = scene_data.proj * view_space_pos;
 
-    out_normal = (PushConstants.model_matrix * vec4(v.normal, 0.f)).xyz; // world space
+    out_normal = normal_matrix * v.normal; // world space
     out_color = v.color.xyz * material_data.color_factors.xyz;
     out_UV.x = v.texCoord.x;
     out_UV.y = v.texCoord.y;
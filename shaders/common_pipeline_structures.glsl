@@ -1,22 +1,13 @@
 
-struct Vertex {
-    vec3 position; // 12 bytes
-    uint buf;
-    vec3 normal; // 12 bytes
-    uint buf1;
-    vec4 tangent; // 16 bytes
-    vec4 color; // 16 bytes
-    vec2 texCoord; // 8 bytes
-    vec2 texCoord1; // 8 bytes
-    uint material; // 4 bytes
-};
+#include "vertex_structures.glsl"
 
-layout(buffer_reference, std430) readonly buffer VertexBuffer {
-    Vertex vertices[];
+layout(buffer_reference, std430) readonly buffer TransformBuffer {
+    mat4 transforms[];
 };
 
+// see GPUObjectDrawPushConstants, the draw's firstInstance is its object index
 layout(push_constant) uniform constants {
-    mat4 model_matrix;
+    TransformBuffer transform_buffer;
     VertexBuffer vertex_buffer;
 } PushConstants;
 
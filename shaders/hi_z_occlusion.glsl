@@ -0,0 +1,36 @@
+// shared by the culling shaders. The pyramid holds the farthest depth under each of its texels, see DepthPyramid
+
+// whether a world-space sphere is entirely behind what the pyramid was built from
+bool is_sphere_occluded(sampler2D depth_pyramid, mat4 view_proj, vec3 center, float radius) {
+    // screen rect and nearest depth of the sphere's bounding box
+    vec3 ndc_min = vec3(1.0);
+    vec3 ndc_max = vec3(-1.0);
+    for(int i = 0; i < 8; i++) {
+        vec3 corner = center + radius * vec3((i & 1) != 0 ? 1.0 : -1.0, (i & 2) != 0 ? 1.0 : -1.0, (i & 4) != 0 ? 1.0 : -1.0);
+        vec4 clip = view_proj * vec4(corner, 1.0);
+        if(clip.w <= 0.0) {
+            return false; // reaches behind the camera, too close to tell
+        }
+        vec3 ndc = clip.xyz / clip.w;
+        ndc_min = min(ndc_min, ndc);
+        ndc_max = max(ndc_max, ndc);
+    }
+
+    vec2 level_0_size = vec2(textureSize(depth_pyramid, 0));
+    vec2 rect_min = clamp(ndc_min.xy * 0.5 + 0.5, 0.0, 1.0) * level_0_size;
+    vec2 rect_max = clamp(ndc_max.xy * 0.5 + 0.5, 0.0, 1.0) * level_0_size;
+
+    // the level where the rect is no wider than a texel, so it touches at most 2x2 of them
+    float rect_size = max(rect_max.x - rect_min.x, rect_max.y - rect_min.y);
+    int level = clamp(int(ceil(log2(max(rect_size, 1.0)))), 0, textureQueryLevels(depth_pyramid) - 1);
+
+    ivec2 level_size = textureSize(depth_pyramid, level);
+    ivec2 first = clamp(ivec2(rect_min) >> level, ivec2(0), level_size - 1);
+    ivec2 last = clamp(ivec2(rect_max) >> level, ivec2(0), level_size - 1);
+
+    float farthest = max(max(texelFetch(depth_pyramid, first, level).r, texelFetch(depth_pyramid, ivec2(last.x, first.y), level).r),
+                         max(texelFetch(depth_pyramid, ivec2(first.x, last.y), level).r, texelFetch(depth_pyramid, last, level).r));
+
+    // depth is 0 near to 1 far
+    return ndc_min.z > farthest;
+}
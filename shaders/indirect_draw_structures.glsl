@@ -0,0 +1,28 @@
+#include "vertex_structures.glsl"
+
+// pipelines drawn through IndirectDrawBuilder. Each indirect command's firstInstance is its slot in the draw data,
+// so gl_InstanceIndex finds the draw
+
+struct DrawData {
+    uint transform_index;
+    uint material_index; // into the bindless material buffer
+    VertexBuffer vertex_buffer;
+};
+
+layout(buffer_reference, std430) readonly buffer TransformBuffer {
+    mat4 transforms[];
+};
+
+layout(buffer_reference, std430) readonly buffer DrawDataBuffer {
+    DrawData draws[];
+};
+
+layout(buffer_reference, std430) readonly buffer NormalMatrixBuffer {
+    mat4 normal_matrices[]; // inverse transpose of the transform at the same index
+};
+
+layout(push_constant) uniform constants {
+    TransformBuffer transform_buffer;
+    DrawDataBuffer draw_data_buffer;
+    NormalMatrixBuffer normal_matrix_buffer;
+} PushConstants;
@@ -10,6 +10,7 @@ layout(set = 0, binding = 0) uniform SceneData {
     vec4 ambient_color;
     vec4 sunlight_direction; // user-provided
     vec4 sunlight_color;
+    vec4 camera_position; // world space
     float ambient_occlusion_scalar; // user-provided
     float shadow_bias_scalar; // user-provided
     int shadow_softening_kernel_size; // user-provided
@@ -19,6 +20,7 @@ layout(set = 0, binding = 0) uniform SceneData {
 layout(set = 1, binding = 0) uniform LightSourceData {
     mat4 light_view_matrix;
     mat4 light_projection_matrix;
+    vec4 light_direction; // world space, towards the light
 } light_source_data;
 
 // ---------- G-BUFFER DATA
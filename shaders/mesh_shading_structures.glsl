@@ -0,0 +1,82 @@
+#include "vertex_structures.glsl"
+
+// pipelines drawn through IndirectDrawBuilder's mesh tasks. A batch's commands are one draw call, so its first slot is
+// pushed and gl_DrawID counts from it. Draw data and transforms are the same as indirect_draw_structures.glsl's
+
+// must match IndirectDrawBuilder::MESH_TASK_WORKGROUP_SIZE, a task workgroup culls this many of a draw's meshlets
+#define MESH_TASK_WORKGROUP_SIZE 32
+
+// must match MeshletCuller::MAX_MESHLET_VERTICES and MAX_MESHLET_TRIANGLES
+#define MAX_MESHLET_VERTICES 64
+#define MAX_MESHLET_TRIANGLES 124
+
+struct DrawData {
+    uint transform_index;
+    uint material_index; // into the bindless material buffer
+    VertexBuffer vertex_buffer;
+};
+
+layout(buffer_reference, std430) readonly buffer TransformBuffer {
+    mat4 transforms[];
+};
+
+layout(buffer_reference, std430) readonly buffer DrawDataBuffer {
+    DrawData draws[];
+};
+
+layout(buffer_reference, std430) readonly buffer NormalMatrixBuffer {
+    mat4 normal_matrices[]; // inverse transpose of the transform at the same index
+};
+
+struct Meshlet {
+    vec4 bounding_sphere; // local-space center and radius
+    vec4 cone; // local-space axis and cutoff
+    uint first_index;
+    uint triangle_count;
+    uint first_data; // vertex_count vertex indices, then a uint per triangle with its corners packed 8 bits each
+    uint vertex_count;
+};
+
+layout(buffer_reference, std430) readonly buffer MeshletBuffer {
+    Meshlet meshlets[];
+};
+
+layout(buffer_reference, std430) readonly buffer MeshletDataBuffer {
+    uint data[];
+};
+
+struct MeshTaskDrawData {
+    MeshletBuffer meshlet_buffer;
+    MeshletDataBuffer meshlet_data_buffer;
+    uint first_meshlet;
+    uint meshlet_count;
+    uint cull_meshlets;
+    uint padding;
+};
+
+layout(buffer_reference, std430) readonly buffer MeshTaskDrawDataBuffer {
+    MeshTaskDrawData draws[];
+};
+
+// planes point into the frustum, see Frustum in FrustumCuller.hpp
+layout(buffer_reference, std430) readonly buffer MeshTaskViewBuffer {
+    vec4 frustum_planes[6];
+    mat4 view_proj;
+    vec4 camera_position;
+};
+
+layout(push_constant) uniform constants {
+    TransformBuffer transform_buffer;
+    DrawDataBuffer draw_data_buffer;
+    NormalMatrixBuffer normal_matrix_buffer;
+    MeshTaskDrawDataBuffer mesh_task_draw_data_buffer;
+    MeshTaskViewBuffer view_buffer;
+    uint first_command;
+    uint padding;
+} PushConstants;
+
+// handed from a task workgroup to the mesh workgroups it launches, one per surviving meshlet
+struct MeshTaskPayload {
+    uint draw_index;
+    uint meshlet_indices[MESH_TASK_WORKGROUP_SIZE];
+};
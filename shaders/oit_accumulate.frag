@@ -0,0 +1,34 @@
+#version 450
+
+#extension GL_GOOGLE_include_directive : require
+#extension GL_EXT_buffer_reference : require
+#extension GL_EXT_nonuniform_qualifier : require
+
+#include "brdf_input_structures_2.glsl"
+
+layout(location = 0) in vec3 in_normal;
+layout(location = 1) in vec3 in_color;
+layout(location = 2) in vec2 in_uv;
+layout(location = 3) in vec3 in_frag_world_pos;
+layout(location = 4) in vec4 in_tangent;
+layout(location = 5) in vec4 in_light_space_pos;
+layout(location = 6) flat in uint in_material_index;
+
+// weighted blended order-independent transparency, McGuire & Bavoil 2013
+// accumulation is blended ONE, ONE and revealage ZERO, ONE_MINUS_SRC_COLOR, so neither depends on draw order
+layout(location = 0) out vec4 out_accumulation;
+layout(location = 1) out float out_revealage;
+
+#include "brdf_shading.glsl"
+
+void main() {
+    material_data = material_buffer.materials[in_material_index];
+    float alpha = sample_material_texture(material_data.color_texture_index, in_uv).a * material_data.color_factors.a;
+    vec3 color = shade_brdf();
+
+    // favours near, opaque-ish fragments. the clamp keeps the sum inside half-float range
+    float weight = clamp(pow(min(1.0, alpha * 10.0) + 0.01, 3.0) * 1e8 * pow(1.0 - gl_FragCoord.z * 0.9, 3.0), 1e-2, 3e3);
+
+    out_accumulation = vec4(color * alpha, alpha) * weight;
+    out_revealage = alpha;
+}
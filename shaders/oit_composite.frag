@@ -0,0 +1,27 @@
+#version 450
+
+layout(set = 0, binding = 0) uniform sampler2D accumulation_tex;
+layout(set = 0, binding = 1) uniform sampler2D revealage_tex;
+
+layout(location = 0) out vec4 out_frag_color;
+
+// resolves the weighted blended transparency targets, blended over the opaque image with SRC_ALPHA, ONE_MINUS_SRC_ALPHA
+void main() {
+    ivec2 coord = ivec2(gl_FragCoord.xy);
+
+    float revealage = texelFetch(revealage_tex, coord, 0).r;
+    if(revealage >= 1.0) {
+        discard; // no transparent surface covers this pixel
+    }
+
+    vec4 accumulation = texelFetch(accumulation_tex, coord, 0);
+
+    // the weighted sum can still overflow a half float with enough layers
+    if(any(isinf(accumulation.rgb))) {
+        accumulation.rgb = vec3(accumulation.a);
+    }
+
+    vec3 average_color = accumulation.rgb / max(accumulation.a, 1e-5);
+
+    out_frag_color = vec4(average_color, 1.0 - revealage);
+}
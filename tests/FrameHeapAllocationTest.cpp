@@ -0,0 +1,281 @@
+//
+// Created by darby on 3/6/2025.
+//
+
+// Runs the CPU side of a frame the way Engine::draw does, on every job system thread, and fails if any steady state
+// frame touches the heap. Built with VULKAN_ENGINE_COUNT_HEAP_ALLOCATIONS so operator new is counted.
+// Vulkan entry points are no-op fakes swapped in through volk's function pointers, so no device is needed.
+
+#define VOLK_IMPLEMENTATION
+#include "Common.hpp"
+#include "HeapAllocationCounter.hpp"
+#include "JobSystem.hpp"
+#include "SharedDescriptorPools.hpp"
+#include "ThreadDescriptorAllocator.hpp"
+#include "ParallelCommandRecorder.hpp"
+#include "DescriptorWriter.hpp"
+#include "FrameArena.hpp"
+#include "DrawSorter.hpp"
+#include "FrustumCuller.hpp"
+
+#include <glm/gtc/constants.hpp>
+
+namespace {
+
+constexpr uint32_t WORKER_COUNT = 7;
+constexpr uint32_t FRAME_OVERLAP = 2;
+constexpr uint32_t SHARED_DESCRIPTOR_POOL_SETS = 128;
+constexpr size_t FRAME_ARENA_SIZE = 256 * 1024;
+
+// the camera orbits once over the warm up, the measured frames go round the same views again
+constexpr uint32_t WARM_UP_FRAME_COUNT = 120;
+constexpr uint32_t MEASURED_FRAME_COUNT = 600;
+
+constexpr uint32_t OBJECT_GRID_SIZE = 24; // cubed
+constexpr uint32_t MATERIAL_COUNT = 16;
+constexpr uint32_t MESH_COUNT = 64;
+constexpr uint32_t ANIMATION_JOB_COUNT = 16;
+
+void install_fake_vulkan() {
+    vkCreateDescriptorPool = [](VkDevice, const VkDescriptorPoolCreateInfo*, const VkAllocationCallbacks*, VkDescriptorPool* pool) {
+        static std::atomic<uint32_t> pool_count { 0 };
+        *pool = reinterpret_cast<VkDescriptorPool>(uintptr_t(pool_count.fetch_add(1) + 1));
+        return VK_SUCCESS;
+    };
+    vkDestroyDescriptorPool = [](VkDevice, VkDescriptorPool, const VkAllocationCallbacks*) {};
+    vkResetDescriptorPool = [](VkDevice, VkDescriptorPool, VkDescriptorPoolResetFlags) { return VK_SUCCESS; };
+    vkAllocateDescriptorSets = [](VkDevice, const VkDescriptorSetAllocateInfo*, VkDescriptorSet* sets) {
+        sets[0] = reinterpret_cast<VkDescriptorSet>(uintptr_t(1));
+        return VK_SUCCESS;
+    };
+    vkUpdateDescriptorSets = [](VkDevice, uint32_t, const VkWriteDescriptorSet*, uint32_t, const VkCopyDescriptorSet*) {};
+
+    vkCreateCommandPool = [](VkDevice, const VkCommandPoolCreateInfo*, const VkAllocationCallbacks*, VkCommandPool* pool) {
+        *pool = reinterpret_cast<VkCommandPool>(uintptr_t(1));
+        return VK_SUCCESS;
+    };
+    vkDestroyCommandPool = [](VkDevice, VkCommandPool, const VkAllocationCallbacks*) {};
+    vkResetCommandPool = [](VkDevice, VkCommandPool, VkCommandPoolResetFlags) { return VK_SUCCESS; };
+    vkAllocateCommandBuffers = [](VkDevice, const VkCommandBufferAllocateInfo*, VkCommandBuffer* command_buffers) {
+        command_buffers[0] = reinterpret_cast<VkCommandBuffer>(uintptr_t(1));
+        return VK_SUCCESS;
+    };
+    vkBeginCommandBuffer = [](VkCommandBuffer, const VkCommandBufferBeginInfo*) { return VK_SUCCESS; };
+    vkEndCommandBuffer = [](VkCommandBuffer) { return VK_SUCCESS; };
+    vkCmdExecuteCommands = [](VkCommandBuffer, uint32_t, const VkCommandBuffer*) {};
+    vkCmdSetViewport = [](VkCommandBuffer, uint32_t, uint32_t, const VkViewport*) {};
+    vkCmdSetScissor = [](VkCommandBuffer, uint32_t, uint32_t, const VkRect2D*) {};
+    vkCmdBindPipeline = [](VkCommandBuffer, VkPipelineBindPoint, VkPipeline) {};
+    vkCmdBindDescriptorSets = [](VkCommandBuffer, VkPipelineBindPoint, VkPipelineLayout, uint32_t, uint32_t, const VkDescriptorSet*, uint32_t, const uint32_t*) {};
+    vkCmdBindIndexBuffer = [](VkCommandBuffer, VkBuffer, VkDeviceSize, VkIndexType) {};
+    vkCmdPushConstants = [](VkCommandBuffer, VkPipelineLayout, VkShaderStageFlags, uint32_t, uint32_t, const void*) {};
+    vkCmdDrawIndexed = [](VkCommandBuffer, uint32_t, uint32_t, uint32_t, int32_t, uint32_t) {};
+}
+
+struct TestFrame {
+    FrameArena frame_arena;
+    ThreadDescriptorAllocator frame_descriptors;
+    ParallelCommandRecorder command_recorder;
+};
+
+// what Engine keeps from frame to frame for the part of draw() under test
+struct TestScene {
+    JobSystem job_system;
+    SharedDescriptorPools shared_descriptor_pools;
+    TestFrame frames[FRAME_OVERLAP];
+
+    std::vector<MaterialPipeline> pipelines;
+    std::vector<MaterialInstance> materials;
+    std::vector<RenderObject> objects;
+    std::vector<glm::vec3> object_origins;
+    std::vector<uint32_t> candidates;
+    std::vector<uint32_t> visible;
+
+    FrustumCuller frustum_culler;
+    DrawSorter draw_sorter;
+    EngineStats stats;
+
+    void init();
+    void destroy();
+    void draw(uint32_t frame_number);
+};
+
+void TestScene::init() {
+    job_system.init(WORKER_COUNT);
+
+    std::vector<DescriptorAllocatorGrowable::PoolSizeRatio> frame_sizes = {
+            { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1 },
+            { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1 },
+    };
+    shared_descriptor_pools.init(VK_NULL_HANDLE, SHARED_DESCRIPTOR_POOL_SETS, frame_sizes);
+
+    for(TestFrame& frame : frames) {
+        frame.frame_arena.init(FRAME_ARENA_SIZE);
+        frame.frame_descriptors.init(VK_NULL_HANDLE, shared_descriptor_pools, DescriptorAllocationMode::Frame, job_system.get_thread_count());
+        frame.command_recorder.init(VK_NULL_HANDLE, 0, job_system.get_thread_count());
+    }
+
+    pipelines.resize(MATERIAL_COUNT / 4);
+    for(uint32_t i = 0; i < pipelines.size(); i++) {
+        pipelines[i] = {
+                .pipeline = reinterpret_cast<VkPipeline>(uintptr_t(i + 1)),
+                .layout = reinterpret_cast<VkPipelineLayout>(uintptr_t(1))
+        };
+    }
+
+    materials.resize(MATERIAL_COUNT);
+    for(uint32_t i = 0; i < MATERIAL_COUNT; i++) {
+        materials[i] = {
+                .forward_rendering_pipeline = &pipelines[i % pipelines.size()],
+                .deferred_rendering_geometry_pipeline = &pipelines[i % pipelines.size()],
+                .material_set = reinterpret_cast<VkDescriptorSet>(uintptr_t(i + 1)),
+                .material_index = i,
+                .pass_type = MaterialPassType::MainColor
+        };
+    }
+
+    // a grid of objects around the origin, the camera looks in at it from outside
+    for(uint32_t x = 0; x < OBJECT_GRID_SIZE; x++) {
+        for(uint32_t y = 0; y < OBJECT_GRID_SIZE; y++) {
+            for(uint32_t z = 0; z < OBJECT_GRID_SIZE; z++) {
+                uint32_t i = static_cast<uint32_t>(objects.size());
+                glm::vec3 origin = (glm::vec3(x, y, z) - glm::vec3(OBJECT_GRID_SIZE / 2)) * 4.f;
+
+                objects.push_back({
+                        .index_count = 36,
+                        .first_index = 0,
+                        .index_buffer = reinterpret_cast<VkBuffer>(uintptr_t(i % MESH_COUNT + 1)),
+                        .material = &materials[i % MATERIAL_COUNT],
+                        .bounds = { .origin = glm::vec3(0.f), .sphere_radius = 1.f, .extents = glm::vec3(0.5f) },
+                        .occluder = nullptr,
+                        .transform = glm::translate(origin),
+                });
+                object_origins.push_back(origin);
+                candidates.push_back(i);
+            }
+        }
+    }
+}
+
+void TestScene::destroy() {
+    for(TestFrame& frame : frames) {
+        frame.command_recorder.destroy();
+        frame.frame_descriptors.destroy();
+        frame.frame_arena.destroy();
+    }
+
+    shared_descriptor_pools.destroy();
+    job_system.shutdown();
+}
+
+void TestScene::draw(uint32_t frame_number) {
+    TestFrame& frame = frames[frame_number % FRAME_OVERLAP];
+
+    // after the fence wait
+    frame.frame_descriptors.reset();
+    frame.frame_arena.reset();
+    frame.command_recorder.reset();
+
+    // objects bob up and down on the job threads, like the animation system's poses
+    float time = static_cast<float>(frame_number) / WARM_UP_FRAME_COUNT;
+    uint32_t objects_per_job = static_cast<uint32_t>(objects.size()) / ANIMATION_JOB_COUNT;
+    JobCounter animation_counter;
+    for(uint32_t job = 0; job < ANIMATION_JOB_COUNT; job++) {
+        job_system.submit([this, job, objects_per_job, time]() {
+            for(uint32_t i = job * objects_per_job; i < (job + 1) * objects_per_job; i++) {
+                float offset = glm::sin((time + static_cast<float>(i) * 0.01f) * glm::two_pi<float>());
+                objects[i].transform = glm::translate(object_origins[i] + glm::vec3(0.f, offset, 0.f));
+            }
+        }, animation_counter);
+    }
+    job_system.wait(animation_counter);
+
+    // camera culling and sorting
+    float angle = time * glm::two_pi<float>();
+    glm::vec3 camera_position = glm::vec3(glm::cos(angle), 0.3f, glm::sin(angle)) * 80.f;
+    glm::mat4 view = glm::lookAt(camera_position, glm::vec3(0.f), glm::vec3(0.f, 1.f, 0.f));
+    glm::mat4 view_proj = glm::perspective(glm::radians(70.f), 16.f / 9.f, 0.1f, 200.f) * view;
+
+    visible.clear();
+    frustum_culler.cull(objects, candidates, Frustum::from_view_proj(view_proj), visible);
+    draw_sorter.sort(objects, visible, DrawPass::Forward, view);
+
+    // a scene set written on the main thread through the frame arena
+    VkDescriptorSetLayout layout = VK_NULL_HANDLE;
+    VkDescriptorSet scene_set = frame.frame_descriptors.allocate(layout);
+    {
+        DescriptorWriter writer(&frame.frame_arena);
+        writer.write_buffer(0, VK_NULL_HANDLE, 256, 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+        writer.write_image(1, VK_NULL_HANDLE, VK_NULL_HANDLE, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+        writer.update_set(VK_NULL_HANDLE, scene_set);
+    }
+
+    // and the draws recorded on every thread, each chunk with a set of its own
+    std::array<VkFormat, 1> color_attachment_formats = { VK_FORMAT_R16G16B16A16_SFLOAT };
+    VkCommandBuffer primary = reinterpret_cast<VkCommandBuffer>(uintptr_t(1));
+    frame.command_recorder.record(primary, color_attachment_formats, VK_FORMAT_D32_SFLOAT, { 1920, 1080 },
+                                  static_cast<uint32_t>(visible.size()), job_system, stats,
+                                  [&](CommandEncoder& encoder, uint32_t start, uint32_t end) {
+        VkDescriptorSet chunk_set = frame.frame_descriptors.allocate(layout);
+
+        for(uint32_t i = start; i < end; i++) {
+            const RenderObject& draw = objects[visible[i]];
+            const MaterialPipeline* pipeline = draw.material->forward_rendering_pipeline;
+
+            encoder.bind_pipeline(pipeline->pipeline);
+            encoder.bind_descriptor_set(pipeline->layout, 0, scene_set);
+            encoder.bind_descriptor_set(pipeline->layout, 1, chunk_set);
+            encoder.bind_descriptor_set(pipeline->layout, 2, draw.material->material_set);
+            encoder.bind_index_buffer(draw.index_buffer, 0, VK_INDEX_TYPE_UINT32);
+            encoder.push_constants(pipeline->layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(glm::mat4), &draw.transform);
+            encoder.draw_indexed(draw.index_count, 1, draw.first_index, 0, 0);
+        }
+    });
+}
+
+}
+
+int main() {
+    if(!heap_allocation_counter::is_enabled()) {
+        fmt::print("built without VULKAN_ENGINE_COUNT_HEAP_ALLOCATIONS, nothing is counted\n");
+        return 1;
+    }
+
+    install_fake_vulkan();
+
+    TestScene scene;
+    scene.init();
+
+    for(uint32_t frame_number = 0; frame_number < WARM_UP_FRAME_COUNT; frame_number++) {
+        scene.draw(frame_number);
+    }
+
+    uint64_t allocation_count = 0;
+    uint32_t allocating_frame_count = 0;
+    uint32_t first_allocating_frame = 0;
+    for(uint32_t frame_number = WARM_UP_FRAME_COUNT; frame_number < WARM_UP_FRAME_COUNT + MEASURED_FRAME_COUNT; frame_number++) {
+        uint64_t allocations_at_start = heap_allocation_counter::get_count();
+        scene.draw(frame_number);
+        uint64_t frame_allocation_count = heap_allocation_counter::get_count() - allocations_at_start;
+
+        if(frame_allocation_count > 0) {
+            if(allocating_frame_count == 0) {
+                first_allocating_frame = frame_number;
+            }
+            allocating_frame_count++;
+            allocation_count += frame_allocation_count;
+        }
+    }
+
+    fmt::print("{} frames after {} warm up frames, {} draws in the last: {} heap allocations\n",
+               MEASURED_FRAME_COUNT, WARM_UP_FRAME_COUNT, scene.visible.size(), allocation_count);
+
+    scene.destroy();
+
+    if(allocation_count > 0) {
+        fmt::print("{} frames allocated, the first was frame {}\n", allocating_frame_count, first_allocating_frame);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,129 @@
+//
+// Created by darby on 3/6/2025.
+//
+
+// Checks the OcclusionCuller against a scene small enough to work out by hand: one quad occluder in front of the
+// camera and boxes that are fully hidden behind it, partly hidden, and crossing the near plane. Runs entirely on the
+// CPU, built with the same SIMD flags as the engine so the path the engine takes is the one tested.
+
+#include "Common.hpp"
+#include "JobSystem.hpp"
+#include "OcclusionCuller.hpp"
+
+namespace {
+
+constexpr uint32_t WORKER_COUNT = 3;
+
+// the depth buffer's aspect, so a square on screen is square in the buffer too
+constexpr float ASPECT_RATIO = static_cast<float>(OcclusionCuller::DEPTH_BUFFER_WIDTH) / OcclusionCuller::DEPTH_BUFFER_HEIGHT;
+
+// an 8x8 quad facing the camera 5 units down -z. At twice the distance it hides everything within 8 of the axis
+constexpr float OCCLUDER_DISTANCE = 5.f;
+constexpr float OCCLUDER_HALF_SIZE = 4.f;
+
+uint32_t failure_count = 0;
+
+#define TEST_CHECK(condition, message) \
+    do { \
+        if (! (condition)) { \
+            fmt::print("Check `{}` failed in {} line {}. Message: {}\n", #condition, __FILE__, __LINE__, message); \
+            failure_count++; \
+        } \
+    } while (false)
+
+RenderObject make_box(const glm::vec3& center, const glm::vec3& extents) {
+    RenderObject object = {};
+    object.bounds.origin = glm::vec3(0.f);
+    object.bounds.extents = extents;
+    object.bounds.sphere_radius = glm::length(extents);
+    object.transform = glm::translate(glm::mat4(1.f), center);
+    return object;
+}
+
+// the camera at the origin looking down -z, projected the way Engine::update_scene does
+glm::mat4 get_view_proj() {
+    glm::mat4 view = glm::lookAt(glm::vec3(0.f), glm::vec3(0.f, 0.f, -1.f), glm::vec3(0.f, 1.f, 0.f));
+    glm::mat4 projection = glm::perspective(glm::radians(70.f), ASPECT_RATIO, 0.1f, 1000.f);
+    projection[1][1] *= -1;
+    return projection * view;
+}
+
+bool contains(const std::vector<uint32_t>& visible, uint32_t object_index) {
+    return std::find(visible.begin(), visible.end(), object_index) != visible.end();
+}
+
+}
+
+int main() {
+    JobSystem job_system;
+    job_system.init(WORKER_COUNT);
+
+    OccluderMesh quad = {
+            .positions = {
+                    { -OCCLUDER_HALF_SIZE, -OCCLUDER_HALF_SIZE, 0.f },
+                    { OCCLUDER_HALF_SIZE, -OCCLUDER_HALF_SIZE, 0.f },
+                    { OCCLUDER_HALF_SIZE, OCCLUDER_HALF_SIZE, 0.f },
+                    { -OCCLUDER_HALF_SIZE, OCCLUDER_HALF_SIZE, 0.f }
+            },
+            .indices = { 0, 1, 2, 0, 2, 3 }
+    };
+
+    enum : uint32_t {
+        Occluder,
+        Hidden,        // well inside the quad's shadow
+        PartlyVisible, // straddling the quad's edge as seen from the camera
+        NearPlane,     // the camera is inside it, its corners behind the near plane
+        InFront,       // between the camera and the quad
+        ObjectCount
+    };
+
+    std::vector<RenderObject> objects(ObjectCount);
+    objects[Occluder] = make_box(glm::vec3(0.f, 0.f, -OCCLUDER_DISTANCE), glm::vec3(OCCLUDER_HALF_SIZE, OCCLUDER_HALF_SIZE, 0.f));
+    objects[Occluder].occluder = &quad;
+    objects[Hidden] = make_box(glm::vec3(0.f, 0.f, -2.f * OCCLUDER_DISTANCE), glm::vec3(1.f));
+    objects[PartlyVisible] = make_box(glm::vec3(2.f * OCCLUDER_HALF_SIZE, 0.f, -2.f * OCCLUDER_DISTANCE), glm::vec3(1.f));
+    objects[NearPlane] = make_box(glm::vec3(0.f, 0.f, -0.05f), glm::vec3(0.5f));
+    objects[InFront] = make_box(glm::vec3(0.f, 0.f, -0.5f * OCCLUDER_DISTANCE), glm::vec3(0.25f));
+
+    glm::mat4 view_proj = get_view_proj();
+    OcclusionCuller occlusion_culler;
+
+    // everything at once
+    std::vector<uint32_t> visible = { Occluder, Hidden, PartlyVisible, NearPlane, InFront };
+    occlusion_culler.cull(objects, view_proj, visible, job_system);
+
+    TEST_CHECK(occlusion_culler.get_occluder_count() == 1, "the quad should be the only occluder");
+    TEST_CHECK(occlusion_culler.get_occluder_triangle_count() == 2, "the quad is two triangles");
+    TEST_CHECK(contains(visible, Occluder), "occluders are never culled");
+    TEST_CHECK(!contains(visible, Hidden), "a box fully behind the quad should be culled");
+    TEST_CHECK(contains(visible, PartlyVisible), "a box partly outside the quad's shadow must be kept");
+    TEST_CHECK(contains(visible, NearPlane), "a box crossing the near plane must never be culled");
+    TEST_CHECK(contains(visible, InFront), "a box in front of the quad must be kept");
+    TEST_CHECK(occlusion_culler.get_culled_count() == 1, "only the hidden box should be culled");
+
+    std::vector<uint32_t> expected = { Occluder, PartlyVisible, NearPlane, InFront };
+    TEST_CHECK(visible == expected, "survivors should keep their order");
+
+    // the near plane box straight behind the quad too, still not culled however deep it reaches
+    objects[NearPlane] = make_box(glm::vec3(0.f, 0.f, -OCCLUDER_DISTANCE), glm::vec3(0.5f, 0.5f, OCCLUDER_DISTANCE));
+    visible = { Occluder, NearPlane };
+    occlusion_culler.cull(objects, view_proj, visible, job_system);
+    TEST_CHECK(contains(visible, NearPlane), "a box reaching back to the camera must never be culled");
+
+    // without the occluder nothing is culled
+    objects[Occluder].occluder = nullptr;
+    visible = { Occluder, Hidden, PartlyVisible };
+    occlusion_culler.cull(objects, view_proj, visible, job_system);
+    TEST_CHECK(occlusion_culler.get_occluder_count() == 0, "nothing carries an occluder mesh");
+    TEST_CHECK(visible.size() == 3, "nothing should be culled without occluders");
+
+    job_system.shutdown();
+
+    if(failure_count != 0) {
+        fmt::print("{} checks failed\n", failure_count);
+        return 1;
+    }
+
+    fmt::print("occlusion culling checks passed\n");
+    return 0;
+}
@@ -0,0 +1,198 @@
+//
+// Created by darby on 3/6/2025.
+//
+
+// Stress test for the lock-free free list in SharedDescriptorPools and the ThreadDescriptorAllocators built on it.
+// Vulkan's descriptor pool entry points are swapped for fakes through volk's function pointers, so no device is needed.
+// The fakes keep a table of pools that notices a pool being allocated from by two threads between resets.
+
+#define VOLK_IMPLEMENTATION
+#include "Common.hpp"
+#include "JobSystem.hpp"
+#include "SharedDescriptorPools.hpp"
+#include "ThreadDescriptorAllocator.hpp"
+
+namespace {
+
+constexpr uint32_t WORKER_COUNT = 7; // plus the main thread, more than most CI machines have cores, to force interleaving
+constexpr uint32_t SETS_PER_POOL = 16;
+
+// SharedDescriptorPools directly, every thread repeatedly holding a few pools and handing them back
+constexpr uint32_t SHARED_ROUND_COUNT = 100000;
+constexpr uint32_t MAX_HELD_POOLS = 4;
+
+// ThreadDescriptorAllocators the way Engine uses them, one per frame in flight, reset when their frame comes around
+constexpr uint32_t FRAME_OVERLAP = 2;
+constexpr uint32_t FRAME_COUNT = 500;
+constexpr uint32_t SETS_PER_FRAME = 2000;
+
+std::atomic<uint32_t> failure_count { 0 };
+
+#define TEST_CHECK(condition, message) \
+    do { \
+        if (! (condition)) { \
+            fmt::print("Check `{}` failed in {} line {}. Message: {}\n", #condition, __FILE__, __LINE__, message); \
+            failure_count.fetch_add(1, std::memory_order_relaxed); \
+        } \
+    } while (false)
+
+struct FakePool {
+    uint32_t allocated_count;
+    std::atomic<uint32_t> owner; // JobSystem thread index + 1 of the thread allocating from it since its last reset
+};
+
+FakePool fake_pools[SharedDescriptorPools::MAX_POOL_COUNT];
+std::atomic<uint32_t> fake_pool_count { 0 };
+
+FakePool& get_fake_pool(VkDescriptorPool pool) {
+    return fake_pools[reinterpret_cast<uintptr_t>(pool) - 1];
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL fake_create_descriptor_pool(VkDevice, const VkDescriptorPoolCreateInfo* create_info,
+                                                           const VkAllocationCallbacks*, VkDescriptorPool* pool) {
+    TEST_CHECK(create_info->maxSets == SETS_PER_POOL, "pool created with the wrong set count");
+
+    uint32_t index = fake_pool_count.fetch_add(1, std::memory_order_relaxed);
+    fake_pools[index].allocated_count = 0;
+    fake_pools[index].owner.store(0, std::memory_order_relaxed);
+
+    *pool = reinterpret_cast<VkDescriptorPool>(uintptr_t(index) + 1);
+    return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL fake_destroy_descriptor_pool(VkDevice, VkDescriptorPool, const VkAllocationCallbacks*) {
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL fake_reset_descriptor_pool(VkDevice, VkDescriptorPool pool, VkDescriptorPoolResetFlags) {
+    FakePool& fake_pool = get_fake_pool(pool);
+    fake_pool.allocated_count = 0;
+    fake_pool.owner.store(0, std::memory_order_release);
+    return VK_SUCCESS;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL fake_allocate_descriptor_sets(VkDevice, const VkDescriptorSetAllocateInfo* allocate_info,
+                                                             VkDescriptorSet* sets) {
+    FakePool& fake_pool = get_fake_pool(allocate_info->descriptorPool);
+
+    uint32_t thread = JobSystem::get_thread_index() + 1;
+    uint32_t owner = 0;
+    if(!fake_pool.owner.compare_exchange_strong(owner, thread, std::memory_order_acquire) && owner != thread) {
+        TEST_CHECK(false, "a pool was allocated from by two threads without a reset in between");
+        return VK_ERROR_OUT_OF_POOL_MEMORY;
+    }
+
+    if(fake_pool.allocated_count == SETS_PER_POOL) {
+        return VK_ERROR_OUT_OF_POOL_MEMORY;
+    }
+    fake_pool.allocated_count++;
+
+    sets[0] = reinterpret_cast<VkDescriptorSet>(uintptr_t(1));
+    return VK_SUCCESS;
+}
+
+std::vector<DescriptorAllocatorGrowable::PoolSizeRatio> pool_ratios = {
+        { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 }
+};
+
+// every thread acquires and releases pools as fast as it can, nothing may be held by two threads at once
+void test_shared_pools(JobSystem& job_system) {
+    fake_pool_count.store(0, std::memory_order_relaxed);
+
+    SharedDescriptorPools shared_pools;
+    shared_pools.init(VK_NULL_HANDLE, SETS_PER_POOL, pool_ratios);
+
+    std::unique_ptr<std::atomic<bool>[]> held = std::make_unique<std::atomic<bool>[]>(SharedDescriptorPools::MAX_POOL_COUNT);
+
+    JobCounter counter;
+    for(uint32_t t = 0; t < job_system.get_thread_count(); t++) {
+        job_system.submit([&shared_pools, &held]() {
+            uint32_t pool_indices[MAX_HELD_POOLS];
+            for(uint32_t round = 0; round < SHARED_ROUND_COUNT; round++) {
+                uint32_t hold_count = 1 + round % MAX_HELD_POOLS;
+
+                for(uint32_t i = 0; i < hold_count; i++) {
+                    pool_indices[i] = shared_pools.acquire();
+                    TEST_CHECK(pool_indices[i] < shared_pools.get_pool_count(), "acquired a pool past the pool count");
+                    TEST_CHECK(!held[pool_indices[i]].exchange(true, std::memory_order_acq_rel), "a pool was handed out twice");
+                }
+
+                for(uint32_t i = 0; i < hold_count; i++) {
+                    held[pool_indices[i]].store(false, std::memory_order_release);
+                    shared_pools.release(pool_indices[i]);
+                }
+            }
+        }, counter);
+    }
+    job_system.wait(counter);
+
+    // a pool's only created when every existing one is held
+    TEST_CHECK(shared_pools.get_pool_count() <= job_system.get_thread_count() * MAX_HELD_POOLS, "more pools were created than were ever held at once");
+    TEST_CHECK(fake_pool_count.load() == shared_pools.get_pool_count(), "pool count doesn't match the pools created");
+
+    fmt::print("shared pools: {} pools over {} threads\n", shared_pools.get_pool_count(), job_system.get_thread_count());
+
+    shared_pools.destroy();
+}
+
+// frame allocators allocating from every thread, reset a frame in flight later, must settle on a fixed set of pools
+void test_frame_allocators(JobSystem& job_system) {
+    fake_pool_count.store(0, std::memory_order_relaxed);
+
+    SharedDescriptorPools shared_pools;
+    shared_pools.init(VK_NULL_HANDLE, SETS_PER_POOL, pool_ratios);
+
+    uint32_t thread_count = job_system.get_thread_count();
+    ThreadDescriptorAllocator frame_allocators[FRAME_OVERLAP];
+    for(ThreadDescriptorAllocator& frame_allocator : frame_allocators) {
+        frame_allocator.init(VK_NULL_HANDLE, shared_pools, DescriptorAllocationMode::Frame, thread_count);
+    }
+
+    // each thread's full pools are full, only its current one can be partly used
+    uint32_t max_frame_pool_count = SETS_PER_FRAME / SETS_PER_POOL + thread_count;
+
+    for(uint32_t frame = 0; frame < FRAME_COUNT; frame++) {
+        ThreadDescriptorAllocator& frame_allocator = frame_allocators[frame % FRAME_OVERLAP];
+        frame_allocator.reset();
+
+        job_system.parallel_for(SETS_PER_FRAME, 16, [&frame_allocator](uint32_t start, uint32_t end) {
+            for(uint32_t i = start; i < end; i++) {
+                VkDescriptorSet set = frame_allocator.allocate(VK_NULL_HANDLE);
+                TEST_CHECK(set != VK_NULL_HANDLE, "allocation failed");
+            }
+        });
+
+        TEST_CHECK(frame_allocator.get_pool_count() <= max_frame_pool_count, "a frame used more pools than its sets need");
+        TEST_CHECK(shared_pools.get_pool_count() <= FRAME_OVERLAP * max_frame_pool_count, "the shared pool count kept growing");
+    }
+
+    fmt::print("frame allocators: {} pools over {} frames\n", shared_pools.get_pool_count(), FRAME_COUNT);
+
+    for(ThreadDescriptorAllocator& frame_allocator : frame_allocators) {
+        frame_allocator.destroy();
+    }
+    shared_pools.destroy();
+}
+
+}
+
+int main() {
+    vkCreateDescriptorPool = fake_create_descriptor_pool;
+    vkDestroyDescriptorPool = fake_destroy_descriptor_pool;
+    vkResetDescriptorPool = fake_reset_descriptor_pool;
+    vkAllocateDescriptorSets = fake_allocate_descriptor_sets;
+
+    JobSystem job_system;
+    job_system.init(WORKER_COUNT);
+
+    test_shared_pools(job_system);
+    test_frame_allocators(job_system);
+
+    job_system.shutdown();
+
+    if(failure_count.load() != 0) {
+        fmt::print("{} checks failed\n", failure_count.load());
+        return 1;
+    }
+
+    return 0;
+}